@@ -0,0 +1,193 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "bench_common.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <string>
+
+#include "utils.h"
+
+//-------------------------------------------------------------------- FUNCTIONS
+
+void parseList(const char* str, vector<ulong>& values)
+{
+  vector<string> tokens;
+  splitStringUsing(str, tokens, ',');
+  for(vector<string>::iterator it = tokens.begin(); it != tokens.end(); ++it) {
+    values.push_back(atol(it->c_str()));
+  }
+}
+
+double getElapsedTime(struct timeval& t)
+{
+  timeval end;
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - t.tv_sec) + (end.tv_usec - t.tv_usec)/1e6;
+}
+
+void resetPeakMemory()
+{
+  FILE* fp = fopen("/proc/self/clear_refs", "w");
+  if(fp) {
+    fputs("5", fp);
+    fclose(fp);
+  }
+}
+
+double getPeakMemory()
+{
+  FILE* fp = fopen("/proc/self/status", "r");
+  if(fp) {
+    char line[256];
+    long peak = -1;
+    while(fgets(line, sizeof(line), fp)) {
+      if(strncmp(line, "VmHWM:", 6) == 0) {
+        peak = atol(line + 6);
+        break;
+      }
+    }
+    fclose(fp);
+    if(peak >= 0) {
+      return peak/1024.0;
+    }
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss/1024.0;
+}
+
+double hashToUnit(int seed, ulong a, ulong b)
+{
+  unsigned long long h = ((unsigned long long)seed << 48) ^ (a * 0x9E3779B97F4A7C15ULL) ^ (b + 0x632BE59BD9B4E019ULL);
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return (h >> 11) * (2.0/9007199254740992.0) - 1.0;
+}
+
+//------------------------------------------------------------------------------
+
+Slice3d* createSyntheticVolume(ulong nNodes, bool randomGraph, int step,
+                               int seed, uchar*& raw_data)
+{
+  int nCells = (int)ceil(pow((double)nNodes, 1.0/3.0) - 1e-6);
+  if(nCells < 2) {
+    nCells = 2;
+  }
+  int width = nCells*step;
+  int height = nCells*step;
+  int depth = nCells*step;
+  ulong sliceSize = (ulong)width*height;
+  ulong nVoxels = sliceSize*depth;
+  ulong cellSliceSize = (ulong)nCells*nCells;
+
+  // supernode centers (in voxels) and mean intensities
+  ulong nTotalCells = cellSliceSize*nCells;
+  int* centers = new int[nTotalCells*3];
+  uchar* intensities = new uchar[nTotalCells];
+  for(ulong c = 0; c < nTotalCells; ++c) {
+    int cx = c%nCells;
+    int cy = (c/nCells)%nCells;
+    int cz = c/cellSliceSize;
+    int jitter[3] = {step/2, step/2, step/2};
+    if(randomGraph) {
+      for(int i = 0; i < 3; ++i) {
+        jitter[i] = (int)((hashToUnit(seed, c, i) + 1.0)*0.5*step);
+        if(jitter[i] >= step) {
+          jitter[i] = step - 1;
+        }
+      }
+    }
+    centers[c*3] = cx*step + jitter[0];
+    centers[c*3+1] = cy*step + jitter[1];
+    centers[c*3+2] = cz*step + jitter[2];
+    intensities[c] = (uchar)((hashToUnit(seed, c, 3) + 1.0)*127.5);
+  }
+
+  raw_data = new uchar[nVoxels];
+  uint* labels = new uint[nVoxels];
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for(int z = 0; z < depth; ++z) {
+    for(int y = 0; y < height; ++y) {
+      for(int x = 0; x < width; ++x) {
+        ulong idx = z*sliceSize + (ulong)y*width + x;
+        int cx = x/step;
+        int cy = y/step;
+        int cz = z/step;
+        ulong cell = cz*cellSliceSize + (ulong)cy*nCells + cx;
+        if(randomGraph) {
+          int minDist = INT_MAX;
+          for(int nz = max(0, cz-1); nz <= min(nCells-1, cz+1); ++nz) {
+            for(int ny = max(0, cy-1); ny <= min(nCells-1, cy+1); ++ny) {
+              for(int nx = max(0, cx-1); nx <= min(nCells-1, cx+1); ++nx) {
+                ulong ncell = nz*cellSliceSize + (ulong)ny*nCells + nx;
+                int dx = x - centers[ncell*3];
+                int dy = y - centers[ncell*3+1];
+                int dz = z - centers[ncell*3+2];
+                int dist = dx*dx + dy*dy + dz*dz;
+                if(dist < minDist) {
+                  minDist = dist;
+                  cell = ncell;
+                }
+              }
+            }
+          }
+        }
+        labels[idx] = cell;
+        int v = intensities[cell] + (int)(hashToUnit(seed, idx, 4)*8);
+        raw_data[idx] = (uchar)min(255, max(0, v));
+      }
+    }
+  }
+
+  Slice3d* slice3d = new Slice3d(raw_data, width, height, depth, step);
+  slice3d->importSupervoxelsFromBuffer(labels, width, height, depth);
+
+  delete[] labels;
+  delete[] intensities;
+  delete[] centers;
+  return slice3d;
+}
+
+
+IplImage* createSyntheticImage(int width, int height, int nChannels,
+                               int step, int seed)
+{
+  IplImage* img = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, nChannels);
+  int nCellsX = (width + step - 1)/step;
+  for(int y = 0; y < height; ++y) {
+    uchar* pImg = (uchar*)(img->imageData + img->widthStep*y);
+    for(int x = 0; x < width; ++x) {
+      ulong cell = (y/step)*nCellsX + x/step;
+      ulong idx = (ulong)y*width + x;
+      for(int c = 0; c < nChannels; ++c) {
+        int v = (int)((hashToUnit(seed, cell, c) + 1.0)*127.5) + (int)(hashToUnit(seed, idx, 4 + c)*8);
+        pImg[x*nChannels + c] = (uchar)min(255, max(0, v));
+      }
+    }
+  }
+  return img;
+}
@@ -0,0 +1,72 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <cv.h>
+#include <sys/time.h>
+#include <vector>
+
+#include "globalsE.h"
+#include "Slice3d.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+double getElapsedTime(struct timeval& t);
+
+/**
+ * Reset the peak resident set size of the process so that the next call
+ * to getPeakMemory only accounts for what was allocated in between.
+ * Only supported on Linux.
+ */
+void resetPeakMemory();
+
+/**
+ * Returns the peak resident set size in Mb.
+ */
+double getPeakMemory();
+
+/**
+ * Parse a comma separated list of integers.
+ */
+void parseList(const char* str, vector<ulong>& values);
+
+/**
+ * Deterministic uniform value in [-1,1] for a given (seed, a, b) triplet.
+ */
+double hashToUnit(int seed, ulong a, ulong b);
+
+//------------------------------------------------------------------------------
+
+/**
+ * Create a cube holding roughly nNodes supernodes of step^3 voxels.
+ * Grid graphs use cubic supernodes. Random graphs jitter the center of each
+ * supernode and assign voxels to the closest center, which gives irregular
+ * shapes and a varying number of neighbors.
+ * raw_data is owned by the caller and has to outlive the returned cube.
+ */
+Slice3d* createSyntheticVolume(ulong nNodes, bool randomGraph, int step,
+                               int seed, uchar*& raw_data);
+
+/**
+ * Create a width x height image made of noisy blobs of size step.
+ */
+IplImage* createSyntheticImage(int width, int height, int nChannels,
+                               int step, int seed);
+
+#endif // BENCH_COMMON_H
@@ -0,0 +1,353 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+//-------------------------------------------------------------------- INCLUDES
+
+#include <argp.h>
+#include <cv.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+// SliceMe
+#include "Config.h"
+#include "Feature.h"
+#include "Slice.h"
+#include "Slice3d.h"
+#include "globals.h"
+
+#include "bench_common.h"
+
+using namespace std;
+
+//--------------------------------------------------------------------- GLOBALS
+
+struct arguments
+{
+  char* config_file;
+  char* nodes;
+  char* dims;
+  char* feature_types;
+  char* threads;
+  char* output_filename;
+  int step;
+  int seed;
+};
+
+struct arguments a_args;
+
+//----------------------------------------------------------------------- PARSER
+
+/* Program documentation. */
+static char doc[] =
+  "Benchmark the extraction of each feature type on synthetic slices and cubes";
+
+/* A description of the arguments we accept. */
+static char args_doc[] = "";
+
+/* The options we understand. */
+static struct argp_option options[] = {
+  {"config_file",'c',  "config_file",0, "config file passed to the features"},
+  {"nodes",'n',  "nodes",0, "comma separated list of number of supernodes (default 1000,10000,100000)"},
+  {"dims",'d',  "dims",0, "comma separated list of dimensions (default 2,3)"},
+  {"feature_types",'f',  "feature_types",0, "comma separated list of feature types (see eFeatureType, default all)"},
+  {"threads",'j',  "threads",0, "comma separated list of thread counts (default 1 and all processors)"},
+  {"step",'s',  "step",0, "supernode size in pixels along each axis (default SUPERPIXEL_DEFAULT_STEP_SIZE in 2d, DEFAULT_VOXEL_STEP in 3d)"},
+  {"seed",'r',  "seed",0, "random seed (default 1)"},
+  {"output_filename",'o',  "output_filename", 0, "append results to this CSV file"},
+  {"verbose",'v',  "verbose",0, "verbose"},
+  { 0 }
+};
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  /* Get the input argument from argp_parse, which we
+     know is a pointer to our arguments structure. */
+  struct arguments *argments = (arguments*)state->input;
+
+  switch (key)
+    {
+    case 'c':
+      argments->config_file = arg;
+      break;
+    case 'd':
+      argments->dims = arg;
+      break;
+    case 'f':
+      argments->feature_types = arg;
+      break;
+    case 'j':
+      argments->threads = arg;
+      break;
+    case 'n':
+      argments->nodes = arg;
+      break;
+    case 'o':
+      argments->output_filename = arg;
+      break;
+    case 'r':
+      argments->seed = atoi(arg);
+      break;
+    case 's':
+      argments->step = atoi(arg);
+      break;
+    case 'v':
+      if(*arg == '1')
+        verbose = true;
+      else
+        verbose = false;
+      break;
+
+    case ARGP_KEY_ARG:
+      printf("Too many arguments %s\n", arg);
+      argp_usage (state);
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+//----------------------------------------------------------------------- HELPERS
+
+struct featureInfo
+{
+  eFeatureType type;
+  const char* name;
+  bool supports2d;
+  bool supports3d;
+};
+
+// F_LOADFROMFILE, F_DFT and F_SIFT read their input from files and are not
+// benchmarked.
+static const featureInfo features[] = {
+  {F_BIAS, "bias", true, true},
+  {F_HISTOGRAM, "histogram", true, true},
+  {F_COLOR_HISTOGRAM, "color_histogram", true, false},
+  {F_GLCM, "glcm", true, true},
+  {F_POSITION, "position", true, false},
+  {F_GAUSSIAN, "gaussian", true, true},
+#ifdef USE_ITK
+  {F_FILTER, "filter", true, true},
+  {F_GRADIENTSTATS, "gradient_stats", false, true},
+#endif
+};
+static const int nFeatures = sizeof(features)/sizeof(featureInfo);
+
+static const featureInfo* getFeatureInfo(int featureType)
+{
+  for(int f = 0; f < nFeatures; ++f) {
+    if(features[f].type == featureType) {
+      return &features[f];
+    }
+  }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc,char* argv[])
+{
+  a_args.config_file = 0;
+  a_args.nodes = (char*)"1000,10000,100000";
+  a_args.dims = (char*)"2,3";
+  a_args.feature_types = 0;
+  a_args.threads = 0;
+  a_args.output_filename = 0;
+  a_args.step = 0;
+  a_args.seed = 1;
+  verbose = false;
+
+  argp_parse (&argp, argc, argv, 0, 0, &a_args);
+
+  Config* config = 0;
+  if(a_args.config_file) {
+    config = new Config(a_args.config_file);
+  } else {
+    config = new Config("", CONFIG_STRING);
+  }
+  Config::setInstance(config);
+
+  vector<ulong> nodes;
+  parseList(a_args.nodes, nodes);
+  vector<ulong> dims;
+  parseList(a_args.dims, dims);
+  vector<ulong> featureTypes;
+  if(a_args.feature_types) {
+    parseList(a_args.feature_types, featureTypes);
+  } else {
+    for(int f = 0; f < nFeatures; ++f) {
+      featureTypes.push_back(features[f].type);
+    }
+  }
+  vector<ulong> threads;
+  if(a_args.threads) {
+    parseList(a_args.threads, threads);
+  } else {
+    threads.push_back(1);
+#ifdef WITH_OPENMP
+    if(omp_get_num_procs() > 1) {
+      threads.push_back(omp_get_num_procs());
+    }
+#endif
+  }
+
+  FILE* fp_out = 0;
+  if(a_args.output_filename) {
+    fp_out = fopen(a_args.output_filename, "a");
+    if(fp_out == 0) {
+      printf("[bench_features] Error : could not open %s\n", a_args.output_filename);
+      exit(-1);
+    }
+    fseek(fp_out, 0, SEEK_END);
+    if(ftell(fp_out) == 0) {
+      fprintf(fp_out, "dims,feature,nodes,pixels,threads,feature_size,setup_s,extract_s,us_per_node,peak_mb\n");
+    }
+  }
+
+  printf("%-4s %-16s %10s %12s %7s %6s %9s %9s %11s %9s\n", "dims", "feature",
+         "nodes", "pixels", "threads", "size", "setup(s)", "extract(s)",
+         "us/node", "peak(Mb)");
+
+  for(vector<ulong>::iterator itD = dims.begin(); itD != dims.end(); ++itD) {
+    int nDims = *itD;
+    if(nDims != 2 && nDims != 3) {
+      printf("[bench_features] Unsupported number of dimensions %d\n", nDims);
+      continue;
+    }
+    int step = a_args.step;
+    if(step <= 0) {
+      step = (nDims == 2)?SUPERPIXEL_DEFAULT_STEP_SIZE:DEFAULT_VOXEL_STEP;
+    }
+
+    for(vector<ulong>::iterator itN = nodes.begin(); itN != nodes.end(); ++itN) {
+      // 2d slices are made of SLIC superpixels computed on a synthetic image,
+      // 3d cubes of cubic supervoxels.
+      Slice* slice = 0;
+      Slice* colorSlice = 0;
+      IplImage* img = 0;
+      IplImage* colorImg = 0;
+      Slice3d* slice3d = 0;
+      uchar* raw_data = 0;
+      ulong nPixels = 0;
+      if(nDims == 2) {
+        int size = (int)ceil(sqrt((double)*itN))*step;
+        img = createSyntheticImage(size, size, 1, step, a_args.seed);
+        slice = new Slice(img, 0, step, SUPERPIXEL_DEFAULT_M);
+        nPixels = (ulong)size*size;
+      } else {
+        slice3d = createSyntheticVolume(*itN, false, step, a_args.seed, raw_data);
+        nPixels = (ulong)slice3d->getWidth()*slice3d->getHeight()*slice3d->getDepth();
+      }
+
+      for(vector<ulong>::iterator itF = featureTypes.begin(); itF != featureTypes.end(); ++itF) {
+        const featureInfo* info = getFeatureInfo(*itF);
+        if(info == 0) {
+          printf("[bench_features] Unsupported feature type %ld\n", *itF);
+          continue;
+        }
+        if((nDims == 2 && !info->supports2d) || (nDims == 3 && !info->supports3d)) {
+          continue;
+        }
+
+        resetPeakMemory();
+
+        // features are built once per slice (some of them precompute
+        // filtered images or cubes in their constructor)
+        Slice_P* slice_p = 0;
+        Feature* feature = 0;
+        timeval t;
+        gettimeofday(&t, NULL);
+        if(nDims == 2) {
+          if(info->type == F_COLOR_HISTOGRAM) {
+            if(colorSlice == 0) {
+              int size = img->width;
+              colorImg = createSyntheticImage(size, size, 3, step, a_args.seed);
+              colorSlice = new Slice(colorImg, 0, step, SUPERPIXEL_DEFAULT_M);
+            }
+            slice_p = colorSlice;
+            feature = Feature::getFeature(colorSlice, info->type);
+          } else {
+            slice_p = slice;
+            feature = Feature::getFeature(slice, info->type);
+          }
+        } else {
+          slice_p = slice3d;
+          feature = Feature::getFeature(slice3d, info->type);
+        }
+        double setupTime = getElapsedTime(t);
+        ulong nNodes = slice_p->getNbSupernodes();
+
+        for(vector<ulong>::iterator itT = threads.begin(); itT != threads.end(); ++itT) {
+          int nThreads = *itT;
+#ifdef WITH_OPENMP
+          omp_set_num_threads(nThreads);
+#endif
+          slice_p->clearPrecomputedFeatures();
+          gettimeofday(&t, NULL);
+          slice_p->precomputeFeatures(feature);
+          double extractTime = getElapsedTime(t);
+          double timePerNode = extractTime*1e6/nNodes;
+          double peakMemory = getPeakMemory();
+
+          printf("%-4d %-16s %10ld %12ld %7d %6d %9.3f %9.3f %11.3f %9.1f\n",
+                 nDims, info->name, nNodes, nPixels, nThreads,
+                 feature->getSizeFeatureVector(), setupTime, extractTime,
+                 timePerNode, peakMemory);
+          if(fp_out) {
+            fprintf(fp_out, "%d,%s,%ld,%ld,%d,%d,%g,%g,%g,%g\n",
+                    nDims, info->name, nNodes, nPixels, nThreads,
+                    feature->getSizeFeatureVector(), setupTime, extractTime,
+                    timePerNode, peakMemory);
+            fflush(fp_out);
+          }
+        }
+        slice_p->clearPrecomputedFeatures();
+        Feature::deleteFeature(slice_p, feature);
+      }
+
+      if(slice) {
+        delete slice;
+        cvReleaseImage(&img);
+      }
+      if(colorSlice) {
+        delete colorSlice;
+        cvReleaseImage(&colorImg);
+      }
+      if(slice3d) {
+        delete slice3d;
+        delete[] raw_data;
+      }
+    }
+  }
+
+  if(fp_out) {
+    fclose(fp_out);
+  }
+
+  return 0;
+}
@@ -0,0 +1,395 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+//-------------------------------------------------------------------- INCLUDES
+
+#include <argp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+// SliceMe
+#include "Config.h"
+#include "Feature.h"
+#include "Slice3d.h"
+#include "energyParam.h"
+#include "globals.h"
+#include "graphInference.h"
+#include "inference.h"
+#include "inference_globals.h"
+
+#include "bench_common.h"
+
+using namespace std;
+
+//--------------------------------------------------------------------- GLOBALS
+
+struct arguments
+{
+  char* config_file;
+  char* nodes;
+  char* classes;
+  char* algos;
+  char* graph_type;
+  char* output_filename;
+  int voxel_step;
+  int feature_size;
+  int nGradientLevels;
+  int maxiter;
+  int seed;
+};
+
+struct arguments a_args;
+
+//----------------------------------------------------------------------- PARSER
+
+/* Program documentation. */
+static char doc[] =
+  "Benchmark the inference backends on synthetic supernode graphs";
+
+/* A description of the arguments we accept. */
+static char args_doc[] = "";
+
+/* The options we understand. */
+static struct argp_option options[] = {
+  {"config_file",'c',  "config_file",0, "config file passed to the backends"},
+  {"nodes",'n',  "nodes",0, "comma separated list of graph sizes (default 1000,10000,100000)"},
+  {"classes",'k',  "classes",0, "comma separated list of number of classes (default 2,3)"},
+  {"algos",'a',  "algos",0, "comma separated list of algo types (default all)"},
+  {"graph_type",'t',  "graph_type",0, "grid or random (default grid)"},
+  {"voxel_step",'s',  "voxel_step",0, "supernode size in voxels along each axis (default 2)"},
+  {"feature_size",'f',  "feature_size",0, "size of the feature vectors (default 16)"},
+  {"gradient_levels",'l',  "gradient_levels",0, "number of gradient levels (default 5)"},
+  {"maxiter",'i',  "maxiter",0, "maximum number of iterations (default 100)"},
+  {"seed",'r',  "seed",0, "random seed (default 1)"},
+  {"output_filename",'o',  "output_filename", 0, "append results to this CSV file"},
+  {"verbose",'v',  "verbose",0, "verbose"},
+  { 0 }
+};
+
+/* Parse a single option. */
+static error_t
+parse_opt (int key, char *arg, struct argp_state *state)
+{
+  /* Get the input argument from argp_parse, which we
+     know is a pointer to our arguments structure. */
+  struct arguments *argments = (arguments*)state->input;
+
+  switch (key)
+    {
+    case 'a':
+      argments->algos = arg;
+      break;
+    case 'c':
+      argments->config_file = arg;
+      break;
+    case 'f':
+      argments->feature_size = atoi(arg);
+      break;
+    case 'i':
+      argments->maxiter = atoi(arg);
+      break;
+    case 'k':
+      argments->classes = arg;
+      break;
+    case 'l':
+      argments->nGradientLevels = atoi(arg);
+      break;
+    case 'n':
+      argments->nodes = arg;
+      break;
+    case 'o':
+      argments->output_filename = arg;
+      break;
+    case 'r':
+      argments->seed = atoi(arg);
+      break;
+    case 's':
+      argments->voxel_step = atoi(arg);
+      break;
+    case 't':
+      argments->graph_type = arg;
+      break;
+    case 'v':
+      if(*arg == '1')
+        verbose = true;
+      else
+        verbose = false;
+      break;
+
+    case ARGP_KEY_ARG:
+      printf("Too many arguments %s\n", arg);
+      argp_usage (state);
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+    }
+  return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+//----------------------------------------------------------------------- HELPERS
+
+struct algoInfo
+{
+  int type;
+  const char* name;
+};
+
+static const algoInfo algos[] = {
+#if USE_LIBDAI
+  {T_GI_LIBDAI, "libDAI"},
+#endif
+#if USE_MAXFLOW
+  {T_GI_MAXFLOW, "maxflow"},
+  {T_GI_EXPANSION, "expansion"},
+#endif
+#if USE_MULTIOBJ
+  {T_GI_MULTIOBJ, "multiobject"},
+#endif
+  {T_GI_ICM, "ICM"},
+  {T_GI_BP, "BP"},
+  {T_GI_MF, "MF"},
+  {T_GI_SAMPLING, "sampling"},
+  {T_GI_MAX, "max"},
+};
+static const int nAlgos = sizeof(algos)/sizeof(algoInfo);
+
+static const char* getAlgoName(int algoType)
+{
+  for(int a = 0; a < nAlgos; ++a) {
+    if(algos[a].type == algoType) {
+      return algos[a].name;
+    }
+  }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Random features drawn independently for each supernode.
+ */
+class F_Synthetic : public Feature
+{
+ public:
+  F_Synthetic(int _feature_size, int _seed) {
+    feature_size = _feature_size;
+    seed = _seed;
+  }
+
+  int getSizeFeatureVectorForOneSupernode() { return feature_size; }
+
+  bool getFeatureVectorForOneSupernode(osvm_node *x,
+                                       Slice3d* slice3d,
+                                       const int supernodeId) {
+    for(int i = 0; i < feature_size; ++i) {
+      x[i].value = hashToUnit(seed, supernodeId, i);
+    }
+    return true;
+  }
+
+ private:
+  int feature_size;
+  int seed;
+};
+
+//-------------------------------------------------------------------- FUNCTIONS
+
+/**
+ * Random unary weights and attractive pairwise weights whose strength
+ * decreases with the gradient level (so that the energy is submodular
+ * for graph-cuts based backends).
+ */
+void createSyntheticParameters(EnergyParam& param, int nClasses,
+                               int featureSize, int nGradientLevels, int seed)
+{
+  param.nClasses = nClasses;
+  param.nUnaryWeights = (nClasses==2)?1:nClasses;
+  param.nGradientLevels = nGradientLevels;
+  param.nOrientations = 1;
+  param.nDistances = 1;
+  param.nScales = 1;
+  param.nLocalScales = 1;
+  param.nScalingCoefficients = param.nScales*param.nUnaryWeights*featureSize;
+  param.includeLocalEdges = (nGradientLevels != 0);
+  param.useGlobalClassifier = false;
+  param.sizePsi = SVM_FEAT_INDEX0(&param) + param.nScalingCoefficients;
+
+  // one extra weight for the binary case (see init_struct_model)
+  param.weights = new double[param.sizePsi + 1];
+  memset(param.weights, 0, (param.sizePsi + 1)*sizeof(double));
+
+  double* pw = param.weights + param.nUnaryWeights;
+  for(int g = 0; g < nGradientLevels; ++g) {
+    double strength = (nGradientLevels - g)/(double)nGradientLevels;
+    for(int i = 0; i < nClasses; ++i) {
+      for(int j = 0; j < nClasses; ++j) {
+        double r = (hashToUnit(seed, g, i*nClasses + j) + 1.0)*0.5;
+        pw[i*nClasses + j] = (i==j)?(strength*r):(-strength*r);
+      }
+    }
+    pw += nClasses*nClasses;
+  }
+
+  for(int i = 0; i < param.nScalingCoefficients; ++i) {
+    param.weights[SVM_FEAT_INDEX0(&param) + i] = hashToUnit(seed, 1000 + nClasses, i);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc,char* argv[])
+{
+  a_args.config_file = 0;
+  a_args.nodes = (char*)"1000,10000,100000";
+  a_args.classes = (char*)"2,3";
+  a_args.algos = 0;
+  a_args.graph_type = (char*)"grid";
+  a_args.output_filename = 0;
+  a_args.voxel_step = 2;
+  a_args.feature_size = 16;
+  a_args.nGradientLevels = 5;
+  a_args.maxiter = 100;
+  a_args.seed = 1;
+  verbose = false;
+
+  argp_parse (&argp, argc, argv, 0, 0, &a_args);
+
+  Config* config = 0;
+  if(a_args.config_file) {
+    config = new Config(a_args.config_file);
+  } else {
+    config = new Config("include_neighbors=0", CONFIG_STRING);
+  }
+  Config::setInstance(config);
+  // run the requested backend even if the energy is submodular
+  config->setParameter("useGCForSubModularEnergy", "0");
+  config->setParameter("include_neighbors", "0");
+
+  bool randomGraph = (strcmp(a_args.graph_type, "random") == 0);
+  int step = a_args.voxel_step;
+  if(randomGraph && step < 2) {
+    printf("[bench_inference] Random graphs need a voxel step of at least 2\n");
+    step = 2;
+  }
+
+  vector<ulong> nodes;
+  parseList(a_args.nodes, nodes);
+  vector<ulong> classes;
+  parseList(a_args.classes, classes);
+  vector<ulong> algoTypes;
+  if(a_args.algos) {
+    parseList(a_args.algos, algoTypes);
+  } else {
+    for(int a = 0; a < nAlgos; ++a) {
+      algoTypes.push_back(algos[a].type);
+    }
+  }
+
+  FILE* fp_out = 0;
+  if(a_args.output_filename) {
+    fp_out = fopen(a_args.output_filename, "a");
+    if(fp_out == 0) {
+      printf("[bench_inference] Error : could not open %s\n", a_args.output_filename);
+      exit(-1);
+    }
+    fseek(fp_out, 0, SEEK_END);
+    if(ftell(fp_out) == 0) {
+      fprintf(fp_out, "graph,nodes,edges,classes,algo,setup_s,run_s,energy,peak_mb\n");
+    }
+  }
+
+  printf("%-7s %10s %10s %7s %-12s %9s %9s %14s %9s\n", "graph", "nodes",
+         "edges", "classes", "algo", "setup(s)", "run(s)", "energy", "peak(Mb)");
+
+  for(vector<ulong>::iterator itN = nodes.begin(); itN != nodes.end(); ++itN) {
+    uchar* raw_data = 0;
+    Slice3d* slice3d = createSyntheticVolume(*itN, randomGraph, step,
+                                             a_args.seed, raw_data);
+    F_Synthetic* feature = new F_Synthetic(a_args.feature_size, a_args.seed);
+    slice3d->precomputeFeatures(feature);
+    slice3d->precomputeGradientIndices(a_args.nGradientLevels);
+    slice3d->precomputeOrientationIndices(1);
+    ulong nNodes = slice3d->getNbSupernodes();
+    ulong nEdges = slice3d->getNbUndirectedEdges();
+
+    for(vector<ulong>::iterator itK = classes.begin(); itK != classes.end(); ++itK) {
+      int nClasses = *itK;
+      EnergyParam param;
+      createSyntheticParameters(param, nClasses, a_args.feature_size,
+                                a_args.nGradientLevels, a_args.seed);
+
+      for(vector<ulong>::iterator itA = algoTypes.begin(); itA != algoTypes.end(); ++itA) {
+        int algoType = *itA;
+        const char* algoName = getAlgoName(algoType);
+        if(algoName == 0) {
+          printf("[bench_inference] Unknown algo type %d\n", algoType);
+          continue;
+        }
+        // graph-cuts backends are restricted to the number of labels they model
+        if((algoType == T_GI_MAXFLOW && nClasses != 2) ||
+           (algoType == T_GI_MULTIOBJ && nClasses != 3)) {
+          continue;
+        }
+
+        resetPeakMemory();
+
+        timeval t;
+        gettimeofday(&t, NULL);
+        GraphInference* gi = createGraphInferenceInstance(algoType, slice3d,
+                                                          param, feature);
+        double setupTime = getElapsedTime(t);
+
+        labelType* nodeLabels = new labelType[nNodes];
+        gettimeofday(&t, NULL);
+        gi->run(nodeLabels, 0, a_args.maxiter);
+        double runTime = getElapsedTime(t);
+
+        double energy = gi->computeEnergy(nodeLabels);
+        double peakMemory = getPeakMemory();
+
+        delete gi;
+        delete[] nodeLabels;
+
+        printf("%-7s %10ld %10ld %7d %-12s %9.3f %9.3f %14.6g %9.1f\n",
+               a_args.graph_type, nNodes, nEdges, nClasses, algoName,
+               setupTime, runTime, energy, peakMemory);
+        if(fp_out) {
+          fprintf(fp_out, "%s,%ld,%ld,%d,%s,%g,%g,%.10g,%g\n",
+                  a_args.graph_type, nNodes, nEdges, nClasses, algoName,
+                  setupTime, runTime, energy, peakMemory);
+          fflush(fp_out);
+        }
+      }
+    }
+
+    delete feature;
+    delete slice3d;
+    delete[] raw_data;
+  }
+
+  if(fp_out) {
+    fclose(fp_out);
+  }
+
+  return 0;
+}
@@ -33,6 +33,8 @@ class F_Bias : public Feature
 
   int getSizeFeatureVectorForOneSupernode();
 
+  bool isThreadSafe() { return true; }
+
   /**
    * Extract a feature vector for a given supernode in a 2d slice
    */
@@ -41,6 +41,8 @@ class F_ColorHistogram : public Feature
 
   int getSizeFeatureVectorForOneSupernode();
 
+  bool isThreadSafe() { return true; }
+
   /**
    * Extract a feature vector for a given supernode in a 2d slice
    */
@@ -15,6 +15,9 @@
 
 #include "F_Combo.h"
 #include "oSVM.h"
+#include "profiler.h"
+
+#include <sstream>
 
 //--------------------------------------------------------------------- METHODS
 
@@ -27,30 +30,23 @@ F_Combo::F_Combo(vector<eFeatureType>& feature_types,
       it != feature_types.end(); it++) {
     _feature = Feature::getFeature(slice, *it);
     features.push_back(_feature);
-  }
-
-  // Initialize feature vectors
-  printf("[F_Combo] Allocating memory to store %ld different features\n", features.size());
-  feature_buffer = new osvm_node*[features.size()];
 
-  uint fidx = 0;
-  for(vector<Feature*>::iterator iFeature = features.begin();
-      iFeature != features.end(); iFeature++) {
-    int max_index = (*iFeature)->getSizeFeatureVectorForOneSupernode()+1;
-    feature_buffer[fidx] = new osvm_node[max_index];
-
-    int i = 0;
-    for(i = 0;i < max_index-1; i++)
-      feature_buffer[fidx][i].index = i+1;
-    feature_buffer[fidx][i].index = -1;
-
-    ++fidx;
+    // one timer per feature type
+    stringstream profileName;
+    profileName << "feature_" << (int)*it;
+    profileIds.push_back(Profiler::registerEntry(profileName.str().c_str(),
+                                                 PROFILE_TIMER));
   }
 
+  printf("[F_Combo] Combining %ld different features\n", features.size());
+
   sizeFV = 0;
+  maxSubSizeFV = 0;
   for(vector<Feature*>::iterator iFeature = features.begin();
       iFeature != features.end(); iFeature++) {
-    sizeFV += (*iFeature)->getSizeFeatureVectorForOneSupernode();
+    int subSizeFV = (*iFeature)->getSizeFeatureVectorForOneSupernode();
+    sizeFV += subSizeFV;
+    maxSubSizeFV = max(maxSubSizeFV, subSizeFV);
   }
 }
 
@@ -63,30 +59,23 @@ F_Combo::F_Combo(vector<eFeatureType>& feature_types,
       it != feature_types.end(); it++) {
     _feature = Feature::getFeature(slice, *it);
     features.push_back(_feature);
-  }
 
-  // Initialize feature vectors
-  printf("[F_Combo] Allocating memory to store %ld different features\n", features.size());
-  feature_buffer = new osvm_node*[features.size()];
-
-  uint fidx = 0;
-  for(vector<Feature*>::iterator iFeature = features.begin();
-      iFeature != features.end(); iFeature++) {
-    int max_index = (*iFeature)->getSizeFeatureVectorForOneSupernode()+1;
-    feature_buffer[fidx] = new osvm_node[max_index];
-
-    int i = 0;
-    for(i = 0;i < max_index-1; i++)
-      feature_buffer[fidx][i].index = i+1;
-    feature_buffer[fidx][i].index = -1;
-
-    ++fidx;
+    // one timer per feature type
+    stringstream profileName;
+    profileName << "feature_" << (int)*it;
+    profileIds.push_back(Profiler::registerEntry(profileName.str().c_str(),
+                                                 PROFILE_TIMER));
   }
 
+  printf("[F_Combo] Combining %ld different features\n", features.size());
+
   sizeFV = 0;
+  maxSubSizeFV = 0;
   for(vector<Feature*>::iterator iFeature = features.begin();
       iFeature != features.end(); iFeature++) {
-    sizeFV += (*iFeature)->getSizeFeatureVectorForOneSupernode();
+    int subSizeFV = (*iFeature)->getSizeFeatureVectorForOneSupernode();
+    sizeFV += subSizeFV;
+    maxSubSizeFV = max(maxSubSizeFV, subSizeFV);
   }
 }
 
@@ -103,15 +92,31 @@ void F_Combo::init()
 
 F_Combo::~F_Combo()
 {
-  uint fidx = 0;
   for(vector<Feature*>::iterator iFeature = features.begin();
       iFeature != features.end(); iFeature++) {
     delete *iFeature;
-    delete[] feature_buffer[fidx];
-    ++fidx;
   }
 }
 
+bool F_Combo::isThreadSafe()
+{
+  for(vector<Feature*>::iterator iFeature = features.begin();
+      iFeature != features.end(); iFeature++) {
+    if(!(*iFeature)->isThreadSafe()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void F_Combo::initBuffer(osvm_node* sx, int subSizeFV)
+{
+  int i = 0;
+  for(i = 0;i < subSizeFV; i++)
+    sx[i].index = i+1;
+  sx[i].index = -1;
+}
+
 int F_Combo::getSizeFeatureVectorForOneSupernode()
 {
   return sizeFV;
@@ -119,14 +124,20 @@ int F_Combo::getSizeFeatureVectorForOneSupernode()
 
 bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *x, Slice* slice, int supernodeId)
 {
+  // allocate memory to store data (done inside this function for multi-thread code)
+  osvm_node *sx = new osvm_node[maxSubSizeFV+1];
+
   uint idx = 0;
   uint fidx = 0;
   for(vector<Feature*>::iterator iFeature = features.begin();
       iFeature != features.end(); iFeature++) {
+    initBuffer(sx, (*iFeature)->getSizeFeatureVectorForOneSupernode());
 
-    osvm_node *sx = feature_buffer[fidx];
+    {
+      ProfilerScope profilerScope(profileIds[fidx]);
+      (*iFeature)->getFeatureVectorForOneSupernode(sx, slice, supernodeId);
+    }
     ++fidx;
-    (*iFeature)->getFeatureVectorForOneSupernode(sx, slice, supernodeId);
 
     if(normalize_features > 0) {
       double norm = oSVM::norm(sx, normalize_features);
@@ -145,6 +156,7 @@ bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *x, Slice* slice, int su
     }
   }
 
+  delete[] sx;
   return true;
 }
 
@@ -152,12 +164,13 @@ bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *n,
                                               const int x,
                                               const int y)
 {
+  // allocate memory to store data (done inside this function for multi-thread code)
+  osvm_node *sx = new osvm_node[maxSubSizeFV+1];
+
   uint idx = 0;
-  uint fidx = 0;
   for(vector<Feature*>::iterator iFeature = features.begin();
       iFeature != features.end(); iFeature++) {
-    osvm_node *sx = feature_buffer[fidx];
-    ++fidx;
+    initBuffer(sx, (*iFeature)->getSizeFeatureVectorForOneSupernode());
     (*iFeature)->getFeatureVectorForOneSupernode(sx,x,y);
 
     if(normalize_features > 0) {
@@ -174,18 +187,25 @@ bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *n,
     }
   }
 
+  delete[] sx;
   return true;
 }
 
 bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *x, Slice3d* slice3d, int supernodeId)
 {
+  // allocate memory to store data (done inside this function for multi-thread code)
+  osvm_node *sx = new osvm_node[maxSubSizeFV+1];
+
   uint idx = 0;
   uint fidx = 0;
   for(vector<Feature*>::iterator iFeature = features.begin();
       iFeature != features.end(); iFeature++) {
-    osvm_node *sx = feature_buffer[fidx];
+    initBuffer(sx, (*iFeature)->getSizeFeatureVectorForOneSupernode());
+    {
+      ProfilerScope profilerScope(profileIds[fidx]);
+      (*iFeature)->getFeatureVectorForOneSupernode(sx, slice3d, supernodeId);
+    }
     ++fidx;
-    (*iFeature)->getFeatureVectorForOneSupernode(sx, slice3d, supernodeId);
 
     if(normalize_features > 0) {
       double norm = oSVM::norm(sx, normalize_features);
@@ -201,18 +221,20 @@ bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *x, Slice3d* slice3d, in
     }
   }
 
+  delete[] sx;
   return true;
 }
 
 bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *n, Slice3d* slice3d,
                                               const int x, const int y, const int z)
 {
+  // allocate memory to store data (done inside this function for multi-thread code)
+  osvm_node *sx = new osvm_node[maxSubSizeFV+1];
+
   uint idx = 0;
-  uint fidx = 0;
   for(vector<Feature*>::iterator iFeature = features.begin();
       iFeature != features.end(); iFeature++) {
-    osvm_node *sx = feature_buffer[fidx];
-    ++fidx;
+    initBuffer(sx, (*iFeature)->getSizeFeatureVectorForOneSupernode());
     (*iFeature)->getFeatureVectorForOneSupernode(sx,slice3d,x,y,z);
 
     if(normalize_features > 0) {
@@ -229,5 +251,6 @@ bool F_Combo::getFeatureVectorForOneSupernode(osvm_node *n, Slice3d* slice3d,
     }
   }
 
+  delete[] sx;
   return true;
 }
\ No newline at end of file
@@ -46,6 +46,11 @@ class F_Combo : public Feature
 
   ~F_Combo();
 
+  /**
+   * A combination is thread-safe if all the underlying features are.
+   */
+  bool isThreadSafe();
+
   inline int getSizeFeatureVectorForOneSupernode();
 
   const vector<Feature*>& getFeatures() { return features; }
@@ -77,12 +82,17 @@ class F_Combo : public Feature
   void init();
 
  private:
+  static void initBuffer(osvm_node* sx, int subSizeFV);
+
   vector<Feature*> features;
   int normalize_features;
   int sizeFV;
 
-  // use to store features
-  osvm_node** feature_buffer;
+  // size of the largest feature vector among the combined features
+  int maxSubSizeFV;
+
+  // profiler ids of the timers associated to each feature
+  vector<int> profileIds;
 };
 
 #endif // F_COMBO_H
@@ -37,6 +37,8 @@ class F_Filter : public Feature
 
   int getSizeFeatureVectorForOneSupernode();
 
+  bool isThreadSafe() { return true; }
+
   bool getFeatureVector(osvm_node *n,
                         const int x,
                         const int y);
@@ -31,6 +31,8 @@ class F_Gaussian : public Feature
 
   int getSizeFeatureVector();
 
+  bool isThreadSafe() { return true; }
+
   /**
    * Extract a feature vector for a given supernode in a 2d slice
    */
@@ -34,6 +34,8 @@ class F_Glcm : public Feature
 
   int getSizeFeatureVectorForOneSupernode();
 
+  bool isThreadSafe() { return true; }
+
   bool getFeatureVectorForOneSupernode(osvm_node *x,
                                        Slice_P* slice,
                                        int supernodeId);
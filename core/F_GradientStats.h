@@ -50,6 +50,8 @@ class F_GradientStats : public Feature
 
   int getSizeFeatureVectorForOneSupernode();
 
+  bool isThreadSafe() { return true; }
+
   /**
    * Extract a feature vector for a given supernode in a 2d slice
    */
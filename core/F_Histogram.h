@@ -47,6 +47,8 @@ class F_Histogram : public Feature
               bool _useColorImage = false,
               IplImage* img = 0);
 
+  bool isThreadSafe() { return true; }
+
  protected:
   int getSizeFeatureVectorForOneSupernode();
 
@@ -54,6 +54,9 @@ class F_LoadFromFile : public Feature
 
   int getSizeFeatureVectorForOneSupernode();
 
+  // the sparse structure is a map that is not safe to read concurrently
+  bool isThreadSafe() { return !USE_SPARSE_STRUCTURE; }
+
   bool getFeatureVector(osvm_node *n,
                         const int x,
                         const int y);
@@ -47,8 +47,7 @@ bool F_Position::getFeatureVector(osvm_node *n,
 
 bool F_Position::getFeatureVector(osvm_node *x, Slice* slice, int supernodeId)
 {
-  node center;
-  slice->getCenter(supernodeId,center);
+  const node& center = slice->getSupernodeStats(supernodeId).center;
   double _x = (center.x - (slice->img_width/2.0))/(double)slice->img_width;
   double _y = center.y/(double)slice->img_height;
   x[0].value = _x;
@@ -23,9 +23,9 @@ using namespace std;
 
 //--------------------------------------------------------------------- METHODS
 
-F_Precomputed::F_Precomputed(map<sidType, osvm_node*>* _features, int _feature_size)
+F_Precomputed::F_Precomputed(Slice_P* _slice, int _feature_size)
 {
-   features = _features;
+   slice = _slice;
    feature_size = _feature_size;
 }
 
@@ -48,8 +48,9 @@ bool F_Precomputed::getFeatureVectorForOneSupernode(osvm_node *x,
                                                     Slice3d* slice3d,
                                                     const int supernodeId)
 {
+  const float* n = slice->getFeature(supernodeId);
   for(int i = 0; i < feature_size; i++) {
-    x[i].value = (*features)[supernodeId][i].value;
+    x[i].value = n[i];
   }
   return true;
 }
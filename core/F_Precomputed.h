@@ -28,10 +28,16 @@ class F_Precomputed : public Feature
 {
  public:	
 
-  F_Precomputed(map<sidType, osvm_node*>* _features, int _feature_size);
+  /**
+   * Read features from the feature matrix of a slice whose features were
+   * loaded with Slice_P::loadFeatures.
+   */
+  F_Precomputed(Slice_P* _slice, int _feature_size);
 
   ~F_Precomputed();
 
+  bool isThreadSafe() { return true; }
+
  protected:
 
   int getSizeFeatureVectorForOneSupernode();
@@ -56,8 +62,8 @@ class F_Precomputed : public Feature
 
   int feature_size;
 
-  // precomputed quantities for nodes
-  map<sidType, osvm_node*>* features;
+  // slice holding the precomputed feature matrix
+  Slice_P* slice;
 };
 
 #endif // F_PRECOMPUTED_H
\ No newline at end of file
@@ -60,6 +60,35 @@ Feature::~Feature()
   }
 }
 
+Feature* Feature::findCachedFeature(ulong sliceId, ulong featureId)
+{
+  Feature* feature = 0;
+  // slices may be loaded from several threads (predict server and pipeline)
+#pragma omp critical(feature_cache)
+  {
+    map<ulong, map<ulong, Feature*> >::iterator lookup = feature_cache.find(sliceId);
+    if(lookup != feature_cache.end()) {
+      map<ulong, Feature*>::iterator lookup_f = lookup->second.find(featureId);
+      if(lookup_f != lookup->second.end()) {
+        feature = lookup_f->second;
+      }
+    }
+  }
+  return feature;
+}
+
+void Feature::insertCachedFeature(ulong sliceId, ulong featureId, Feature* feature)
+{
+#pragma omp critical(feature_cache)
+  feature_cache[sliceId][featureId] = feature;
+}
+
+void Feature::releaseCachedFeatures(ulong sliceId)
+{
+#pragma omp critical(feature_cache)
+  feature_cache.erase(sliceId);
+}
+
 Feature* Feature::getFeature(Slice_P* slice_p,
                              vector<eFeatureType>& feature_types)
 {
@@ -87,13 +116,10 @@ Feature* Feature::getFeature(Slice* slice,
                              std::vector<eFeatureType>& feature_types)
 {
   ulong featureId = getFeatureTypeId(feature_types);
-  map<ulong, map<ulong, Feature*> >::iterator lookup = feature_cache.find(slice->getId());
-  if(lookup != feature_cache.end()) {
-    map<ulong, Feature*>::iterator lookup_f = lookup->second.find(featureId);
-    if(lookup_f != lookup->second.end()) {
-      PRINT_MESSAGE("[Feature] Re-use feature from cache : (%p,%ld)\n", slice, featureId);
-      return lookup_f->second;
-    }
+  Feature* cachedFeature = findCachedFeature(slice->getId(), featureId);
+  if(cachedFeature) {
+    PRINT_MESSAGE("[Feature] Re-use feature from cache : (%p,%ld)\n", slice, featureId);
+    return cachedFeature;
   }
 
   Feature* feat = 0;
@@ -103,7 +129,7 @@ Feature* Feature::getFeature(Slice* slice,
   } else {
     PRINT_MESSAGE("[Feature] Inserting combo feature in cache : (%p,%ld)\n", slice, featureId);
     feat = new F_Combo(feature_types, slice);
-    feature_cache[slice->getId()][featureId] = feat;
+    insertCachedFeature(slice->getId(), featureId, feat);
   }
   return feat;
 }
@@ -112,13 +138,10 @@ Feature* Feature::getFeature(Slice* slice,
                              eFeatureType feature_type)
 {
   ulong featureId = (ulong)feature_type;
-  map<ulong, map<ulong, Feature*> >::iterator lookup = feature_cache.find(slice->getId());
-  if(lookup != feature_cache.end()) {
-    map<ulong, Feature*>::iterator lookup_f = lookup->second.find(featureId);
-    if(lookup_f != lookup->second.end()) {
-      PRINT_MESSAGE("[Feature] Re-use feature from cache : (%p,%ld)\n", slice, featureId);
-      return lookup_f->second;
-    }
+  Feature* cachedFeature = findCachedFeature(slice->getId(), featureId);
+  if(cachedFeature) {
+    PRINT_MESSAGE("[Feature] Re-use feature from cache : (%p,%ld)\n", slice, featureId);
+    return cachedFeature;
   }
 
   Feature* _feature = 0; // caller is responsible for deleting returned feature
@@ -259,7 +282,7 @@ Feature* Feature::getFeature(Slice* slice,
 
   PRINT_MESSAGE("[Feature] Inserting feature of size %d in cache : (%ld,%p,%ld)\n",
                 _feature->getSizeFeatureVector(), slice->getId(), slice, featureId);
-  feature_cache[slice->getId()][featureId] = _feature;
+  insertCachedFeature(slice->getId(), featureId, _feature);
 
   return _feature;
 }
@@ -268,13 +291,10 @@ Feature* Feature::getFeature(Slice3d* slice3d,
                              std::vector<eFeatureType>& feature_types)
 {
   ulong featureId = getFeatureTypeId(feature_types);
-  map<ulong, map<ulong, Feature*> >::iterator lookup = feature_cache.find(slice3d->getId());
-  if(lookup != feature_cache.end()) {
-    map<ulong, Feature*>::iterator lookup_f = lookup->second.find(featureId);
-    if(lookup_f != lookup->second.end()) {
-      PRINT_MESSAGE("[Feature] Re-use feature from cache : (%p,%ld)\n", slice3d, featureId);
-      return lookup_f->second;
-    }
+  Feature* cachedFeature = findCachedFeature(slice3d->getId(), featureId);
+  if(cachedFeature) {
+    PRINT_MESSAGE("[Feature] Re-use feature from cache : (%p,%ld)\n", slice3d, featureId);
+    return cachedFeature;
   }
 
   Feature* feat = 0;
@@ -285,7 +305,7 @@ Feature* Feature::getFeature(Slice3d* slice3d,
     feat = new F_Combo(feature_types, slice3d);
     PRINT_MESSAGE("[Feature] Inserting feature of size %d in cache : (%ld,%p,%ld)\n",
                   feat->getSizeFeatureVector(), slice3d->getId(), slice3d, featureId);
-    feature_cache[slice3d->getId()][featureId] = feat;
+    insertCachedFeature(slice3d->getId(), featureId, feat);
   }
   return feat;
 }
@@ -294,13 +314,10 @@ Feature* Feature::getFeature(Slice3d* slice3d,
                              eFeatureType feature_type)
 {
   ulong featureId = (ulong)feature_type;
-  map<ulong, map<ulong, Feature*> >::iterator lookup = feature_cache.find(slice3d->getId());
-  if(lookup != feature_cache.end()) {
-    map<ulong, Feature*>::iterator lookup_f = lookup->second.find(featureId);
-    if(lookup_f != lookup->second.end()) {
-      PRINT_MESSAGE("[Feature] Re-use feature from cache : (%p,%ld)\n", slice3d, featureId);
-      return lookup_f->second;
-    }
+  Feature* cachedFeature = findCachedFeature(slice3d->getId(), featureId);
+  if(cachedFeature) {
+    PRINT_MESSAGE("[Feature] Re-use feature from cache : (%p,%ld)\n", slice3d, featureId);
+    return cachedFeature;
   }
 
   Feature* feat = 0; // caller is responsible for deleting returned feature
@@ -373,7 +390,7 @@ Feature* Feature::getFeature(Slice3d* slice3d,
 
   PRINT_MESSAGE("[Feature] Inserting feature of size %d in cache: (%ld,%p,%ld)\n",
                 feat->getSizeFeatureVector(), slice3d->getId(), slice3d, featureId);
-  feature_cache[slice3d->getId()][featureId] = feat;
+  insertCachedFeature(slice3d->getId(), featureId, feat);
   return feat;
 }
 
@@ -428,7 +445,7 @@ void Feature::saveCube(Slice_P& slice, const char* filename, int feature_dimensi
   const map<sidType, supernode* >& _supernodes = slice.getSupernodes();
   for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
       it != _supernodes.end(); it++) {
-    getFeatureVector(fn, &slice, it->first);
+    getStoredFeatureVector(fn, slice, it->first);
 
     nodeIterator ni = it->second->getIterator();
     ni.goToBegin();
@@ -447,6 +464,19 @@ void Feature::saveCube(Slice_P& slice, const char* filename, int feature_dimensi
   delete[] data;
 }
 
+void Feature::getStoredFeatureVector(osvm_node *n, Slice_P& slice, sidType sid)
+{
+  int fvSize = getSizeFeatureVector();
+  if(slice.isFeatureComputed(sid) && slice.getFeatureSize() == fvSize) {
+    const float* x = slice.getFeature(sid);
+    for(int i = 0; i < fvSize; ++i) {
+      n[i].value = x[i];
+    }
+  } else {
+    getFeatureVector(n, &slice, sid);
+  }
+}
+
 void Feature::save(Slice_P& slice, const char* filename)
 {
   int fvSize = getSizeFeatureVector();
@@ -458,7 +488,7 @@ void Feature::save(Slice_P& slice, const char* filename)
   for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
       it != _supernodes.end(); it++) {
     ofs << (int) it->second->getLabel();
-    getFeatureVector(n, &slice, it->first);
+    getStoredFeatureVector(n, slice, it->first);
     for(int i = 0; i < fvSize; ++i) {
       ofs << " " << i+1 << FEATURE_FIELD_SEPARATOR << n[i].value;
     }
@@ -479,7 +509,7 @@ void Feature::saveSparse(Slice_P& slice, const char* filename)
   for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
       it != _supernodes.end(); it++) {
     ofs << (int) it->second->getLabel();
-    getFeatureVector(n, &slice, it->first);
+    getStoredFeatureVector(n, slice, it->first);
     for(int i = 0; i < fvSize; ++i) {
       if(n[i].value != 0) {
         ofs << " " << i+1 << FEATURE_FIELD_SEPARATOR << n[i].value;
@@ -611,9 +641,9 @@ bool Feature::getFeatureVectorGivenDistance(osvm_node *x, Slice_P* slice_p, int
 
     if(slice_p->isFeatureComputed(sidn)) {
       // Feature already exists. Copy relevant part of the vector.
-      osvm_node* xn = slice_p->getFeature(sidn);
+      const float* xn = slice_p->getFeature(sidn);
       for(int i = 0; i < sizeFV; ++i) {
-        x[distance*sizeFV+i].value += xn[i].value;
+        x[distance*sizeFV+i].value += xn[i];
       }
     } else {
       getFeatureVectorForOneSupernode(xt, slice_p, sn->id);
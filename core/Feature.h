@@ -30,7 +30,7 @@ class Feature
 
   Feature();
 
-  ~Feature();
+  virtual ~Feature();
 
   static void deleteFeature(Slice_P* slice_p, Feature* _feature);
   static void deleteFeature(Feature* _feature);
@@ -144,6 +144,14 @@ class Feature
 
   virtual eFeatureType getFeatureType() { return F_UNKNOWN; }
 
+  /**
+   * Returns true if feature vectors can be extracted for different
+   * supernodes from several threads at the same time.
+   */
+  virtual bool isThreadSafe() { return false; }
+
+  bool getIncludeNeighbors() { return includeNeighbors; }
+
   static void initSVMNode(osvm_node*& x, int d);
 
   static void precomputeFeatures(Slice_P* slice, Feature* feature, float**& output);
@@ -152,6 +160,12 @@ class Feature
 
   static void rescaleCache(Slice_P* slice);
 
+  /**
+   * Remove the features of a slice from the cache. Must be called before the
+   * features returned by getFeature for this slice are deleted.
+   */
+  static void releaseCachedFeatures(ulong sliceId);
+
   virtual void rescale(Slice_P* slice) { ; }
 
   void save(Slice_P& slice, const char* filename);
@@ -170,9 +184,19 @@ class Feature
   // TODO(lucchi) : Delete features !
   static map<ulong, map<ulong, Feature*> > feature_cache;
 
+  static Feature* findCachedFeature(ulong sliceId, ulong featureId);
+
+  static void insertCachedFeature(ulong sliceId, ulong featureId, Feature* feature);
+
  private:
   bool includeNeighbors;
 
+  /**
+   * Copy the feature vector of a supernode from the feature matrix of the
+   * slice if it was precomputed, otherwise extract it.
+   */
+  void getStoredFeatureVector(osvm_node *n, Slice_P& slice, sidType sid);
+
 };
 
 #endif // FEATURE
@@ -37,34 +37,9 @@ void Slice::init(int width, int height)
   min_sid = INT_MAX; //numeric_limits<int>::max();
 
   // Populating mSupernodes
-  map<sidType, supernode* >::iterator iLabel;
-  int iBuffer = 0;
-  sidType sid;  // supernode id
-  for(int y=0;y<img_height;y++) {
-    for(int x=0;x<img_width;x++) {
-      node* p = new node;
-      p->x = x;
-      p->y = y;
-      p->z = 0;
-      
-      sid = pixelLabels[iBuffer];
-      iLabel = mSupernodes.find(sid);
-      if(iLabel != mSupernodes.end()) {
-        iLabel->second->addNode(p);
-      } else {
-        // Create a new supernode
-        supernode* s = new supernode;
-        s->id = sid;
-        s->addNode(p);
-        mSupernodes[sid] = s;
-
-        if(s->id < min_sid)
-          min_sid = s->id;
-      }
-
-      iBuffer++;
-    }
-  }
+  supernodeStorage.build(&pixelLabels, img_width, img_height, 1, mSupernodes);
+  if(!mSupernodes.empty())
+    min_sid = mSupernodes.begin()->first;
 
   if(min_sid > 0) {
     printf("[Slice] WARNING : min_sid equals %d. Should be 0 ?\n", min_sid);
@@ -321,11 +296,6 @@ void Slice::generateSuperpixels(int superpixelStepSize, float M)
 
 Slice::~Slice()
 {
-  for(map<sidType, supernode* >::iterator it = mSupernodes.begin();
-      it != mSupernodes.end(); it++) {
-    delete it->second;
-  }
-
   delete[] pixelLabels;
 
   if(img != 0) {
@@ -499,8 +469,7 @@ bool Slice::computeStats(int supernodeId, double& pMean, double& pVar)
 
 bool Slice::getCenter(int supernodeId, node& center)
 {
-  supernode* s = getSupernode(supernodeId);
-  s->getCenter(center);
+  center = getSupernodeStats(supernodeId).center;
   return true;
 }
 
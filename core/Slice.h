@@ -56,6 +56,9 @@ class Slice : public Slice_P
   // map containing a list of supernodes indexed by their supernode id
   map<sidType, supernode* > mSupernodes;
 
+  // storage for the supernodes and lines indexed by mSupernodes
+  supernodeArena supernodeStorage;
+
   Slice() {}
 
   Slice(const char* a_image_name, const char* fn_label,
@@ -184,6 +187,13 @@ class Slice : public Slice_P
 
   uchar* getRawData() { return (uchar*)(img->imageData); }
 
+  const uchar* getVoxelData(int x, int y, int z) {
+    if(img == 0) {
+      return 0;
+    }
+    return (uchar*)(img->imageData + y*img->widthStep) + x*img->nChannels;
+  }
+
   int getIntensity(int x, int y, int z = 0);
 
   float getAvgIntensity(sidType supernodeId);
@@ -239,7 +249,7 @@ class Slice : public Slice_P
   }
 
   supernode* getSupernode(sidType sid) {
-    return mSupernodes[sid];
+    return supernodeStorage.getSupernode(sid);
   }
 
   map<sidType, supernode* >* getMutableSupernodes() {
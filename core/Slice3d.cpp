@@ -21,11 +21,14 @@
 #include "LKM.h"
 
 // SliceMe
+#include "Config.h"
 #include "Slice3d.h"
 #include "globalsE.h"
+#include "label_export.h"
+#include "profiler.h"
+#include "supervoxel_slic.h"
 #include "utils.h"
-
-#define USE_RUN_LENGTH_ENCODING
+#include "volume_loader.h"
 
 Slice3d::Slice3d(unsigned char* a_raw_data,
                  int awidth, int aheight,
@@ -159,10 +162,6 @@ void Slice3d::init()
 Slice3d::~Slice3d()
 {
   if(mSupervoxels) {
-    for(map< sidType, supernode* >::iterator it = mSupervoxels->begin();
-        it != mSupervoxels->end();it++) {
-      delete it->second;
-    }
     delete mSupervoxels;
   }
   
@@ -197,6 +196,24 @@ int Slice3d::raw2Double(double**& ptr_data)
   return 0;
 }
 
+int Slice3d::raw2Float(float*& ptr_data)
+{
+  ulong cubeSize = (ulong)sliceSize*depth;
+  ptr_data = new float[cubeSize];
+  if (ptr_data == 0) {
+    printf("[Slice3d] Error while allocating memory for 3d volume\n");
+    return -1;
+  }
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for(long i = 0; i < (long)cubeSize; i++) {
+    ptr_data[i] = (float)raw_data[i];
+  }
+  return 0;
+}
+
 int Slice3d::raw2RGB(unsigned int**& ptr_data)
 {
   // supervoxel library needs a cube made of ints so we have to convert the cube
@@ -265,6 +282,7 @@ void Slice3d::loadSupervoxels(const char* imageDir, const int voxel_step, const
 
 void Slice3d::generateSupervoxels(const double _cubeness)
 {
+  PROFILE_SCOPE("supervoxels");
   cubeness = _cubeness;
   int slice_size = width*height;
 
@@ -311,23 +329,39 @@ void Slice3d::generateSupervoxels(const double _cubeness)
     }
   else  
     {
-      double** ptr_data;
-      raw2Double(ptr_data);
-      LKM* lkm = new LKM(false); // do not free memory
-      lkm->DoSupervoxelSegmentationForGrayVolume(ptr_data,
-                                                 (int)width,(int)height,(int)depth,
-                                                 klabels,
-                                                 nLabels,
-                                                 (int)supernode_step,
-                                                 cubeness);
-
-      PRINT_MESSAGE("[Slice3d] Supervoxelization done\n");
-      for(int z=0;z<depth;z++) {
-        delete[] ptr_data[z];
+      string config_tmp;
+      bool useParallelSupervoxels = false;
+      if(Config::Instance()->getParameter("parallel_supervoxels", config_tmp)) {
+        useParallelSupervoxels = config_tmp.c_str()[0] == '1';
       }
-      delete[] ptr_data;
 
-      delete lkm;
+      if(useParallelSupervoxels) {
+        float* ptr_data;
+        raw2Float(ptr_data);
+        SupervoxelSLIC slic((int)width, (int)height, (int)depth,
+                            (int)supernode_step, cubeness);
+        nLabels = slic.segment(ptr_data, klabels);
+        PRINT_MESSAGE("[Slice3d] Supervoxelization done\n");
+        delete[] ptr_data;
+      } else {
+        double** ptr_data;
+        raw2Double(ptr_data);
+        LKM* lkm = new LKM(false); // do not free memory
+        lkm->DoSupervoxelSegmentationForGrayVolume(ptr_data,
+                                                   (int)width,(int)height,(int)depth,
+                                                   klabels,
+                                                   nLabels,
+                                                   (int)supernode_step,
+                                                   cubeness);
+
+        PRINT_MESSAGE("[Slice3d] Supervoxelization done\n");
+        for(int z=0;z<depth;z++) {
+          delete[] ptr_data[z];
+        }
+        delete[] ptr_data;
+
+        delete lkm;
+      }
     }
 
   createIndexingStructures(klabels);
@@ -338,11 +372,10 @@ void Slice3d::createIndexingStructures(sidType** _klabels, bool force)
 {
   if(mSupervoxels !=0) {
     if(force) {
-      for(map< sidType, supernode* >::iterator it = mSupervoxels->begin();
-          it != mSupervoxels->end();it++) {
-        delete it->second;
-      }
+      // supernodes are owned by supervoxelArena
+      supervoxelArena.clear();
       delete mSupervoxels;
+      releaseSupernodeStats();
     } else {
       printf("[Slice3d] Error in createIndexingStructures : structures already existing\n");
       return;
@@ -350,103 +383,18 @@ void Slice3d::createIndexingStructures(sidType** _klabels, bool force)
   }
 
   ulong slice_size = width*height;
-  // Creating indexation structure
-  PRINT_MESSAGE("[Slice3d] Creating indexing structure. %fMb needed\n",
-                (sizeof(supernode)*slice_size*depth/(supernode_step*supernode_step)
-                 + sizeof(node) * slice_size*depth)/(1024.0*1024.0));
+  PRINT_MESSAGE("[Slice3d] Cube size = (%d,%d,%d)=%ld voxels\n", width, height, depth,slice_size*depth);
 
   mSupervoxels = new map< sidType, supernode* >;
-  supernode* s;
-  map<sidType,supernode*>::iterator itVoxel;
+  supervoxelArena.build(_klabels, width, height, depth, *mSupervoxels);
 
-  PRINT_MESSAGE("[Slice3d] Cube size = (%d,%d,%d)=%ld voxels\n", width, height, depth,slice_size*depth);
+  PRINT_MESSAGE("[Slice3d] Indexing structure created. %ld lines, %fMb used\n",
+                supervoxelArena.getNbLines(),
+                (sizeof(supernode)*mSupervoxels->size()
+                 + sizeof(lineContainer)*supervoxelArena.getNbLines())/(1024.0*1024.0));
 
   sidType sid;
-
-#ifdef USE_RUN_LENGTH_ENCODING
-  sidType previousSid;
-  lineContainer* line;
-
-  for(int d=0;d<depth;d++) { 
-    for(int y=0;y<height;y++) {
-
-      // create new line
-      line = new lineContainer;
-      line->coord.x = 0;
-      line->coord.y = y;
-      line->coord.z = d;
-      sid = _klabels[d][y*width]; // x=0
-
-      // add line to supernode
-      itVoxel = mSupervoxels->find(sid);
-      if(itVoxel == mSupervoxels->end()) {
-        // Create new supernode and add it to the list
-        s = new supernode;
-        s->id = sid;
-        (*mSupervoxels)[sid] = s;
-      } else {
-        // Supernode already exists
-        s = itVoxel->second;
-      }
-
-      s->addLine(line);
-
-      previousSid = sid;
-
-      for(int x = 0;x < width;x++) {
-        sid = _klabels[d][y*width+x];
-        if(sid == previousSid) {
-          line->length++;
-        } else {
-          // create new line
-          line = new lineContainer;
-          line->coord.x = x;
-          line->coord.y = y;
-          line->coord.z = d;
-          line->length = 1;
-          previousSid = sid;
-
-          // add line to supernode
-          itVoxel = mSupervoxels->find(sid);
-          if(itVoxel == mSupervoxels->end()) {
-            // Create new supernode and add it to the list
-            s = new supernode;
-            s->id = sid;
-            (*mSupervoxels)[sid] = s;
-          } else {
-            // Supernode already exists
-            s = itVoxel->second;
-          }
-
-          s->addLine(line);
-        }
-      }
-    }
-  }
-#else
-  for(int d=0;d<depth;d++)
-    for(int y=0;y<height;y++)
-      for(int x=0;x<width;x++) {
-        sid = _klabels[d][y*width+x];
-        itVoxel = mSupervoxels->find(sid);
-        if(itVoxel == mSupervoxels->end()) {
-          // Create new supernode and add it to the list
-          s = new supernode;
-          s->id = sid;
-          (*mSupervoxels)[sid] = s;
-        } else {
-          // Supernode already exists
-          s = itVoxel->second;
-        }
-
-        // Add node to the supernode
-        node* p = new node;
-        p->z = d;
-        p->y = y;
-        p->x = x;
-        s->addNode(p);
-      }
-#endif
+  supernode* s;
 
   PRINT_MESSAGE("[Slice3d] %d supervoxels created\n", (int)mSupervoxels->size());
 
@@ -461,9 +409,11 @@ void Slice3d::createIndexingStructures(sidType** _klabels, bool force)
   if(loadNeighbors) {
     PRINT_MESSAGE("[Slice3d] Indexing neighbors...\n");
 
+    // neighbors are only cached for cubes loaded from a directory
+    bool cacheNeighbors = !inputDir.empty();
     stringstream sout_neighbors;
     sout_neighbors << inputDir << "neighbors_" << supernode_step << "_" << cubeness;
-    if(fileExists(sout_neighbors.str().c_str())) {
+    if(cacheNeighbors && fileExists(sout_neighbors.str().c_str())) {
       PRINT_MESSAGE("[Slice3d] Loading neighbors from %s\n", sout_neighbors.str().c_str());
       ifstream ifs(sout_neighbors.str().c_str());
       string line;
@@ -471,11 +421,11 @@ void Slice3d::createIndexingStructures(sidType** _klabels, bool force)
         vector<string> tokens;
         splitString(line, tokens);
         int sid = atoi(tokens[0].c_str());
-        supernode* s = (*mSupervoxels)[sid];
+        supernode* s = supervoxelArena.getSupernode(sid);
         vector<supernode*>* ptrNeighbors = &(s->neighbors);
         for(int i = 1; i < tokens.size(); ++i) {
           int nsid = atoi(tokens[i].c_str());
-          supernode* sn = (*mSupervoxels)[nsid];
+          supernode* sn = supervoxelArena.getSupernode(nsid);
           s->neighbors.push_back(sn);
         }
       }
@@ -496,8 +446,8 @@ void Slice3d::createIndexingStructures(sidType** _klabels, bool force)
                 for(int nz = z-nh_size; nz <= z+nh_size; nz++) {
                   nsid = _klabels[nz][ny*width+nx];
                   if(sid > nsid) {
-                    s = (*mSupervoxels)[sid];
-                    sn = (*mSupervoxels)[nsid];
+                    s = supervoxelArena.getSupernode(sid);
+                    sn = supervoxelArena.getSupernode(nsid);
                     if(sn == 0) {
                       printf("[Slice3d] Error : supernode %d is null (coordinate=(%d,%d,%d))\n",nsid,nx,ny,nz);
                       exit(-1);
@@ -526,21 +476,23 @@ void Slice3d::createIndexingStructures(sidType** _klabels, bool force)
         }
       }
 
-      PRINT_MESSAGE("Exporting neighbors to %s\n", sout_neighbors.str().c_str());
-      ofstream ofs(sout_neighbors.str().c_str());
-      for(map<sidType, supernode* >::iterator it = mSupervoxels->begin();
-          it != mSupervoxels->end(); it++) {
-        s = it->second;
-        stringstream sout;
-        sout << s->id;
-        for(vector < supernode* >::iterator itN = s->neighbors.begin();
-            itN != s->neighbors.end();itN++) {
-          supernode* ns = *itN;
-          sout << " " << ns->id;
+      if(cacheNeighbors) {
+        PRINT_MESSAGE("Exporting neighbors to %s\n", sout_neighbors.str().c_str());
+        ofstream ofs(sout_neighbors.str().c_str());
+        for(map<sidType, supernode* >::iterator it = mSupervoxels->begin();
+            it != mSupervoxels->end(); it++) {
+          s = it->second;
+          stringstream sout;
+          sout << s->id;
+          for(vector < supernode* >::iterator itN = s->neighbors.begin();
+              itN != s->neighbors.end();itN++) {
+            supernode* ns = *itN;
+            sout << " " << ns->id;
+          }
+          ofs << sout.str() << endl;
         }
-        ofs << sout.str() << endl;
+        ofs.close();
       }
-      ofs.close();
 
     }
 
@@ -858,48 +810,8 @@ void Slice3d::loadFromDir(const char* dir, int nImgs)
 
 void Slice3d::loadFromDir(const char* dir, const node& start, const node& end)
 {
-  const int bytes_per_pixel = 1;
-  IplImage* img;
-  IplImage* gray_img;
   int nImgs = end.z-start.z;
 
-  // load files
-  vector<string> files;
-  getFilesInDir(dir, files, start.z, "png", true);
-  if(files.size() == 0) {
-    getFilesInDir(dir, files, start.z, "tif", true);
-  }
-
-  int nValidImgs = 0;
-  for(vector<string>::iterator itFile = files.begin();
-      itFile != files.end(); itFile++) {
-    if(width == UNITIALIZED_SIZE) {
-      IplImage* img_slice = cvLoadImage(itFile->c_str(),0);
-      if(!img_slice)
-        continue;
-
-      width = img_slice->width;
-      height = img_slice->height;
-
-      cvReleaseImage(&img_slice);
-    }
-
-    nValidImgs++;
-  }
-
-  if(nImgs != -1) {
-    if(nImgs > nValidImgs) {
-      printf("[Slice3d] Warning : nImgs=%d > nValidImgs=%d\n", nImgs, nValidImgs);
-      nImgs = nValidImgs;
-    }
-  }
-  else {
-    nImgs = nValidImgs;
-  }
-
-  // ask for enough memory for the texels and make sure we got it before proceeding
-  depth = nImgs; //files.size();
-
   if(!isDirectory(dir)) {
     PRINT_MESSAGE("[Slice3d] Loading data from file %s\n", dir);
     importData(dir);
@@ -916,190 +828,30 @@ void Slice3d::loadFromDir(const char* dir, const node& start, const node& end)
     return;
   }
 
-  ulong n = width*height*sizeof(char);
-  raw_data = new uchar[n*depth];
-
-  PRINT_MESSAGE("[Slice3d] Loading %d %dx%d images (%ld pixels) from directory %s\n",
-                nImgs, width, height, n, dir);
-  int d = 0;
-  for(int iImage = 0; iImage < nImgs; iImage++)
-    {
-      string image = files[iImage];
-
-      // Load image in black and white
-      // Do no handle 3d cubes in color for now !
-      IplImage* img_slice = cvLoadImage(image.c_str(),0);
-
-      if(!img_slice) {
-	PRINT_MESSAGE("[Slice3d] Warning : image %s not loaded properly\n", image.c_str());
-        continue;
-      }
-
-      if(img_slice->width != width || img_slice->height != height)
-        {
-          PRINT_MESSAGE("[Slice3d] Warning : (img_slice->width != width || img_slice->height != height)\n");
-          if(img_slice->nChannels != bytes_per_pixel)
-            {
-              gray_img = cvCreateImage(cvSize(img_slice->width,img_slice->height),IPL_DEPTH_8U,bytes_per_pixel);
-              cvCvtColor(img_slice,gray_img,CV_RGB2GRAY);
-              img = cvCreateImage(cvSize(width,height),IPL_DEPTH_8U,bytes_per_pixel);
-              cvResize(gray_img,img);
-              cvReleaseImage(&gray_img);
-            }
-          else
-            {
-              img = cvCreateImage(cvSize(width,height),IPL_DEPTH_8U,bytes_per_pixel);
-              cvResize(img_slice,img);
-            }
-
-          memcpy(raw_data+(d*n),img->imageData,n);
-          cvReleaseImage(&img);
-          cvReleaseImage(&img_slice);
-        }
-      else
-        {
-          img = img_slice;
-
-          if(img_slice->nChannels != bytes_per_pixel)
-            {
-              // FIXME
-              printf("[Slice3d] img_slice->nChannels %d\n", img_slice->nChannels);
-              exit(-1);
-            }
-
-          if(img->widthStep != img->width)
-            {
-              int i = 0;
-              for(int y = 0; y < img->height ; y++)
-                for(int x = 0; x < img->width ; x++)
-                  {
-                    raw_data[d*n+i] = ((uchar*)(img->imageData + img->widthStep*y))[x*img->nChannels];
-                    i++;
-                  }
-            }
-          else
-            memcpy(raw_data+(d*n),img->imageData,n);
-
-          cvReleaseImage(&img);
-        }
-      ++d;
+  // only the slices and the window [start, end) are decoded
+  VolumeLoader loader(dir, start.z, nImgs);
+  if(width == UNITIALIZED_SIZE) {
+    width = loader.getWidth();
+    height = loader.getHeight();
+  } else {
+    if(start.x + width > loader.getWidth() || start.y + height > loader.getHeight()) {
+      printf("[Slice3d] Window (%d,%d)+(%d,%d) is larger than the %dx%d images in %s\n",
+             start.x, start.y, (int)width, (int)height, loader.getWidth(), loader.getHeight(), dir);
+      exit(-1);
     }
+    loader.setWindow(start.x, start.y, width, height);
+  }
+  depth = loader.getDepth();
+
+  PRINT_MESSAGE("[Slice3d] Loading %d %dx%d images from directory %s\n",
+                (int)depth, (int)width, (int)height, dir);
+  raw_data = loader.loadVolume();
 }
 
 void Slice3d::loadFromDir(const char* dir, uchar*& raw_data,
                           int& width, int& height, int* nImgs)
 {
-  const int bytes_per_pixel = 1;
-  IplImage* img;
-  IplImage* gray_img;
-
-  // load files
-  vector<string> files;
-  getFilesInDir(dir, files,"png", true);
-  if(files.size() == 0) {
-    getFilesInDir(dir, files,"tif", true);
-  }
-
-  width = -1;
-  int nValidImgs = 0;
-  for(vector<string>::iterator itFile = files.begin();
-      itFile != files.end(); itFile++)
-    {
-      if((itFile->c_str()[0] != '.') && ( (getExtension(*itFile) == "png") || (getExtension(*itFile) == "tif")) )
-        {
-          if(width == -1)
-            {
-              IplImage* img_slice = cvLoadImage(itFile->c_str(),0);
-              if(!img_slice)
-                continue;
-
-              width = img_slice->width;
-              height = img_slice->height;
-
-              cvReleaseImage(&img_slice);
-            }
-
-          nValidImgs++;
-        }
-    }
-
-  if(*nImgs != -1)
-    {
-      if(*nImgs > nValidImgs)
-        {
-          printf("[PixelData] Warning : nImgs=%d > nValidImgs=%d\n", *nImgs, nValidImgs);
-          *nImgs = nValidImgs;
-        }
-    }
-  else
-    *nImgs = nValidImgs;
-
-  // ask for enough memory for the texels and make sure we got it before proceeding
-  uint n = width*height*sizeof(char);
-  raw_data = new uchar[n*(*nImgs)];
-
-  printf("[PixelData] Loading %d images from directory %s, width=%d, height=%d\n", *nImgs, dir, width, height);
-  int d = 0;
-  for(int iImage = 0; d < *nImgs; iImage++)
-    {
-      string image = files[iImage];
-
-      // Load image in black and white
-      // Do no handle 3d cubes in color for now !
-      IplImage* img_slice = cvLoadImage(image.c_str(),0);
-
-      if(!img_slice)
-        continue;
-
-      if(img_slice->width != width || img_slice->height != height)
-        {
-          if(img_slice->nChannels != bytes_per_pixel)
-            {
-              gray_img = cvCreateImage(cvSize(img_slice->width,img_slice->height),IPL_DEPTH_8U,bytes_per_pixel);
-              cvCvtColor(img_slice,gray_img,CV_RGB2GRAY);
-              img = cvCreateImage(cvSize(width,height),IPL_DEPTH_8U,bytes_per_pixel);
-              cvResize(gray_img,img);
-              cvReleaseImage(&gray_img);
-            }
-          else
-            {
-              img = cvCreateImage(cvSize(width,height),IPL_DEPTH_8U,bytes_per_pixel);
-              cvResize(img_slice,img);
-            }
-
-          memcpy(raw_data+(d*n),img->imageData,n);
-          cvReleaseImage(&img);
-          cvReleaseImage(&img_slice);
-        }
-      else
-        {
-          img = img_slice;
-
-          if(img_slice->nChannels != bytes_per_pixel)
-            {
-              // FIXME
-              printf("[Slice3d] img_slice->nChannels %d\n", img_slice->nChannels);
-              exit(-1);
-            }
-
-          if(img->widthStep != img->width)
-            {
-              int i = 0;
-              for(int y = 0; y < img->height ; y++)
-                for(int x = 0; x < img->width ; x++)
-                  {
-                    raw_data[d*n+i] = ((uchar*)(img->imageData + img->widthStep*y))[x*img->nChannels];
-                    i++;
-                  }
-            }
-          else
-            memcpy(raw_data+(d*n),img->imageData,n);
-
-          cvReleaseImage(&img);
-        }
-
-      d++;
-    }
+  ::loadFromDir(dir, raw_data, width, height, nImgs);
 }
 
 
@@ -1219,20 +971,31 @@ void Slice3d::rescaleRawData()
 {
   // bin intensities
   ulong n = width*height*depth;
-  const int nBuckets = 256;
-  ulong buckets[nBuckets];
-  for(int i = 0; i < nBuckets; ++i) {
+  ulong buckets[RESCALE_N_BUCKETS];
+  for(int i = 0; i < RESCALE_N_BUCKETS; ++i) {
     buckets[i] = 0;
   }
   for(ulong i = 0; i < n; ++i) {
     ++buckets[raw_data[i]];
   }
 
+  double min_intensity;
+  double max_intensity;
+  computeRescaleRange(buckets, n, min_intensity, max_intensity);
+
+  PRINT_MESSAGE("[Slice3d] Rescaling data. min=%g, max=%g\n", min_intensity,
+                max_intensity);
+  rescaleRawData(raw_data, n, min_intensity, max_intensity);
+}
+
+void Slice3d::computeRescaleRange(const ulong* buckets, ulong n,
+                                  double& min_intensity, double& max_intensity)
+{
   // compute min and max
-  int min_intensity_count = n*0.01;
-  int cum_count = 0;
-  double min_intensity = 0;
-  for(int i = 0; i < nBuckets; ++i) {
+  ulong min_intensity_count = n*0.01;
+  ulong cum_count = 0;
+  min_intensity = 0;
+  for(int i = 0; i < RESCALE_N_BUCKETS; ++i) {
     cum_count += buckets[i];
 
     if(cum_count >= min_intensity_count) {
@@ -1241,9 +1004,9 @@ void Slice3d::rescaleRawData()
     }
   }
 
-  double max_intensity = min_intensity;
-  int max_intensity_count = n*0.99;
-  for(int i = min_intensity; i < nBuckets; ++i) {
+  max_intensity = min_intensity;
+  ulong max_intensity_count = n*0.99;
+  for(int i = min_intensity; i < RESCALE_N_BUCKETS; ++i) {
     cum_count += buckets[i];
 
     if(cum_count >= max_intensity_count) {
@@ -1251,13 +1014,14 @@ void Slice3d::rescaleRawData()
       break;
     }
   }
+}
 
-  // rescale
-  PRINT_MESSAGE("[Slice3d] Rescaling data. min=%g, max=%g\n", min_intensity,
-                max_intensity);
+void Slice3d::rescaleRawData(uchar* data, ulong n,
+                             double min_intensity, double max_intensity)
+{
   double new_intensity = 0;
   for(ulong i = 0; i < n; ++i) {
-    new_intensity = (raw_data[i] - min_intensity) / (double)(max_intensity - min_intensity);
+    new_intensity = (data[i] - min_intensity) / (double)(max_intensity - min_intensity);
     new_intensity *= 255;
     if(new_intensity > 255) {
       new_intensity = 255;
@@ -1265,16 +1029,13 @@ void Slice3d::rescaleRawData()
     if(new_intensity < 0) {
       new_intensity = 0;
     }
-    raw_data[i] = new_intensity;
+    data[i] = new_intensity;
   }
 }
 
 supernode* Slice3d::getSupernode(sidType sid)
 {
-  if(sid < (sidType)mSupervoxels->size())
-    return (*mSupervoxels)[sid];
-  else
-    return 0;
+  return supervoxelArena.getSupernode(sid);
 }
 
 /*
@@ -1879,6 +1640,137 @@ void Slice3d::exportSupernodeLabels(const char* filename, int nClasses,
   delete[] labelCube;
 }
 
+void Slice3d::exportCompressedSupernodeLabels(const char* filename, int nClasses,
+                                              labelType* labels,
+                                              int _nLabels,
+                                              const map<labelType, ulong>* labelToClassIdx)
+{
+  eLabelExportFormat format;
+  int level;
+  getLabelExportParameters(format, level);
+
+  nClasses = max(1,nClasses-1);
+  if(_nLabels == -1) {
+    _nLabels = getNbSupernodes();
+  }
+
+  // value written for each supervoxel
+  uchar* values = new uchar[_nLabels];
+  for(int sid = 0; sid < _nLabels; sid++) {
+    labelType label = labels[sid];
+    if(label>nClasses) {
+      printf("[Slice3d] Error in exportCompressedSupernodeLabels : label=%d > nClasses=%d\n",label,nClasses+1);
+      exit(-1);
+    }
+    values[sid] = (label/(float)nClasses)*255;
+  }
+
+  if(format == LABEL_EXPORT_RLE) {
+    string rleName = string(filename) + ".rle";
+    RLECubeWriter writer(rleName.c_str(), width, height, depth);
+    for(int sid = 0; sid < _nLabels; sid++) {
+      supernode* s = getSupernode(sid);
+      if(s == 0) {
+        continue;
+      }
+      const lineContainer* lines = s->getLines();
+      for(uint l = 0; l < s->getNumberOfLines(); ++l) {
+        writer.addRun(lines[l], values[sid]);
+      }
+    }
+    if(!writer.close()) {
+      printf("[Slice3d] Error while writing %s\n", rleName.c_str());
+    }
+    delete[] values;
+    return;
+  }
+
+  // bucket the lines by slice
+  ulong* sliceStart = new ulong[depth+1];
+  memset(sliceStart, 0, (depth+1)*sizeof(ulong));
+  for(int sid = 0; sid < _nLabels; sid++) {
+    supernode* s = getSupernode(sid);
+    if(s == 0) {
+      continue;
+    }
+    const lineContainer* lines = s->getLines();
+    for(uint l = 0; l < s->getNumberOfLines(); ++l) {
+      ++sliceStart[lines[l].coord.z + 1];
+    }
+  }
+  for(int z = 0; z < depth; ++z) {
+    sliceStart[z+1] += sliceStart[z];
+  }
+
+  const lineContainer** sliceLines = new const lineContainer*[sliceStart[depth]];
+  uchar* sliceValues = new uchar[sliceStart[depth]];
+  ulong* sliceFill = new ulong[depth];
+  memcpy(sliceFill, sliceStart, depth*sizeof(ulong));
+  for(int sid = 0; sid < _nLabels; sid++) {
+    supernode* s = getSupernode(sid);
+    if(s == 0) {
+      continue;
+    }
+    const lineContainer* lines = s->getLines();
+    for(uint l = 0; l < s->getNumberOfLines(); ++l) {
+      ulong i = sliceFill[lines[l].coord.z]++;
+      sliceLines[i] = &lines[l];
+      sliceValues[i] = values[sid];
+    }
+  }
+  delete[] sliceFill;
+  delete[] values;
+
+  string zipName = string(filename) + ".zip";
+  ZipCubeWriter writer(zipName.c_str(), sliceSize, depth, level);
+
+  int firstImageToExtract = getDepth()/2;
+  const int nBatchSlices = 8;
+  uchar* batch = new uchar[nBatchSlices*(ulong)sliceSize];
+  for(int z0 = 0; z0 < depth; z0 += nBatchSlices) {
+    int nSlices = min(nBatchSlices, depth - z0);
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for(int i = 0; i < nSlices; ++i) {
+      uchar* slice = batch + i*(ulong)sliceSize;
+      memset(slice, 0, sliceSize);
+      for(ulong l = sliceStart[z0+i]; l < sliceStart[z0+i+1]; ++l) {
+        memset(slice + sliceLines[l]->coord.y*width + sliceLines[l]->coord.x,
+               sliceValues[l], sliceLines[l]->length);
+      }
+    }
+
+    if(firstImageToExtract >= z0 && firstImageToExtract < z0 + nSlices) {
+      stringstream sBaseName;
+      sBaseName << getDirectoryFromPath(filename) << "/";
+      sBaseName << getNameFromPathWithoutExtension(filename);
+      sBaseName << "_" << firstImageToExtract;
+      sBaseName << ".png";
+
+      PRINT_MESSAGE("[Slice3d] Exporting %d-th image from cube %s\n",
+                    firstImageToExtract, sBaseName.str().c_str());
+      exportImageFromCube(sBaseName.str().c_str(),
+                          batch + (firstImageToExtract - z0)*(ulong)sliceSize,
+                          getWidth(), getHeight(), 0, 1);
+    }
+
+    writer.writeSlices(batch, nSlices);
+  }
+
+  if(writer.close()) {
+    exportVIVAInfo(filename, depth, height, width, "uchar");
+  } else {
+    printf("[Slice3d] Error while writing %s\n", zipName.c_str());
+  }
+
+  delete[] batch;
+  delete[] sliceLines;
+  delete[] sliceValues;
+  delete[] sliceStart;
+}
+
 void Slice3d::resize(sizeSliceType w, sizeSliceType h, sizeSliceType d, map<sidType, sidType>* sid_mapping)
 {
   assert(w <= width);
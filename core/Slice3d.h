@@ -35,6 +35,9 @@ using namespace std;
 //#define UNITIALIZED_SIZE 0
 #define UNITIALIZED_SIZE -1
 
+// number of intensity bins used by rescaleRawData
+#define RESCALE_N_BUCKETS 256
+
 //--------------------------------------------------------------------- CLASSES
 
 
@@ -66,6 +69,9 @@ class Slice3d : public Slice_P
   // map containing a list of supernodes indexed by their supernode id
   map<sidType, supernode* >* mSupervoxels;
 
+  // storage for the supernodes and lines indexed by mSupervoxels
+  supernodeArena supervoxelArena;
+
   /**
    * No initialization. Should be used when importing data with the importData method.
    */
@@ -201,6 +207,16 @@ class Slice3d : public Slice_P
                              int nLabels,
 			     const map<labelType, ulong>* labelToClassIdx);
 
+  /**
+   * Export labels without building the label cube.
+   * Slices are generated from the supervoxel lines and streamed to
+   * filename.zip (or written as runs to filename.rle, see label_export.h).
+   */
+  void exportCompressedSupernodeLabels(const char* filename, int nClasses,
+                                       labelType* labels,
+                                       int nLabels,
+                                       const map<labelType, ulong>* labelToClassIdx);
+
   void generateSupernodeLabels(const char* fn_annotation,
                                bool includeBoundaryLabels,
                                bool useColorImages);
@@ -236,6 +252,13 @@ class Slice3d : public Slice_P
 
   uchar* getRawData() { return raw_data; }
 
+  const uchar* getVoxelData(int x, int y, int z) {
+    if(raw_data == 0) {
+      return 0;
+    }
+    return raw_data + ((ulong)z)*sliceSize + (y*width) + x;
+  }
+
 #ifdef USE_REVERSE_INDEXING
   sidType getSid(int x, int y, int z) { return klabels[z][(y*width) + x]; }
 #else
@@ -272,6 +295,11 @@ class Slice3d : public Slice_P
    */
   int raw2Double(double**& ptr_data);
 
+  /**
+   * conversion from raw (uchar, 1 channel) to a contiguous float volume
+   */
+  int raw2Float(float*& ptr_data);
+
   /**
    * Supervoxel library needs a cube made of ints so we have to convert the cube
    * Ask for enough memory for the texels and make sure we got it before proceeding
@@ -298,7 +326,7 @@ class Slice3d : public Slice_P
   inline probType getProb(int sid, int label, int scale = 0) {
     probType prob = 0;
     if(label < nLabels) {
-      supernode* s = (*mSupervoxels)[sid];
+      supernode* s = supervoxelArena.getSupernode(sid);
       if(s->data) {
         prob = s->data->prob_estimates[label+(nLabels*scale)];
       }
@@ -336,6 +364,19 @@ class Slice3d : public Slice_P
 
   void rescaleRawData();
 
+  /**
+   * Intensity range used by rescaleRawData : 1st and 99th percentiles of a
+   * histogram of RESCALE_N_BUCKETS bins computed over n voxels.
+   */
+  static void computeRescaleRange(const ulong* buckets, ulong n,
+                                  double& min_intensity, double& max_intensity);
+
+  /**
+   * Linearly map [min_intensity, max_intensity] to [0, 255].
+   */
+  static void rescaleRawData(uchar* data, ulong n,
+                             double min_intensity, double max_intensity);
+
   void setDeleteRawData(bool _val) { delete_raw_data = _val; }
 
   // no need to free memory as functions in Supernode will not reallocate memory.
@@ -19,17 +19,55 @@
 #include "utils.h"
 #include "globalsE.h"
 #include "oSVM.h"
+#include "profiler.h"
 
 #include <fstream>
 #include <deque>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+// feature matrix rows are aligned on FEATURE_MATRIX_ALIGNMENT bytes
+static void* allocateAligned(size_t size)
+{
+#ifdef _WIN32
+  return _aligned_malloc(size, FEATURE_MATRIX_ALIGNMENT);
+#else
+  void* buffer = 0;
+  if(posix_memalign(&buffer, FEATURE_MATRIX_ALIGNMENT, size) != 0) {
+    return 0;
+  }
+  return buffer;
+#endif
+}
+
+static void freeAligned(void* buffer)
+{
+#ifdef _WIN32
+  _aligned_free(buffer);
+#else
+  free(buffer);
+#endif
+}
 
 //------------------------------------------------------------------------------
 
 ulong Slice_P::generateId()
 {
   static ulong id = 0;
-  return id++;
+  ulong newId;
+  // slices may be created from several threads (predict server and pipeline)
+#pragma omp critical(slice_id)
+  newId = id++;
+  return newId;
 }
 
 //------------------------------------------------------------------------------
@@ -38,13 +76,31 @@ Slice_P::Slice_P()
 {
   max_distance = -1;
   id = Slice_P::generateId();
+  edgeOffsets = 0;
+  edges = 0;
+  nEdgeEntries = 0;
+  gradientIdxsComputed = false;
+  orientationIdxsComputed = false;
+  distanceIdxsComputed = false;
+  feature_size = 0;
+  featureMatrix = 0;
+  featureStride = 0;
+  nFeatureRows = 0;
+  featureComputed = 0;
+  featureMapping = 0;
+  featureMappingSize = 0;
+  supernodeStatsTable = 0;
 }
 
 Slice_P::~Slice_P()
 {
-  for(map<sidType, osvm_node*>::iterator it = features.begin();
-      it != features.end(); ++it) {
-    delete[] it->second;
+  releaseFeatureMatrix();
+  releaseSupernodeStats();
+  if(edgeOffsets) {
+    delete[] edgeOffsets;
+  }
+  if(edges) {
+    delete[] edges;
   }
 }
 
@@ -131,6 +187,60 @@ void Slice_P::getMinMaxGradient(int& minGradient, int& maxGradient)
   }
 }
 
+void Slice_P::buildEdgeTable()
+{
+  const map<sidType, supernode* >& _supernodes = getSupernodes();
+  ulong nSupernodes = _supernodes.size();
+
+  // count edges
+  ulong* _edgeOffsets = new ulong[nSupernodes+1];
+  _edgeOffsets[0] = 0;
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    assert(it->first >= 0 && (ulong)it->first < nSupernodes);
+    _edgeOffsets[it->first+1] = it->second->neighbors.size();
+  }
+  for(ulong sid = 0; sid < nSupernodes; ++sid) {
+    _edgeOffsets[sid+1] += _edgeOffsets[sid];
+  }
+  ulong _nEdgeEntries = _edgeOffsets[nSupernodes];
+
+  // fill edges. Neighbors are only appended to the lists so the bins of the
+  // edges already present in the old table are still valid.
+  edgeInfo* _edges = new edgeInfo[_nEdgeEntries + 1];
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    sidType sid = it->first;
+    const vector<supernode*>& lNeighbors = it->second->neighbors;
+    ulong nOldEdges = 0;
+    if(edgeOffsets) {
+      nOldEdges = edgeOffsets[sid+1] - edgeOffsets[sid];
+    }
+    edgeInfo* e = _edges + _edgeOffsets[sid];
+    for(ulong i = 0; i < lNeighbors.size(); ++i, ++e) {
+      if(i < nOldEdges) {
+        *e = edges[edgeOffsets[sid] + i];
+        assert(e->sid == lNeighbors[i]->id);
+      } else {
+        e->sid = lNeighbors[i]->id;
+        e->gradientIdx = 0;
+        e->orientationIdx = 0;
+        e->distanceIdx = 0;
+      }
+    }
+  }
+
+  if(edgeOffsets) {
+    delete[] edgeOffsets;
+  }
+  if(edges) {
+    delete[] edges;
+  }
+  edgeOffsets = _edgeOffsets;
+  edges = _edges;
+  nEdgeEntries = _nEdgeEntries;
+}
+
 void Slice_P::precomputeDistanceIndices(int _nDistances)
 {
   /*
@@ -143,20 +253,22 @@ void Slice_P::precomputeDistanceIndices(int _nDistances)
     }
   */
 
-  if(distanceIdxs.size() == 0) {
-    const map<sidType, supernode* >& _supernodes = getSupernodes();
-    for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
-        it != _supernodes.end(); it++) {
-      for(vector < supernode* >::iterator itN = it->second->neighbors.begin();
-          itN != it->second->neighbors.end(); itN++) {
-
-        if(it->first < (*itN)->id) {
-          continue;
-        }
-
-        computeDistanceIdx(it->second, *itN, _nDistances);
+  if(!distanceIdxsComputed) {
+    if(!isEdgeTableBuilt()) {
+      buildEdgeTable();
+    }
+    assert(_nDistances <= 256);
+
+    ulong nSupernodes = getNbSupernodes();
+    for(ulong sid = 0; sid < nSupernodes; ++sid) {
+      const node& cs = getSupernodeStats(sid).center;
+      edgeInfo* itE_end = edges + edgeOffsets[sid+1];
+      for(edgeInfo* itE = edges + edgeOffsets[sid]; itE != itE_end; ++itE) {
+        itE->distanceIdx = computeDistanceIdx(cs, getSupernodeStats(itE->sid).center,
+                                              _nDistances);
       }
     }
+    distanceIdxsComputed = true;
   } else {
     printf("[Slice_P]::precomputeDistanceIndices Distance indices were already precomputed\n");
   }
@@ -164,76 +276,36 @@ void Slice_P::precomputeDistanceIndices(int _nDistances)
 
 int Slice_P::computeDistanceIdx(supernode* s, supernode* sn, int _nDistances)
 {
-  ulong edgeId = getEdgeId(s->id, sn->id);
-  int distanceIdx = 0;
+  return computeDistanceIdx(getSupernodeStats(s->id).center,
+                            getSupernodeStats(sn->id).center, _nDistances);
+}
 
-  if(distanceIdxs.find(edgeId) != distanceIdxs.end()) {
-    distanceIdx = distanceIdxs[edgeId];
-  } else {
-    node cs;
-    node cn;
-    s->getCenter(cs);
-    sn->getCenter(cn);
-    double sq_distance = node_square_distance(cs, cn);
-    double dist_ratio = sq_distance / MAX_SQ_DISTANCE_LONG_RANGE_EDGES;
-    distanceIdx = (int)(dist_ratio*_nDistances+0.5);
-    if(distanceIdx >= _nDistances) {
-      distanceIdx = _nDistances-1;
-    }
-    distanceIdxs[edgeId] = distanceIdx;
-    //printf("[Slice_P]::precomputeDistanceIndices (%d,%d) %d -> (%g,%d)\n",
-    //       s->id, sn->id, _nDistances, sq_distance, distanceIdx);
+int Slice_P::computeDistanceIdx(const node& c1, const node& c2, int _nDistances)
+{
+  double sq_distance = node_square_distance(c1, c2);
+  double dist_ratio = sq_distance / MAX_SQ_DISTANCE_LONG_RANGE_EDGES;
+  int distanceIdx = (int)(dist_ratio*_nDistances+0.5);
+  if(distanceIdx >= _nDistances) {
+    distanceIdx = _nDistances-1;
   }
-
   return distanceIdx;
 }
 
 void Slice_P::precomputeGradientIndices(int _nGradientLevels)
 {
-  if(gradientIdxs.size() == 0) {
-    const map<sidType, supernode* >& _supernodes = getSupernodes();
-
-    /*
-    // update MAX_INTENSITY_GRADIENT
-    if(getNbChannels() == 3) {
-      MAX_INTENSITY_GRADIENT = 0;
-
-      for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
-          it != _supernodes.end(); it++) {
-        for(vector < supernode* >::iterator itN = it->second->neighbors.begin();
-            itN != it->second->neighbors.end(); itN++) {
-
-          if(it->first < (*itN)->id) {
-            continue;
-          }
-
-          int r1,g1,b1;
-          int r2,g2,b2;
-          getAvgIntensity(it->first,r1,g1,b1);
-          getAvgIntensity((*itN)->id,r2,g2,b2);
-
-          float gradient = abs(r1-r2) + abs(g1-g2) + abs(b1-b2);
-          if(gradient > MAX_INTENSITY_GRADIENT) {
-            MAX_INTENSITY_GRADIENT = gradient;
-          }
-        }
-      }
-      printf("[Slice_P] MAX_INTENSITY_GRADIENT = %d\n", MAX_INTENSITY_GRADIENT);
+  if(!gradientIdxsComputed) {
+    if(!isEdgeTableBuilt()) {
+      buildEdgeTable();
     }
-    */
-
-    for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
-        it != _supernodes.end(); it++) {
-      for(vector < supernode* >::iterator itN = it->second->neighbors.begin();
-          itN != it->second->neighbors.end(); itN++) {
-
-        if(it->first < (*itN)->id) {
-          continue;
-        }
 
-        computeGradientIdx(it->first, (*itN)->id, _nGradientLevels);
+    ulong nSupernodes = getNbSupernodes();
+    for(ulong sid = 0; sid < nSupernodes; ++sid) {
+      edgeInfo* itE_end = edges + edgeOffsets[sid+1];
+      for(edgeInfo* itE = edges + edgeOffsets[sid]; itE != itE_end; ++itE) {
+        itE->gradientIdx = computeGradientIdx(sid, itE->sid, _nGradientLevels);
       }
     }
+    gradientIdxsComputed = true;
   } else {
     printf("[Slice_P]::precomputeGradientIndices Gradient indices were already precomputed\n");
   }
@@ -241,65 +313,47 @@ void Slice_P::precomputeGradientIndices(int _nGradientLevels)
 
 int Slice_P::computeGradientIdx(int sid1, int sid2, int nGradientLevels)
 {
-  ulong edgeId = getEdgeId(sid1, sid2);
-  int gradientIdx = 0;
-
-  if(gradientIdxs.find(edgeId) != gradientIdxs.end()) {
-    gradientIdx = gradientIdxs[edgeId];
+  const supernodeStats& s1 = getSupernodeStats(sid1);
+  const supernodeStats& s2 = getSupernodeStats(sid2);
+  float gradient;
+  if(getNbChannels() == 3) {
+    const float* i1 = s1.mean;
+    const float* i2 = s2.mean;
+    gradient = fabs(i1[0]-i2[0]) + fabs(i1[1]-i2[1]) + fabs(i1[2]-i2[2]);
   } else {
-    if(getNbChannels() == 3) {
-      int r1,g1,b1;
-      int r2,g2,b2;
-      getAvgIntensity(sid1,r1,g1,b1);
-      getAvgIntensity(sid2,r2,g2,b2);
-
-      float gradient = abs(r1-r2) + abs(g1-g2) + abs(b1-b2);
-      //gradient /= (3*MAX_INTENSITY);
-      gradient /= MAX_INTENSITY_GRADIENT;
-      gradientIdx = (int)(gradient*nGradientLevels+0.5);
-
-      /*
-      // 3d gradient : too many parameters...
-      float dr = abs(r1-r2)/(float)MAX_INTENSITY;
-      float dg = abs(g1-g2)/(float)MAX_INTENSITY;
-      float db = abs(b1-b2)/(float)MAX_INTENSITY;
-      gradientIdx = dr*nGradientLevels*nGradientLevels + dg*nGradientLevels + db;
-      */
-
-      if(gradientIdx >= nGradientLevels) {
-        gradientIdx = nGradientLevels-1;
-      }
-    } else {
-      float gradient = abs(getAvgIntensity(sid1) - getAvgIntensity(sid2));
-      gradient /= MAX_INTENSITY_GRADIENT;
-      gradientIdx = (int)(gradient*nGradientLevels+0.5);
-      if(gradientIdx >= nGradientLevels) {
-        gradientIdx = nGradientLevels-1;
-      }
-    }
-    gradientIdxs[edgeId] = gradientIdx;
+    gradient = fabs(s1.avgIntensity - s2.avgIntensity);
   }
+  return computeGradientIdx(gradient, nGradientLevels);
+}
 
+int Slice_P::computeGradientIdx(float gradient, int nGradientLevels)
+{
+  gradient /= MAX_INTENSITY_GRADIENT;
+  int gradientIdx = (int)(gradient*nGradientLevels+0.5);
+  if(gradientIdx >= nGradientLevels) {
+    gradientIdx = nGradientLevels-1;
+  }
   return gradientIdx;
 }
 
 void Slice_P::precomputeOrientationIndices(int _nOrientations)
 {
-  if(orientationIdxs.size() == 0 && _nOrientations > 1) {
-    const map<sidType, supernode* >& _supernodes = getSupernodes();
-    for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
-        it != _supernodes.end(); it++) {
-      for(vector < supernode* >::iterator itN = it->second->neighbors.begin();
-          itN != it->second->neighbors.end(); itN++) {
-
-        // process all edges
-        //if(it->first < (*itN)->id) {
-        //  continue;
-        //}
+  if(!orientationIdxsComputed && _nOrientations > 1) {
+    if(!isEdgeTableBuilt()) {
+      buildEdgeTable();
+    }
 
-        computeOrientationIdx(it->second, *itN, _nOrientations);
+    // process all edges
+    ulong nSupernodes = getNbSupernodes();
+    for(ulong sid = 0; sid < nSupernodes; ++sid) {
+      const node& cs = getSupernodeStats(sid).center;
+      edgeInfo* itE_end = edges + edgeOffsets[sid+1];
+      for(edgeInfo* itE = edges + edgeOffsets[sid]; itE != itE_end; ++itE) {
+        itE->orientationIdx = computeOrientationIdx(sid, cs,
+                                                    itE->sid, getSupernodeStats(itE->sid).center);
       }
     }
+    orientationIdxsComputed = true;
   } else {
     printf("[Slice_P]::precomputeOrientationIndices Orientation indices were already precomputed OR no orientation specified\n");
   }
@@ -307,78 +361,150 @@ void Slice_P::precomputeOrientationIndices(int _nOrientations)
 
 int Slice_P::computeOrientationIdx(supernode* s, supernode* sn, int _nOrientations)
 {
-  ulong edgeId = getDirectedEdgeId(s->id, sn->id);
-  int orientationIdx = 0;
+  return computeOrientationIdx(s->id, getSupernodeStats(s->id).center,
+                               sn->id, getSupernodeStats(sn->id).center);
+}
 
-  if(orientationIdxs.find(edgeId) != orientationIdxs.end()) {
-    orientationIdx = orientationIdxs[edgeId];
+int Slice_P::computeOrientationIdx(sidType sid1, const node& c1,
+                                   sidType sid2, const node& c2)
+{
+  float v[3];
+  int angleXY;
+
+  // compute vector sn
+  if(sid1 < sid2) {
+    v[0] = c2.x - c1.x;
+    v[1] = c2.y - c1.y;
+    v[2] = c2.z - c1.z;
   } else {
-    node cs;
-    node cn;
-    float v[3];
-    int angleXY;
-
-    s->getCenter(cs);
-    sn->getCenter(cn);
-    // compute vector sn
-    if(s->id < sn->id) {
-      v[0] = cn.x - cs.x;
-      v[1] = cn.y - cs.y;
-      v[2] = cn.z - cs.z;
-    } else {
-      v[0] = cs.x - cn.x;
-      v[1] = cs.y - cn.y;
-      v[2] = cs.z - cn.z;
-    }
-
-    angleXY = atan2(v[1], v[0])*180.0/PI;
-    angleXY += 180.0;
-    orientationIdx = angleToIdx(angleXY);
-    orientationIdxs[edgeId] = orientationIdx;
-  }
-  return orientationIdx;
+    v[0] = c1.x - c2.x;
+    v[1] = c1.y - c2.y;
+    v[2] = c1.z - c2.z;
+  }
+
+  angleXY = atan2(v[1], v[0])*180.0/PI;
+  angleXY += 180.0;
+  return angleToIdx(angleXY);
+}
+
+void Slice_P::releaseFeatureMatrix()
+{
+  if(featureMapping) {
+#ifdef _WIN32
+    freeAligned(featureMapping);
+#else
+    munmap(featureMapping, featureMappingSize);
+#endif
+    featureMapping = 0;
+    featureMappingSize = 0;
+  } else if(featureMatrix) {
+    freeAligned(featureMatrix);
+  }
+  featureMatrix = 0;
+  if(featureComputed) {
+    delete[] featureComputed;
+    featureComputed = 0;
+  }
+}
+
+void Slice_P::allocateFeatureMatrix(int _featureSize)
+{
+  releaseFeatureMatrix();
+
+  const int floatsPerAlignment = FEATURE_MATRIX_ALIGNMENT/sizeof(float);
+  feature_size = _featureSize;
+  featureStride = ((_featureSize + floatsPerAlignment - 1)/floatsPerAlignment)*floatsPerAlignment;
+  nFeatureRows = getNbSupernodes();
+
+  size_t matrixSize = nFeatureRows*featureStride*sizeof(float);
+  void* buffer = allocateAligned(matrixSize);
+  if(buffer == 0) {
+    printf("[Slice_P] Failed to allocate %ld bytes for the feature matrix\n", (long)matrixSize);
+    exit(-1);
+  }
+  featureMatrix = (float*)buffer;
+  memset(featureMatrix, 0, matrixSize);
+
+  featureComputed = new uchar[nFeatureRows];
+  memset(featureComputed, 0, nFeatureRows*sizeof(uchar));
+
+  printf("[Slice_P] Allocated feature matrix %ldx%d (%ld MB)\n",
+         nFeatureRows, featureStride, (long)(matrixSize/(1024*1024)));
 }
 
 void Slice_P::precomputeFeatures(Feature* feature)
 {
-  if(features.size() == 0) {
+  PROFILE_SCOPE("precompute_features");
+  if(featureMatrix == 0) {
 
     int fvSize = feature->getSizeFeatureVector();
-    int max_index = fvSize + 1;
-    feature_size = fvSize;
-
-#if USE_SPARSE_VECTORS
-    int upper_index = fvSize;
-    int nScales = 1;
-    string config_tmp;
-    if(Config::Instance()->getParameter("nScales", config_tmp)) {
-      nScales = atoi(config_tmp.c_str());
-    }
-    printf("[Slice_P] Using sparse vectors with nScales=%d\n", nScales);
-    upper_index -= nScales*21;
-#endif
+    allocateFeatureMatrix(fvSize);
 
     const map<sidType, supernode* >& _supernodes = getSupernodes();
-    printf("[Slice_P] precomputing features for %ld nodes\n", _supernodes.size());
+    vector<sidType> sids;
+    sids.reserve(_supernodes.size());
     for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
         it != _supernodes.end(); it++) {
-      //printf("-");
-      osvm_node* n = new osvm_node[max_index];
-      int i = 0;
-      for(i = 0;i < max_index-1; i++)
-        n[i].index = i+1;
-      n[i].index = -1;
-
-      feature->getFeatureVector(n, this, it->first);
-
-#if USE_SPARSE_VECTORS
-      osvm_node* n_sparse = 0;
-      feature_sizes[it->first] = oSVM::create_sparse_vector(n, n_sparse, upper_index);
-      delete[] n;
-      features[it->first] = n_sparse;
-#else
-      features[it->first] = n;
+      sids.push_back(it->first);
+    }
+    long nSids = sids.size();
+
+    bool parallel = feature->isThreadSafe();
+    printf("[Slice_P] precomputing features for %ld nodes (thread-safe=%d)\n",
+           nSids, (int)parallel);
+    PROFILE_COUNT("feature_supernodes", nSids);
+
+    // With neighbors included, the first block of each row holds the features
+    // of the supernode itself and the other blocks are averages of the first
+    // block of the neighbors at increasing distances. The first blocks are
+    // therefore all filled before any neighborhood is aggregated so that each
+    // thread only writes to its own row and only reads first blocks.
+    bool includeNeighbors = feature->getIncludeNeighbors();
+    int sizeFV = includeNeighbors?feature->getSizeFeatureVectorForOneSupernode():fvSize;
+
+#ifdef WITH_OPENMP
+    #pragma omp parallel if(parallel)
+#endif
+    {
+      // features are extracted into a temporary node vector and then copied
+      // to the corresponding row of the feature matrix.
+      osvm_node* n = 0;
+      oSVM::initSVMNode(n, fvSize);
+
+#ifdef WITH_OPENMP
+      #pragma omp for schedule(dynamic, 64)
+#endif
+      for(long i = 0; i < nSids; ++i) {
+        sidType sid = sids[i];
+        if(includeNeighbors) {
+          feature->getFeatureVectorForOneSupernode(n, this, sid);
+        } else {
+          feature->getFeatureVector(n, this, sid);
+        }
+
+        float* x = getMutableFeature(sid);
+        for(int f = 0; f < sizeFV; f++) {
+          x[f] = n[f].value;
+        }
+        featureComputed[sid] = 1;
+      }
+
+      if(includeNeighbors) {
+#ifdef WITH_OPENMP
+        #pragma omp for schedule(dynamic, 64)
 #endif
+        for(long i = 0; i < nSids; ++i) {
+          sidType sid = sids[i];
+          feature->getFeatureVector(n, this, sid);
+
+          float* x = getMutableFeature(sid);
+          for(int f = sizeFV; f < fvSize; f++) {
+            x[f] = n[f].value;
+          }
+        }
+      }
+
+      delete[] n;
     }
   } else {
     printf("[Slice_P]::precomputeFeatures : Features were already precomputed\n");
@@ -388,19 +514,14 @@ void Slice_P::precomputeFeatures(Feature* feature)
 
 void Slice_P::rescalePrecomputedFeatures(const char* scale_filename)
 {
-  if(features.size() == 0) {
+  if(featureMatrix == 0) {
     printf("[Slice_P]::rescalePrecomputedFeatures: Features were not precomputed\n");
     return;
   }
 
   // get feature dimension
   const map<sidType, supernode* >& _supernodes = getSupernodes();
-  osvm_node* x1 = features[_supernodes.begin()->first];
-  int fvSize = 0;
-  for(int i = 0;x1[i].index != -1; i++) {
-    ++fvSize;
-  }
-  int max_index = fvSize + 1;
+  int fvSize = feature_size;
 
   printf("[Slice_P] Rescaling features of dimension %d\n", fvSize);
 
@@ -459,17 +580,17 @@ void Slice_P::rescalePrecomputedFeatures(const char* scale_filename)
     for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
         it != _supernodes.end(); it++) {
 
-      osvm_node* x = features[it->first];
+      const float* x = getFeature(it->first);
 
       // use running average to avoid overflow
-      for(int i = 0;x[i].index != -1; i++) {
-        //mean[i].value = ((n-1.0)/n*mean[i].value) + (x[i].value/n);
-        mean[i].value += x[i].value;
+      for(int i = 0; i < fvSize; i++) {
+        //mean[i].value = ((n-1.0)/n*mean[i].value) + (x[i]/n);
+        mean[i].value += x[i];
       }
 
-      for(int i = 0;x[i].index != -1; i++) {
-        //E_x2[i].value = ((n-1.0)/n*E_x2[i].value) + ((x[i].value*x[i].value)/n);
-        E_x2[i].value += x[i].value*x[i].value;
+      for(int i = 0; i < fvSize; i++) {
+        //E_x2[i].value = ((n-1.0)/n*E_x2[i].value) + ((x[i]*x[i])/n);
+        E_x2[i].value += x[i]*x[i];
       }
 
       //++n;
@@ -525,25 +646,25 @@ void Slice_P::rescalePrecomputedFeatures(const char* scale_filename)
   for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
       it != _supernodes.end(); it++) {
 
-    osvm_node* x = features[it->first];
+    float* x = getMutableFeature(it->first);
 
     if(it->first == sid_to_print) {
       printf("x_100 (before rescaling):");
-      for(int i = 0; x[i].index != -1; i++) {
-        printf("%g ", x[i].value);
+      for(int i = 0; i < fvSize; i++) {
+        printf("%g ", x[i]);
       }
       printf("\n");
     }
 
-    for(int i = 0;x[i].index != -1; i++) {
-      x[i].value -= mean[i].value;
-      x[i].value /= sqrt(variance[i].value);
+    for(int i = 0; i < fvSize; i++) {
+      x[i] -= mean[i].value;
+      x[i] /= sqrt(variance[i].value);
     }
 
     if(it->first == sid_to_print) {
       printf("x_100 (after rescaling):");
-      for(int i = 0; x[i].index != -1; i++) {
-        printf("%g ", x[i].value);
+      for(int i = 0; i < fvSize; i++) {
+        printf("%g ", x[i]);
       }
       printf("\n");
     }
@@ -554,6 +675,71 @@ void Slice_P::rescalePrecomputedFeatures(const char* scale_filename)
   delete[] variance;
 }
 
+void Slice_P::rescalePrecomputedFeatures(const vector<double>& mean,
+                                         const vector<double>& variance)
+{
+  if(featureMatrix == 0) {
+    printf("[Slice_P]::rescalePrecomputedFeatures: Features were not precomputed\n");
+    return;
+  }
+
+  int fvSize = feature_size;
+  if((int)mean.size() < fvSize || (int)variance.size() < fvSize) {
+    printf("[Slice_P] Error : scale of dimension %ld does not match features of dimension %d\n",
+           mean.size(), fvSize);
+    exit(-1);
+  }
+
+  // prevent division by 0
+  vector<double> stddev(fvSize);
+  for(int i = 0; i < fvSize; i++) {
+    stddev[i] = (variance[i] == 0)?1.0:sqrt(variance[i]);
+  }
+
+  const map<sidType, supernode* >& _supernodes = getSupernodes();
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    float* x = getMutableFeature(it->first);
+    for(int i = 0; i < fvSize; i++) {
+      x[i] -= mean[i];
+      x[i] /= stddev[i];
+    }
+  }
+}
+
+bool Slice_P::loadFeatureScale(const char* scale_filename,
+                               vector<double>& mean,
+                               vector<double>& variance)
+{
+  ifstream ifs(scale_filename);
+  if(ifs.fail()) {
+    return false;
+  }
+
+  string line;
+  vector<string> tokens;
+
+  // mean
+  getline(ifs, line);
+  splitString(line, tokens);
+  mean.resize(tokens.size());
+  for(uint i = 0; i < tokens.size(); ++i) {
+    mean[i] = atof(tokens[i].c_str());
+  }
+
+  // variance
+  getline(ifs, line);
+  tokens.clear();
+  splitString(line, tokens);
+  variance.resize(tokens.size());
+  for(uint i = 0; i < tokens.size(); ++i) {
+    variance[i] = atof(tokens[i].c_str());
+  }
+
+  ifs.close();
+  return !mean.empty() && mean.size() == variance.size();
+}
+
 bool Slice_P::loadFeatures(const char* filename, int* featureSize)
 {
   ifstream ifsF(filename);
@@ -583,29 +769,15 @@ bool Slice_P::loadFeatures(const char* filename, int* featureSize)
   ifsF.clear();
   ifsF.seekg(0, ios::beg);
 
-#if USE_SPARSE_VECTORS
-  int upper_index = *featureSize;
-  int nScales = 1;
-  string config_tmp;
-  if(Config::Instance()->getParameter("nScales", config_tmp)) {
-    nScales = atoi(config_tmp.c_str());
-  }
-  printf("[Slice_P] nScales=%d\n", nScales);
-  upper_index -= nScales*21;
-#endif
+  allocateFeatureMatrix(*featureSize);
 
   const int label_offset = 1;
-  int max_index = *featureSize + 1;
   ulong nodeId = 0;
   while(getline(ifsF, line)) {
     tokens.clear();
     splitString(line, tokens);
 
-    osvm_node* n = new osvm_node[max_index];
-    int i = 0;
-    for(i = 0;i < max_index-1; i++)
-      n[i].index = i+1;
-    n[i].index = -1;
+    float* n = getMutableFeature(nodeId);
 
     for(uint i = 0; i < tokens.size()-1; ++i) {
       string field = tokens[i+label_offset];
@@ -622,17 +794,9 @@ bool Slice_P::loadFeatures(const char* filename, int* featureSize)
       } else {
         value = atof(field.c_str());
       }
-      n[field_index - FEATURE_FIRST_INDEX].value = value;
+      n[field_index - FEATURE_FIRST_INDEX] = value;
     }
-
-#if USE_SPARSE_VECTORS
-    osvm_node* n_sparse = 0;
-    feature_sizes[nodeId] = oSVM::create_sparse_vector(n, n_sparse, upper_index);
-    delete[] n;
-    features[nodeId] = n_sparse;
-#else
-    features[nodeId] = n;
-#endif
+    featureComputed[nodeId] = 1;
 
     ++nodeId;
 
@@ -644,25 +808,313 @@ bool Slice_P::loadFeatures(const char* filename, int* featureSize)
   return true;
 }
 
+ulong Slice_P::computeSupernodeChecksum()
+{
+  // FNV-1a
+  const ulong fnv_prime = 1099511628211UL;
+  ulong checksum = 14695981039346656037UL;
+  node n;
+  const map<sidType, supernode* >& _supernodes = getSupernodes();
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    checksum = (checksum ^ (ulong)it->first) * fnv_prime;
+    nodeIterator ni = it->second->getIterator();
+    ni.goToBegin();
+    while(!ni.isAtEnd()) {
+      ni.get(n);
+      checksum = (checksum ^ (ulong)n.x) * fnv_prime;
+      checksum = (checksum ^ (ulong)n.y) * fnv_prime;
+      checksum = (checksum ^ (ulong)n.z) * fnv_prime;
+      ni.next();
+    }
+  }
+  return checksum;
+}
+
+bool Slice_P::saveFeatureCache(const char* filename, int featureTypes)
+{
+  if(featureMatrix == 0) {
+    printf("[Slice_P] saveFeatureCache : features were not precomputed\n");
+    return false;
+  }
+
+  string cache_filename = string(filename) + FEATURE_CACHE_EXTENSION;
+  FILE* fp = fopen(cache_filename.c_str(), "wb");
+  if(fp == 0) {
+    printf("[Slice_P] Failed to open %s\n", cache_filename.c_str());
+    return false;
+  }
+
+  featureCacheHeader header;
+  memset(&header, 0, sizeof(featureCacheHeader));
+  header.magic = FEATURE_CACHE_MAGIC;
+  header.version = FEATURE_CACHE_VERSION;
+  header.nSupernodes = nFeatureRows;
+  header.featureSize = feature_size;
+  header.featureStride = featureStride;
+  header.featureTypes = featureTypes;
+  header.supernodeStep = supernode_step;
+  header.cubeness = cubeness;
+  header.supernodeChecksum = computeSupernodeChecksum();
+  header.dataOffset = ((sizeof(featureCacheHeader) + FEATURE_MATRIX_ALIGNMENT - 1)/FEATURE_MATRIX_ALIGNMENT)*FEATURE_MATRIX_ALIGNMENT;
+
+  char padding[FEATURE_MATRIX_ALIGNMENT];
+  memset(padding, 0, FEATURE_MATRIX_ALIGNMENT);
+  size_t matrixSize = nFeatureRows*featureStride*sizeof(float);
+  bool written = fwrite(&header, sizeof(featureCacheHeader), 1, fp) == 1 &&
+    fwrite(padding, 1, header.dataOffset - sizeof(featureCacheHeader), fp) == header.dataOffset - sizeof(featureCacheHeader) &&
+    fwrite(featureMatrix, 1, matrixSize, fp) == matrixSize;
+  fclose(fp);
+
+  if(!written) {
+    printf("[Slice_P] Failed to write feature cache %s\n", cache_filename.c_str());
+    remove(cache_filename.c_str());
+    return false;
+  }
+
+  printf("[Slice_P] Saved %ldx%d features to %s\n", nFeatureRows, feature_size,
+         cache_filename.c_str());
+  return true;
+}
+
+bool Slice_P::mapFeatures(const char* filename, int featureTypes, int* featureSize)
+{
+  FILE* fp = fopen(filename, "rb");
+  if(fp == 0) {
+    printf("[Slice_P] Failed to open feature cache %s\n", filename);
+    return false;
+  }
+
+  struct stat st;
+  featureCacheHeader header;
+  if(stat(filename, &st) != 0 ||
+     fread(&header, sizeof(featureCacheHeader), 1, fp) != 1) {
+    printf("[Slice_P] Failed to read header of feature cache %s\n", filename);
+    fclose(fp);
+    return false;
+  }
+
+  const char* error = 0;
+  if(header.magic != FEATURE_CACHE_MAGIC) {
+    error = "invalid magic number";
+  } else if(header.version != FEATURE_CACHE_VERSION) {
+    error = "unsupported version";
+  } else if(header.nSupernodes != getNbSupernodes()) {
+    error = "different number of supernodes";
+  } else if(header.featureTypes != featureTypes) {
+    error = "different feature types";
+  } else if(header.supernodeStep != supernode_step || header.cubeness != cubeness) {
+    error = "different supernode step or cubeness";
+  } else if(header.dataOffset % FEATURE_MATRIX_ALIGNMENT != 0 ||
+            header.featureStride*sizeof(float) % FEATURE_MATRIX_ALIGNMENT != 0 ||
+            header.featureSize > header.featureStride) {
+    error = "invalid layout";
+  } else if((ulong)st.st_size != header.dataOffset + header.nSupernodes*header.featureStride*sizeof(float)) {
+    error = "truncated file";
+  } else if(header.supernodeChecksum != computeSupernodeChecksum()) {
+    error = "supernodes have changed";
+  }
+  if(error) {
+    printf("[Slice_P] Ignoring feature cache %s : %s\n", filename, error);
+    fclose(fp);
+    return false;
+  }
+
+#ifdef _WIN32
+  // no mmap : read the whole file into an aligned buffer so that the
+  // matrix layout (and dataOffset) is the same as in the mapped case.
+  void* mapping = allocateAligned(st.st_size);
+  bool loaded = (mapping != 0 && fseek(fp, 0, SEEK_SET) == 0 &&
+                 fread(mapping, 1, st.st_size, fp) == (size_t)st.st_size);
+  fclose(fp);
+  if(!loaded) {
+    if(mapping) {
+      freeAligned(mapping);
+    }
+    printf("[Slice_P] Failed to read feature cache %s\n", filename);
+    return false;
+  }
+#else
+  // private mapping : pages are only copied if the features are modified
+  // (e.g. rescaled), the file itself is never written.
+  void* mapping = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+  fclose(fp);
+  if(mapping == MAP_FAILED) {
+    printf("[Slice_P] Failed to map feature cache %s\n", filename);
+    return false;
+  }
+#endif
+
+  releaseFeatureMatrix();
+  featureMapping = mapping;
+  featureMappingSize = st.st_size;
+  featureMatrix = (float*)((char*)mapping + header.dataOffset);
+  feature_size = header.featureSize;
+  featureStride = header.featureStride;
+  nFeatureRows = header.nSupernodes;
+  featureComputed = new uchar[nFeatureRows];
+  memset(featureComputed, 1, nFeatureRows*sizeof(uchar));
+  *featureSize = feature_size;
+
+  printf("[Slice_P] Mapped %ldx%d features from %s\n", nFeatureRows, feature_size, filename);
+  return true;
+}
+
+bool Slice_P::loadFeatureCache(const char* filename, int featureTypes, int* featureSize)
+{
+  string cache_filename = string(filename) + FEATURE_CACHE_EXTENSION;
+  if(fileExists(cache_filename) &&
+     mapFeatures(cache_filename.c_str(), featureTypes, featureSize)) {
+    return true;
+  }
+
+  // legacy text format
+  if(fileExists(filename) && loadFeatures(filename, featureSize)) {
+    saveFeatureCache(filename, featureTypes);
+    return true;
+  }
+  return false;
+}
+
+void Slice_P::exportCompressedSupernodeLabels(const char* filename, int nClasses,
+                                              labelType* labels,
+                                              int nLabels,
+                                              const map<labelType, ulong>* labelToClassIdx)
+{
+  exportSupernodeLabels(filename, nClasses, labels, nLabels, labelToClassIdx);
+}
+
 vector<node>* Slice_P::getCenters()
 {
   vector < node >* lCenters = new vector < node >;
   const map<sidType, supernode* >& _supernodes = getSupernodes();
   lCenters->reserve(_supernodes.size());
-  node center;
   for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
       it != _supernodes.end(); it++) {
-    it->second->getCenter(center);
-    lCenters->push_back(center);
+    lCenters->push_back(getSupernodeStats(it->first).center);
   }
   return lCenters;
 }
 
+void Slice_P::computeSupernodeStats()
+{
+  PROFILE_SCOPE("supernode_stats");
+  releaseSupernodeStats();
+
+  const map<sidType, supernode* >& _supernodes = getSupernodes();
+  ulong nSupernodes = _supernodes.size();
+  vector<supernode*> lSupernodes(nSupernodes, (supernode*)0);
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    assert(it->first >= 0 && (ulong)it->first < nSupernodes);
+    lSupernodes[it->first] = it->second;
+  }
+
+  int nChannels = min(getNbChannels(), SUPERNODE_STATS_MAX_CHANNELS);
+  int channelStep = getNbChannels();
+  printf("[Slice_P] Computing statistics for %ld supernodes\n", nSupernodes);
+
+  supernodeStats* _stats = new supernodeStats[nSupernodes];
+
+  // supernodes partition the volume so iterating over their lines visits
+  // each voxel exactly once and each thread writes to its own entries.
+#ifdef WITH_OPENMP
+  #pragma omp parallel for schedule(dynamic, 64)
+#endif
+  for(long sid = 0; sid < (long)nSupernodes; ++sid) {
+    supernodeStats& st = _stats[sid];
+    double sum[SUPERNODE_STATS_MAX_CHANNELS];
+    double sumSq[SUPERNODE_STATS_MAX_CHANNELS];
+    double sumAll = 0;
+    for(int c = 0; c < SUPERNODE_STATS_MAX_CHANNELS; ++c) {
+      sum[c] = 0;
+      sumSq[c] = 0;
+      st.mean[c] = 0;
+      st.variance[c] = 0;
+    }
+    st.avgIntensity = 0;
+    st.size = 0;
+
+    supernode* s = lSupernodes[sid];
+    if(s == 0 || s->getNumberOfLines() == 0) {
+      continue;
+    }
+
+    ulong cx = 0;
+    ulong cy = 0;
+    ulong cz = 0;
+    const lineContainer* lines = s->getLines();
+    st.bboxMin = lines[0].coord;
+    st.bboxMax = lines[0].coord;
+    for(uint l = 0; l < s->getNumberOfLines(); ++l) {
+      const lineContainer& line = lines[l];
+      const node& c = line.coord;
+      int xEnd = c.x + (int)line.length - 1;
+
+      // sum of x over the line is length*(first+last)/2
+      cx += ((ulong)line.length*(c.x + xEnd))/2;
+      cy += (ulong)line.length*c.y;
+      cz += (ulong)line.length*c.z;
+      st.size += line.length;
+
+      if(c.x < st.bboxMin.x) st.bboxMin.x = c.x;
+      if(c.y < st.bboxMin.y) st.bboxMin.y = c.y;
+      if(c.z < st.bboxMin.z) st.bboxMin.z = c.z;
+      if(xEnd > st.bboxMax.x) st.bboxMax.x = xEnd;
+      if(c.y > st.bboxMax.y) st.bboxMax.y = c.y;
+      if(c.z > st.bboxMax.z) st.bboxMax.z = c.z;
+
+      const uchar* data = getVoxelData(c.x, c.y, c.z);
+      if(data) {
+        for(uint i = 0; i < line.length; ++i, data += channelStep) {
+          for(int ch = 0; ch < nChannels; ++ch) {
+            sum[ch] += data[ch];
+            sumSq[ch] += data[ch]*data[ch];
+          }
+          for(int ch = 0; ch < channelStep; ++ch) {
+            sumAll += data[ch];
+          }
+        }
+      }
+    }
+
+    st.center.x = cx/st.size;
+    st.center.y = cy/st.size;
+    st.center.z = cz/st.size;
+    for(int ch = 0; ch < nChannels; ++ch) {
+      double m = sum[ch]/st.size;
+      st.mean[ch] = m;
+      st.variance[ch] = max(0.0, sumSq[ch]/st.size - m*m);
+    }
+    st.avgIntensity = sumAll/(st.size*channelStep);
+  }
+
+  supernodeStatsTable = _stats;
+}
+
+void Slice_P::releaseSupernodeStats()
+{
+  if(supernodeStatsTable) {
+    delete[] supernodeStatsTable;
+    supernodeStatsTable = 0;
+  }
+}
+
 // this function is more generic and can add neighbors at any given distance
 void Slice_P::addLongRangeEdges_supernodeBased(int nDistances)
 {
   const map<sidType, supernode* >& _supernodes = getSupernodes();
   ulong nSupernodes = _supernodes.size();
+  assert(nDistances <= 256);
+
+  // immediate neighbors are stored first in the list of neighbors. Distances
+  // of the long range edges appended after them are stored in longRangeDistances.
+  vector<ulong> nImmediateNeighbors(nSupernodes);
+  vector< vector<uchar> > longRangeDistances(nSupernodes);
+  for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
+      it != _supernodes.end(); it++) {
+    nImmediateNeighbors[it->first] = it->second->neighbors.size();
+  }
 
   //#ifdef WITH_OPENMP
   //#pragma omp parallel for
@@ -681,10 +1133,6 @@ void Slice_P::addLongRangeEdges_supernodeBased(int nDistances)
 
     for(vector<supernode*>::iterator itN = s->neighbors.begin();
         itN != s->neighbors.end(); ++itN) {
-        // store distance to avoid online computation
-      ulong edgeId = getEdgeId(s->id, (*itN)->id);
-      //assert(distanceIdxs.find(edgeId) == distanceIdxs.end());
-      distanceIdxs[edgeId] = 0;      
       distances[(*itN)->id] = 0;
     }
 
@@ -708,33 +1156,16 @@ void Slice_P::addLongRangeEdges_supernodeBased(int nDistances)
           s->neighbors.push_back(sq);
 
           // store distance to avoid online computation
-          ulong edgeId = getEdgeId(s->id, sq->id);
-          //assert(distanceIdxs.find(edgeId) == distanceIdxs.end());
-          distanceIdxs[edgeId] = dist;
-        }
-        /*
-        else {
-          if(distanceIdxs.find(edgeId) == distanceIdxs.end()) {
-            printf("[Slice_P] Error %d %d %ld %d\n", s->id, sq->id, edgeId, dist);
-            exit(-1);
-          }
+          longRangeDistances[s->id].push_back(dist);
         }
-        */
       }
 
       // add neighbors to the queue
       if(dist < (nDistances-1)) { //-1 as distance indices start at 0
-        // iterate over neighbors of sq and add them to the queue if there are not already in it
-        for(vector<supernode*>::iterator itNq = sq->neighbors.begin();
-            itNq != sq->neighbors.end(); ++itNq) {
-
-          // check that distance is 0 (i.e. immediate neighbor)
-          ulong edgeId = getEdgeId(sq->id, (*itNq)->id);
-          if(distanceIdxs.count(edgeId) > 0 && distanceIdxs[edgeId] != 0) {
-            continue;
-          }
-
-          supernode* snq = *itNq;
+        // iterate over immediate neighbors of sq and add them to the queue if
+        // there are not already in it
+        for(ulong i = 0; i < nImmediateNeighbors[sq->id]; ++i) {
+          supernode* snq = sq->neighbors[i];
           deque<supernode*>::iterator lookup = find(pending_list.begin(), pending_list.end(), snq);
           if(lookup == pending_list.end()) {
             set<sidType>::iterator lookup_visited = visited.find(snq->id);
@@ -752,13 +1183,17 @@ void Slice_P::addLongRangeEdges_supernodeBased(int nDistances)
   for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
       it != _supernodes.end(); it++) {
     supernode* s = it->second;
-    for(vector<supernode*>::iterator itN = s->neighbors.begin();
-        itN != s->neighbors.end(); ++itN) {
-      supernode* sn = *itN;
+    for(ulong i = 0; i < s->neighbors.size(); ++i) {
+      supernode* sn = s->neighbors[i];
       // check if retrieved supernode is already in the list of neighbors
       vector<supernode*>::iterator lookup = find(sn->neighbors.begin(), sn->neighbors.end(), s); // slow
       if(lookup == sn->neighbors.end()) {
         sn->neighbors.push_back(s);
+        uchar dist = 0;
+        if(i >= nImmediateNeighbors[s->id]) {
+          dist = longRangeDistances[s->id][i - nImmediateNeighbors[s->id]];
+        }
+        longRangeDistances[sn->id].push_back(dist);
       }
     }
   }
@@ -769,6 +1204,21 @@ void Slice_P::addLongRangeEdges_supernodeBased(int nDistances)
       it != _supernodes.end(); it++) {
     nbEdges += it->second->neighbors.size();
   }
+
+  // store distances in the edge table
+  buildEdgeTable();
+  for(ulong sid = 0; sid < nSupernodes; ++sid) {
+    edgeInfo* e = edges + edgeOffsets[sid];
+    ulong nEdges = edgeOffsets[sid+1] - edgeOffsets[sid];
+    for(ulong i = 0; i < nEdges; ++i, ++e) {
+      if(i < nImmediateNeighbors[sid]) {
+        e->distanceIdx = 0;
+      } else {
+        e->distanceIdx = longRangeDistances[sid][i - nImmediateNeighbors[sid]];
+      }
+    }
+  }
+  distanceIdxsComputed = true;
 }
 
 #if 0
@@ -871,6 +1321,8 @@ void Slice_P::addLongRangeEdges()
       it != _supernodes.end(); it++) {
     nbEdges += it->second->neighbors.size();
   }
+
+  buildEdgeTable();
 }
 
 void Slice_P::printEdgeStats()
@@ -895,25 +1347,16 @@ void Slice_P::printEdgeStats()
 
 void Slice_P::printDistanceIndicesCount(int nDistances)
 {
-  const map<sidType, supernode* >& _supernodes = getSupernodes();
-  ulong nSupernodes = _supernodes.size();
+  ulong nSupernodes = getNbSupernodes();
   map<int, ulong> counts;
   for(int i = 0; i < nDistances; ++i) {
     counts[i] = 0;
   }
 
   for(ulong sid = 0; sid < nSupernodes; ++sid) {
-    map<sidType, supernode* >::const_iterator it = _supernodes.find(sid);
-    supernode* s = it->second;
-
-    supernode* sn = 0;
-    for(vector < supernode* >::iterator it2 = s->neighbors.begin();
-        it2 != s->neighbors.end(); it2++) { 
-      sn = *it2;
-
-      // TODO : edge Id or < ?
-      int idx = getDistanceIdx(s->id, sn->id);
-      ++counts[idx];
+    const edgeInfo* itE_end = getEdgesEnd(sid);
+    for(const edgeInfo* itE = getEdgesBegin(sid); itE != itE_end; ++itE) {
+      ++counts[itE->distanceIdx];
     }
   }
 
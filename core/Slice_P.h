@@ -43,6 +43,61 @@ class Feature;
 
 //------------------------------------------------------------------------------
 
+/**
+ * Directed edge stored in the compressed sparse row (CSR) adjacency of Slice_P.
+ * The gradient, orientation and distance bins are precomputed once so that
+ * inference does not need any lookup to evaluate pairwise potentials.
+ */
+struct edgeInfo
+{
+  sidType sid; // id of the neighboring supernode
+  short gradientIdx; // -1 if no gradient levels are used
+  uchar orientationIdx;
+  uchar distanceIdx;
+};
+
+//------------------------------------------------------------------------------
+
+#define SUPERNODE_STATS_MAX_CHANNELS 4
+
+/**
+ * Statistics of the voxels of a supernode, computed for all the supernodes in
+ * a single pass by Slice_P::computeSupernodeStats.
+ */
+struct supernodeStats
+{
+  ulong size; // number of voxels
+  node center; // rounded down, as returned by supernode::getCenter
+  node bboxMin;
+  node bboxMax; // inclusive
+  float mean[SUPERNODE_STATS_MAX_CHANNELS];
+  float variance[SUPERNODE_STATS_MAX_CHANNELS];
+  float avgIntensity; // mean over all the channels
+};
+
+//------------------------------------------------------------------------------
+
+/**
+ * Header of the binary feature cache. The feature matrix (nSupernodes rows of
+ * featureStride floats) starts at dataOffset, a multiple of
+ * FEATURE_MATRIX_ALIGNMENT, so that the file can be mapped and used directly.
+ */
+struct featureCacheHeader
+{
+  uint magic;
+  uint version;
+  ulong nSupernodes;
+  int featureSize;
+  int featureStride;
+  int featureTypes; // mask of feature types (see getFeatureTypes)
+  int supernodeStep;
+  int cubeness;
+  ulong supernodeChecksum; // see computeSupernodeChecksum
+  ulong dataOffset;
+};
+
+//------------------------------------------------------------------------------
+
 class Slice_P
 {
  public:
@@ -57,6 +112,13 @@ class Slice_P
 
   void addLongRangeEdges_supernodeBased(int nDistances);
 
+  /**
+   * Build the CSR adjacency from supernode::neighbors.
+   * Has to be called again every time the neighbors are modified. Bins of the
+   * edges that were already present are preserved.
+   */
+  void buildEdgeTable();
+
   int angleToIdx(int angle) {
     int idx = 0;
     if(angle > 45 && angle < 135) {
@@ -96,6 +158,15 @@ class Slice_P
 				     int nLabels,
 				     const map<labelType, ulong>* labelToClassIdx) = 0;
 
+  /**
+   * Export labels to a compressed file.
+   * Default implementation calls exportSupernodeLabels.
+   */
+  virtual void exportCompressedSupernodeLabels(const char* filename, int nClasses,
+                                               labelType* labels,
+                                               int nLabels,
+                                               const map<labelType, ulong>* labelToClassIdx);
+
   static ulong generateId();
 
   /**
@@ -105,6 +176,35 @@ class Slice_P
    */
   vector<node>* getCenters();
 
+  /**
+   * Compute the statistics of all the supernodes with one sweep over the
+   * voxels. Called on first use by getSupernodeStats.
+   */
+  void computeSupernodeStats();
+
+  /**
+   * Compute the statistics if they were not computed yet. getSupernodeStats
+   * is not thread-safe on first use, so this has to be called before the
+   * slice is shared between threads.
+   */
+  void precomputeSupernodeStats() {
+    if(supernodeStatsTable == 0) {
+      computeSupernodeStats();
+    }
+  }
+
+  inline const supernodeStats& getSupernodeStats(sidType sid) {
+    if(supernodeStatsTable == 0) {
+      computeSupernodeStats();
+    }
+    return supernodeStatsTable[sid];
+  }
+
+  /**
+   * Release the statistics, e.g. after the supernodes were modified.
+   */
+  void releaseSupernodeStats();
+
   /**
    * Return a pointer to the raw image data (pixels or voxels).
    */
@@ -177,36 +277,74 @@ class Slice_P
   }
 
   inline int getDistanceIdx(int sid1, int sid2) {
-    ulong edgeId = getEdgeId(sid1, sid2);
-    return distanceIdxs[edgeId];
+    const edgeInfo* e = findEdge(sid1, sid2);
+    return e?e->distanceIdx:0;
+  }
+
+  /**
+   * Edges of supernode sid are stored contiguously between getEdgesBegin(sid)
+   * and getEdgesEnd(sid), in the same order as supernode::neighbors.
+   * Assume the table was built with buildEdgeTable (called by the
+   * precompute*Indices functions).
+   */
+  inline const edgeInfo* getEdgesBegin(sidType sid) {
+    return edges + edgeOffsets[sid];
   }
 
-  inline osvm_node* getFeature(sidType sid) {
-    return features[sid];
+  inline const edgeInfo* getEdgesEnd(sidType sid) {
+    return edges + edgeOffsets[sid+1];
+  }
+
+  inline bool isEdgeTableBuilt() { return edgeOffsets != 0; }
+
+  /**
+   * Returns the directed edge sid1->sid2 or 0 if the two supernodes are not
+   * neighbors. Linear in the degree of sid1 : use getEdgesBegin/getEdgesEnd in
+   * inner loops.
+   */
+  inline const edgeInfo* findEdge(sidType sid1, sidType sid2) {
+    const edgeInfo* itE_end = getEdgesEnd(sid1);
+    for(const edgeInfo* itE = getEdgesBegin(sid1); itE != itE_end; ++itE) {
+      if(itE->sid == sid2) {
+        return itE;
+      }
+    }
+    return 0;
+  }
+
+  /**
+   * Returns the precomputed feature vector of a supernode : a row of
+   * getFeatureSize() floats in the feature matrix.
+   * Assume features were precomputed with precomputeFeatures or loadFeatures.
+   */
+  inline const float* getFeature(sidType sid) {
+    return featureMatrix + (ulong)sid*featureStride;
+  }
+
+  inline float* getMutableFeature(sidType sid) {
+    return featureMatrix + (ulong)sid*featureStride;
   }
 
   inline int getFeatureSize() { return feature_size; }
 
-#if USE_SPARSE_VECTORS
-  inline int getFeatureSize(int id) { return feature_sizes[id]; }
-#endif
+  /**
+   * Distance in floats between two consecutive rows of the feature matrix.
+   * Rows are padded with zeros so that each of them is 64-byte aligned.
+   */
+  inline int getFeatureStride() { return featureStride; }
 
   /**
    * This function assumes that the gradient was already computed with
    * precomputeGradientIndices
    */
   inline int getGradientIdx(int sid1, int sid2) {
-    ulong edgeId = getEdgeId(sid1, sid2);
-    return gradientIdxs[edgeId];
+    const edgeInfo* e = findEdge(sid1, sid2);
+    return e?e->gradientIdx:0;
   }
 
   inline int getOrientationIdx(int sid1, int sid2) {
-    if(orientationIdxs.size() == 0) {
-      return 0;
-    } else {
-      ulong edgeId = getDirectedEdgeId(sid1, sid2);
-      return orientationIdxs[edgeId];
-    }
+    const edgeInfo* e = findEdge(sid1, sid2);
+    return e?e->orientationIdx:0;
   }
 
   virtual sizeSliceType getWidth() = 0;
@@ -241,22 +379,66 @@ class Slice_P
                                                  bool includeBoundaryLabels,
                                                  bool useColorImages);
 
-  map<sidType, osvm_node*>* getPrecomputedFeatures() { return &features; }
-
   inline bool isFeatureComputed(sidType sid) {
-    return (features.find(sid) != features.end());
+    return featureMatrix && featureComputed[sid];
   }
 
+  inline bool areFeaturesPrecomputed() { return featureMatrix != 0; }
+
+  /**
+   * Load features from a text file in libsvm format (label idx:value ...).
+   */
   bool loadFeatures(const char* filename, int* featureSize);
 
+  /**
+   * Map the binary feature cache filename+FEATURE_CACHE_EXTENSION and use it
+   * as the feature matrix. Falls back on the text file filename which is then
+   * converted to a binary cache. Returns false if neither file can be used or
+   * if the cache was computed for different supernodes or feature types.
+   */
+  bool loadFeatureCache(const char* filename, int featureTypes, int* featureSize);
+
+  /**
+   * Map a binary feature cache written by saveFeatureCache. Pages are mapped
+   * copy-on-write so rescaling the features does not modify the file.
+   * On Windows the file is read into memory instead.
+   */
+  bool mapFeatures(const char* filename, int featureTypes, int* featureSize);
+
+  /**
+   * Write the feature matrix to the binary cache filename+FEATURE_CACHE_EXTENSION.
+   */
+  bool saveFeatureCache(const char* filename, int featureTypes);
+
+  /**
+   * Hash of the supernode partition (ids and voxel coordinates) used to check
+   * that a feature cache matches the supervoxels it was computed for.
+   */
+  ulong computeSupernodeChecksum();
+
   // First, compute mean and variance of all precomputed features.
   // All the features get the mean subtracted and get divided by the variance.
   void rescalePrecomputedFeatures(const char* scale_filename = 0);
 
+  // Rescale the precomputed features with a mean and variance loaded
+  // beforehand by loadFeatureScale.
+  void rescalePrecomputedFeatures(const vector<double>& mean,
+                                  const vector<double>& variance);
+
+  // Load the mean and variance written by rescalePrecomputedFeatures.
+  static bool loadFeatureScale(const char* scale_filename,
+                               vector<double>& mean,
+                               vector<double>& variance);
+
   void precomputeDistanceIndices(int _nDistances);
 
   void precomputeFeatures(Feature* feature);
 
+  /**
+   * Release precomputed features so that precomputeFeatures recomputes them.
+   */
+  void clearPrecomputedFeatures() { releaseFeatureMatrix(); }
+
   void precomputeGradientIndices(int _nGradientLevels);
 
   void precomputeOrientationIndices(int _nOrientations);
@@ -318,16 +500,51 @@ class Slice_P
   bool includeOtherLabel;
 
   // precomputed quantities for nodes
-  map<sidType, osvm_node*> features;
+  // row-major matrix of nFeatureRows x featureStride floats
+  float* featureMatrix;
+  int featureStride;
+  ulong nFeatureRows;
+  uchar* featureComputed;
 
-#if USE_SPARSE_VECTORS
-  map<sidType, int> feature_sizes;
-#endif
+  // non-zero if featureMatrix points to a mapped feature cache
+  void* featureMapping;
+  size_t featureMappingSize;
 
   // precomputed quantities for edges
-  map<ulong, int> gradientIdxs;
-  map<ulong, int> orientationIdxs;
-  map<ulong, int> distanceIdxs;
+  // CSR adjacency : edges of supernode sid are stored in
+  // edges[edgeOffsets[sid]..edgeOffsets[sid+1]-1]
+  ulong* edgeOffsets;
+  edgeInfo* edges;
+  ulong nEdgeEntries;
+
+  // per-supernode statistics indexed by sid (see computeSupernodeStats)
+  supernodeStats* supernodeStatsTable;
+
+  bool gradientIdxsComputed;
+  bool orientationIdxsComputed;
+  bool distanceIdxsComputed;
+
+  /**
+   * Pointer to the first channel of voxel (x,y,z) in the raw data or 0 if no
+   * data was loaded. Channels of a voxel and consecutive voxels along x are
+   * assumed to be stored contiguously.
+   */
+  virtual const uchar* getVoxelData(int x, int y, int z) = 0;
+
+  int computeGradientIdx(float gradient, int nGradientLevels);
+
+  int computeOrientationIdx(sidType sid1, const node& c1,
+                            sidType sid2, const node& c2);
+
+  int computeDistanceIdx(const node& c1, const node& c2, int _nDistances);
+
+  /**
+   * Allocate a zero-initialized feature matrix with one row of
+   * _featureSize floats per supernode.
+   */
+  void allocateFeatureMatrix(int _featureSize);
+
+  void releaseFeatureMatrix();
 
  public:
   string inputDir;
@@ -14,6 +14,7 @@
 /////////////////////////////////////////////////////////////////////////
 
 // standard libraries
+#include <stdlib.h>
 #include <vector>
 
 // SliceMe
@@ -99,9 +100,115 @@ uint supernode::size()
 {
   uint nodeSize = 0;
   // count number of pixels in line containers
-  for(vector<lineContainer*>::iterator it = lines.begin();
-      it != lines.end(); it++)
-    nodeSize += (*it)->length;
+  for(uint i = 0; i < nLines; ++i)
+    nodeSize += lines[i].length;
+  return nodeSize;
+}
+
+//------------------------------------------------------------------------------
+
+supernodeArena::supernodeArena()
+{
+  supernodeArray = 0;
+  nSupernodes = 0;
+  lineArray = 0;
+  nLines = 0;
+}
+
+supernodeArena::~supernodeArena()
+{
+  clear();
+}
+
+void supernodeArena::clear()
+{
+  if(supernodeArray) {
+    delete[] supernodeArray;
+    supernodeArray = 0;
+  }
+  if(lineArray) {
+    delete[] lineArray;
+    lineArray = 0;
+  }
+  nSupernodes = 0;
+  nLines = 0;
+}
 
-  return nodeSize + nodes.size();
+void supernodeArena::build(sidType** labels, int width, int height, int depth,
+                           map<sidType, supernode*>& supernodes)
+{
+  clear();
+
+  // find the largest sid so that supernodes can be indexed directly
+  sidType maxSid = -1;
+  for(int z = 0; z < depth; z++) {
+    const sidType* pLabel = labels[z];
+    for(ulong i = 0; i < (ulong)width*height; i++) {
+      if(pLabel[i] < 0) {
+        printf("[Supernode] Error : negative supernode id %d\n", pLabel[i]);
+        exit(-1);
+      }
+      if(pLabel[i] > maxSid) {
+        maxSid = pLabel[i];
+      }
+    }
+  }
+  nSupernodes = maxSid + 1;
+
+  // counting pass : number of lines per supernode
+  ulong* lineOffsets = new ulong[nSupernodes + 1];
+  memset(lineOffsets, 0, (nSupernodes + 1)*sizeof(ulong));
+  for(int z = 0; z < depth; z++) {
+    for(int y = 0; y < height; y++) {
+      const sidType* pLabel = labels[z] + (ulong)y*width;
+      for(int x = 0; x < width; x++) {
+        if(x == 0 || pLabel[x] != pLabel[x-1]) {
+          lineOffsets[pLabel[x] + 1]++;
+        }
+      }
+    }
+  }
+
+  // prefix sum
+  for(sidType sid = 0; sid < nSupernodes; sid++) {
+    lineOffsets[sid + 1] += lineOffsets[sid];
+  }
+  nLines = lineOffsets[nSupernodes];
+
+  supernodeArray = new supernode[nSupernodes];
+  lineArray = new lineContainer[nLines];
+  for(sidType sid = 0; sid < nSupernodes; sid++) {
+    supernodeArray[sid].id = sid;
+    supernodeArray[sid].lines = lineArray + lineOffsets[sid];
+  }
+
+  // fill pass
+  lineContainer* line = 0;
+  for(int z = 0; z < depth; z++) {
+    for(int y = 0; y < height; y++) {
+      const sidType* pLabel = labels[z] + (ulong)y*width;
+      for(int x = 0; x < width; x++) {
+        if(x == 0 || pLabel[x] != pLabel[x-1]) {
+          supernode* s = &supernodeArray[pLabel[x]];
+          line = lineArray + lineOffsets[pLabel[x]] + s->nLines;
+          s->nLines++;
+          line->coord.x = x;
+          line->coord.y = y;
+          line->coord.z = z;
+          line->length = 0;
+        }
+        line->length++;
+      }
+    }
+  }
+  delete[] lineOffsets;
+
+  // supernodes are inserted in increasing order of sid
+  supernodes.clear();
+  for(sidType sid = 0; sid < nSupernodes; sid++) {
+    if(supernodeArray[sid].nLines != 0) {
+      supernodes.insert(supernodes.end(),
+                        pair<sidType, supernode*>(sid, &supernodeArray[sid]));
+    }
+  }
 }
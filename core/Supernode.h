@@ -18,6 +18,7 @@
 // standard libraries
 #include <stdio.h>
 #include <string.h>
+#include <map>
 
 // SliceMe
 #include "globalsE.h"
@@ -88,16 +89,16 @@ class supernode_data
 
 /**
  * Class to iterate over nodes
- * 2 types of storage are available : nodes and lines (i.e run length encoding)
+ * Nodes are stored as lines (i.e run length encoding) pointing into the
+ * arena owned by supernodeArena.
  */
 class nodeIterator
 {
  public:
-  nodeIterator(vector<lineContainer*>* _lines,
-               vector<node*>* _nodes)
+  nodeIterator(const lineContainer* _lines, uint _nLines)
     {
       lines = _lines;
-      nodes = _nodes;
+      nLines = _nLines;
       goToBegin();
     }
 
@@ -107,133 +108,67 @@ class nodeIterator
 
   void goToBegin()
   {
-    itLines = lines->begin();
+    lineIdx = 0;
     nodeIdx = 0;
-    lineIdx = 1;
-    itNodes = nodes->begin();
   }
 
   bool isAtEnd()
   {
-    if(itLines == lines->end() && itNodes == nodes->end())
-      return true;
-    else
-      return false;
+    return lineIdx >= nLines;
   }
 
   inline void next()
   {
-    if(itLines != lines->end())
+    if(lineIdx < nLines)
       {
-        //printf("next (*itLines)->length %d %d\n", nodeIdx, (*itLines)->length);
-        if(nodeIdx < ((*itLines)->length - 1))
+        if(nodeIdx < (lines[lineIdx].length - 1))
           {
             nodeIdx++; // next node
           }
         else
           {
             nodeIdx = 0;
-            itLines++; // next line
-            lineIdx++;
+            lineIdx++; // next line
           }
-      }    
-    else
-    if(itNodes != nodes->end())
-      {
-        itNodes++;
-      }    
+      }
   }
 
   node get()
   {
     node n;
-    if(itLines != lines->end())
-      {
-        n.x = (*itLines)->coord.x + nodeIdx;
-        n.y = (*itLines)->coord.y;
-        n.z = (*itLines)->coord.z;
-      }
-    else
-      {
-        if(itNodes != nodes->end())
-          {
-            n.x = (*itNodes)->x;
-            n.y = (*itNodes)->y;
-            n.z = (*itNodes)->z;
-          }    
-        else
-          {
-            n.x = 0; n.y = 0; n.z = 0;
-          }
-      }
+    get(n);
     return n;
   }
 
   void get(node& n)
   {
-    if(itLines != lines->end())
+    if(lineIdx < nLines)
       {
-        n.x = (*itLines)->coord.x + nodeIdx;
-        n.y = (*itLines)->coord.y;
-        n.z = (*itLines)->coord.z;
+        n.x = lines[lineIdx].coord.x + nodeIdx;
+        n.y = lines[lineIdx].coord.y;
+        n.z = lines[lineIdx].coord.z;
       }
     else
       {
-        if(itNodes != nodes->end())
-          {
-            n.x = (*itNodes)->x;
-            n.y = (*itNodes)->y;
-            n.z = (*itNodes)->z;
-          }    
-        else
-          {
-            n.x = 0; n.y = 0; n.z = 0;
-          }
+        n.x = 0; n.y = 0; n.z = 0;
       }
   }
 
-  /*
-  void test()
-  {
-    int nodeSize = 0;
-    // count number of pixels in line containers
-    for(vector<lineContainer*>::iterator it = lines.begin();
-        it != lines.end(); it++)
-      nodeSize += (*it)->length;
-
-    printf("nodeSize %d\n", nodeSize);
-
-    int i = 1;
-    goToBegin();
-    while(!isAtEnd())
-      {
-        printf("%d ", i);
-        i++;
-        next();
-      }
-    printf("\n");
-  }
-  */
-
   uint size()
   {
-    int nodeSize = 0;
+    uint nodeSize = 0;
     // count number of pixels in line containers
-    for(vector<lineContainer*>::iterator it = lines->begin();
-        it != lines->end(); it++)
-      nodeSize += (*it)->length;
-
-    return nodeSize + nodes->size();
+    for(uint i = 0; i < nLines; ++i)
+      nodeSize += lines[i].length;
+    return nodeSize;
   }
 
  private:
-  vector<lineContainer*>* lines;
-  vector<node*>* nodes;
+  const lineContainer* lines;
+  uint nLines;
 
-  // iterators
-  vector<lineContainer*>::iterator itLines;
+  // current position
   uint lineIdx;
-  vector<node*>::iterator itNodes;
   uint nodeIdx;
 };
 
@@ -270,27 +205,21 @@ class supernode
     neighbors.push_back(n);
   }
 
-  void addLine(lineContainer* l)
-  {
-    lines.push_back(l);
-  }
-
-  void addNode(node* n)
-  {
-    nodes.push_back(n);
-  }
-
   /**
    * Get center of the supernode with corresponding given id
    * @param center will be initialized by this function
    */
   void getCenter(node& center);
 
-  int getNumberOfNodes() { return nodes.size(); }
+  uint getNumberOfLines() { return nLines; }
+
+  const lineContainer* getLines() { return lines; }
 
   supernode()
   {
     data = 0;
+    lines = 0;
+    nLines = 0;
   }
 
   uint size();
@@ -299,25 +228,60 @@ class supernode
     {
       if(data)
         delete data;
-
-      for(vector<node*>::iterator it = nodes.begin();
-          it != nodes.end(); it++)
-        delete *it;
-
-      for(vector<lineContainer*>::iterator it = lines.begin();
-          it != lines.end(); it++)
-        delete *it;
     }
 
   /**
    * Returns a new node iterator
    */
-  nodeIterator getIterator() { return nodeIterator(&lines, &nodes); }
+  nodeIterator getIterator() { return nodeIterator(lines, nLines); }
 
  private:
-  vector<lineContainer*> lines;
-  vector<node*> nodes;
+  // lines are owned by the supernodeArena the supernode belongs to
+  const lineContainer* lines;
+  uint nLines;
+
+  friend class supernodeArena;
+};
+
+//------------------------------------------------------------------------------
+
+/**
+ * Flat storage for all the supernodes of a slice or a cube.
+ * Supernodes are stored in a dense array indexed by sid and the nodes
+ * belonging to each supernode are stored as contiguous lines in a single
+ * array. The arena is filled with a counting pass over the label volume,
+ * a prefix sum over the counts and a fill pass.
+ */
+class supernodeArena
+{
+ public:
+  supernodeArena();
 
+  ~supernodeArena();
+
+  /**
+   * Build supernodes from a label volume.
+   * @param labels is an array of depth slices of size width*height
+   * @param supernodes map indexing the supernodes created by this function
+   */
+  void build(sidType** labels, int width, int height, int depth,
+             map<sidType, supernode*>& supernodes);
+
+  void clear();
+
+  supernode* getSupernode(sidType sid) {
+    if(sid < 0 || sid >= nSupernodes || supernodeArray[sid].nLines == 0)
+      return 0;
+    return &supernodeArray[sid];
+  }
+
+  ulong getNbLines() { return nLines; }
+
+ private:
+  supernode* supernodeArray;
+  sidType nSupernodes;
+  lineContainer* lineArray;
+  ulong nLines;
 };
 
 #endif // SUPERNODE_H
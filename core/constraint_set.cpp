@@ -17,12 +17,20 @@
 #include "Config.h"
 #include "svm_struct_globals.h" // for SSVM_PRINT
 
+#include <string.h>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
 ConstraintSet* ConstraintSet::pInstance = 0; // initialize pointer
 
 ConstraintSet::ConstraintSet()
 {
   max_number_constraints = CONSTRAINT_SET_DEFAULT_SIZE;
   sortingType = CS_DISTANCE;
+  score_version = 1;
+  size_psi = 0;
   string config_tmp;
   if(Config::Instance()->getParameter("cs_max_number_constraints", config_tmp)) {
     max_number_constraints = atoi(config_tmp.c_str());
@@ -42,11 +50,121 @@ void ConstraintSet::clear()
     for(vector<constraint>::iterator it = itC->second->begin();
         it != itC->second->end(); ++it) {
       delete[] it->first->w;
-      delete[] it->first;
+      delete it->first;
     }
     delete itC->second;
   }
   constraints.clear();
+  hashes.clear();
+}
+
+ulong ConstraintSet::computeHash(SWORD* w)
+{
+  // FNV-1a over the indices and values of the non-zero entries
+  const ulong fnv_prime = 1099511628211UL;
+  ulong hash = 14695981039346656037UL;
+  for(SWORD* p = w; p->wnum; ++p) {
+    if(p->weight == 0) {
+      continue;
+    }
+    double weight = p->weight;
+    ulong bits = 0;
+    memcpy(&bits, &weight, sizeof(double));
+    hash = (hash ^ (ulong)p->wnum) * fnv_prime;
+    hash = (hash ^ bits) * fnv_prime;
+  }
+  return hash;
+}
+
+void ConstraintSet::updateScoreVersion(double* w)
+{
+  if((int)score_w.size() == size_psi &&
+     std::equal(score_w.begin(), score_w.end(), w)) {
+    return;
+  }
+  score_w.assign(w, w + size_psi);
+  ++score_version;
+}
+
+void ConstraintSet::computeScores(vector< constraint >* _cs, double* w)
+{
+  const int n = _cs->size();
+#ifdef WITH_OPENMP
+#pragma omp parallel for if(n > 16)
+#endif
+  for(int i = 0; i < n; ++i) {
+    getScore((*_cs)[i].first, w);
+  }
+}
+
+void ConstraintSet::computeScores(double* w)
+{
+  updateScoreVersion(w);
+  for(map<cs_id_type, vector< constraint >* >::iterator itC = constraints.begin();
+      itC != constraints.end(); ++itC) {
+    computeScores(itC->second, w);
+  }
+}
+
+void ConstraintSet::removeHash(cs_id_type id, c_item* item)
+{
+  multimap<ulong, c_item*>& _hashes = hashes[id];
+  pair<multimap<ulong, c_item*>::iterator, multimap<ulong, c_item*>::iterator> range =
+    _hashes.equal_range(item->hash);
+  for(multimap<ulong, c_item*>::iterator it = range.first; it != range.second; ++it) {
+    if(it->second == item) {
+      _hashes.erase(it);
+      break;
+    }
+  }
+}
+
+void ConstraintSet::rebase(cs_id_type id, SWORD* shift)
+{
+  map<cs_id_type, vector< constraint >* >::iterator itC = constraints.find(id);
+  if(itC == constraints.end()) {
+    return;
+  }
+  vector< constraint >* _cs = itC->second;
+  multimap<ulong, c_item*>& _hashes = hashes[id];
+  _hashes.clear();
+  for(vector<constraint>::iterator it = _cs->begin(); it != _cs->end(); ++it) {
+    c_item* item = it->first;
+
+    // merge the two sparse vectors sorted by wnum
+    int n = 0;
+    for(SWORD* p = item->w; p->wnum; ++p) ++n;
+    for(SWORD* p = shift; p->wnum; ++p) ++n;
+    SWORD* w = new SWORD[n + 1];
+    SWORD* pa = item->w;
+    SWORD* pb = shift;
+    int si = 0;
+    while(pa->wnum || pb->wnum) {
+      if(pb->wnum == 0 || (pa->wnum && pa->wnum < pb->wnum)) {
+        w[si] = *pa;
+        ++pa;
+      } else if(pa->wnum == 0 || pb->wnum < pa->wnum) {
+        w[si] = *pb;
+        ++pb;
+      } else {
+        w[si].wnum = pa->wnum;
+        w[si].weight = pa->weight + pb->weight;
+        ++pa;
+        ++pb;
+      }
+      if(w[si].weight != 0) {
+        ++si;
+      }
+    }
+    w[si].wnum = 0;
+    w[si].weight = 0;
+
+    delete[] item->w;
+    item->w = w;
+    item->hash = computeHash(item->w);
+    item->score_version = 0;
+    _hashes.insert(make_pair(item->hash, item));
+  }
 }
 
 void ConstraintSet::getConstraints(vector< constraint >& all_cs)
@@ -81,13 +199,15 @@ const constraint* ConstraintSet::getMostViolatedConstraint(cs_id_type id, double
   constraint* c = 0;
   if(constraints.find(id) != constraints.end()) {
     vector< constraint >* _cs = constraints[id];
+    updateScoreVersion(w);
+    computeScores(_cs, w);
     double max_margin = 0;
     bool initialized = false;
     int i = 0;
     int i_max = 0;
     for(vector<constraint>::iterator it = _cs->begin();
         it != _cs->end(); ++it) {
-      double margin = computeScore(it->first->w, w) + it->first->loss;
+      double margin = it->first->score + it->first->loss;
       if(!initialized || (margin > max_margin)) {
         max_margin = margin;
         c = &(*it);
@@ -127,9 +247,10 @@ double ConstraintSet::computeScore(cs_id_type id, double* w)
   double score = 0;
   if(constraints.find(id) != constraints.end()) {
     vector< constraint >* _cs = constraints[id];
+    updateScoreVersion(w);
     for(vector<constraint>::iterator it = _cs->begin();
         it != _cs->end(); ++it) {
-      score += computeScore(it->first->w, w);
+      score += getScore(it->first, w);
     }
   }
   return score;
@@ -191,18 +312,18 @@ bool ConstraintSet::add(cs_id_type id, SWORD* w, double loss, int sizePsi)
 
 void ConstraintSet::create_item(SWORD* w, int sizePsi, c_item* _item)
 {
-#if USE_SPARSE_VECTORS
   // count number of non zeros
   int n_non_zeros = 0;
   int i = 0;
   while(w[i].wnum) {
+    assert(w[i].wnum < sizePsi);
     if(w[i].weight != 0) {
       ++n_non_zeros;
     }
     ++i;
   }
 
-  // add +1 for last element whose index is -1
+  // add +1 for last element whose index is 0
   _item->w = new SWORD[n_non_zeros + 1];
 
   int si = 0; // index for sparse vector
@@ -215,17 +336,11 @@ void ConstraintSet::create_item(SWORD* w, int sizePsi, c_item* _item)
     ++i;
   }
   _item->w[si].wnum = 0;
-#else
-  _item->w = new SWORD[sizePsi];
-  int i = 0;
-  while(w[i].wnum) {
-    _item->w[i] = w[i];
-    ++i;
-  }
-  _item->w[i].wnum = 0;
-  _item->w[i].weight = 0;
-#endif
+  _item->w[si].weight = 0;
   _item->loss = 0;
+  _item->hash = computeHash(_item->w);
+  _item->score = 0;
+  _item->score_version = 0;
 }
 
 void ConstraintSet::getSortingValue(double& sorting_value, cs_id_type id, SWORD* w)
@@ -259,38 +374,41 @@ void ConstraintSet::getSortingValue(double& sorting_value, cs_id_type id, SWORD*
 
 bool ConstraintSet::contains(cs_id_type id, SWORD* w)
 {
-  ulong n_constraints = count(id);
-  vector< constraint >* _cs = 0;
+  return contains(id, w, computeHash(w));
+}
 
-  if(n_constraints == 0) {
+bool ConstraintSet::contains(cs_id_type id, SWORD* w, ulong hash)
+{
+  map<cs_id_type, multimap<ulong, c_item*> >::iterator itH = hashes.find(id);
+  if(itH == hashes.end()) {
     return false;
-  } else {
-    _cs = constraints[id];
   }
 
-  return contains(_cs, w);
-}
-
-bool ConstraintSet::contains(vector< constraint >* _cs, SWORD* w)
-{
-  bool new_constraint = true;
-  for(vector<constraint>::iterator it = _cs->begin(); it != _cs->end(); ++it) {
-    SWORD* _w = it->first->w;
+  // only the constraints with the same hash have to be compared
+  pair<multimap<ulong, c_item*>::iterator, multimap<ulong, c_item*>::iterator> range =
+    itH->second.equal_range(hash);
+  for(multimap<ulong, c_item*>::iterator it = range.first; it != range.second; ++it) {
+    // compare the non-zero entries of the two sparse vectors
+    SWORD* pa = w;
+    SWORD* pb = it->second->w;
     bool is_diff = false;
-    int i = 0;
-    while(w[i].wnum) {
-      if(w[i].weight != _w[i].weight) {
+    while(pa->wnum || pb->wnum) {
+      if(pa->wnum && pa->weight == 0) {
+        ++pa;
+        continue;
+      }
+      if(pa->wnum != pb->wnum || pa->weight != pb->weight) {
         is_diff = true;
         break;
       }
-      ++i;
+      ++pa;
+      ++pb;
     }
     if(!is_diff) {
-      new_constraint = false;
-      break;
+      return true;
     }
   }
-  return !new_constraint;
+  return false;
 }
 
 bool ConstraintSet::add(cs_id_type id, SWORD* w, double loss, int sizePsi, double sorting_value)
@@ -298,6 +416,10 @@ bool ConstraintSet::add(cs_id_type id, SWORD* w, double loss, int sizePsi, doubl
   double added = false;
   ulong n_constraints = count(id);
   vector< constraint >* _cs = 0;
+  ulong hash = computeHash(w);
+  if(sizePsi > size_psi) {
+    size_psi = sizePsi;
+  }
 
   if(n_constraints == 0) {
     _cs = new vector< constraint >;
@@ -310,7 +432,7 @@ bool ConstraintSet::add(cs_id_type id, SWORD* w, double loss, int sizePsi, doubl
   if(n_constraints < max_number_constraints) {
 
     // check if constraint is different from all the known constraints
-    bool existing_constraint = contains(_cs, w);
+    bool existing_constraint = contains(id, w, hash);
 
     if(!existing_constraint) {
       c_item* _item = new c_item;
@@ -318,6 +440,7 @@ bool ConstraintSet::add(cs_id_type id, SWORD* w, double loss, int sizePsi, doubl
       _item->loss = loss;
       _item->id = _cs->size();
       _cs->push_back(make_pair(_item, sorting_value)); // use distance of 0 for now
+      hashes[id].insert(make_pair(_item->hash, _item));
       ++n_constraints;
       added = true;
       SSVM_PRINT("[ConstraintSet] cs_id %d: Added new constraint with value %g. Set contains %ld constraints\n",
@@ -343,7 +466,7 @@ bool ConstraintSet::add(cs_id_type id, SWORD* w, double loss, int sizePsi, doubl
 
   } else {
 
-    bool existing_constraint = contains(_cs, w);
+    bool existing_constraint = contains(id, w, hash);
 
     if(!existing_constraint) {
       // add new constraint
@@ -352,6 +475,7 @@ bool ConstraintSet::add(cs_id_type id, SWORD* w, double loss, int sizePsi, doubl
       _item->loss = loss;
       _item->id = _cs->size();
       _cs->push_back(make_pair(_item, sorting_value)); // use distance of 0 for now
+      hashes[id].insert(make_pair(_item->hash, _item));
       added = true;
 
       // remove constraint with smallest score
@@ -359,6 +483,9 @@ bool ConstraintSet::add(cs_id_type id, SWORD* w, double loss, int sizePsi, doubl
         getSortingValue(it->second, id, it->first->w);
       }
       std::sort(_cs->begin(), _cs->end(), compare_pair_second<>());
+      removeHash(id, _cs->begin()->first);
+      delete[] _cs->begin()->first->w;
+      delete _cs->begin()->first;
       _cs->erase(_cs->begin());
     } else {
       SSVM_PRINT("[ConstraintSet] cs_id %d: Already existing constraint in set\n", id);
@@ -376,11 +503,11 @@ void ConstraintSet::save(const char* filename)
       itC != constraints.end(); ++itC) {
     for(vector<constraint>::iterator it = itC->second->begin();
       it != itC->second->end(); ++it) {
-      // output id + sorting value + loss
+      // output id + sorting value + loss + sparse psi
       ofs << itC->first << " " << it->second << " " << it->first->loss;
       SWORD* _w = it->first->w;
       while (_w->wnum) {
-        ofs << " " << _w->weight;
+        ofs << " " << _w->wnum << ":" << _w->weight;
         ++_w;
       }
       ofs << endl;
@@ -391,13 +518,14 @@ void ConstraintSet::save(const char* filename)
 
 void ConstraintSet::saveMargins(double* w, const char* filename)
 {
+  updateScoreVersion(w);
   ofstream ofs(filename, ios::out);
   for(map<cs_id_type, vector< constraint >* >::iterator itC = constraints.begin();
       itC != constraints.end(); ++itC) {
     for(vector<constraint>::iterator it = itC->second->begin();
       it != itC->second->end(); ++it) {
       // output id + margin
-      double margin = computeScore(it->first->w, w) + it->first->loss;
+      double margin = getScore(it->first, w) + it->first->loss;
       ofs << itC->first << " " << margin << endl;
     }
   }
@@ -418,9 +546,10 @@ void ConstraintSet::printStats(cs_id_type id, double* w)
 {
   if(constraints.find(id) != constraints.end()) {
     vector< constraint >* _cs = constraints[id];
+    updateScoreVersion(w);
     for(vector<constraint>::iterator it = _cs->begin();
         it != _cs->end(); ++it) {
-      double score = computeScore(it->first->w, w);
+      double score = getScore(it->first, w);
       double loss = it->first->loss;
       double margin = loss + score;
       printf("[ConstraintSet] Score = %g, Loss = %g, Margin = %g\n", score, loss, margin);
@@ -18,14 +18,23 @@
 
 #include "svm_struct_api_types.h"
 
+#include <map>
+
 // maximum number of constraints to be stored
 #define CONSTRAINT_SET_DEFAULT_SIZE 100
 
+// w is relative to the labels y the gradient moves toward. For the direct
+// gradients these labels change at every step and the constraints are
+// rebased (see ConstraintSet::rebase) so that w is always relative to the
+// current ones.
 struct c_item {
-  SWORD* w; // psi
+  SWORD* w; // sparse psi(x,ybar) - psi(x,y), sorted by wnum
   double loss;
   //int* indices;
   int id;
+  ulong hash; // hash of the non-zero entries of w
+  double score; // cached w*psi, valid if score_version is up to date
+  ulong score_version;
 };
 
 typedef std::pair<c_item*, double> constraint;
@@ -106,10 +115,19 @@ class ConstraintSet
 
   bool contains(cs_id_type id, SWORD* w);
 
-  bool contains(vector< constraint >* _cs, SWORD* w);
+  bool contains(cs_id_type id, SWORD* w, ulong hash);
 
   int count(cs_id_type id);
 
+  /**
+   * Add the sparse vector shift to all the constraints of example id, e.g.
+   * psi(x,y_old) - psi(x,y_new) to express them against new labels y_new.
+   */
+  void rebase(cs_id_type id, SWORD* shift);
+
+  /**
+   * Copy the non-zero entries of the sparse vector w.
+   */
   void create_item(SWORD* w, int sizePsi, c_item* _item);
 
   bool isFull() { return constraints.size() == max_number_constraints; }
@@ -131,6 +149,12 @@ class ConstraintSet
    */
   const constraint* getMostViolatedConstraint(cs_id_type id, double* w, int* max_index = 0);
 
+  /**
+   * Compute the score w*psi of all the constraints in the working set.
+   * Scores are cached until w changes.
+   */
+  void computeScores(double* w);
+
   ulong getCapacity() { return max_number_constraints; }
 
   ulong getSize();
@@ -153,32 +177,75 @@ class ConstraintSet
 
   map<cs_id_type, vector< constraint >* > constraints;
 
+  // constraints of each example indexed by the hash of their non-zero entries
+  map<cs_id_type, multimap<ulong, c_item*> > hashes;
+
   eSortingType sortingType;
 
-  inline double computeDistance(SWORD* wa, SWORD* wb)
+  // weight vector the cached scores were computed for
+  vector<double> score_w;
+  ulong score_version;
+
+  // size of the weight vector (largest sizePsi given to add)
+  int size_psi;
+
+  /**
+   * Hash of the non-zero entries of a sparse vector
+   */
+  ulong computeHash(SWORD* w);
+
+  /**
+   * Returns the cached score of a constraint, computing it if w changed
+   * since it was cached. updateScoreVersion has to be called first.
+   */
+  inline double getScore(c_item* item, double* w)
   {
-    double d = 0;
-    SWORD* pa = wa;
-    SWORD* pb = wb;
-    while (pa->wnum) {
-      double t = wa->weight - wb->weight;
-      d += t*t;
-      ++pa;
-      ++pb;
+    if(item->score_version != score_version) {
+      item->score = computeScore(item->w, w);
+      item->score_version = score_version;
     }
-    return sqrt(d);
+    return item->score;
+  }
+
+  /**
+   * Invalidate the cached scores if w changed
+   */
+  void updateScoreVersion(double* w);
+
+  /**
+   * Compute the scores of all the constraints in _cs in one pass
+   */
+  void computeScores(vector< constraint >* _cs, double* w);
+
+  void removeHash(cs_id_type id, c_item* item);
+
+  inline double computeDistance(SWORD* wa, SWORD* wb)
+  {
+    return sqrt(computeSquareDistance(wa, wb));
   }
 
+  /**
+   * Squared euclidean distance between two sparse vectors sorted by wnum.
+   */
   inline double computeSquareDistance(SWORD* wa, SWORD* wb)
   {
     double d = 0;
+    double t;
     SWORD* pa = wa;
     SWORD* pb = wb;
-    while (pa->wnum) {
-      double t = wa->weight - wb->weight;
+    while (pa->wnum || pb->wnum) {
+      if(pb->wnum == 0 || (pa->wnum && pa->wnum < pb->wnum)) {
+        t = pa->weight;
+        ++pa;
+      } else if(pa->wnum == 0 || pb->wnum < pa->wnum) {
+        t = pb->weight;
+        ++pb;
+      } else {
+        t = pa->weight - pb->weight;
+        ++pa;
+        ++pb;
+      }
       d += t*t;
-      ++pa;
-      ++pb;
     }
     return d;
   }
@@ -17,6 +17,7 @@
 #include "graphInference.h"
 
 #include <fstream>
+#include <math.h>
 #include <stdlib.h>
 #include <map>
 
@@ -35,6 +36,7 @@ EnergyParam::EnergyParam()
   includeLocalEdges = false;
   weights = 0;
   nDistances = 1;
+  featureScaleFolded = false;
 }
 
 EnergyParam::EnergyParam(const EnergyParam& _param)
@@ -48,6 +50,7 @@ EnergyParam::EnergyParam(const EnergyParam& _param)
   includeLocalEdges = _param.includeLocalEdges;
   weights = _param.weights;
   nDistances = _param.nDistances;
+  featureScaleFolded = _param.featureScaleFolded;
 }
 
 EnergyParam& EnergyParam::operator=(EnergyParam const& _param)
@@ -61,6 +64,7 @@ EnergyParam& EnergyParam::operator=(EnergyParam const& _param)
   includeLocalEdges = _param.includeLocalEdges;
   weights = _param.weights;
   nDistances = _param.nDistances;
+  featureScaleFolded = _param.featureScaleFolded;
 
   return *this;
 }
@@ -98,8 +102,49 @@ void EnergyParam::save(const char* filename)
   ofs.close();
 }
 
+bool EnergyParam::foldFeatureScale(const vector<double>& mean,
+                                   const vector<double>& variance)
+{
+  if(!weights || featureScaleFolded) {
+    return false;
+  }
+
+#ifndef W_OFFSET
+  printf("[EnergyParam] Feature scale can not be folded into the weights without class offsets (W_OFFSET)\n");
+  return false;
+#else
+  // the scale must cover exactly the features the model was trained on
+  int fvSize = mean.size();
+  int modelFvSize = (sizePsi - SVM_FEAT_INDEX0(this)) / nUnaryWeights;
+  if(fvSize != modelFvSize || (int)variance.size() != fvSize) {
+    printf("[EnergyParam] Error: scale of dimension %d (mean) and %ld (variance) does not match the feature dimension %d of the model\n",
+           fvSize, variance.size(), modelFvSize);
+    exit(-1);
+  }
+
+  // w.(x-mean)/stddev + b = (w/stddev).x + (b - w.mean/stddev)
+  for(int c = 0; c < nUnaryWeights; ++c) {
+    double offset = 0;
+    for(int f = 0; f < fvSize; ++f) {
+      // prevent division by 0 as in Slice_P::rescalePrecomputedFeatures
+      double stddev = (variance[f] == 0)?1.0:sqrt(variance[f]);
+      double& w = weights[SVM_FEAT_INDEX(this, c, f)];
+      w /= stddev;
+      offset += w*mean[f];
+    }
+    weights[c] -= offset;
+  }
+
+  printf("[EnergyParam] Folded feature scale of dimension %d into the weights\n", fvSize);
+  featureScaleFolded = true;
+  return true;
+#endif
+}
+
 void EnergyParam::load(const char* filename)
 {
+  featureScaleFolded = false;
+
   // Load global stats
   ifstream ifsStats(filename);
   if(ifsStats.fail()) {
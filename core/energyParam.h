@@ -43,6 +43,15 @@ class EnergyParam
   void printMetaData();
   void save(const char* filename);
 
+  /**
+   * Absorb the feature standardization (x-mean)/sqrt(variance) into the
+   * unary weights and the class offsets so that inference can run on the
+   * raw features. Returns false if the weights were left unchanged and
+   * exits if the scale does not match the feature dimension of the model.
+   */
+  bool foldFeatureScale(const std::vector<double>& mean,
+                        const std::vector<double>& variance);
+
   int sizePsi;
   int nUnaryWeights;
   int nClasses;
@@ -55,6 +64,9 @@ class EnergyParam
   bool includeLocalEdges;
   bool useGlobalClassifier;
 
+  // true if the weights expect raw (not rescaled) features
+  bool featureScaleFolded;
+
   // weight vector
   double* weights;
 
@@ -0,0 +1,219 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "evaluation_queue.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+void EvaluationSnapshot::run()
+{
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for(int taskId = 0; taskId < nTasks; ++taskId) {
+    runTask(taskId);
+  }
+  finish();
+}
+
+#ifndef _WIN32
+
+//------------------------------------------------------------------------------
+
+EvaluationQueue::EvaluationQueue(int _nWorkers, bool _dropStaleSnapshots)
+{
+  nWorkers = max(1, _nWorkers);
+  dropStaleSnapshots = _dropStaleSnapshots;
+  stopping = false;
+  nSnapshots = 0;
+
+  pthread_mutex_init(&mutex, 0);
+  pthread_mutex_init(&finishMutex, 0);
+  pthread_cond_init(&taskAvailable, 0);
+  pthread_cond_init(&snapshotDone, 0);
+
+  workers.resize(nWorkers);
+  for(int i = 0; i < nWorkers; ++i) {
+    if(pthread_create(&workers[i], 0, workerThread, this) != 0) {
+      printf("[EvaluationQueue] Error : could not create worker thread %d\n", i);
+      exit(-1);
+    }
+  }
+  printf("[EvaluationQueue] Started %d workers (drop stale snapshots = %d)\n",
+         nWorkers, (int)dropStaleSnapshots);
+}
+
+EvaluationQueue::~EvaluationQueue()
+{
+  wait();
+
+  pthread_mutex_lock(&mutex);
+  stopping = true;
+  pthread_cond_broadcast(&taskAvailable);
+  pthread_mutex_unlock(&mutex);
+
+  for(int i = 0; i < nWorkers; ++i) {
+    pthread_join(workers[i], 0);
+  }
+
+  pthread_mutex_destroy(&mutex);
+  pthread_mutex_destroy(&finishMutex);
+  pthread_cond_destroy(&taskAvailable);
+  pthread_cond_destroy(&snapshotDone);
+}
+
+void EvaluationQueue::push(EvaluationSnapshot* snapshot)
+{
+  PendingSnapshot* s = new PendingSnapshot;
+  s->snapshot = snapshot;
+  s->nextTask = 0;
+  s->nRunningTasks = 0;
+  s->done = (snapshot->nTasks == 0);
+
+  vector<EvaluationSnapshot*> dropped;
+
+  pthread_mutex_lock(&mutex);
+  if(dropStaleSnapshots) {
+    deque<PendingSnapshot*>::iterator it = pending.begin();
+    while(it != pending.end()) {
+      if((*it)->nextTask == 0) {
+        dropped.push_back((*it)->snapshot);
+        unfinished.erase(find(unfinished.begin(), unfinished.end(), *it));
+        delete *it;
+        it = pending.erase(it);
+        --nSnapshots;
+      } else {
+        ++it;
+      }
+    }
+  }
+  if(snapshot->nTasks > 0) {
+    pending.push_back(s);
+    pthread_cond_broadcast(&taskAvailable);
+  }
+  unfinished.push_back(s);
+  ++nSnapshots;
+  pthread_mutex_unlock(&mutex);
+
+  for(vector<EvaluationSnapshot*>::iterator it = dropped.begin();
+      it != dropped.end(); ++it) {
+    printf("[EvaluationQueue] Dropping stale snapshot of iteration %d\n", (*it)->iterationId);
+    delete *it;
+  }
+
+  if(s->done) {
+    finishReadySnapshots();
+  }
+}
+
+void EvaluationQueue::wait()
+{
+  pthread_mutex_lock(&mutex);
+  while(nSnapshots > 0) {
+    pthread_cond_wait(&snapshotDone, &mutex);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+void* EvaluationQueue::workerThread(void* arg)
+{
+  EvaluationQueue* queue = (EvaluationQueue*)arg;
+
+#ifdef WITH_OPENMP
+  // the number of workers is the share of the cores used for evaluation
+  omp_set_num_threads(1);
+#endif
+
+  PendingSnapshot* snapshot;
+  int taskId;
+  while(queue->popTask(snapshot, taskId)) {
+    snapshot->snapshot->runTask(taskId);
+    queue->taskDone(snapshot);
+  }
+  return 0;
+}
+
+bool EvaluationQueue::popTask(PendingSnapshot*& snapshot, int& taskId)
+{
+  pthread_mutex_lock(&mutex);
+  while(pending.empty() && !stopping) {
+    pthread_cond_wait(&taskAvailable, &mutex);
+  }
+  if(pending.empty()) {
+    pthread_mutex_unlock(&mutex);
+    return false;
+  }
+  snapshot = pending.front();
+  taskId = snapshot->nextTask++;
+  ++snapshot->nRunningTasks;
+  if(snapshot->nextTask == snapshot->snapshot->nTasks) {
+    pending.pop_front();
+  }
+  pthread_mutex_unlock(&mutex);
+  return true;
+}
+
+void EvaluationQueue::taskDone(PendingSnapshot* snapshot)
+{
+  pthread_mutex_lock(&mutex);
+  --snapshot->nRunningTasks;
+  bool done = (snapshot->nRunningTasks == 0 &&
+               snapshot->nextTask == snapshot->snapshot->nTasks);
+  snapshot->done = done;
+  pthread_mutex_unlock(&mutex);
+
+  if(done) {
+    finishReadySnapshots();
+  }
+}
+
+void EvaluationQueue::finishReadySnapshots()
+{
+  // a snapshot that completes before an older one is finished by the thread
+  // completing the older one.
+  pthread_mutex_lock(&finishMutex);
+  while(true) {
+    PendingSnapshot* snapshot = 0;
+    pthread_mutex_lock(&mutex);
+    if(!unfinished.empty() && unfinished.front()->done) {
+      snapshot = unfinished.front();
+      unfinished.pop_front();
+    }
+    pthread_mutex_unlock(&mutex);
+    if(snapshot == 0) {
+      break;
+    }
+
+    snapshot->snapshot->finish();
+    delete snapshot->snapshot;
+    delete snapshot;
+
+    pthread_mutex_lock(&mutex);
+    --nSnapshots;
+    pthread_cond_broadcast(&snapshotDone);
+    pthread_mutex_unlock(&mutex);
+  }
+  pthread_mutex_unlock(&finishMutex);
+}
+
+#endif // _WIN32
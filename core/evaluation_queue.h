@@ -0,0 +1,133 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef EVALUATION_QUEUE_H
+#define EVALUATION_QUEUE_H
+
+#include <deque>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+/**
+ * Evaluation of a model snapshot split into independent tasks (e.g. one per
+ * example). Tasks may run concurrently. finish is called once, after all the
+ * tasks are done.
+ */
+class EvaluationSnapshot
+{
+ public:
+  EvaluationSnapshot(int _iterationId) {
+    iterationId = _iterationId;
+    nTasks = 0;
+  }
+
+  virtual ~EvaluationSnapshot() { }
+
+  virtual void runTask(int taskId) = 0;
+
+  virtual void finish() = 0;
+
+  /**
+   * Run all the tasks in the calling thread (and its OpenMP threads).
+   */
+  void run();
+
+  int iterationId;
+  int nTasks;
+};
+
+#ifndef _WIN32
+
+/**
+ * Pool of worker threads evaluating snapshots in the background.
+ * Tasks are handed out in the order the snapshots were pushed and snapshots
+ * are finished in that order too, so that score files list the iterations
+ * in order whatever the number of workers. If
+ * dropStaleSnapshots is set, snapshots that are still waiting when a newer
+ * one is pushed are discarded.
+ */
+class EvaluationQueue
+{
+ public:
+  EvaluationQueue(int nWorkers, bool dropStaleSnapshots);
+
+  /**
+   * Waits for the pending snapshots.
+   */
+  ~EvaluationQueue();
+
+  /**
+   * Queue snapshot for evaluation. The queue takes ownership of snapshot.
+   */
+  void push(EvaluationSnapshot* snapshot);
+
+  /**
+   * Block until all the snapshots pushed so far are evaluated.
+   */
+  void wait();
+
+  int getNbWorkers() { return nWorkers; }
+
+ private:
+  struct PendingSnapshot
+  {
+    EvaluationSnapshot* snapshot;
+    int nextTask;
+    int nRunningTasks;
+    // all the tasks are done
+    bool done;
+  };
+
+  int nWorkers;
+  bool dropStaleSnapshots;
+  bool stopping;
+
+  // snapshots with tasks not started yet, oldest first
+  deque<PendingSnapshot*> pending;
+  // snapshots not finished yet, in the order they were pushed
+  deque<PendingSnapshot*> unfinished;
+  // number of snapshots pushed and not finished yet
+  int nSnapshots;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t taskAvailable;
+  pthread_cond_t snapshotDone;
+  // serializes calls to finish (score files are appended)
+  pthread_mutex_t finishMutex;
+
+  vector<pthread_t> workers;
+
+  static void* workerThread(void* arg);
+
+  bool popTask(PendingSnapshot*& snapshot, int& taskId);
+
+  void taskDone(PendingSnapshot* snapshot);
+
+  /**
+   * Finish the done snapshots at the front of unfinished.
+   */
+  void finishReadySnapshots();
+};
+
+#endif // _WIN32
+
+#endif // EVALUATION_QUEUE_H
@@ -56,6 +56,7 @@ double GI_ICM::run(labelType* inferredLabels,
                    double* _loss)
 {
   bool useLossFunction = lossPerLabel!=0;
+  updatePairwiseTable();
   string paramMSRC;
   Config::Instance()->getParameter("msrc", paramMSRC);
   bool useMSRC = paramMSRC.c_str()[0] == '1';
@@ -83,14 +84,9 @@ double GI_ICM::run(labelType* inferredLabels,
   supernode *s;
   node cs;
 
-  // allocate memory to store features
-  int fvSize = feature->getSizeFeatureVector();
-  int max_index = fvSize + 1;
-  osvm_node* n = new osvm_node[max_index];
-  int i = 0;
-  for(i = 0;i < max_index-1; i++)
-    n[i].index = i+1;
-  n[i].index = -1;
+  // unary potentials do not change across iterations
+  double* allUnaryPotentials = new double[slice->getNbSupernodes()*param->nClasses];
+  computeAllUnaryPotentials(allUnaryPotentials);
 
   const map<int, supernode* >& _supernodes = slice->getSupernodes();
 
@@ -117,19 +113,20 @@ double GI_ICM::run(labelType* inferredLabels,
         s->getCenter(cs);
       }
 
+      const double* sidPotentials = allUnaryPotentials + (ulong)sid*param->nClasses;
+
       if(param->nClasses != 2) {
 
         for(int c = 0; c < (int)param->nClasses; c++) {
-          double unaryPotential = computeUnaryPotential(slice, sid, i);
+          double unaryPotential = sidPotentials[c];
           buf[c] = unaryPotential;
 
           // add pairwise potential
           if(param->includeLocalEdges) {
-            vector < supernode* >* lNeighbors = &(s->neighbors);
-            for(vector < supernode* >::iterator itN = lNeighbors->begin();
-                itN != lNeighbors->end(); itN++) {
-              double pairwisePotential = computePairwisePotential(slice, s, (*itN),
-                                                               c, inferredLabels[(*itN)->id]);
+            const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+            for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
+              double pairwisePotential = computePairwisePotential(sid, *itE,
+                                                               c, inferredLabels[itE->sid]);
               buf[c] += pairwisePotential;
             }
           }
@@ -139,16 +136,15 @@ double GI_ICM::run(labelType* inferredLabels,
         buf[T_FOREGROUND] = 0;
 
         const int c = T_BACKGROUND;
-        double unaryPotential = computeUnaryPotential(slice, sid, c);
+        double unaryPotential = sidPotentials[c];
         buf[c] = unaryPotential;
 
         // add pairwise potential
         if(param->includeLocalEdges) {
-          vector < supernode* >* lNeighbors = &(s->neighbors);
-          for(vector < supernode* >::iterator itN = lNeighbors->begin();
-              itN != lNeighbors->end(); itN++) {
-            double pairwisePotential = computePairwisePotential(slice, s, (*itN),
-                                                             c, inferredLabels[(*itN)->id]);
+          const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+          for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
+            double pairwisePotential = computePairwisePotential(sid, *itE,
+                                                             c, inferredLabels[itE->sid]);
 
             buf[c] += pairwisePotential;
           }
@@ -193,7 +189,7 @@ double GI_ICM::run(labelType* inferredLabels,
   }
 
   // cleaning  
-  delete[] n;
+  delete[] allUnaryPotentials;
   delete[] buf;
   return computeEnergy(inferredLabels);
 }
\ No newline at end of file
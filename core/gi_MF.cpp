@@ -68,6 +68,7 @@ double GI_MF::run(labelType* inferredLabels,
                    double* _loss)
 {
   bool useLossFunction = lossPerLabel!=0;
+  updatePairwiseTable();
   string paramMSRC;
   Config::Instance()->getParameter("msrc", paramMSRC);
   bool useMSRC = paramMSRC.c_str()[0] == '1';
@@ -113,6 +114,10 @@ double GI_MF::run(labelType* inferredLabels,
   }
   INFERENCE_PRINT("[gi_MF] maxPotential=%g, scale=%g\n", maxPotential, scale);
 
+  // unary potentials do not change across iterations
+  double* allUnaryPotentials = new double[nSupernodes*param->nClasses];
+  computeAllUnaryPotentials(allUnaryPotentials);
+
 #if EXP_DOMAIN
   INFERENCE_PRINT("[gi_MF] Computing in exp domain\n");
   // go to exponential domain
@@ -159,32 +164,32 @@ double GI_MF::run(labelType* inferredLabels,
       sid = its->first;
       s = its->second;
       bs = believes[sid];
+      const double* sidPotentials = allUnaryPotentials + (ulong)sid*param->nClasses;
 
       if(param->nClasses != 2) {
 
         for(int c = 0; c < (int)param->nClasses; c++) {
-          double unaryPotential = computeUnaryPotential(slice, sid, c) * scale;
+          double unaryPotential = sidPotentials[c] * scale;
 
           double pairwiseBelief = 0;
           if(param->includeLocalEdges) {
-            vector < supernode* >* lNeighbors = &(s->neighbors);
-            for(vector < supernode* >::iterator itN = lNeighbors->begin();
-                itN != lNeighbors->end(); itN++) {
+            const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+            for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
 
               // set edges once
-              if(its->first < (*itN)->id) {
+              if(sid < itE->sid) {
                 continue;
               }
 
 #if USE_LONG_RANGE_EDGES
-               double pairwisePotential = computePairwisePotential_distance(slice, s, (*itN),
-                                                                            c, inferredLabels[(*itN)->id]);
+               double pairwisePotential = computePairwisePotential_distance(sid, *itE,
+                                                                            c, inferredLabels[itE->sid]);
 #else
-               double pairwisePotential = computePairwisePotential(slice, s, (*itN),
-                                                                   c, inferredLabels[(*itN)->id]);
+               double pairwisePotential = computePairwisePotential(sid, *itE,
+                                                                   c, inferredLabels[itE->sid]);
 #endif
                pairwisePotential *= scale;
-               pairwiseBelief += believes[(*itN)->id][c] * pairwisePotential;
+               pairwiseBelief += believes[itE->sid][c] * pairwisePotential;
             }
           }
 #if EXP_DOMAIN
@@ -205,30 +210,29 @@ double GI_MF::run(labelType* inferredLabels,
 #endif
 
         c = T_BACKGROUND;
-        double unaryPotential = computeUnaryPotential(slice, sid, c) * scale;
+        double unaryPotential = sidPotentials[c] * scale;
         //printf("unaryPotential %d %g\n", sid, unaryPotential);
 
         double pairwiseBelief = 0;
         if(param->includeLocalEdges) {
-          vector < supernode* >* lNeighbors = &(s->neighbors);
-          for(vector < supernode* >::iterator itN = lNeighbors->begin();
-              itN != lNeighbors->end(); itN++) {
+          const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+          for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
 
             // set edges once
-            if(its->first < (*itN)->id) {
+            if(sid < itE->sid) {
               continue;
             }
 
 #if USE_LONG_RANGE_EDGES
-            double pairwisePotential = computePairwisePotential_distance(slice, s, (*itN),
-                                                                         c, inferredLabels[(*itN)->id]);
+            double pairwisePotential = computePairwisePotential_distance(sid, *itE,
+                                                                         c, inferredLabels[itE->sid]);
 #else
-            double pairwisePotential = computePairwisePotential(slice, s, (*itN),
-                                                                c, inferredLabels[(*itN)->id]);
+            double pairwisePotential = computePairwisePotential(sid, *itE,
+                                                                c, inferredLabels[itE->sid]);
 #endif
             pairwisePotential *= scale;
-            pairwiseBelief += believes[(*itN)->id][c] * pairwisePotential;
-            //printf("pairwisePotential %d %d %d %g %g %g\n", sid, (*itN)->id, c, pairwisePotential, believes[(*itN)->id][c], pairwiseBelief);
+            pairwiseBelief += believes[itE->sid][c] * pairwisePotential;
+            //printf("pairwisePotential %d %d %d %g %g %g\n", sid, itE->sid, c, pairwisePotential, believes[itE->sid][c], pairwiseBelief);
           }
         }
 #if EXP_DOMAIN
@@ -291,6 +295,7 @@ double GI_MF::run(labelType* inferredLabels,
   }
 
   // cleaning
+  delete[] allUnaryPotentials;
   return computeEnergy(inferredLabels);
 }
 
@@ -414,20 +414,19 @@ void GI_MRF::precomputeEdgeCosts()
   const map<int, supernode* >& _supernodes = slice->getSupernodes();
   for(map<int, supernode* >::const_iterator its = _supernodes.begin();
       its != _supernodes.end(); its++) {
-    vector < supernode* >* lNeighbors = &(its->second->neighbors);
     pix1 = its->first;
 
-    for(vector < supernode* >::iterator itN = lNeighbors->begin();
-        itN != lNeighbors->end(); itN++) {
+    const edgeInfo* itE_end = slice->getEdgesEnd(pix1);
+    for(const edgeInfo* itE = slice->getEdgesBegin(pix1); itE != itE_end; ++itE) {
       // set edges once
-      if(its->first < (*itN)->id) {
+      if(pix1 < itE->sid) {
         continue;
       }
         
-      pix2 = (*itN)->id;
+      pix2 = itE->sid;
 
-      gradientIdx = slice->getGradientIdx(pix1,pix2);
-      orientationIdx = slice->getOrientationIdx(pix1, pix2);
+      gradientIdx = itE->gradientIdx;
+      orientationIdx = itE->orientationIdx;
         
       edgeIdx = pix1*nNodes + pix2;
       edgeIdxToGradientIdx[edgeIdx] = gradientIdx;
@@ -0,0 +1,636 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "gi_bp.h"
+
+// SliceMe
+#include "Config.h"
+#include "profiler.h"
+#include "utils.h"
+
+#include "inference_globals.h"
+
+#include <float.h>
+#include <queue>
+
+//------------------------------------------------------------------------------
+
+// potentials are rescaled so that the maximum potential is equal to this value
+// before computing marginals (same normalization as GI_libDAI)
+#define BP_MARGINAL_MAX_POTENTIAL 5.0
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+GI_BP::GI_BP(Slice_P* _slice,
+             const EnergyParam* _param,
+             double* _smw,
+             labelType* _groundTruthLabels,
+             double* _lossPerLabel,
+             Feature* _feature,
+             map<sidType, nodeCoeffType>* _nodeCoeffs,
+             map<sidType, edgeCoeffType>* _edgeCoeffs)
+{
+  GraphInference::init();
+  slice = _slice;
+  param = _param;
+  smw = _smw;
+  lossPerLabel = _lossPerLabel;
+  groundTruthLabels = _groundTruthLabels;
+  feature = _feature;
+  nodeCoeffs = _nodeCoeffs;
+  edgeCoeffs = _edgeCoeffs;
+
+  nNodes = slice->getNbSupernodes();
+  nClasses = param->nClasses;
+  unaryScores = 0;
+  edgeOffsets = 0;
+  nDirectedEdges = 0;
+  edgeTargets = 0;
+  reverseEdges = 0;
+  edgeBins = 0;
+  edgeCoeffs_f = 0;
+  pairwiseScores = 0;
+  messages = 0;
+  messagesComputed = false;
+  maxPotential = 0;
+
+  string config_tmp;
+#ifdef WITH_OPENMP
+  schedule = BP_SCHEDULE_PARALLEL;
+#else
+  schedule = BP_SCHEDULE_SEQUENTIAL;
+#endif
+  if(Config::Instance()->getParameter("bp_schedule", config_tmp)) {
+    schedule = atoi(config_tmp.c_str());
+  }
+  damping = 0;
+  if(Config::Instance()->getParameter("bp_damping", config_tmp)) {
+    damping = atof(config_tmp.c_str());
+  }
+  tolerance = 1e-6;
+  if(Config::Instance()->getParameter("bp_tolerance", config_tmp)) {
+    tolerance = atof(config_tmp.c_str());
+  }
+
+  precomputeUnaryScores();
+  buildEdges();
+  if(schedule == BP_SCHEDULE_PARALLEL) {
+    colorNodes();
+  }
+
+  INFERENCE_PRINT("[GI_BP] %ld nodes, %ld directed edges, schedule=%d, damping=%g, %ld colors\n",
+                  nNodes, nDirectedEdges, schedule, damping, colorClasses.size());
+}
+
+GI_BP::~GI_BP()
+{
+  if(unaryScores) {
+    delete[] unaryScores;
+  }
+  if(edgeOffsets) {
+    delete[] edgeOffsets;
+  }
+  if(edgeTargets) {
+    delete[] edgeTargets;
+  }
+  if(reverseEdges) {
+    delete[] reverseEdges;
+  }
+  if(edgeBins) {
+    delete[] edgeBins;
+  }
+  if(edgeCoeffs_f) {
+    delete[] edgeCoeffs_f;
+  }
+  if(pairwiseScores) {
+    delete[] pairwiseScores;
+  }
+  if(messages) {
+    delete[] messages;
+  }
+}
+
+void GI_BP::precomputeUnaryScores()
+{
+  bool useLossFunction = lossPerLabel!=0;
+
+  string config_tmp;
+  int loss_function = 0;
+  if(Config::Instance()->getParameter("loss_function", config_tmp)) {
+    loss_function = atoi(config_tmp.c_str());
+  }
+
+  double* allUnaryPotentials = new double[nNodes*nClasses];
+  computeAllUnaryPotentials(allUnaryPotentials);
+
+  unaryScores = new float[nNodes*nClasses];
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    double coeff = nodeCoeffs?(*nodeCoeffs)[sid]:1.0;
+    for(int c = 0; c < nClasses; ++c) {
+      double score = allUnaryPotentials[sid*nClasses + c]*coeff;
+
+      if(useLossFunction && c != groundTruthLabels[sid]) {
+        // add loss of the ground truth label
+        double loss;
+        if(loss_function == LOSS_NODE_BASED) {
+          loss = lossPerLabel[sid];
+        } else {
+          loss = lossPerLabel[groundTruthLabels[sid]];
+        }
+        score += loss*coeff;
+      }
+
+      unaryScores[sid*nClasses + c] = score;
+      if(fabs(score) > maxPotential) {
+        maxPotential = fabs(score);
+      }
+    }
+  }
+  delete[] allUnaryPotentials;
+}
+
+void GI_BP::buildEdges()
+{
+  edgeOffsets = new ulong[nNodes+1];
+  for(ulong sid = 0; sid <= nNodes; ++sid) {
+    edgeOffsets[sid] = 0;
+  }
+
+  if(!param->includeLocalEdges) {
+    return;
+  }
+
+  updatePairwiseTable();
+  int nPairwiseStates = nClasses*nClasses;
+  int nBins = pairwiseTable.getNbBins();
+  pairwiseScores = new float[nBins*nPairwiseStates];
+  for(int bin = 0; bin < nBins; ++bin) {
+    const double* scores = pairwiseTable.getScores(bin);
+    for(int p = 0; p < nPairwiseStates; ++p) {
+      pairwiseScores[bin*nPairwiseStates + p] = scores[p];
+    }
+  }
+
+  // undirected edges, in the same order as the other backends so that the
+  // edge coefficients match
+  vector<sidType> edgeNodes;
+  vector<int> bins;
+  vector<float> coeffs;
+  edgeNodes.reserve(2*slice->getNbUndirectedEdges());
+  ulong edgeId = 0;
+  for(ulong sid = 0; sid < nNodes; sid++) {
+    const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+    for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
+
+      // set edges once
+      if((sidType)sid < itE->sid) {
+        continue;
+      }
+
+      int bin = pairwiseTable.getBin(*itE);
+      double coeff = edgeCoeffs?(*edgeCoeffs)[edgeId]:1.0;
+      edgeNodes.push_back(sid);
+      edgeNodes.push_back(itE->sid);
+      bins.push_back(bin);
+      coeffs.push_back(coeff);
+      ++edgeOffsets[sid+1];
+      ++edgeOffsets[itE->sid+1];
+
+      const double* scores = pairwiseTable.getScores(bin);
+      for(int p = 0; p < nPairwiseStates; ++p) {
+        if(fabs(scores[p]*coeff) > maxPotential) {
+          maxPotential = fabs(scores[p]*coeff);
+        }
+      }
+      ++edgeId;
+    }
+  }
+
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    edgeOffsets[sid+1] += edgeOffsets[sid];
+  }
+  nDirectedEdges = edgeOffsets[nNodes];
+
+  edgeTargets = new sidType[nDirectedEdges];
+  reverseEdges = new ulong[nDirectedEdges];
+  edgeBins = new int[nDirectedEdges];
+  edgeCoeffs_f = new float[nDirectedEdges];
+
+  vector<ulong> fill(edgeOffsets, edgeOffsets + nNodes);
+  for(ulong e = 0; e < bins.size(); ++e) {
+    sidType i = edgeNodes[2*e];
+    sidType j = edgeNodes[2*e+1];
+    ulong a = fill[i]++;
+    ulong b = fill[j]++;
+    edgeTargets[a] = j;
+    edgeTargets[b] = i;
+    reverseEdges[a] = b;
+    reverseEdges[b] = a;
+    edgeBins[a] = bins[e];
+    edgeBins[b] = bins[e];
+    edgeCoeffs_f[a] = coeffs[e];
+    edgeCoeffs_f[b] = coeffs[e];
+  }
+
+  messages = new float[nDirectedEdges*nClasses];
+}
+
+void GI_BP::colorNodes()
+{
+  // greedy coloring : nodes with the same color are not neighbors
+  vector<int> colors(nNodes, -1);
+  vector<ulong> usedBy;
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    for(ulong e = edgeOffsets[sid]; e < edgeOffsets[sid+1]; ++e) {
+      int c = colors[edgeTargets[e]];
+      if(c != -1) {
+        usedBy[c] = sid;
+      }
+    }
+    int color = 0;
+    while(color < (int)usedBy.size() && usedBy[color] == sid) {
+      ++color;
+    }
+    if(color == (int)usedBy.size()) {
+      usedBy.push_back(nNodes);
+      colorClasses.push_back(vector<sidType>());
+    }
+    colors[sid] = color;
+    colorClasses[color].push_back(sid);
+  }
+}
+
+void GI_BP::computeBelief(sidType sid, float* belief)
+{
+  const float* u = unaryScores + (ulong)sid*nClasses;
+  for(int c = 0; c < nClasses; ++c) {
+    belief[c] = u[c];
+  }
+  for(ulong e = edgeOffsets[sid]; e < edgeOffsets[sid+1]; ++e) {
+    const float* m = messages + reverseEdges[e]*nClasses;
+    for(int c = 0; c < nClasses; ++c) {
+      belief[c] += m[c];
+    }
+  }
+}
+
+float GI_BP::updateNode(sidType sid, float gamma, float* buffer,
+                        int direction, float* deltas)
+{
+  float* belief = buffer;
+  float* h = buffer + nClasses;
+  float* m = buffer + 2*nClasses;
+
+  computeBelief(sid, belief);
+  if(gamma != 1) {
+    for(int c = 0; c < nClasses; ++c) {
+      belief[c] *= gamma;
+    }
+  }
+
+  float maxDelta = 0;
+  for(ulong e = edgeOffsets[sid]; e < edgeOffsets[sid+1]; ++e) {
+    sidType t = edgeTargets[e];
+    if((direction > 0 && t < sid) || (direction < 0 && t > sid)) {
+      continue;
+    }
+
+    // remove the message coming from the target
+    const float* mIn = messages + reverseEdges[e]*nClasses;
+    for(int c = 0; c < nClasses; ++c) {
+      h[c] = belief[c] - mIn[c];
+    }
+
+    float maxM = -FLT_MAX;
+    for(int lt = 0; lt < nClasses; ++lt) {
+      float best = -FLT_MAX;
+      for(int ls = 0; ls < nClasses; ++ls) {
+        float v = h[ls] + getPairwiseScore(sid, e, ls, lt);
+        if(v > best) {
+          best = v;
+        }
+      }
+      m[lt] = best;
+      if(best > maxM) {
+        maxM = best;
+      }
+    }
+
+    // normalize so that the maximum of each message is 0
+    float* mOut = messages + e*nClasses;
+    float delta = 0;
+    for(int lt = 0; lt < nClasses; ++lt) {
+      float v = damping*mOut[lt] + (1 - damping)*(m[lt] - maxM);
+      if(fabs(v - mOut[lt]) > delta) {
+        delta = fabs(v - mOut[lt]);
+      }
+      mOut[lt] = v;
+    }
+
+    if(deltas) {
+      deltas[e - edgeOffsets[sid]] = delta;
+    }
+    if(delta > maxDelta) {
+      maxDelta = delta;
+    }
+  }
+  return maxDelta;
+}
+
+size_t GI_BP::runSequential(size_t maxiter)
+{
+  float* buffer = new float[3*nClasses];
+  size_t iter = 0;
+  while(iter < maxiter) {
+    ++iter;
+    float maxDelta = 0;
+    for(ulong sid = 0; sid < nNodes; ++sid) {
+      maxDelta = max(maxDelta, updateNode(sid, 1, buffer, 0, 0));
+    }
+    if(maxDelta < tolerance) {
+      break;
+    }
+  }
+  delete[] buffer;
+  return iter;
+}
+
+size_t GI_BP::runResidual(size_t maxiter)
+{
+  float* buffer = new float[3*nClasses];
+  ulong maxDegree = 0;
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    maxDegree = max(maxDegree, edgeOffsets[sid+1] - edgeOffsets[sid]);
+  }
+  float* deltas = new float[maxDegree+1];
+
+  // residual of a node is the largest change of its incoming messages since
+  // it was last updated. Entries of the queue are discarded if the residual
+  // of the node changed after they were pushed.
+  vector<float> residuals(nNodes, FLT_MAX);
+  priority_queue< pair<float, sidType> > pending;
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    pending.push(make_pair(FLT_MAX, (sidType)sid));
+  }
+
+  ulong maxUpdates = maxiter*nNodes;
+  ulong nUpdates = 0;
+  while(!pending.empty() && nUpdates < maxUpdates) {
+    pair<float, sidType> top = pending.top();
+    pending.pop();
+    sidType sid = top.second;
+    if(top.first != residuals[sid]) {
+      continue;
+    }
+    if(top.first < tolerance) {
+      break;
+    }
+
+    residuals[sid] = 0;
+    updateNode(sid, 1, buffer, 0, deltas);
+    ++nUpdates;
+
+    for(ulong e = edgeOffsets[sid]; e < edgeOffsets[sid+1]; ++e) {
+      sidType t = edgeTargets[e];
+      float delta = deltas[e - edgeOffsets[sid]];
+      if(delta > residuals[t]) {
+        residuals[t] = delta;
+        pending.push(make_pair(delta, t));
+      }
+    }
+  }
+
+  delete[] deltas;
+  delete[] buffer;
+  return (nUpdates + nNodes - 1)/max(nNodes, (ulong)1);
+}
+
+size_t GI_BP::runParallel(size_t maxiter)
+{
+  size_t iter = 0;
+  while(iter < maxiter) {
+    ++iter;
+    float maxDelta = 0;
+    for(ulong color = 0; color < colorClasses.size(); ++color) {
+      const vector<sidType>& nodes = colorClasses[color];
+      long nColorNodes = nodes.size();
+
+#ifdef WITH_OPENMP
+      #pragma omp parallel
+#endif
+      {
+        float* buffer = new float[3*nClasses];
+        float localMaxDelta = 0;
+#ifdef WITH_OPENMP
+        #pragma omp for schedule(dynamic, 256)
+#endif
+        for(long n = 0; n < nColorNodes; ++n) {
+          localMaxDelta = max(localMaxDelta, updateNode(nodes[n], 1, buffer, 0, 0));
+        }
+#ifdef WITH_OPENMP
+        #pragma omp critical
+#endif
+        {
+          if(localMaxDelta > maxDelta) {
+            maxDelta = localMaxDelta;
+          }
+        }
+        delete[] buffer;
+      }
+    }
+    if(maxDelta < tolerance) {
+      break;
+    }
+  }
+  return iter;
+}
+
+size_t GI_BP::runTRWS(size_t maxiter)
+{
+  // weight of each node is one over the number of monotonic chains going
+  // through it for the ordering given by the node ids
+  vector<float> gammas(nNodes);
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    ulong nLower = 0;
+    ulong nHigher = 0;
+    for(ulong e = edgeOffsets[sid]; e < edgeOffsets[sid+1]; ++e) {
+      if(edgeTargets[e] < (sidType)sid) {
+        ++nLower;
+      } else {
+        ++nHigher;
+      }
+    }
+    gammas[sid] = 1.0f/max(max(nLower, nHigher), (ulong)1);
+  }
+
+  float* buffer = new float[3*nClasses];
+  size_t iter = 0;
+  while(iter < maxiter) {
+    ++iter;
+    float maxDelta = 0;
+    // forward pass
+    for(ulong sid = 0; sid < nNodes; ++sid) {
+      maxDelta = max(maxDelta, updateNode(sid, gammas[sid], buffer, 1, 0));
+    }
+    // backward pass
+    for(long sid = nNodes - 1; sid >= 0; --sid) {
+      maxDelta = max(maxDelta, updateNode(sid, gammas[sid], buffer, -1, 0));
+    }
+    if(maxDelta < tolerance) {
+      break;
+    }
+  }
+  delete[] buffer;
+  return iter;
+}
+
+size_t GI_BP::runSchedule(size_t maxiter)
+{
+  if(messages) {
+    for(ulong i = 0; i < nDirectedEdges*nClasses; ++i) {
+      messages[i] = 0;
+    }
+  }
+
+  size_t nIterations = 0;
+  switch(schedule)
+    {
+    case BP_SCHEDULE_SEQUENTIAL:
+      nIterations = runSequential(maxiter);
+      break;
+    case BP_SCHEDULE_RESIDUAL:
+      nIterations = runResidual(maxiter);
+      break;
+    case BP_SCHEDULE_PARALLEL:
+      nIterations = runParallel(maxiter);
+      break;
+    case BP_SCHEDULE_TRWS:
+      nIterations = runTRWS(maxiter);
+      break;
+    default:
+      printf("[GI_BP] Unknown schedule %d\n", schedule);
+      exit(-1);
+      break;
+    }
+  messagesComputed = true;
+  return nIterations;
+}
+
+void GI_BP::decode(labelType* labels)
+{
+  float* belief = new float[nClasses];
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    computeBelief(sid, belief);
+    int bestLabel = 0;
+    for(int c = 1; c < nClasses; ++c) {
+      if(belief[c] > belief[bestLabel]) {
+        bestLabel = c;
+      }
+    }
+    labels[sid] = bestLabel;
+  }
+  delete[] belief;
+}
+
+void GI_BP::decodeTRWS(labelType* labels)
+{
+  // labels are assigned in order, conditioned on the labels of the lower
+  // neighbors and on the messages of the higher ones
+  float* score = new float[nClasses];
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    const float* u = unaryScores + sid*nClasses;
+    for(int c = 0; c < nClasses; ++c) {
+      score[c] = u[c];
+    }
+    for(ulong e = edgeOffsets[sid]; e < edgeOffsets[sid+1]; ++e) {
+      sidType t = edgeTargets[e];
+      if(t < (sidType)sid) {
+        for(int c = 0; c < nClasses; ++c) {
+          score[c] += getPairwiseScore(sid, e, c, labels[t]);
+        }
+      } else {
+        const float* m = messages + reverseEdges[e]*nClasses;
+        for(int c = 0; c < nClasses; ++c) {
+          score[c] += m[c];
+        }
+      }
+    }
+    int bestLabel = 0;
+    for(int c = 1; c < nClasses; ++c) {
+      if(score[c] > score[bestLabel]) {
+        bestLabel = c;
+      }
+    }
+    labels[sid] = bestLabel;
+  }
+  delete[] score;
+}
+
+double GI_BP::run(labelType* inferredLabels,
+                  int id,
+                  size_t maxiter,
+                  labelType* nodeLabelsGroundTruth,
+                  bool computeEnergyAtEachIteration,
+                  double* _loss)
+{
+  size_t nIterations;
+  {
+    PROFILE_SCOPE("bp");
+    nIterations = runSchedule(maxiter);
+  }
+  PROFILE_COUNT("bp_iterations", nIterations);
+  INFERENCE_PRINT("[GI_BP] %ld iterations\n", (long)nIterations);
+
+  if(schedule == BP_SCHEDULE_TRWS) {
+    decodeTRWS(inferredLabels);
+  } else {
+    decode(inferredLabels);
+  }
+
+  if(_loss) {
+    *_loss = 0;
+  }
+
+  return GraphInference::computeEnergy(inferredLabels);
+}
+
+void GI_BP::getMarginals(float* marginals, const int label)
+{
+  if(!messagesComputed) {
+    runSchedule(INFERENCE_MAX_ITER);
+  }
+
+  double scale = 1;
+  if(maxPotential != 0) {
+    scale = BP_MARGINAL_MAX_POTENTIAL/maxPotential;
+  }
+
+  float* belief = new float[nClasses];
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    computeBelief(sid, belief);
+    float maxBelief = belief[0];
+    for(int c = 1; c < nClasses; ++c) {
+      maxBelief = max(maxBelief, belief[c]);
+    }
+    double sum = 0;
+    for(int c = 0; c < nClasses; ++c) {
+      sum += exp(scale*(belief[c] - maxBelief));
+    }
+    marginals[sid] = exp(scale*(belief[label] - maxBelief))/sum;
+  }
+  delete[] belief;
+}
@@ -0,0 +1,154 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef GI_BP_H
+#define GI_BP_H
+
+// SliceMe
+#include "Feature.h"
+#include "Slice_P.h"
+
+#include "graphInference.h"
+#include "energyParam.h"
+
+// standard libraries
+#include <map>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+// message passing schedules (config parameter bp_schedule)
+#define BP_SCHEDULE_SEQUENTIAL 0
+#define BP_SCHEDULE_RESIDUAL 1
+#define BP_SCHEDULE_PARALLEL 2
+#define BP_SCHEDULE_TRWS 3
+
+//------------------------------------------------------------------------------
+
+/**
+ * Max-product loopy belief propagation working directly on the adjacency of
+ * the supernodes. Messages are stored in the log domain as floats in a single
+ * array indexed by directed edge so no factor graph has to be built.
+ * Supported schedules :
+ * - sequential : nodes are updated in order (same as libDAI SEQFIX).
+ * - residual : the node whose incoming messages changed most is updated first.
+ * - parallel : nodes are greedily colored and nodes of the same color, which
+ *   are never neighbors, are updated in parallel.
+ * - TRW-S : sequential tree-reweighted message passing (Kolmogorov 2006).
+ */
+class GI_BP : public GraphInference
+{
+ public:
+
+  /**
+   * Constructor for SSVM framework
+   */
+  GI_BP(Slice_P* _slice,
+        const EnergyParam* _param,
+        double* _smw,
+        labelType* _groundTruthLabels,
+        double* _lossPerLabel,
+        Feature* _feature,
+        std::map<sidType, nodeCoeffType>* _nodeCoeffs,
+        std::map<sidType, edgeCoeffType>* _edgeCoeffs);
+
+  ~GI_BP();
+
+  double run(labelType* inferredLabels,
+             int id,
+             size_t maxiter,
+             labelType* nodeLabelsGroundTruth = 0,
+             bool computeEnergyAtEachIteration = false,
+             double* _loss = 0);
+
+  /**
+   * Normalized max-marginals of a given label for all the supernodes.
+   * Potentials are rescaled as in GI_libDAI so that exported values can be
+   * compared. Runs BP if run was not called before.
+   */
+  void getMarginals(float* marginals, const int label);
+
+  int getSchedule() { return schedule; }
+
+ private:
+  ulong nNodes;
+  int nClasses;
+
+  // nNodes x nClasses scores (including loss and node coefficients)
+  float* unaryScores;
+
+  // Directed edges of node i are stored in [edgeOffsets[i], edgeOffsets[i+1])
+  ulong* edgeOffsets;
+  ulong nDirectedEdges;
+  sidType* edgeTargets;
+  ulong* reverseEdges;
+  int* edgeBins;
+  float* edgeCoeffs_f;
+
+  // nBins x nClasses x nClasses, indexed by label(max sid)*nClasses + label(min sid)
+  float* pairwiseScores;
+
+  // message sent along each directed edge, indexed by the label of the target
+  float* messages;
+  bool messagesComputed;
+
+  // maximum absolute potential (used to rescale marginals)
+  double maxPotential;
+
+  int schedule;
+  float damping;
+  float tolerance;
+
+  // node colors for the parallel schedule
+  std::vector< std::vector<sidType> > colorClasses;
+
+  void precomputeUnaryScores();
+
+  void buildEdges();
+
+  void colorNodes();
+
+  // score of directed edge e going out of node sid
+  inline float getPairwiseScore(sidType sid, ulong e, int s_label, int t_label) {
+    const float* scores = pairwiseScores + edgeBins[e]*nClasses*nClasses;
+    int p = (sid > edgeTargets[e])?(s_label*nClasses + t_label):(t_label*nClasses + s_label);
+    return scores[p]*edgeCoeffs_f[e];
+  }
+
+  // unary score plus all the incoming messages
+  void computeBelief(sidType sid, float* belief);
+
+  /**
+   * Recompute the messages sent by node sid. The belief is multiplied by
+   * gamma (1 except for TRW-S). If direction is positive (resp. negative),
+   * only messages to neighbors with a higher (resp. lower) id are updated.
+   * buffer must hold 3*nClasses floats. Returns the largest change of a
+   * message value and stores the change of each outgoing message in deltas
+   * if not null.
+   */
+  float updateNode(sidType sid, float gamma, float* buffer,
+                   int direction, float* deltas);
+
+  size_t runSchedule(size_t maxiter);
+  size_t runSequential(size_t maxiter);
+  size_t runResidual(size_t maxiter);
+  size_t runParallel(size_t maxiter);
+  size_t runTRWS(size_t maxiter);
+
+  void decode(labelType* labels);
+  void decodeTRWS(labelType* labels);
+};
+
+#endif //GI_BP_H
@@ -0,0 +1,370 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "gi_expansion.h"
+
+// SliceMe
+#include "Config.h"
+#include "profiler.h"
+#include "utils.h"
+
+#include "inference_globals.h"
+
+//------------------------------------------------------------------------------
+
+// tolerance used to check the metric condition on the pairwise table
+#define EXPANSION_METRIC_EPSILON 1e-9
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+GI_expansion::GI_expansion(Slice_P* _slice,
+                           const EnergyParam* _param,
+                           double* _smw,
+                           labelType* _groundTruthLabels,
+                           double* _lossPerLabel,
+                           Feature* _feature,
+                           map<sidType, nodeCoeffType>* _nodeCoeffs,
+                           map<sidType, edgeCoeffType>* _edgeCoeffs)
+{
+  GraphInference::init();
+  slice = _slice;
+  param = _param;
+  smw = _smw;
+  lossPerLabel = _lossPerLabel;
+  groundTruthLabels = _groundTruthLabels;
+  feature = _feature;
+  nodeCoeffs = _nodeCoeffs;
+  edgeCoeffs = _edgeCoeffs;
+
+  nNodes = slice->getNbSupernodes();
+  nClasses = param->nClasses;
+  unaryEnergies = 0;
+  isMetric = true;
+
+  precomputeUnaryEnergies();
+  if(param->includeLocalEdges) {
+    precomputeEdges();
+  }
+
+  g = new GraphType(nNodes, moveEdges.size());
+
+  INFERENCE_PRINT("[GI_expansion] %ld nodes, %ld edges, %d classes. Using %s moves\n",
+                  nNodes, moveEdges.size(), nClasses, isMetric?"expansion":"swap");
+}
+
+GI_expansion::~GI_expansion()
+{
+  if(g) {
+    delete g;
+  }
+  if(unaryEnergies) {
+    delete[] unaryEnergies;
+  }
+}
+
+void GI_expansion::precomputeUnaryEnergies()
+{
+  bool useLossFunction = lossPerLabel!=0;
+
+  string config_tmp;
+  int loss_function = 0;
+  if(Config::Instance()->getParameter("loss_function", config_tmp)) {
+    loss_function = atoi(config_tmp.c_str());
+  }
+
+  unaryEnergies = new double[nNodes*nClasses];
+  computeAllUnaryPotentials(unaryEnergies);
+
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    double* u = unaryEnergies + sid*nClasses;
+    double coeff = nodeCoeffs?(*nodeCoeffs)[sid]:1.0;
+    for(int c = 0; c < nClasses; ++c) {
+      double score = u[c]*coeff;
+
+      if(useLossFunction && c != groundTruthLabels[sid]) {
+        // add loss of the ground truth label
+        double loss;
+        if(loss_function == LOSS_NODE_BASED) {
+          loss = lossPerLabel[sid];
+        } else {
+          loss = lossPerLabel[groundTruthLabels[sid]];
+        }
+        score += loss*coeff;
+      }
+
+      // scores are maximized and energies minimized
+      u[c] = -score;
+    }
+  }
+}
+
+void GI_expansion::precomputeEdges()
+{
+  updatePairwiseTable();
+
+  int nSupernodes = slice->getNbSupernodes();
+  moveEdges.reserve(slice->getNbUndirectedEdges());
+  ulong edgeId = 0;
+  for(int sid = 0; sid < nSupernodes; sid++) {
+    const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+    for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
+
+      // set edges once
+      if(sid < itE->sid) {
+        continue;
+      }
+
+      moveEdge e;
+      e.i = sid;
+      e.j = itE->sid;
+      e.scores = pairwiseTable.getScores(pairwiseTable.getBin(*itE));
+      e.coeff = edgeCoeffs?(*edgeCoeffs)[edgeId]:1.0;
+      moveEdges.push_back(e);
+      ++edgeId;
+    }
+  }
+
+  // Expansion moves are regular if E(a,a) + E(b,c) <= E(b,a) + E(a,c) for all
+  // labels a,b,c (Kolmogorov and Zabih). Edge coefficients are positive so
+  // checking the bins of the pairwise table is enough.
+  isMetric = true;
+  for(int bin = 0; isMetric && bin < pairwiseTable.getNbBins(); ++bin) {
+    const double* scores = pairwiseTable.getScores(bin);
+    for(int a = 0; isMetric && a < nClasses; ++a) {
+      for(int b = 0; isMetric && b < nClasses; ++b) {
+        for(int c = 0; isMetric && c < nClasses; ++c) {
+          double lhs = -scores[a*nClasses + a] - scores[b*nClasses + c];
+          double rhs = -scores[b*nClasses + a] - scores[a*nClasses + c];
+          if(lhs > rhs + EXPANSION_METRIC_EPSILON) {
+            isMetric = false;
+          }
+        }
+      }
+    }
+  }
+}
+
+double GI_expansion::computeMoveEnergy(const labelType* labels)
+{
+  double energy = 0;
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    energy += unaryEnergies[sid*nClasses + labels[sid]];
+  }
+  for(vector<moveEdge>::const_iterator itE = moveEdges.begin();
+      itE != moveEdges.end(); ++itE) {
+    energy += getPairwiseEnergy(*itE, labels[itE->i], labels[itE->j]);
+  }
+  return energy;
+}
+
+void GI_expansion::addPairwiseTerm(sidType i, sidType j,
+                                   double A, double B, double C, double D,
+                                   ulong& nTruncated)
+{
+  // E(xi,xj) = A + (C-A)xi + (D-C)xj + (B+C-A-D)(1-xi)xj
+  // a node in the sink segment pays its source capacity
+  g->add_tweights(i, C-A, 0);
+  g->add_tweights(j, D-C, 0);
+  double cap = B+C-A-D;
+  if(cap < 0) {
+    cap = 0;
+    ++nTruncated;
+  }
+  g->add_edge(i, j, cap, 0);
+}
+
+bool GI_expansion::expansionMove(labelType* labels, labelType alpha, double& energy)
+{
+  // label 0 (source) keeps the current label, label 1 (sink) switches to alpha
+  g->reset();
+  g->add_node(nNodes);
+
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    const double* u = unaryEnergies + sid*nClasses;
+    g->add_tweights(sid, u[alpha], u[labels[sid]]);
+  }
+
+  ulong nTruncated = 0;
+  for(vector<moveEdge>::const_iterator itE = moveEdges.begin();
+      itE != moveEdges.end(); ++itE) {
+    labelType li = labels[itE->i];
+    labelType lj = labels[itE->j];
+    addPairwiseTerm(itE->i, itE->j,
+                    getPairwiseEnergy(*itE, li, lj),
+                    getPairwiseEnergy(*itE, li, alpha),
+                    getPairwiseEnergy(*itE, alpha, lj),
+                    getPairwiseEnergy(*itE, alpha, alpha),
+                    nTruncated);
+  }
+
+  {
+    PROFILE_SCOPE("maxflow");
+    g->maxflow();
+  }
+
+  labelType* newLabels = new labelType[nNodes];
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    newLabels[sid] = (g->what_segment(sid) == GraphType::SINK)?alpha:labels[sid];
+  }
+
+  double newEnergy = computeMoveEnergy(newLabels);
+  bool accepted = newEnergy < energy;
+  if(accepted) {
+    memcpy(labels, newLabels, nNodes*sizeof(labelType));
+    energy = newEnergy;
+  }
+  if(nTruncated > 0) {
+    INFERENCE_PRINT("[GI_expansion] %ld non-regular terms truncated in expansion move %d\n",
+                    nTruncated, (int)alpha);
+  }
+  delete[] newLabels;
+  return accepted;
+}
+
+bool GI_expansion::swapMove(labelType* labels, labelType alpha, labelType beta, double& energy)
+{
+  // only nodes labeled alpha or beta take part in the move.
+  // label 0 (source) is alpha, label 1 (sink) is beta
+  bool hasNodes = false;
+  g->reset();
+  g->add_node(nNodes);
+
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    if(labels[sid] == alpha || labels[sid] == beta) {
+      const double* u = unaryEnergies + sid*nClasses;
+      g->add_tweights(sid, u[beta], u[alpha]);
+      hasNodes = true;
+    }
+  }
+  if(!hasNodes) {
+    return false;
+  }
+
+  ulong nTruncated = 0;
+  for(vector<moveEdge>::const_iterator itE = moveEdges.begin();
+      itE != moveEdges.end(); ++itE) {
+    labelType li = labels[itE->i];
+    labelType lj = labels[itE->j];
+    bool iInMove = (li == alpha || li == beta);
+    bool jInMove = (lj == alpha || lj == beta);
+    if(iInMove && jInMove) {
+      addPairwiseTerm(itE->i, itE->j,
+                      getPairwiseEnergy(*itE, alpha, alpha),
+                      getPairwiseEnergy(*itE, alpha, beta),
+                      getPairwiseEnergy(*itE, beta, alpha),
+                      getPairwiseEnergy(*itE, beta, beta),
+                      nTruncated);
+    } else if(iInMove) {
+      g->add_tweights(itE->i, getPairwiseEnergy(*itE, beta, lj),
+                      getPairwiseEnergy(*itE, alpha, lj));
+    } else if(jInMove) {
+      g->add_tweights(itE->j, getPairwiseEnergy(*itE, li, beta),
+                      getPairwiseEnergy(*itE, li, alpha));
+    }
+  }
+
+  {
+    PROFILE_SCOPE("maxflow");
+    g->maxflow();
+  }
+
+  labelType* newLabels = new labelType[nNodes];
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    if(labels[sid] == alpha || labels[sid] == beta) {
+      newLabels[sid] = (g->what_segment(sid) == GraphType::SINK)?beta:alpha;
+    } else {
+      newLabels[sid] = labels[sid];
+    }
+  }
+
+  double newEnergy = computeMoveEnergy(newLabels);
+  bool accepted = newEnergy < energy;
+  if(accepted) {
+    memcpy(labels, newLabels, nNodes*sizeof(labelType));
+    energy = newEnergy;
+  }
+  if(nTruncated > 0) {
+    INFERENCE_PRINT("[GI_expansion] %ld non-regular terms truncated in swap move %d-%d\n",
+                    nTruncated, (int)alpha, (int)beta);
+  }
+  delete[] newLabels;
+  return accepted;
+}
+
+double GI_expansion::run(labelType* inferredLabels,
+                         int id,
+                         size_t maxiter,
+                         labelType* nodeLabelsGroundTruth,
+                         bool computeEnergyAtEachIteration,
+                         double* _loss)
+{
+  PROFILE_SCOPE("expansion");
+
+  // start from the labels maximizing the unary scores
+  labelType* labels = new labelType[nNodes];
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    const double* u = unaryEnergies + sid*nClasses;
+    labelType bestLabel = 0;
+    for(int c = 1; c < nClasses; ++c) {
+      if(u[c] < u[bestLabel]) {
+        bestLabel = c;
+      }
+    }
+    labels[sid] = bestLabel;
+  }
+
+  double energy = computeMoveEnergy(labels);
+  INFERENCE_PRINT("[GI_expansion] Initial energy %g\n", energy);
+
+  size_t nCycles = 0;
+  while(nCycles < maxiter) {
+    ++nCycles;
+    bool improved = false;
+    if(isMetric) {
+      for(int alpha = 0; alpha < nClasses; ++alpha) {
+        if(expansionMove(labels, alpha, energy)) {
+          improved = true;
+        }
+      }
+    } else {
+      for(int alpha = 0; alpha < nClasses; ++alpha) {
+        for(int beta = alpha + 1; beta < nClasses; ++beta) {
+          if(swapMove(labels, alpha, beta, energy)) {
+            improved = true;
+          }
+        }
+      }
+    }
+
+    if(computeEnergyAtEachIteration) {
+      INFERENCE_PRINT("[GI_expansion] Cycle %ld energy %g\n", (long)nCycles, energy);
+    }
+
+    if(!improved) {
+      break;
+    }
+  }
+  PROFILE_COUNT("expansion_cycles", nCycles);
+  INFERENCE_PRINT("[GI_expansion] Stopped after %ld cycles. Energy %g\n", (long)nCycles, energy);
+
+  for(ulong sid = 0; sid < nNodes; ++sid) {
+    inferredLabels[sid] = labels[sid];
+  }
+  delete[] labels;
+
+  return GraphInference::computeEnergy(inferredLabels);
+}
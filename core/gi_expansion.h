@@ -0,0 +1,121 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef GI_EXPANSION_H
+#define GI_EXPANSION_H
+
+// Include gi_maxflow.h first to get the maxflow graph type
+#include "gi_maxflow.h"
+
+// SliceMe
+#include "Feature.h"
+#include "Slice_P.h"
+
+#include "graphInference.h"
+#include "energyParam.h"
+
+// standard libraries
+#include <map>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+/**
+ * Multi-class inference with graph-cut moves (Boykov, Veksler and Zabih).
+ * Alpha-expansion is used if the pairwise potentials are a metric and
+ * alpha-beta swap otherwise. A single maxflow graph is allocated and reset
+ * between moves.
+ */
+class GI_expansion : public GraphInference
+{
+ public:
+
+  /**
+   * Constructor for SSVM framework
+   */
+  GI_expansion(Slice_P* _slice,
+               const EnergyParam* _param,
+               double* _smw,
+               labelType* _groundTruthLabels,
+               double* _lossPerLabel,
+               Feature* _feature,
+               std::map<sidType, nodeCoeffType>* _nodeCoeffs,
+               std::map<sidType, edgeCoeffType>* _edgeCoeffs);
+
+  ~GI_expansion();
+
+  /**
+   * Run moves until the energy stops decreasing or maxiter cycles over all
+   * the labels (or pairs of labels for swap moves) were performed.
+   */
+  double run(labelType* inferredLabels,
+             int id,
+             size_t maxiter,
+             labelType* nodeLabelsGroundTruth = 0,
+             bool computeEnergyAtEachIteration = false,
+             double* _loss = 0);
+
+  bool useExpansion() { return isMetric; }
+
+ private:
+
+  struct moveEdge
+  {
+    sidType i; // max sid
+    sidType j; // min sid
+    const double* scores;
+    double coeff;
+  };
+
+  GraphType* g;
+
+  ulong nNodes;
+  int nClasses;
+
+  // nNodes x nClasses energies (-score, including loss and node coefficients)
+  double* unaryEnergies;
+
+  std::vector<moveEdge> moveEdges;
+
+  // true if alpha-expansion can be used for all the edges
+  bool isMetric;
+
+  void precomputeUnaryEnergies();
+
+  void precomputeEdges();
+
+  // pairwise energy of edge e for labels li of e.i and lj of e.j
+  inline double getPairwiseEnergy(const moveEdge& e, labelType li, labelType lj) {
+    return -e.scores[li*nClasses + lj]*e.coeff;
+  }
+
+  double computeMoveEnergy(const labelType* labels);
+
+  bool expansionMove(labelType* labels, labelType alpha, double& energy);
+
+  bool swapMove(labelType* labels, labelType alpha, labelType beta, double& energy);
+
+  /**
+   * Add the binary term A=E(0,0), B=E(0,1), C=E(1,0), D=E(1,1) between
+   * nodes i and j. Label 0 is the source and label 1 the sink. Non-regular
+   * terms are truncated, which is why moves are only accepted if they
+   * decrease the energy.
+   */
+  void addPairwiseTerm(sidType i, sidType j,
+                       double A, double B, double C, double D,
+                       ulong& nTruncated);
+};
+
+#endif // GI_EXPANSION_H
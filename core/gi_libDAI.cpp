@@ -17,6 +17,7 @@
 
 // SliceMe
 #include "Config.h"
+#include "profiler.h"
 #include "utils.h"
 
 #include "inference_globals.h"
@@ -53,7 +54,6 @@ GI_libDAI::GI_libDAI(Slice_P* _slice,
   maxPotential = 0;
   unaryPotentials = 0;
   nUnaryPotentials = 0;
-  nEdgePotentials = 0;
   allocateGraph();
   buildSSVMGraph();
 }
@@ -165,6 +165,7 @@ double GI_libDAI::run(labelType* inferredLabels,
           bp.setProperties(opts);
           //Real maxDiff = bp.run();
           bp.run();
+          PROFILE_COUNT("bp_iterations", bp.Iterations());
 
           labels = bp.findMaximum();
 
@@ -194,6 +195,7 @@ double GI_libDAI::run(labelType* inferredLabels,
 
   } else {
     bp.run();
+    PROFILE_COUNT("bp_iterations", bp.Iterations());
     labels = bp.findMaximum();
 
     if(replaceVoidMSRC) {
@@ -290,15 +292,6 @@ void GI_libDAI::computeNodePotentials()
   Real *buf = new Real[param->nClasses];
   factors.clear();
 
-  // allocate memory to store features
-  int fvSize = feature->getSizeFeatureVector();
-  int max_index = fvSize + 1;
-  osvm_node* n = new osvm_node[max_index];
-  int i = 0;
-  for(i = 0;i < max_index-1; i++)
-    n[i].index = i+1;
-  n[i].index = -1;
-
   bool useLossFunction = lossPerLabel!=0;
 
   string config_tmp;
@@ -315,14 +308,18 @@ void GI_libDAI::computeNodePotentials()
     unaryPotentials[k] = new Real[param->nClasses];
   }
 
+  double* allUnaryPotentials = new double[nUnaryPotentials*param->nClasses];
+  computeAllUnaryPotentials(allUnaryPotentials);
+
   maxPotential = 0;
   for(map<int, supernode* >::const_iterator its = _supernodes.begin();
       its != _supernodes.end(); its++) {
     sid = its->first;
+    const double* sidPotentials = allUnaryPotentials + (ulong)sid*param->nClasses;
 
     if(param->nClasses != 2) {
       for(int i = 0; i < (int)param->nClasses; i++) {
-        double unaryPotential = computeUnaryPotential(slice, sid, i);
+        double unaryPotential = sidPotentials[i];
 
         if(nodeCoeffs) {
           unaryPotential *= (*nodeCoeffs)[sid];
@@ -337,7 +334,7 @@ void GI_libDAI::computeNodePotentials()
       // Only 2 classes.
       buf[T_FOREGROUND] = 0;
       const int i = T_BACKGROUND;
-      double unaryPotential = computeUnaryPotential(slice, sid, i);
+      double unaryPotential = sidPotentials[i];
 
       if(nodeCoeffs) {
         unaryPotential *= (*nodeCoeffs)[sid];
@@ -384,7 +381,7 @@ void GI_libDAI::computeNodePotentials()
     }
     //INFERENCE_PRINT("\n");
   }
-  delete[] n;
+  delete[] allUnaryPotentials;
   delete[] buf;
 }
 
@@ -436,62 +433,26 @@ void GI_libDAI::computeEdgePotentials()
 {
   // Pairwise factors
   if(param->nGradientLevels > 0) {
+    // edge potentials are looked up in the pairwise table when the factors
+    // are created. Only the maximum potential is needed here.
+    updatePairwiseTable();
     int nPairwiseStates = param->nClasses*param->nClasses;
-    int gradientIdx;
-    int orientationIdx;
-    int idx;
-    int oidx;
-    supernode *s;
-    const map<int, supernode* >& _supernodes = slice->getSupernodes();
-    nEdgePotentials = slice->getNbEdges();
-    INFERENCE_PRINT("[gi_libDAI] Allocating memory for %d edges and %d states\n",
-                    nEdgePotentials, nPairwiseStates);
-    for (uint k = 0; k < nEdgePotentials; ++k) {
-      edgePotentials[k] = new Real[nPairwiseStates];
-    }
-
+    int nSupernodes = slice->getNbSupernodes();
     uint edgeId = 0;
-    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-        its != _supernodes.end(); its++) {
-      s = its->second;
-      vector < supernode* >* lNeighbors = &(s->neighbors);
-      for(vector < supernode* >::iterator itN = lNeighbors->begin();
-          itN != lNeighbors->end(); itN++) {
+    for(int sid = 0; sid < nSupernodes; sid++) {
+      const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+      for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
 
         // set edges once
-        if(its->first < (*itN)->id) {
+        if(sid < itE->sid) {
           continue;
         }
 
-        gradientIdx = slice->getGradientIdx(its->first,(*itN)->id);
-        orientationIdx = slice->getOrientationIdx(its->first,(*itN)->id);
-        oidx = orientationIdx*param->nClasses*param->nClasses;
-#if USE_LONG_RANGE_EDGES
-        int distanceIdx = slice->getDistanceIdx(s->id, (*itN)->id);
-        oidx += distanceIdx*param->nGradientLevels*param->nClasses*param->nClasses*param->nOrientations;
-#endif
-
-        map<uint, Real*>::iterator lookup = edgePotentials.find(edgeId);
-        if(lookup == edgePotentials.end()) {
-          edgePotentials[edgeId] = new Real[nPairwiseStates];
-        }
-
+        const double* scores = pairwiseTable.getScores(pairwiseTable.getBin(*itE));
+        double coeff = edgeCoeffs?(*edgeCoeffs)[edgeId]:1.0;
         for(int p = 0; p < nPairwiseStates; p++ ) {
-          // w[0..nClasses-1] contains the unary weights
-          double w_sum = 0;
-          for(int i = 0; i <= gradientIdx; i++) {
-            idx = (i*param->nClasses*param->nClasses*param->nOrientations) + oidx + p;
-            w_sum += smw[idx+param->nUnaryWeights]; // param->nUnaryWeights is the offset due to unary terms
-          }
-
-          if(edgeCoeffs) {
-            w_sum *= (*edgeCoeffs)[edgeId];
-          }
-
-          edgePotentials[edgeId][p] = w_sum;
-
-          if (fabs(w_sum) > maxPotential) {
-            maxPotential = fabs(w_sum);
+          if (fabs(scores[p]*coeff) > maxPotential) {
+            maxPotential = fabs(scores[p]*coeff);
           }
         }
         ++edgeId;
@@ -519,41 +480,33 @@ void GI_libDAI::addLocalEdges()
   }
   INFERENCE_PRINT("[gi_libDAI] maxPotential=%g, scale=%g\n", maxPotential, scale);
 
+  int nSupernodes = slice->getNbSupernodes();
   if(param->nGradientLevels > 0) {
-    supernode *s;
     uint edgeId = 0;
     int nPairwiseStates = param->nClasses*param->nClasses;
-    const map<int, supernode* >& _supernodes = slice->getSupernodes();
-    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-        its != _supernodes.end(); its++) {
-      s = its->second;
-
-      vector < supernode* >* lNeighbors = &(s->neighbors);
-      for(vector < supernode* >::iterator itN = lNeighbors->begin();
-          itN != lNeighbors->end(); itN++) {
+    for(int sid = 0; sid < nSupernodes; sid++) {
+      const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+      for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
 
         // set edges once
-        if(its->first < (*itN)->id) {
+        if(sid < itE->sid) {
           continue;
         }
 
-        Factor fac( VarSet( vars[its->first], vars[(*itN)->id] ), 1.0 );
+        Factor fac( VarSet( vars[sid], vars[itE->sid] ), 1.0 );
+        const double* scores = pairwiseTable.getScores(pairwiseTable.getBin(*itE));
+        double coeff = edgeCoeffs?(*edgeCoeffs)[edgeId]*scale:scale;
         for(int p = 0; p < nPairwiseStates; p++ ) {
 #if LIBDAI_24
-          fac[p] = std::exp(edgePotentials[edgeId][p]*scale);
+          fac[p] = std::exp(scores[p]*coeff);
 #else
-          fac.set(p, std::exp(edgePotentials[edgeId][p]*scale));
+          fac.set(p, std::exp(scores[p]*coeff));
 #endif
         }
         factors.push_back(fac);
         ++edgeId;
       }
     }
-
-    for (uint k = 0; k < nEdgePotentials; ++k) {
-      delete[] edgePotentials[k];
-    }
-    edgePotentials.clear();
   } else {
     // potts model
     double gamma = smw[param->nUnaryWeights];
@@ -562,21 +515,18 @@ void GI_libDAI::addLocalEdges()
     }
     printf("gi_libDAI potts w[%d]=%g %g\n", param->nUnaryWeights, smw[param->nUnaryWeights], gamma);
     ulong edgeId = 0;
-    const map<int, supernode* >& _supernodes = slice->getSupernodes();
-    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-        its != _supernodes.end(); its++) {
-      vector < supernode* >* lNeighbors = &(its->second->neighbors);
-      for(vector < supernode* >::iterator itN = lNeighbors->begin();
-          itN != lNeighbors->end(); itN++)  {
-        assert(its->first != (*itN)->id);
+    for(int sid = 0; sid < nSupernodes; sid++) {
+      const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+      for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
+        assert(sid != itE->sid);
         // set edges once
-        if(its->first < (*itN)->id) {
+        if(sid < itE->sid) {
           continue;
         }
 
-        //Factor fac = createFactorPotts( vars[its->first], vars[(*itN)->id],gamma);
-        //Factor fac = createFactorIsing( vars[its->first], vars[(*itN)->id],gamma);
-        Factor fac( VarSet(vars[its->first], vars[(*itN)->id]), 1.0 );
+        //Factor fac = createFactorPotts( vars[sid], vars[itE->sid],gamma);
+        //Factor fac = createFactorIsing( vars[sid], vars[itE->sid],gamma);
+        Factor fac( VarSet(vars[sid], vars[itE->sid]), 1.0 );
         fac[0] = std::exp(gamma);
         if(edgeCoeffs) {
           fac[0] = fac[0]*(*edgeCoeffs)[edgeId];
@@ -110,8 +110,6 @@ class GI_libDAI : public GraphInference
 
   dai::Real** unaryPotentials;
   uint nUnaryPotentials;
-  map<uint, dai::Real*> edgePotentials;
-  uint nEdgePotentials;
 };
 
 #endif //GI_LIBDAI_H
\ No newline at end of file
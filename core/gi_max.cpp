@@ -76,24 +76,19 @@ double GI_max::run(labelType* inferredLabels,
   int sid = 0;
   double maxScore = 0;
 
-  // allocate memory to store features
-  int fvSize = feature->getSizeFeatureVector();
-  int max_index = fvSize + 1;
-  osvm_node* n = new osvm_node[max_index];
-  int i = 0;
-  for(i = 0;i < max_index-1; i++)
-    n[i].index = i+1;
-  n[i].index = -1;
+  double* allUnaryPotentials = new double[slice->getNbSupernodes()*param->nClasses];
+  computeAllUnaryPotentials(allUnaryPotentials);
 
   const map<int, supernode* >& _supernodes = slice->getSupernodes();
   for(map<int, supernode* >::const_iterator its = _supernodes.begin();
       its != _supernodes.end(); its++) {
     sid = its->first;
+    const double* sidPotentials = allUnaryPotentials + (ulong)sid*param->nClasses;
 
     if(param->nClasses != 2) {
       for(int i = 0; i < (int)param->nClasses; i++) {
 
-        double unaryPotential = computeUnaryPotential(slice, sid, i);
+        double unaryPotential = sidPotentials[i];
 
         if(nodeCoeffs) {
           unaryPotential *= (*nodeCoeffs)[sid];
@@ -105,7 +100,7 @@ double GI_max::run(labelType* inferredLabels,
       buf[T_FOREGROUND] = 0;
 
       const int i = T_BACKGROUND;
-      double unaryPotential = computeUnaryPotential(slice, sid, i);
+      double unaryPotential = sidPotentials[i];
 
       if(nodeCoeffs) {
         unaryPotential *= (*nodeCoeffs)[sid];
@@ -146,7 +141,7 @@ double GI_max::run(labelType* inferredLabels,
     }
   }
   
-  delete[] n;
+  delete[] allUnaryPotentials;
   delete[] buf;
   return computeEnergy(inferredLabels);
 }
@@ -17,6 +17,7 @@
 
 // SliceMe
 #include "Config.h"
+#include "profiler.h"
 #include "utils.h"
 
 #include "inference_globals.h"
@@ -48,6 +49,7 @@ GI_maxflow::GI_maxflow(Slice_P* _slice,
   edgePotentials = 0;
   nUnaryPotentials = 0;
   nEdgePotentials = 0;
+  reuseTrees = false;
   createGraph();
 }
 
@@ -73,6 +75,17 @@ void GI_maxflow::createGraph()
   }
 
   g = new GraphType(slice->getNbSupernodes(), slice->getNbUndirectedEdges());
+  reuseTrees = false;
+  computePotentials();
+
+  addUnaryNodes();
+  if(param->includeLocalEdges) {
+    addLocalEdges();
+  }
+}
+
+void GI_maxflow::computePotentials()
+{
   precomputeUnaryPotentials();
   if(param->includeLocalEdges) {
     precomputeEdgePotentials();
@@ -102,10 +115,94 @@ void GI_maxflow::createGraph()
       }
     }
   }
+}
 
-  addUnaryNodes();
+void GI_maxflow::setParam(const EnergyParam* _param)
+{
+  if(_param != &paramCopy) {
+    paramCopy = *_param;
+    // weights are owned by _param (and not used for inference)
+    paramCopy.weights = 0;
+  }
+  param = &paramCopy;
+}
+
+void GI_maxflow::updateGraph(const EnergyParam* _param,
+                             double* _smw,
+                             labelType* _groundTruthLabels,
+                             double* _lossPerLabel)
+{
+  setParam(_param);
+  smw = _smw;
+  groundTruthLabels = _groundTruthLabels;
+  lossPerLabel = _lossPerLabel;
+
+  // keep the capacities currently stored in the graph
+  maxflow_cap_type* oldTCaps = new maxflow_cap_type[nUnaryPotentials];
+  for(uint p = 0; p < nUnaryPotentials; p++) {
+    oldTCaps[p] = unaryPotentials[p][T_BACKGROUND] - unaryPotentials[p][T_FOREGROUND];
+  }
+  maxflow_cap_type* oldEdgePotentials = 0;
+  if(edgePotentials) {
+    oldEdgePotentials = new maxflow_cap_type[nEdgePotentials];
+    for(ulong e = 0; e < nEdgePotentials; e++) {
+      oldEdgePotentials[e] = edgePotentials[e];
+    }
+  }
+
+  computePotentials();
+
+  ulong nChangedNodes = 0;
+  ulong nChangedEdges = 0;
+
+  // Edges were added in the same order as edgePotentials, each of them
+  // followed by its reverse arc.
   if(param->includeLocalEdges) {
-    addLocalEdges();
+    GraphType::arc_id a = g->get_first_arc();
+    for(ulong edgeId = 0; edgeId < nEdgePotentials; edgeId++) {
+      GraphType::arc_id a_rev = g->get_next_arc(a);
+      float cap = edgePotentials[edgeId];
+      if(cap != (float)oldEdgePotentials[edgeId]) {
+        // the reverse arc has no capacity so its residual is the flow through a
+        float flow = g->get_rcap(a_rev);
+        GraphType::node_id i;
+        GraphType::node_id j;
+        g->get_arc_ends(a, i, j);
+        if(flow <= cap) {
+          g->set_rcap(a, cap - flow);
+        } else {
+          // The new capacity is below the current flow : saturate the arc and
+          // send the excess back through the terminal links. This only adds a
+          // constant to the energy.
+          float excess = flow - cap;
+          g->set_rcap(a, 0);
+          g->set_rcap(a_rev, cap);
+          g->set_trcap(i, g->get_trcap(i) + excess);
+          g->set_trcap(j, g->get_trcap(j) - excess);
+        }
+        g->mark_node(i);
+        g->mark_node(j);
+        ++nChangedEdges;
+      }
+      a = g->get_next_arc(a_rev);
+    }
+  }
+
+  for(uint p = 0; p < nUnaryPotentials; p++) {
+    float delta = (unaryPotentials[p][T_BACKGROUND] - unaryPotentials[p][T_FOREGROUND]) - oldTCaps[p];
+    if(delta != 0) {
+      g->set_trcap(p, g->get_trcap(p) + delta);
+      g->mark_node(p);
+      ++nChangedNodes;
+    }
+  }
+
+  INFERENCE_PRINT("[GI_maxflow] Graph updated. %ld/%ld nodes and %ld/%ld edges changed\n",
+                  nChangedNodes, nUnaryPotentials, nChangedEdges, nEdgePotentials);
+
+  delete[] oldTCaps;
+  if(oldEdgePotentials) {
+    delete[] oldEdgePotentials;
   }
 }
 
@@ -120,7 +217,12 @@ double GI_maxflow::run(labelType* inferredLabels,
                        bool computeEnergyAtEachIteration,
                        double* _loss)
 {
-  double flow = g->maxflow();
+  double flow;
+  {
+    PROFILE_SCOPE("maxflow");
+    flow = g->maxflow(reuseTrees);
+  }
+  reuseTrees = true;
   INFERENCE_PRINT("[GI_maxflow] flow=%g\n", flow);
 
   const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
@@ -158,10 +260,12 @@ void GI_maxflow::addUnaryNodes()
 void GI_maxflow::precomputeUnaryPotentials()
 {
   const map<sidType, supernode* >& _supernodes = slice->getSupernodes();
-  nUnaryPotentials = _supernodes.size();
-  unaryPotentials = new maxflow_cap_type*[nUnaryPotentials];
-  for(uint p = 0; p < nUnaryPotentials; p++) {
-    unaryPotentials[p] = new maxflow_cap_type[param->nClasses];
+  if(!unaryPotentials) {
+    nUnaryPotentials = _supernodes.size();
+    unaryPotentials = new maxflow_cap_type*[nUnaryPotentials];
+    for(uint p = 0; p < nUnaryPotentials; p++) {
+      unaryPotentials[p] = new maxflow_cap_type[param->nClasses];
+    }
   }
 
   bool useLossFunction = lossPerLabel!=0;
@@ -172,6 +276,9 @@ void GI_maxflow::precomputeUnaryPotentials()
     loss_function = atoi(config_tmp.c_str());
   }
 
+  double* allUnaryPotentials = new double[nUnaryPotentials*param->nClasses];
+  computeAllUnaryPotentials(allUnaryPotentials);
+
   double weightToSource = 0;
   double weightToSink = 0;
   sidType sid = 0;
@@ -180,7 +287,7 @@ void GI_maxflow::precomputeUnaryPotentials()
     sid = it->first;
 
     // Source = background
-    weightToSource = computeUnaryPotential(slice, sid, T_BACKGROUND);
+    weightToSource = allUnaryPotentials[(ulong)sid*param->nClasses + T_BACKGROUND];
 
     // Sink = foreground
     weightToSink = 0;
@@ -211,67 +318,53 @@ void GI_maxflow::precomputeUnaryPotentials()
     unaryPotentials[sid][T_FOREGROUND] = weightToSink;
     //printf("sid %d %g %g\n", sid, weightToSource, weightToSink);
   }
+  delete[] allUnaryPotentials;
 }
 
 void GI_maxflow::precomputeEdgePotentials()
 {
-  nEdgePotentials = slice->getNbUndirectedEdges();
-  edgePotentials = new maxflow_cap_type[nEdgePotentials];
+  if(!edgePotentials) {
+    nEdgePotentials = slice->getNbUndirectedEdges();
+    edgePotentials = new maxflow_cap_type[nEdgePotentials];
+  }
 
   // Pairwise factors
   if(param->nGradientLevels > 0) {
+    updatePairwiseTable();
     int nPairwiseStates = param->nClasses*param->nClasses;
     double *score = new double[nPairwiseStates];
-    int gradientIdx;
-    int idx;
-    int oidx = 0;
-    supernode *s;
-    const map<int, supernode* >& _supernodes = slice->getSupernodes();
+    int nSupernodes = slice->getNbSupernodes();
     ulong edgeId = 0;
-    for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-        its != _supernodes.end(); its++) {
-      s= its->second;
-
-      vector < supernode* >* lNeighbors = &(s->neighbors);
-      for(vector < supernode* >::iterator itN = lNeighbors->begin();
-          itN != lNeighbors->end(); itN++) {
-        //INFERENCE_PRINT("GI_maxflow::addLocalEdges %d %d\n", its->first,(*itN)->id);
+    for(int sid = 0; sid < nSupernodes; sid++) {
+      const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+      for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
+        //INFERENCE_PRINT("GI_maxflow::addLocalEdges %d %d\n", sid, itE->sid);
 
         // set edges once
-        if(its->first < (*itN)->id) {
+        if(sid < itE->sid) {
           continue;
         }
 
-        // get gradient index. Do not use any orientation index with maxflow
-        // as it's only used for the EM dataset
-        gradientIdx = slice->getGradientIdx(its->first,(*itN)->id);
+        // Do not use any orientation index with maxflow as it's only used
+        // for the EM dataset. Weights are laid out as
+        // [distance][gradient][orientation][state] so orientation 0 of each
+        // gradient level is nOrientations*nClasses^2 weights apart.
 #if USE_LONG_RANGE_EDGES
-        int distanceIdx = slice->getDistanceIdx(s->id, (*itN)->id);
-        oidx = distanceIdx*param->nGradientLevels*param->nClasses*param->nClasses*param->nOrientations;
-        //printf("distanceIdx %d/%d\n",distanceIdx,param->nDistances);
+        int bin = pairwiseTable.getBin(itE->gradientIdx, 0, itE->distanceIdx);
+#else
+        int bin = pairwiseTable.getBin(itE->gradientIdx, 0, 0);
 #endif
-
+        const double* scores = pairwiseTable.getScores(bin);
+        double coeff = edgeCoeffs?(*edgeCoeffs)[edgeId]:1.0;
         for(int p = 0; p < nPairwiseStates; p++ ) {
-          // w[0..nClasses-1] contains the unary weights
-          double w_sum = 0;
-          for(int i = 0; i <= gradientIdx; i++) {
-            idx = (i*param->nClasses*param->nClasses) + oidx + p;
-            w_sum += smw[idx+param->nUnaryWeights]; // param->nUnaryWeights is the offset due to unary terms
-          }
-
-          if(edgeCoeffs) {
-            w_sum *= (*edgeCoeffs)[edgeId];
-          }
-
-          score[p] = w_sum;
-          
+          score[p] = scores[p]*coeff;
         }
 
         double D = score[0] + score[3] - score[1] - score[2];
         assert(D>=0); //submodularity condition
 
-        unaryPotentials[its->first][T_BACKGROUND] += (score[0] - score[2]); // A-C
-        unaryPotentials[(*itN)->id][T_FOREGROUND] += (score[3] - score[2]); // D-C
+        unaryPotentials[sid][T_BACKGROUND] += (score[0] - score[2]); // A-C
+        unaryPotentials[itE->sid][T_FOREGROUND] += (score[3] - score[2]); // D-C
 
         edgePotentials[edgeId] = D;
 
@@ -290,22 +383,17 @@ void GI_maxflow::precomputeEdgePotentials()
 void GI_maxflow::addLocalEdges()
 {
   ulong edgeId = 0;
-  supernode *s;
-
-  const map<int, supernode* >& _supernodes = slice->getSupernodes();
-  for(map<int, supernode* >::const_iterator its = _supernodes.begin();
-      its != _supernodes.end(); its++) {
-    s= its->second;
-    vector < supernode* >* lNeighbors = &(s->neighbors);
-    for(vector < supernode* >::iterator itN = lNeighbors->begin();
-        itN != lNeighbors->end(); itN++) {
+  int nSupernodes = slice->getNbSupernodes();
+  for(int sid = 0; sid < nSupernodes; sid++) {
+    const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+    for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
 
       // set edges once
-      if(its->first < (*itN)->id) {
+      if(sid < itE->sid) {
         continue;
       }
 
-      g->add_edge(its->first, (*itN)->id, edgePotentials[edgeId], 0);
+      g->add_edge(sid, itE->sid, edgePotentials[edgeId], 0);
       ++edgeId;
     }
   }
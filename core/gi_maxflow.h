@@ -74,6 +74,23 @@ class GI_maxflow : public GraphInference
              bool computeEnergyAtEachIteration = false,
              double* _loss = 0);
 
+  /**
+   * Update the capacities of the graph for a new parameter vector.
+   * The topology of the graph is unchanged so only the nodes whose capacities
+   * changed are marked and the next call to run re-uses the search trees of
+   * the previous maxflow computation.
+   */
+  void updateGraph(const EnergyParam* _param,
+                   double* _smw,
+                   labelType* _groundTruthLabels,
+                   double* _lossPerLabel);
+
+  /**
+   * Use a copy of _param so that the object can outlive the caller's
+   * parameters (graphs stored in GraphCache).
+   */
+  void setParam(const EnergyParam* _param);
+
  private:
   GraphType* g;
 
@@ -83,6 +100,13 @@ class GI_maxflow : public GraphInference
   ulong nEdgePotentials;
   maxflow_cap_type minPotential;
 
+  // true if maxflow was already computed on g
+  bool reuseTrees;
+
+  // copy of the energy parameters set by setParam
+  EnergyParam paramCopy;
+
+  void computePotentials();
 };
 
 
@@ -17,6 +17,7 @@
 
 // SliceMe
 #include "Config.h"
+#include "profiler.h"
 #include "utils.h"
 
 #include "inference_globals.h"
@@ -135,7 +136,11 @@ double GI_multiobject::run(labelType* inferredLabels,
                        bool computeEnergyAtEachIteration,
                        double* _loss)
 {
-  double flow = g->maxflow();
+  double flow;
+  {
+    PROFILE_SCOPE("maxflow");
+    flow = g->maxflow();
+  }
   INFERENCE_PRINT("[GI_multiobject] flow=%g\n", flow);
   INFERENCE_PRINT("[GI_multiobject] nNodes=%ld nEdges=%ld\n", nNodes, nEdges);
 
@@ -165,18 +170,17 @@ double GI_multiobject::run(labelType* inferredLabels,
   // sanity check
   for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
       it != _supernodes.end(); it++) {
-    supernode* s = it->second;
-    for(vector < supernode* >::iterator itN = s->neighbors.begin();
-        itN != s->neighbors.end();itN++) {
+    const edgeInfo* itE_end = slice->getEdgesEnd(it->first);
+    for(const edgeInfo* itE = slice->getEdgesBegin(it->first); itE != itE_end; ++itE) {
 
       // set edges once
-      if(it->first < (*itN)->id) {
+      if(it->first < itE->sid) {
         continue;
       }
 
-      if( (inferredLabels[it->first] == BACKGROUND && inferredLabels[(*itN)->id] == FOREGROUND)
-          || (inferredLabels[it->first] == FOREGROUND && inferredLabels[(*itN)->id] == BACKGROUND) ) {
-        printf("[gi_multiobject] WARNING %d %d\n", it->first, (*itN)->id);
+      if( (inferredLabels[it->first] == BACKGROUND && inferredLabels[itE->sid] == FOREGROUND)
+          || (inferredLabels[it->first] == FOREGROUND && inferredLabels[itE->sid] == BACKGROUND) ) {
+        printf("[gi_multiobject] WARNING %d %d\n", it->first, itE->sid);
       }
     }
   }
@@ -218,13 +222,16 @@ void GI_multiobject::precomputeDataTerm()
   double weightBoundary = 0;
   sidType sid = 0;
   double score[4];
+  double* allUnaryPotentials = new double[_supernodes.size()*param->nClasses];
+  computeAllUnaryPotentials(allUnaryPotentials);
   for(map<sidType, supernode* >::const_iterator it = _supernodes.begin();
       it != _supernodes.end(); it++) {
     sid = it->first;
 
-    weightBackground = computeUnaryPotential(slice, sid, BACKGROUND);
-    weightBoundary = computeUnaryPotential(slice, sid, BOUNDARY);
-    weightForeground = computeUnaryPotential(slice, sid, FOREGROUND);
+    const double* sidPotentials = allUnaryPotentials + (ulong)sid*param->nClasses;
+    weightBackground = sidPotentials[BACKGROUND];
+    weightBoundary = sidPotentials[BOUNDARY];
+    weightForeground = sidPotentials[FOREGROUND];
 
     if(useLossFunction) {
       // add loss of the ground truth label
@@ -250,6 +257,7 @@ void GI_multiobject::precomputeDataTerm()
     unaryPotentials[nNodes + sid][INSIDE_LABEL] += score[3] - score[2]; // D-C
     edgePotentials[nextLayerEdgeId[sid]] += D;
   }
+  delete[] allUnaryPotentials;
 }
 
 void GI_multiobject::precomputeEdgePotentials()
@@ -264,6 +272,7 @@ void GI_multiobject::precomputeEdgePotentials()
   ulong edgeId = 0;
   double s33[3][3];
 
+  updatePairwiseTable();
   for(int n = 0; n < N_LAYERS; ++n) {
 
     const map<int, supernode* >& _supernodes = slice->getSupernodes();
@@ -271,33 +280,33 @@ void GI_multiobject::precomputeEdgePotentials()
         its != _supernodes.end(); its++) {
       s = its->second;
 
-      vector < supernode* >* lNeighbors = &(s->neighbors);
-      for(vector < supernode* >::iterator itN = lNeighbors->begin();
-          itN != lNeighbors->end(); itN++) {
+      const edgeInfo* itE_end = slice->getEdgesEnd(its->first);
+      for(const edgeInfo* itE = slice->getEdgesBegin(its->first); itE != itE_end; ++itE) {
 
         // set edges once
-        if(its->first < (*itN)->id) {
+        if(its->first < itE->sid) {
           continue;
         }
 
         // get gradient index. Do not use any orientation index with maxflow
-        // as it's only used for the EM dataset
-        gradientIdx = slice->getGradientIdx(its->first,(*itN)->id);
+        // as it's only used for the EM dataset. Weights are laid out as
+        // [distance][gradient][orientation][state] so orientation 0 of each
+        // gradient level is nOrientations*nClasses^2 weights apart.
+        gradientIdx = itE->gradientIdx;
 
 #if USE_LONG_RANGE_EDGES
-        int distanceIdx = slice->getDistanceIdx(s->id, (*itN)->id);
+        int distanceIdx = itE->distanceIdx;
         oidx = distanceIdx*param->nGradientLevels*param->nClasses*param->nClasses*param->nOrientations;
 #endif
 
+#if USE_LONG_RANGE_EDGES
+        const double* scores = pairwiseTable.getScores(pairwiseTable.getBin(gradientIdx, 0, distanceIdx));
+#else
+        const double* scores = pairwiseTable.getScores(pairwiseTable.getBin(gradientIdx, 0, 0));
+#endif
         for(int r = 0; r < 3; ++r) {
           for(int c = 0; c < 3; ++c) {
-            double w_sum = 0;
-            for(int i = 0; i <= gradientIdx; i++) {
-              int p = 3*r + c;
-              idx = (i*param->nClasses*param->nClasses) + oidx + p;
-              w_sum += smw[idx+param->nUnaryWeights]; // param->nUnaryWeights is the offset due to unary terms
-            }
-            s33[r][c] = w_sum;
+            s33[r][c] = scores[3*r + c];
           }
         }
 
@@ -341,7 +350,7 @@ void GI_multiobject::precomputeEdgePotentials()
               double w_sum = 0;
               for(int i = 0; i <= gradientIdx; i++) {
                 int p = 3*r + c;
-                idx = (i*param->nClasses*param->nClasses) + oidx + p;
+                idx = (i*param->nClasses*param->nClasses*param->nOrientations) + oidx + p;
                 w_sum += smw[idx+param->nUnaryWeights]; // param->nUnaryWeights is the offset due to unary terms
                 printf("rc %d %d %d %g\n", r, c, idx, smw[idx+param->nUnaryWeights]);
               }
@@ -362,7 +371,7 @@ void GI_multiobject::precomputeEdgePotentials()
         assert(D>=0); //submodularity condition
 
         unaryPotentials[its->first + (n*nNodes)][OUTSIDE_LABEL] += (score[0] - score[2]); // A-C
-        unaryPotentials[(*itN)->id + (n*nNodes)][INSIDE_LABEL] += (score[3] - score[2]); // D-C
+        unaryPotentials[itE->sid + (n*nNodes)][INSIDE_LABEL] += (score[3] - score[2]); // D-C
 
         edgePotentials[edgeId] += D;
 
@@ -394,9 +403,8 @@ void GI_multiobject::precomputeEdgePotentials()
     nextLayerEdgeId[its->first] = edgeId;
     ++edgeId;
 
-    vector < supernode* >* lNeighbors = &(s->neighbors);
-    for(vector < supernode* >::iterator itN = lNeighbors->begin();
-        itN != lNeighbors->end(); itN++) {
+    const edgeInfo* itE_end = slice->getEdgesEnd(its->first);
+    for(const edgeInfo* itE = slice->getEdgesBegin(its->first); itE != itE_end; ++itE) {
       edgePotentials[edgeId] += D;
       ++edgeId;
     }
@@ -419,17 +427,16 @@ void GI_multiobject::addLocalEdges()
     for(map<int, supernode* >::const_iterator its = _supernodes.begin();
         its != _supernodes.end(); its++) {
       s = its->second;
-      vector < supernode* >* lNeighbors = &(s->neighbors);
-      for(vector < supernode* >::iterator itN = lNeighbors->begin();
-          itN != lNeighbors->end(); itN++) {
+      const edgeInfo* itE_end = slice->getEdgesEnd(its->first);
+      for(const edgeInfo* itE = slice->getEdgesBegin(its->first); itE != itE_end; ++itE) {
 
         // set edges once
-        if(its->first < (*itN)->id) {
+        if(its->first < itE->sid) {
           continue;
         }
 
         // add edge in all layers
-        g->add_edge(its->first + (n*nNodes), (*itN)->id + (n*nNodes), edgePotentials[edgeId], 0);
+        g->add_edge(its->first + (n*nNodes), itE->sid + (n*nNodes), edgePotentials[edgeId], 0);
 
         ++edgeId;
       }
@@ -448,10 +455,9 @@ void GI_multiobject::addLocalEdges()
     g->add_edge(its->first, its->first + nNodes, edgePotentials[edgeId], 0);
     ++edgeId;
 
-    vector < supernode* >* lNeighbors = &(s->neighbors);
-    for(vector < supernode* >::iterator itN = lNeighbors->begin();
-        itN != lNeighbors->end(); itN++) {
-      g->add_edge((*itN)->id, its->first + nNodes, edgePotentials[edgeId], 0);
+    const edgeInfo* itE_end = slice->getEdgesEnd(its->first);
+    for(const edgeInfo* itE = slice->getEdgesBegin(its->first); itE != itE_end; ++itE) {
+      g->add_edge(itE->sid, its->first + nNodes, edgePotentials[edgeId], 0);
       ++edgeId;
 
     }
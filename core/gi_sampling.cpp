@@ -128,6 +128,7 @@ double GI_sampling::runOnce(labelType* inferredLabels,
                             double* _loss,
                             double temperature)
 {
+  updatePairwiseTable();
   double *buf = new double[param->nClasses];
   double *bufUnary = new double[param->nClasses];
   double *bufPairwise = new double[param->nClasses];
@@ -138,17 +139,10 @@ double GI_sampling::runOnce(labelType* inferredLabels,
   double totalUnaryScore = 0;
   double totalPairwiseScore = 0;
   double totalLoss = 0;
-  supernode *s;
   bool useLossFunction = lossPerLabel!=0;
 
-  // allocate memory to store features
-  int fvSize = feature->getSizeFeatureVector();
-  int max_index = fvSize + 1;
-  osvm_node* n = new osvm_node[max_index];
-  int i = 0;
-  for(i = 0;i < max_index-1; i++)
-    n[i].index = i+1;
-  n[i].index = -1;
+  double* allUnaryPotentials = new double[slice->getNbSupernodes()*param->nClasses];
+  computeAllUnaryPotentials(allUnaryPotentials);
 
   const map<int, supernode* >& _supernodes = slice->getSupernodes();
 
@@ -206,32 +200,30 @@ double GI_sampling::runOnce(labelType* inferredLabels,
       } else {
         sid = i;
       }
-      s = slice->getSupernode(sid);
-
-      vector < supernode* >* lNeighbors = &(s->neighbors);
+      const edgeInfo* itE_begin = slice->getEdgesBegin(sid);
+      const edgeInfo* itE_end = slice->getEdgesEnd(sid);
 
       if(param->nClasses != 2) {
 
         for(int c = 0; c < (int)param->nClasses; c++) {
-          bufUnary[c] = computeUnaryPotential(slice, sid, c);
+          bufUnary[c] = allUnaryPotentials[(ulong)sid*param->nClasses + c];
 
           // add pairwise potential
           bufPairwise[c] = 0;
-          for(vector < supernode* >::iterator itN = lNeighbors->begin();
-              itN != lNeighbors->end(); itN++) {
+          for(const edgeInfo* itE = itE_begin; itE != itE_end; ++itE) {
 
             // set edges once
-            if(s->id < (*itN)->id) {
+            if(sid < itE->sid) {
               continue;
             }
 
 #if USE_LONG_RANGE_EDGES
-            double pairwisePotential = computePairwisePotential_distance(slice, s, (*itN),
-                                                                         c, inferredLabels[(*itN)->id]);
+            double pairwisePotential = computePairwisePotential_distance(sid, *itE,
+                                                                         c, inferredLabels[itE->sid]);
 
 #else
-            double pairwisePotential = computePairwisePotential(slice, s, (*itN),
-                                                                c, inferredLabels[(*itN)->id]);
+            double pairwisePotential = computePairwisePotential(sid, *itE,
+                                                                c, inferredLabels[itE->sid]);
 #endif
 
             bufPairwise[c] += pairwisePotential;
@@ -242,28 +234,27 @@ double GI_sampling::runOnce(labelType* inferredLabels,
         bufPairwise[T_FOREGROUND] = 0;
 
         int c = T_BACKGROUND;
-        bufUnary[c] = computeUnaryPotential(slice, sid, c);
+        bufUnary[c] = allUnaryPotentials[(ulong)sid*param->nClasses + c];
         //printf("unary %d %d %g\n", sid, c, buf[c]);
 
         // add pairwise potential
         bufPairwise[c] = 0;
-        for(vector < supernode* >::iterator itN = lNeighbors->begin();
-            itN != lNeighbors->end(); itN++) {
+        for(const edgeInfo* itE = itE_begin; itE != itE_end; ++itE) {
 
           // set edges once
-          if(s->id < (*itN)->id) {
+          if(sid < itE->sid) {
             continue;
           }
 
 #if USE_LONG_RANGE_EDGES
-          double pairwisePotential = computePairwisePotential_distance(slice, s, (*itN),
-                                                                       c, inferredLabels[(*itN)->id]);
+          double pairwisePotential = computePairwisePotential_distance(sid, *itE,
+                                                                       c, inferredLabels[itE->sid]);
 #else
-          double pairwisePotential = computePairwisePotential(slice, s, (*itN),
-                                                              c, inferredLabels[(*itN)->id]);
+          double pairwisePotential = computePairwisePotential(sid, *itE,
+                                                              c, inferredLabels[itE->sid]);
 #endif
           bufPairwise[c] += pairwisePotential;
-          //printf("pairwise %d, %d %d %g\n", sid, (*itN)->id, c, pairwisePotential);
+          //printf("pairwise %d, %d %d %g\n", sid, itE->sid, c, pairwisePotential);
         }
       }
 
@@ -341,7 +332,7 @@ double GI_sampling::runOnce(labelType* inferredLabels,
     gsl_rng_free(rng);
 #endif
   
-  delete[] n;
+  delete[] allUnaryPotentials;
 
   delete[] buf;
   delete[] bufUnary;
@@ -360,21 +351,15 @@ double GI_sampling::runOnce_VOC(labelType* inferredLabels,
                                 double temperature,
                                 ulong* TPs, ulong* FPs, ulong* FNs)
 {
+  updatePairwiseTable();
   double *buf = new double[param->nClasses];
   int sid = 0;
   double totalScore_old = 0;
   double totalScore = 10;
-  supernode *s;
   bool useLossFunction = lossPerLabel!=0;
 
-  // allocate memory to store features
-  int fvSize = feature->getSizeFeatureVector();
-  int max_index = fvSize + 1;
-  osvm_node* n = new osvm_node[max_index];
-  int i = 0;
-  for(i = 0;i < max_index-1; i++)
-    n[i].index = i+1;
-  n[i].index = -1;
+  double* allUnaryPotentials = new double[slice->getNbSupernodes()*param->nClasses];
+  computeAllUnaryPotentials(allUnaryPotentials);
 
   const map<int, supernode* >& _supernodes = slice->getSupernodes();
 
@@ -436,25 +421,23 @@ double GI_sampling::runOnce_VOC(labelType* inferredLabels,
       } else {
         sid = i;
       }
-      s = slice->getSupernode(sid);
-
-      vector < supernode* >* lNeighbors = &(s->neighbors);
+      const edgeInfo* itE_begin = slice->getEdgesBegin(sid);
+      const edgeInfo* itE_end = slice->getEdgesEnd(sid);
 
       if(param->nClasses != 2) {
 
         for(int c = 0; c < (int)param->nClasses; c++) {
-          buf[c] = computeUnaryPotential(slice, sid, c);
+          buf[c] = allUnaryPotentials[(ulong)sid*param->nClasses + c];
 
           if(iter >= 0) {
             // add pairwise potential
-            for(vector < supernode* >::iterator itN = lNeighbors->begin();
-                itN != lNeighbors->end(); itN++) {
+            for(const edgeInfo* itE = itE_begin; itE != itE_end; ++itE) {
 #if USE_LONG_RANGE_EDGES
-              double pairwisePotential = computePairwisePotential_distance(slice, s, (*itN),
-                                                                  c, inferredLabels[(*itN)->id]);
+              double pairwisePotential = computePairwisePotential_distance(sid, *itE,
+                                                                  c, inferredLabels[itE->sid]);
 #else
-              double pairwisePotential = computePairwisePotential(slice, s, (*itN),
-                                                                           c, inferredLabels[(*itN)->id]);
+              double pairwisePotential = computePairwisePotential(sid, *itE,
+                                                                           c, inferredLabels[itE->sid]);
 #endif
 
               buf[c] += pairwisePotential;
@@ -465,18 +448,17 @@ double GI_sampling::runOnce_VOC(labelType* inferredLabels,
         buf[T_FOREGROUND] = 0;
 
         int c = T_BACKGROUND;
-        buf[c] = computeUnaryPotential(slice, sid, c);
+        buf[c] = allUnaryPotentials[(ulong)sid*param->nClasses + c];
 
         if(iter >= 0) {
           // add pairwise potential
-          for(vector < supernode* >::iterator itN = lNeighbors->begin();
-              itN != lNeighbors->end(); itN++) {
+          for(const edgeInfo* itE = itE_begin; itE != itE_end; ++itE) {
 #if USE_LONG_RANGE_EDGES
-            double pairwisePotential = computePairwisePotential_distance(slice, s, (*itN),
-                                                                c, inferredLabels[(*itN)->id]);
+            double pairwisePotential = computePairwisePotential_distance(sid, *itE,
+                                                                c, inferredLabels[itE->sid]);
 #else
-            double pairwisePotential = computePairwisePotential(slice, s, (*itN),
-                                                                c, inferredLabels[(*itN)->id]);
+            double pairwisePotential = computePairwisePotential(sid, *itE,
+                                                                c, inferredLabels[itE->sid]);
 #endif
             buf[c] += pairwisePotential;
           }
@@ -608,7 +590,7 @@ double GI_sampling::runOnce_VOC(labelType* inferredLabels,
     gsl_rng_free(rng);
 #endif
   
-  delete[] n;
+  delete[] allUnaryPotentials;
   delete[] probs;
   delete[] cumulated_probs;
 
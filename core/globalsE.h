@@ -26,8 +26,6 @@ using namespace std;
 #define USE_LONG_RANGE_EDGES 0
 #define MAX_SQ_DISTANCE_LONG_RANGE_EDGES 500
 
-#define USE_SPARSE_VECTORS 0
-
 //-----------------------------------------------------------------------------
 
 enum eFeatureType
@@ -163,6 +161,14 @@ extern int DEFAULT_LONG_RANGE_EDGES_DISTANCE;
 // by libsvmwrite)
 #define FEATURE_FIRST_INDEX 1
 
+// alignment (in bytes) of the rows of the precomputed feature matrix
+#define FEATURE_MATRIX_ALIGNMENT 64
+
+// binary feature cache (see Slice_P::saveFeatureCache)
+#define FEATURE_CACHE_MAGIC 0x54414546 // "FEAT"
+#define FEATURE_CACHE_VERSION 1
+#define FEATURE_CACHE_EXTENSION ".bin"
+
 extern bool verbose;
 
 #define PRINT_MESSAGE(format, ...) if(verbose) printf (format, ## __VA_ARGS__)
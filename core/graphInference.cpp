@@ -40,6 +40,7 @@ GraphInference::GraphInference(Slice_P* _slice,
   feature = _feature;
   nodeCoeffs = _nodeCoeffs;
   edgeCoeffs = _edgeCoeffs;
+  updatePairwiseTable();
 }
 
 GraphInference::~GraphInference()
@@ -89,10 +90,10 @@ double GraphInference::computeEnergy(labelType* nodeLabels)
 	continue;
       }
 
-      osvm_node *n = slice->getFeature(sid);
+      const float* x = slice->getFeature(sid);
       energySupernode = 0;
       for(int s = 0; s < fvSize; s++) {
-        energySupernode -= smw[SVM_FEAT_INDEX(param, label,s)]*n[s].value;
+        energySupernode -= smw[SVM_FEAT_INDEX(param, label,s)]*x[s];
       }
 
 #ifdef W_OFFSET
@@ -111,17 +112,15 @@ double GraphInference::computeEnergy(labelType* nodeLabels)
       // add energy for pairwize term
       if(param->nGradientLevels == 0) {
         ulong edgeId = 0;
-        const map<int, supernode* >& _supernodes = slice->getSupernodes();
-        for(map<sidType, supernode* >::const_iterator itNode = _supernodes.begin();
-            itNode != _supernodes.end(); itNode++) {
-          for(vector<supernode*>::iterator itNode2 = itNode->second->neighbors.begin();
-              itNode2 != itNode->second->neighbors.end(); itNode2++) {
+        for(int sid = 0; sid < nSupernodes; sid++) {
+          const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+          for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
             // set edges once
-            if(itNode->first < (*itNode2)->id) {
+            if(sid < itE->sid) {
               continue;
             }
             
-            if(nodeLabels[itNode->first] == nodeLabels[(*itNode2)->id]) {
+            if(nodeLabels[sid] == nodeLabels[itE->sid]) {
               energyEdge = smw[param->nUnaryWeights];
               if(edgeCoeffs) {
                 energyEdge *= (*edgeCoeffs)[edgeId];
@@ -132,39 +131,18 @@ double GraphInference::computeEnergy(labelType* nodeLabels)
           }
         }
       } else {
-#if USE_LONG_RANGE_EDGES
-        int distanceIdx;
-#endif
-        int gradientIdx;
-        int orientationIdx;
-        int w_edgeIdx;
+        updatePairwiseTable();
         ulong edgeId = 0;
-        const map<int, supernode* >& _supernodes = slice->getSupernodes();
-        for(map<sidType, supernode* >::const_iterator itNode = _supernodes.begin();
-            itNode != _supernodes.end(); itNode++) {
-          for(vector<supernode*>::iterator itNode2 = itNode->second->neighbors.begin();
-              itNode2 != itNode->second->neighbors.end(); itNode2++) {
+        for(int sid = 0; sid < nSupernodes; sid++) {
+          const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+          for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
             // set edges once
-            if(itNode->first < (*itNode2)->id) {
+            if(sid < itE->sid) {
               continue;
             }
-          
-            gradientIdx = slice->getGradientIdx(itNode->first,(*itNode2)->id);
-            orientationIdx = slice->getOrientationIdx(itNode->first, (*itNode2)->id);
-
-            int offset = (orientationIdx*param->nClasses*param->nClasses);
 
-#if USE_LONG_RANGE_EDGES
-            distanceIdx = slice->getDistanceIdx(itNode->first,
-                                                (*itNode2)->id);
-            offset += distanceIdx*param->nGradientLevels*param->nClasses*param->nClasses*param->nOrientations;
-#endif
-
-            energyEdge = 0;
-            for(int i =0; i <= gradientIdx; i++) {
-              w_edgeIdx = (i*param->nClasses*param->nClasses*param->nOrientations) + offset + nodeLabels[itNode->first]*param->nClasses + nodeLabels[(*itNode2)->id];
-              energyEdge -= smw[w_edgeIdx + param->nUnaryWeights];
-            }
+            energyEdge = -pairwiseTable.getScore(pairwiseTable.getBin(*itE), sid, itE->sid,
+                                                 nodeLabels[sid], nodeLabels[itE->sid]);
 
             if(edgeCoeffs) {
               energyEdge *= (*edgeCoeffs)[edgeId];
@@ -185,70 +163,79 @@ double GraphInference::computeEnergy(labelType* nodeLabels)
   return energy - loss;
 }
 
+void GraphInference::computeAllUnaryPotentials(double* unaryPotentials)
+{
+  const int nClasses = param->nClasses;
+  const int nSupernodes = slice->getNbSupernodes();
+  const int fvSize = slice->getFeatureSize();
+  const int featureStride = slice->getFeatureStride();
+
+  // only the background class has weights in the binary case
+  const int nScoredClasses = (nClasses != 2)?nClasses:1;
+
+  // Re-lay out the weights class-major so that each potential is a dot product
+  // between two contiguous rows. Padding is zero as in the feature matrix.
+  double* w = new double[nScoredClasses*featureStride];
+  for(int c = 0; c < nScoredClasses; c++) {
+    double* wc = w + c*featureStride;
+    for(int f = 0; f < fvSize; f++) {
+      wc[f] = smw[SVM_FEAT_INDEX(param, c, f)];
+    }
+    for(int f = fvSize; f < featureStride; f++) {
+      wc[f] = 0;
+    }
+  }
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for(int sid = 0; sid < nSupernodes; sid++) {
+    const float* x = slice->getFeature(sid);
+    double* buf = unaryPotentials + (ulong)sid*nClasses;
+    for(int c = 0; c < nScoredClasses; c++) {
+      const double* wc = w + c*featureStride;
+      double p = 0;
+#if defined(_OPENMP) && _OPENMP >= 201307
+#pragma omp simd reduction(+:p)
+#endif
+      for(int f = 0; f < featureStride; f++) {
+        p += x[f]*wc[f];
+      }
+#ifdef W_OFFSET
+      p += smw[c];
+#endif
+      buf[c] = p;
+    }
+    if(nClasses == 2) {
+      buf[T_FOREGROUND] = 0;
+    }
+  }
+
+  delete[] w;
+}
+
 void GraphInference::computeNodePotentials(double**& unaryPotentials, double& maxPotential)
 {
-  // allocate memory to store features
-  int fvSize = feature->getSizeFeatureVector();
-  int max_index = fvSize + 1;
-  osvm_node* n = new osvm_node[max_index];
-  int i = 0;
-  for(i = 0;i < max_index-1; i++)
-    n[i].index = i+1;
-  n[i].index = -1;
+  const int nClasses = param->nClasses;
+  double* allUnaryPotentials = new double[slice->getNbSupernodes()*nClasses];
+  computeAllUnaryPotentials(allUnaryPotentials);
 
   bool useLossFunction = lossPerLabel!=0;
   int sid = 0;
-  double p = 0;
   const map<int, supernode* >& _supernodes = slice->getSupernodes();
   maxPotential = 0;
   for(map<int, supernode* >::const_iterator its = _supernodes.begin();
       its != _supernodes.end(); its++) {
     sid = its->first;
     double* buf = unaryPotentials[sid];
+    const double* sidPotentials = allUnaryPotentials + (ulong)sid*nClasses;
 
-    if(param->nClasses != 2) {
-      for(int i = 0; i < (int)param->nClasses; i++) {
-        //INFERENCE_PRINT("1.%d:%e:%e:%e ", i, buf[i],std::log(buf[i]),std::log(buf[i])*smw[SVM_PROB_INDEX]);
-
-        feature->getFeatureVector(n, slice, sid);
-        p = 0;
-        for(int s=0; s < fvSize; s++) {
-          p += n[s].value*smw[SVM_FEAT_INDEX(param,i,s)];
-        }
-
-#ifdef W_OFFSET
-        p += smw[i];
-#endif
-        if(nodeCoeffs) {
-          p *= (*nodeCoeffs)[sid];
-        }
-        buf[i] = p;
-
-        if (fabs(buf[i]) > maxPotential) {
-          maxPotential = fabs(buf[i]);
-        }
-      }
-    } else {
-      // Only 2 classes.
-      buf[T_FOREGROUND] = 0;
-
-      int i = T_BACKGROUND;
-      feature->getFeatureVector(n, slice, sid);
-      p = 0;
-      for(int s=0; s < fvSize; s++) {
-        assert(s+1 == n[s].index);
-        p += n[s].value*smw[SVM_FEAT_INDEX(param,i,s)];
-      }
-#ifdef W_OFFSET
-      p += smw[i];
-#endif
-
+    for(int i = 0; i < nClasses; i++) {
+      buf[i] = sidPotentials[i];
       if(nodeCoeffs) {
-        p *= (*nodeCoeffs)[sid];
+        buf[i] *= (*nodeCoeffs)[sid];
       }
 
-      buf[i] = p;
-
       if (fabs(buf[i]) > maxPotential) {
         maxPotential = fabs(buf[i]);
       }
@@ -275,9 +262,6 @@ void GraphInference::computeNodePotentials(double**& unaryPotentials, double& ma
       //buf[groundTruthLabels[sid]] = buf[groundTruthLabels[sid]]-1;
     }
 
-    for(int c = 0; c < (int)param->nClasses; c++) {
-      unaryPotentials[sid][c] = buf[c];
-    }
   }
-  delete[] n;
+  delete[] allUnaryPotentials;
 }
\ No newline at end of file
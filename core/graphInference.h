@@ -24,6 +24,7 @@
 
 #include "inference_globals.h"
 #include "energyParam.h"
+#include "pairwise_table.h"
 
 //------------------------------------------------------------------------------
 
@@ -40,6 +41,8 @@
 #define T_GI_LIBDAI_ICM_QPBO 10
 #define T_GI_MF 11
 #define T_GI_MULTIOBJ 12
+#define T_GI_EXPANSION 13
+#define T_GI_BP 14
 
 //------------------------------------------------------------------------------
 
@@ -69,6 +72,16 @@ class GraphInference
 
   void computeNodePotentials(double**& unaryPotentials, double& maxPotential);
 
+  /**
+   * Compute the unary potentials of all the supernodes for all the classes in
+   * a single pass over the precomputed feature matrix.
+   * unaryPotentials is a row-major nSupernodes x nClasses matrix allocated by
+   * the caller. With 2 classes, only T_BACKGROUND has weights and the
+   * T_FOREGROUND column is set to 0 (same convention as the backends).
+   * Node coefficients and loss are not included.
+   */
+  void computeAllUnaryPotentials(double* unaryPotentials);
+
   void init();
 
   virtual double run(labelType* inferredLabels,
@@ -80,6 +93,12 @@ class GraphInference
 
   static void setColormap(map<ulong, labelType>& _classIdxToLabel) { classIdxToLabel = _classIdxToLabel;}
 
+  /**
+   * Rebuild the pairwise lookup table if smw changed.
+   * Has to be called before evaluating pairwise potentials.
+   */
+  void updatePairwiseTable() { pairwiseTable.update(param, smw); }
+
   Slice_P* slice;
   double* smw;
 
@@ -88,6 +107,17 @@ class GraphInference
   labelType* groundTruthLabels;   /* ground truth labels */
   Feature* feature;
 
+  // compute pairwise potential for the edge e going out of node sid
+  inline double computePairwisePotential(sidType sid, const edgeInfo& e,
+                                         labelType s_label,
+                                         labelType sn_label);
+
+  // compute pairwise potential for the edge e going out of node sid
+  // distance adaptive pairwise term
+  inline double computePairwisePotential_distance(sidType sid, const edgeInfo& e,
+                                                  labelType s_label,
+                                                  labelType sn_label);
+
   // compute pairwise potential for 2 given nodes s and sn
   inline double computePairwisePotential(Slice_P* slice, supernode* s,
                                          supernode* sn,
@@ -107,24 +137,16 @@ class GraphInference
   inline double computeUnaryPotential(Slice_P* slice, sidType sid,
                                       labelType label) {
     double p = 0;
-    osvm_node *n = slice->getFeature(sid);
-
-#if USE_SPARSE_VECTORS
-    assert(0);
-    // To be implemented...
-#endif
-
-    int fidx = 0;
-    int widx = SVM_FEAT_INDEX(param, label, fidx);
-    while(n[fidx].index != -1) {
-      p += n[fidx].value*smw[widx];
-      if(isinf(p) || isnan(p)) {
-        printf("[graphInference] computeUnary image (%ld, %s) sid %d label %d -> %d %d %d %g %g\n", slice->getId(), slice->getName().c_str(), sid, (int) label, fidx, widx, n[fidx].index, n[fidx].value,smw[widx]);
-        oSVM::print(n);
-        exit(-1);
-      }
-      fidx++;
-      widx += SVM_FEAT_NUM_CLASSES(param);
+    const float* x = slice->getFeature(sid);
+    const int fvSize = slice->getFeatureSize();
+    const int wStride = SVM_FEAT_NUM_CLASSES(param);
+    const double* w = smw + SVM_FEAT_INDEX(param, label, 0);
+    for(int fidx = 0; fidx < fvSize; fidx++) {
+      p += x[fidx]*w[fidx*wStride];
+    }
+    if(isinf(p) || isnan(p)) {
+      printf("[graphInference] computeUnary image (%ld, %s) sid %d label %d -> %g\n", slice->getId(), slice->getName().c_str(), sid, (int) label, p);
+      exit(-1);
     }
 
 #ifdef W_OFFSET
@@ -152,6 +174,9 @@ class GraphInference
 
  protected:
 
+  // pairwise potentials indexed by edge bin
+  PairwiseTable pairwiseTable;
+
   map<sidType, nodeCoeffType>* nodeCoeffs;
   map<sidType, edgeCoeffType>* edgeCoeffs;
 
@@ -160,36 +185,15 @@ class GraphInference
 
 };
 
-double GraphInference::computePairwisePotential(Slice_P* slice, supernode* s,
-                                                supernode* sn,
+double GraphInference::computePairwisePotential(sidType sid, const edgeInfo& e,
                                                 labelType s_label,
                                                 labelType sn_label)
 {
-  int idx;
-  double energy = 0;
-  int p = 0;
-  if(s->id < sn->id) {
-    p = (sn_label*param->nClasses) + s_label;
-  } else {
-    p = (s_label*param->nClasses) + sn_label;
-  }
-
-  int gradientIdx = slice->getGradientIdx(s->id, sn->id);
-  int orientationIdx = slice->getOrientationIdx(s->id, sn->id);
-
-  p += (orientationIdx*param->nClasses*param->nClasses);
-
-  // w[0..nClasses-1] contains the unary weights
-  for(int g = 0; g <= gradientIdx; g++) {
-    idx = (g*param->nClasses*param->nClasses*param->nOrientations) + p;
-    energy += smw[idx+param->nUnaryWeights]; // nUnaryWeights is the offset due to unary terms
-  }
-  return energy;
+  int bin = pairwiseTable.getBin(e.gradientIdx, e.orientationIdx, 0);
+  return pairwiseTable.getScore(bin, sid, e.sid, s_label, sn_label);
 }
 
-
-double GraphInference::computePairwisePotential_distance(Slice_P* slice, supernode* s,
-                                                         supernode* sn,
+double GraphInference::computePairwisePotential_distance(sidType sid, const edgeInfo& e,
                                                          labelType s_label,
                                                          labelType sn_label)
 {
@@ -198,29 +202,43 @@ double GraphInference::computePairwisePotential_distance(Slice_P* slice, superno
   assert(0);
 #endif
 
-  int idx;
-  double energy = 0;
-  int p = 0;
-  if(s->id < sn->id) {
-    p = (sn_label*param->nClasses) + s_label;
+  return pairwiseTable.getScore(pairwiseTable.getBin(e), sid, e.sid, s_label, sn_label);
+}
+
+double GraphInference::computePairwisePotential(Slice_P* slice, supernode* s,
+                                                supernode* sn,
+                                                labelType s_label,
+                                                labelType sn_label)
+{
+  const edgeInfo* e = slice->findEdge(s->id, sn->id);
+  if(e) {
+    return computePairwisePotential(s->id, *e, s_label, sn_label);
   } else {
-    p = (s_label*param->nClasses) + sn_label;
+    edgeInfo e0;
+    e0.sid = sn->id;
+    e0.gradientIdx = 0;
+    e0.orientationIdx = 0;
+    e0.distanceIdx = 0;
+    return computePairwisePotential(s->id, e0, s_label, sn_label);
   }
+}
 
-  int gradientIdx = slice->getGradientIdx(s->id, sn->id);
-  int orientationIdx = slice->getOrientationIdx(s->id, sn->id); 
-  int distanceIdx = slice->getDistanceIdx(s->id, sn->id);
-
-  p += (orientationIdx*param->nClasses*param->nClasses);
-
-  p += distanceIdx*param->nGradientLevels*param->nClasses*param->nClasses*param->nOrientations;
-
-  // w[0..nClasses-1] contains the unary weights
-  for(int g = 0; g <= gradientIdx; g++) {
-    idx = (g*param->nClasses*param->nClasses*param->nOrientations) + p;
-    energy += smw[idx+param->nUnaryWeights]; // nUnaryWeights is the offset due to unary terms
+double GraphInference::computePairwisePotential_distance(Slice_P* slice, supernode* s,
+                                                         supernode* sn,
+                                                         labelType s_label,
+                                                         labelType sn_label)
+{
+  const edgeInfo* e = slice->findEdge(s->id, sn->id);
+  if(e) {
+    return computePairwisePotential_distance(s->id, *e, s_label, sn_label);
+  } else {
+    edgeInfo e0;
+    e0.sid = sn->id;
+    e0.gradientIdx = 0;
+    e0.orientationIdx = 0;
+    e0.distanceIdx = 0;
+    return computePairwisePotential_distance(s->id, e0, s_label, sn_label);
   }
-  return energy;
 }
 
 #endif //GRAPH_INFERENCE_H
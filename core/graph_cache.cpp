@@ -0,0 +1,71 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "graph_cache.h"
+
+GraphCache* GraphCache::pInstance = 0; // initialize pointer
+
+GraphCache::~GraphCache()
+{
+  clear();
+}
+
+void GraphCache::clear()
+{
+#ifdef WITH_OPENMP
+#pragma omp critical(graph_cache)
+#endif
+  {
+    for(std::map<int, GraphInference*>::iterator it = graphs.begin();
+        it != graphs.end(); ++it) {
+      delete it->second;
+    }
+    graphs.clear();
+  }
+}
+
+bool GraphCache::exists(int id)
+{
+  return getGraph(id) != 0;
+}
+
+GraphInference* GraphCache::getGraph(int id)
+{
+  GraphInference* gi = 0;
+#ifdef WITH_OPENMP
+#pragma omp critical(graph_cache)
+#endif
+  {
+    std::map<int, GraphInference*>::iterator lookup = graphs.find(id);
+    if(lookup != graphs.end()) {
+      gi = lookup->second;
+    }
+  }
+  return gi;
+}
+
+void GraphCache::setGraph(int id, GraphInference* gi)
+{
+#ifdef WITH_OPENMP
+#pragma omp critical(graph_cache)
+#endif
+  {
+    std::map<int, GraphInference*>::iterator lookup = graphs.find(id);
+    if(lookup != graphs.end() && lookup->second != gi) {
+      delete lookup->second;
+    }
+    graphs[id] = gi;
+  }
+}
@@ -0,0 +1,63 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef GRAPH_CACHE_H
+#define GRAPH_CACHE_H
+
+#include "graphInference.h"
+
+#include <map>
+
+/**
+ * Keeps the inference objects built for each training example so that their
+ * graph can be re-used across SSVM iterations (the topology of the graph does
+ * not change, only the parameter vector does).
+ */
+class GraphCache
+{
+ public:
+  static GraphCache* pInstance;
+
+  static GraphCache* Instance() 
+  {    
+    if (pInstance == 0)  // is it the first call?
+      {
+        pInstance = new GraphCache; // create unique instance
+      }
+    return pInstance; // address of unique instance
+  }
+
+  ~GraphCache();
+
+  bool exists(int id);
+
+  /**
+   * Returns the inference object stored for a given example or 0.
+   */
+  GraphInference* getGraph(int id);
+
+  void clear();
+
+  /**
+   * Store an inference object. The cache takes ownership of gi.
+   */
+  void setGraph(int id, GraphInference* gi);
+
+ private:
+  std::map<int, GraphInference*> graphs;
+
+};
+
+#endif //GRAPH_CACHE_H
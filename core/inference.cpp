@@ -20,10 +20,12 @@
 #include "graphInference.h"
 #include "Slice.h"
 #include "gi_sampling.h"
+#include "gi_ICM.h"
 #include "gi_max.h"
 #include "gi_MF.h"
 #include "utils.h"
 #include "globalsE.h"
+#include "profiler.h"
 
 #ifdef _WIN32
 #include "direct.h"
@@ -36,10 +38,12 @@
 #endif
 #if USE_MAXFLOW
 #include "gi_maxflow.h"
+#include "gi_expansion.h"
 #endif
 #if USE_MULTIOBJ
 #include "gi_multiobject.h"
 #endif
+#include "gi_bp.h"
 
 #include <sstream>
 #include <vector>
@@ -172,7 +176,19 @@ GraphInference* createGraphInferenceInstance(int algo_type,
                          _nodeCoeffs,
                          _edgeCoeffs);
       break;
+#else
+    case T_GI_LIBDAI:
 #endif
+    case T_GI_BP:
+      gi = new GI_BP(slice,
+                     &param,
+                     param.weights,
+                     groundTruthLabels,
+                     lossPerLabel,
+                     feature,
+                     _nodeCoeffs,
+                     _edgeCoeffs);
+      break;
 
 #if USE_MAXFLOW
     case T_GI_MAXFLOW:
@@ -185,6 +201,17 @@ GraphInference* createGraphInferenceInstance(int algo_type,
                           _nodeCoeffs,
                           _edgeCoeffs);
       break;
+
+    case T_GI_EXPANSION:
+      gi = new GI_expansion(slice,
+                            &param,
+                            param.weights,
+                            groundTruthLabels,
+                            lossPerLabel,
+                            feature,
+                            _nodeCoeffs,
+                            _edgeCoeffs);
+      break;
 #endif
 
     case T_GI_MF:
@@ -197,6 +224,16 @@ GraphInference* createGraphInferenceInstance(int algo_type,
                      _nodeCoeffs);
       break;
 
+    case T_GI_ICM:
+      gi = new GI_ICM(slice,
+                      &param,
+                      param.weights,
+                      groundTruthLabels,
+                      lossPerLabel,
+                      feature,
+                      _nodeCoeffs);
+      break;
+
     case T_GI_MAX:
       {
         gi = new GI_max(slice,
@@ -306,11 +343,14 @@ labelType* computeLabels(Slice_P* g, Feature* feature, const EnergyParam& param,
     return computeLabels_sampling(g, feature, param, algoType, energy,
                                   groundTruthLabels, lossPerLabel, _nodeCoeffs, _edgeCoeffs);
   } else {
+    PROFILE_SCOPE("inference");
     GraphInference* gi_Inference =
       createGraphInferenceInstance(algoType, g, param, feature, groundTruthLabels,
                                    lossPerLabel, _nodeCoeffs, _edgeCoeffs);
     size_t maxiter = 100;
     ulong nNodes = g->getNbSupernodes();
+    PROFILE_COUNT("inference_supernodes", nNodes);
+    PROFILE_COUNT("inference_edges", g->getNbEdges());
     labelType* nodeLabels = new labelType[nNodes];
     gi_Inference->run(nodeLabels, 0, maxiter);
     if(param.nClasses == 3) {
@@ -355,14 +395,11 @@ double compute_score(Slice_P* slice, Feature* feature, const EnergyParam& param,
       sid = i;
     }
 
-    supernode* s = slice->getSupernode(sid);
-    vector < supernode* >* lNeighbors = &(s->neighbors);
-
     double potential = gi.computeUnaryPotential(slice, sid, c);
-    for(vector < supernode* >::iterator itN = lNeighbors->begin();
-        itN != lNeighbors->end(); itN++) {
+    const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+    for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
       const int c2 = rand()*param.nClasses / (double)RAND_MAX;
-      double pairwisePotential = gi.computePairwisePotential(slice, s, (*itN),
+      double pairwisePotential = gi.computePairwisePotential(sid, *itE,
                                                              c, c2);
       potential += pairwisePotential;
     }
@@ -569,13 +606,30 @@ double segmentImage(SPATTERN x,
                     const bool compress_image,
                     const char* overlay_dir,
                     const int metric_type)
+{
+  EnergyParam param(weight_file);
+  return segmentImage(x, output_file, algoType, param, labelToClassIdx,
+                      output_roc_file, groundTruthLabels, lossPerLabel,
+                      compress_image, overlay_dir, metric_type);
+}
+
+double segmentImage(SPATTERN x,
+                    const char* output_file,
+                    int algoType,
+                    const EnergyParam& param,
+                    map<labelType, ulong>* labelToClassIdx,
+                    const string& output_roc_file,
+                    labelType* groundTruthLabels,
+                    double* lossPerLabel,
+                    const bool compress_image,
+                    const char* overlay_dir,
+                    const int metric_type)
 {
   Slice_P* g = x.slice;
   Feature* feature = x.feature;
   map<sidType, nodeCoeffType>* _nodeCoeffs = x.nodeCoeffs;
   map<sidType, edgeCoeffType>* _edgeCoeffs = x.edgeCoeffs;
 
-  EnergyParam param(weight_file);
   bool output_is_dir = isDirectory(output_file);
   string output_dir = getDirectoryFromPath(output_file);
   double energy = 0;
@@ -603,13 +657,23 @@ double segmentImage(SPATTERN x,
     getLabelToClassMap(paramColormap.c_str(), *labelToClassIdx);
   }
 
-  // output image
+  // output image. As before, volumes are only compressed when they are
+  // scored against the ground truth.
   int nNodes = g->getNbSupernodes();
-  g->exportSupernodeLabels(soutColoredImage.str().c_str(),
-                           param.nClasses,
-                           nodeLabels,
-                           nNodes,
-                           labelToClassIdx);
+  if(compress_image && g->getType() == SLICEP_SLICE3D &&
+     !output_roc_file.empty()) {
+    g->exportCompressedSupernodeLabels(soutColoredImage.str().c_str(),
+                                       param.nClasses,
+                                       nodeLabels,
+                                       nNodes,
+                                       labelToClassIdx);
+  } else {
+    g->exportSupernodeLabels(soutColoredImage.str().c_str(),
+                             param.nClasses,
+                             nodeLabels,
+                             nNodes,
+                             labelToClassIdx);
+  }
 
   map<labelType, ulong> labelCount;
   g->countSupernodeLabels(nodeLabels, labelCount);
@@ -717,10 +781,6 @@ double segmentImage(SPATTERN x,
         ofsRoc << SEPARATOR << accuracy << endl;
         ofsRoc.close();
       }
-
-      if(compress_image && g->getType() == SLICEP_SLICE3D) {
-        zipAndDeleteCube(soutColoredImage.str().c_str());
-      }
     }
   }
 
@@ -70,6 +70,22 @@ double segmentImage(SPATTERN x,
                     const char* overlay_dir,
                     const int metric_type);
 
+/**
+ * Same as above with a model that was already loaded (e.g. with the feature
+ * scale folded into the weights).
+ */
+double segmentImage(SPATTERN x,
+                    const char* output_file,
+                    int algoType,
+                    const EnergyParam& param,
+                    map<labelType, ulong>* labelToClassIdx,
+                    const string& output_roc_file,
+                    labelType* groundTruthLabels,
+                    double* lossPerLabel,
+                    const bool compress_image,
+                    const char* overlay_dir,
+                    const int metric_type);
+
 void computeScore(const char* image_dir,
                   const char* image_pattern,
                   const char* superpixelDir,
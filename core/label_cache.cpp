@@ -23,35 +23,56 @@ LabelCache::~LabelCache()
 
 void LabelCache::clear()
 {
-  for(map<int, LABEL>::iterator it = labels.begin();
-      it != labels.end(); ++it) {
-    delete[] it->second.nodeLabels;
+#ifdef WITH_OPENMP
+#pragma omp critical(label_cache)
+#endif
+  {
+    for(map<int, LABEL>::iterator it = labels.begin();
+        it != labels.end(); ++it) {
+      delete[] it->second.nodeLabels;
+    }
+    labels.clear();
   }
-  labels.clear();
 }
 
 bool LabelCache::exists(int id)
 {
   bool labelFound = false;
-  map<int, LABEL>::iterator lookup = labels.find(id);
-  if(lookup != labels.end()) {
-    labelFound = true;
+#ifdef WITH_OPENMP
+#pragma omp critical(label_cache)
+#endif
+  {
+    map<int, LABEL>::iterator lookup = labels.find(id);
+    if(lookup != labels.end()) {
+      labelFound = true;
+    }
   }
   return labelFound;
 }
 
+// Examples are processed concurrently by the most violated constraint search
+// so accesses to the map are serialized. Each example only ever touches its
+// own entry so the labels themselves do not need to be locked.
 bool LabelCache::getLabel(int id, LABEL& l)
 {
   bool labelFound = false;
-  map<int, LABEL>::iterator lookup = labels.find(id);
-  if(lookup != labels.end()) {
-    l = labels[id];
-    labelFound = true;
+#ifdef WITH_OPENMP
+#pragma omp critical(label_cache)
+#endif
+  {
+    map<int, LABEL>::iterator lookup = labels.find(id);
+    if(lookup != labels.end()) {
+      l = lookup->second;
+      labelFound = true;
+    }
   }
   return labelFound;
 }
 
 void LabelCache::setLabel(int id, LABEL& l)
 {
+#ifdef WITH_OPENMP
+#pragma omp critical(label_cache)
+#endif
   labels[id] = l;
 }
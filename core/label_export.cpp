@@ -0,0 +1,319 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "label_export.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "zlib.h"
+
+#include "Config.h"
+#include "profiler.h"
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+#define RLE_MAGIC "SLRL"
+
+//------------------------------------------------------------------------------
+
+void getLabelExportParameters(eLabelExportFormat& format, int& level)
+{
+  format = LABEL_EXPORT_ZIP;
+  level = Z_DEFAULT_COMPRESSION;
+
+  string config_tmp;
+  if(Config::Instance()->getParameter("label_export_format", config_tmp)) {
+    if(config_tmp == "rle") {
+      format = LABEL_EXPORT_RLE;
+    } else if(config_tmp != "zip") {
+      printf("[LabelExport] Unknown export format %s, using zip\n", config_tmp.c_str());
+    }
+  }
+  if(Config::Instance()->getParameter("label_export_level", config_tmp)) {
+    level = atoi(config_tmp.c_str());
+    if(level < 0 || level > 9) {
+      level = Z_DEFAULT_COMPRESSION;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+
+ZipCubeWriter::ZipCubeWriter(const char* filename, ulong _sliceSize,
+                             int _depth, int _level)
+{
+  sliceSize = _sliceSize;
+  depth = _depth;
+  level = _level;
+  nWrittenSlices = 0;
+  adler = adler32(0L, Z_NULL, 0);
+  finished = false;
+  failed = false;
+
+  fp = fopen(filename, "wb");
+  if(fp == 0) {
+    printf("[LabelExport] Error : could not open %s\n", filename);
+    return;
+  }
+
+  // zlib header : deflate with a 32K window, no dictionary
+  const uchar header[2] = { 0x78, 0x9c };
+  if(fwrite(header, 1, 2, fp) != 2) {
+    failed = true;
+  }
+}
+
+ZipCubeWriter::~ZipCubeWriter()
+{
+  if(fp) {
+    close();
+  }
+}
+
+bool ZipCubeWriter::compressBlock(const uchar* data, ulong len, bool last,
+                                  vector<uchar>& out)
+{
+  z_stream strm;
+  strm.zalloc = Z_NULL;
+  strm.zfree = Z_NULL;
+  strm.opaque = Z_NULL;
+  if(deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+                  Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+
+  // a sync flush appends an empty stored block (at most 10 bytes with the
+  // pending bits) to the deflate bound.
+  out.resize(deflateBound(&strm, len) + 16);
+  strm.next_in = (Bytef*)data;
+  strm.avail_in = len;
+  strm.next_out = &out[0];
+  strm.avail_out = out.size();
+
+  int flush = last?Z_FINISH:Z_SYNC_FLUSH;
+  int ret;
+  do {
+    ret = deflate(&strm, flush);
+    if(ret == Z_STREAM_ERROR) {
+      (void)deflateEnd(&strm);
+      return false;
+    }
+    if(strm.avail_out == 0) {
+      ulong used = out.size();
+      out.resize(used*2);
+      strm.next_out = &out[used];
+      strm.avail_out = out.size() - used;
+    } else if(!last || ret == Z_STREAM_END) {
+      break;
+    }
+  } while(true);
+
+  out.resize(out.size() - strm.avail_out);
+  (void)deflateEnd(&strm);
+  return true;
+}
+
+void ZipCubeWriter::writeSlices(const uchar* data, int nSlices)
+{
+  if(fp == 0 || failed) {
+    return;
+  }
+  if(nWrittenSlices + nSlices > depth) {
+    printf("[LabelExport] Error : %d slices written to a cube of depth %d\n",
+           nWrittenSlices + nSlices, depth);
+    exit(-1);
+  }
+
+  vector< vector<uchar> > blocks(nSlices);
+  vector<ulong> adlers(nSlices);
+  int nFailed = 0;
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:nFailed)
+#endif
+  for(int i = 0; i < nSlices; ++i) {
+    const uchar* slice = data + sliceSize*i;
+    bool last = (nWrittenSlices + i == depth - 1);
+    if(!compressBlock(slice, sliceSize, last, blocks[i])) {
+      ++nFailed;
+    }
+    adlers[i] = adler32(adler32(0L, Z_NULL, 0), slice, sliceSize);
+  }
+
+  if(nFailed != 0) {
+    failed = true;
+    return;
+  }
+
+  for(int i = 0; i < nSlices; ++i) {
+    if(!blocks[i].empty() &&
+       fwrite(&blocks[i][0], 1, blocks[i].size(), fp) != blocks[i].size()) {
+      failed = true;
+      return;
+    }
+    PROFILE_COUNT("export_bytes", blocks[i].size());
+    adler = adler32_combine(adler, adlers[i], sliceSize);
+  }
+
+  nWrittenSlices += nSlices;
+  if(nWrittenSlices == depth) {
+    finished = true;
+  }
+}
+
+bool ZipCubeWriter::close()
+{
+  if(fp == 0) {
+    return false;
+  }
+
+  if(!finished && !failed) {
+    // terminate the stream with an empty final block
+    const uchar final_block[2] = { 0x03, 0x00 };
+    if(fwrite(final_block, 1, 2, fp) != 2) {
+      failed = true;
+    }
+  }
+
+  // adler32 checksum of the uncompressed data (big endian)
+  uchar trailer[4];
+  trailer[0] = (adler >> 24) & 0xff;
+  trailer[1] = (adler >> 16) & 0xff;
+  trailer[2] = (adler >> 8) & 0xff;
+  trailer[3] = adler & 0xff;
+  if(fwrite(trailer, 1, 4, fp) != 4) {
+    failed = true;
+  }
+
+  fclose(fp);
+  fp = 0;
+  return !failed;
+}
+
+//------------------------------------------------------------------------------
+
+RLECubeWriter::RLECubeWriter(const char* filename, int width, int height,
+                             int depth)
+{
+  nRuns = 0;
+  failed = false;
+
+  fp = fopen(filename, "wb");
+  if(fp == 0) {
+    printf("[LabelExport] Error : could not open %s\n", filename);
+    return;
+  }
+
+  int header[4] = { width, height, depth, 0 };
+  if(fwrite(RLE_MAGIC, 1, 4, fp) != 4 ||
+     fwrite(header, sizeof(int), 4, fp) != 4) {
+    failed = true;
+  }
+}
+
+RLECubeWriter::~RLECubeWriter()
+{
+  if(fp) {
+    close();
+  }
+}
+
+void RLECubeWriter::addRun(const lineContainer& line, uchar label)
+{
+  if(fp == 0 || failed) {
+    return;
+  }
+  int run[4] = { line.coord.x, line.coord.y, line.coord.z, (int)line.length };
+  if(fwrite(run, sizeof(int), 4, fp) != 4 ||
+     fwrite(&label, 1, 1, fp) != 1) {
+    failed = true;
+    return;
+  }
+  PROFILE_COUNT("export_bytes", 4*sizeof(int) + 1);
+  ++nRuns;
+}
+
+bool RLECubeWriter::close()
+{
+  if(fp == 0) {
+    return false;
+  }
+
+  // number of runs is the last field of the header
+  if(fseek(fp, 4 + 3*sizeof(int), SEEK_SET) != 0 ||
+     fwrite(&nRuns, sizeof(int), 1, fp) != 1) {
+    failed = true;
+  }
+
+  fclose(fp);
+  fp = 0;
+  return !failed;
+}
+
+bool importRLECube(const char* filename, uchar*& cube,
+                   int& width, int& height, int& depth)
+{
+  FILE* fp = fopen(filename, "rb");
+  if(fp == 0) {
+    printf("[LabelExport] Error : could not open %s\n", filename);
+    return false;
+  }
+
+  char magic[4];
+  int header[4];
+  if(fread(magic, 1, 4, fp) != 4 || strncmp(magic, RLE_MAGIC, 4) != 0 ||
+     fread(header, sizeof(int), 4, fp) != 4) {
+    printf("[LabelExport] Error : %s is not a RLE cube\n", filename);
+    fclose(fp);
+    return false;
+  }
+  width = header[0];
+  height = header[1];
+  depth = header[2];
+  int nRuns = header[3];
+
+  ulong sliceSize = (ulong)width*height;
+  ulong cubeSize = sliceSize*depth;
+  cube = new uchar[cubeSize];
+  memset(cube, 0, cubeSize);
+
+  bool valid = true;
+  int run[4];
+  uchar label;
+  for(int i = 0; i < nRuns; ++i) {
+    if(fread(run, sizeof(int), 4, fp) != 4 || fread(&label, 1, 1, fp) != 1) {
+      valid = false;
+      break;
+    }
+    if(run[0] < 0 || run[1] < 0 || run[2] < 0 || run[3] < 0 ||
+       run[0] + run[3] > width || run[1] >= height || run[2] >= depth) {
+      valid = false;
+      break;
+    }
+    memset(cube + run[2]*sliceSize + (ulong)run[1]*width + run[0], label, run[3]);
+  }
+  fclose(fp);
+
+  if(!valid) {
+    printf("[LabelExport] Error : %s is truncated or corrupted\n", filename);
+    delete[] cube;
+    cube = 0;
+  }
+  return valid;
+}
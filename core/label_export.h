@@ -0,0 +1,130 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef LABEL_EXPORT_H
+#define LABEL_EXPORT_H
+
+#include <stdio.h>
+#include <vector>
+
+#include "globalsE.h"
+#include "Supernode.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+enum eLabelExportFormat
+{
+  LABEL_EXPORT_ZIP = 0, // zlib stream of the raw uchar cube ordered by zyx
+  LABEL_EXPORT_RLE      // runs of labels written from the supernode lines
+};
+
+/**
+ * Read the label export format and the zlib compression level from the
+ * config file (label_export_format = zip|rle, label_export_level = 0..9).
+ */
+void getLabelExportParameters(eLabelExportFormat& format, int& level);
+
+//------------------------------------------------------------------------------
+
+/**
+ * Writes a uchar cube as a single zlib stream, one slice at a time.
+ * Slices given to writeSlices are deflated in parallel as independent
+ * blocks (byte-aligned with a sync flush) and appended in order so the
+ * output can be inflated by any zlib decoder, including inf().
+ */
+class ZipCubeWriter
+{
+ public:
+  /**
+   * @param level is the zlib compression level (Z_DEFAULT_COMPRESSION, 1=fast)
+   */
+  ZipCubeWriter(const char* filename, ulong sliceSize, int depth,
+                int level);
+
+  ~ZipCubeWriter();
+
+  bool isOpen() { return fp != 0; }
+
+  /**
+   * Append nSlices consecutive slices of sliceSize voxels.
+   */
+  void writeSlices(const uchar* data, int nSlices);
+
+  /**
+   * Terminate the stream. Returns false if an error occured.
+   */
+  bool close();
+
+ private:
+  FILE* fp;
+  ulong sliceSize;
+  int depth;
+  int level;
+
+  int nWrittenSlices;
+  ulong adler;
+  bool finished;
+  bool failed;
+
+  /**
+   * Deflate len bytes as a raw deflate block.
+   * The block is terminated if last is true.
+   */
+  bool compressBlock(const uchar* data, ulong len, bool last,
+                     vector<uchar>& out);
+};
+
+//------------------------------------------------------------------------------
+
+/**
+ * Writes the labels of a volume as runs along the x axis :
+ * header "SLRL", width, height, depth, nRuns (int32)
+ * then nRuns records x, y, z, length (int32) and label (uchar).
+ * Runs are appended in any order so that supernode lines can be written
+ * directly, voxels not covered by a run are 0.
+ */
+class RLECubeWriter
+{
+ public:
+  RLECubeWriter(const char* filename, int width, int height, int depth);
+
+  ~RLECubeWriter();
+
+  bool isOpen() { return fp != 0; }
+
+  void addRun(const lineContainer& line, uchar label);
+
+  /**
+   * Write the number of runs in the header and close the file.
+   */
+  bool close();
+
+ private:
+  FILE* fp;
+  int nRuns;
+  bool failed;
+};
+
+/**
+ * Decode a cube written by RLECubeWriter.
+ * cube is allocated by this function and caller is responsible for freeing
+ * memory.
+ */
+bool importRLECube(const char* filename, uchar*& cube,
+                   int& width, int& height, int& depth);
+
+#endif // LABEL_EXPORT_H
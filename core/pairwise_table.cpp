@@ -0,0 +1,88 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "pairwise_table.h"
+
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+
+PairwiseTable::PairwiseTable()
+{
+  nClasses = 0;
+  nPairwiseStates = 0;
+  nGradientLevels = 0;
+  nOrientations = 0;
+  nBins = 0;
+}
+
+bool PairwiseTable::update(const EnergyParam* param, const double* smw)
+{
+  int nDistances = 1;
+#if USE_LONG_RANGE_EDGES
+  nDistances = max(1, param->nDistances);
+#endif
+  const int _nOrientations = max(1, param->nOrientations);
+  const int nStates = param->nClasses*param->nClasses;
+  const int nWeights = (param->nGradientLevels == 0)?1:
+    nDistances*param->nGradientLevels*_nOrientations*nStates;
+  const double* w = smw + param->nUnaryWeights;
+
+  if(nClasses == param->nClasses && nGradientLevels == param->nGradientLevels &&
+     nOrientations == _nOrientations && (int)weights.size() == nWeights &&
+     equal(weights.begin(), weights.end(), w)) {
+    return false;
+  }
+
+  nClasses = param->nClasses;
+  nPairwiseStates = nStates;
+  nGradientLevels = param->nGradientLevels;
+  nOrientations = _nOrientations;
+  weights.assign(w, w + nWeights);
+
+  if(nGradientLevels == 0) {
+    // potts model
+    nBins = 1;
+    scores.assign(nPairwiseStates, 0);
+    for(int c = 0; c < nClasses; c++) {
+      scores[c*nClasses + c] = w[0];
+    }
+  } else {
+    // the weights of bin (d,g,o) start at bin*nPairwiseStates so the prefix
+    // sum over gradient levels adds the scores of the bin nOrientations
+    // entries before.
+    nBins = nDistances*nGradientLevels*nOrientations;
+    scores.resize(nBins*nPairwiseStates);
+    for(int d = 0; d < nDistances; d++) {
+      for(int g = 0; g < nGradientLevels; g++) {
+        for(int o = 0; o < nOrientations; o++) {
+          int bin = getBin(g, o, d);
+          double* s = &scores[bin*nPairwiseStates];
+          const double* wb = w + bin*nPairwiseStates;
+          for(int p = 0; p < nPairwiseStates; p++) {
+            s[p] = wb[p];
+          }
+          if(g > 0) {
+            const double* prev = &scores[(bin - nOrientations)*nPairwiseStates];
+            for(int p = 0; p < nPairwiseStates; p++) {
+              s[p] += prev[p];
+            }
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
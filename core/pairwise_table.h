@@ -0,0 +1,97 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef PAIRWISE_TABLE_H
+#define PAIRWISE_TABLE_H
+
+#include <vector>
+
+#include "Slice_P.h"
+#include "energyParam.h"
+#include "globalsE.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+/**
+ * Pairwise potentials for each (distance, gradient, orientation) bin.
+ * The pairwise weights of a bin with gradient index g are the sum of the
+ * weights of gradient levels 0..g so the table is prefix-summed once per
+ * weight vector and each edge evaluation is a single lookup.
+ * Each bin holds nClasses*nClasses scores indexed by
+ * label(max sid)*nClasses + label(min sid), the convention used by psi.
+ * With no gradient levels, the single bin holds the potts model.
+ */
+class PairwiseTable
+{
+ public:
+  PairwiseTable();
+
+  /**
+   * Rebuild the table if the pairwise weights in smw changed since the last
+   * call. Returns true if the table was rebuilt.
+   */
+  bool update(const EnergyParam* param, const double* smw);
+
+  inline int getBin(const edgeInfo& e) const {
+#if USE_LONG_RANGE_EDGES
+    return getBin(e.gradientIdx, e.orientationIdx, e.distanceIdx);
+#else
+    return getBin(e.gradientIdx, e.orientationIdx, 0);
+#endif
+  }
+
+  inline int getBin(int gradientIdx, int orientationIdx, int distanceIdx) const {
+    if(nGradientLevels == 0) {
+      return 0;
+    }
+    return ((distanceIdx*nGradientLevels) + gradientIdx)*nOrientations + orientationIdx;
+  }
+
+  /**
+   * Returns the nClasses*nClasses scores of a bin
+   */
+  inline const double* getScores(int bin) const {
+    return &scores[bin*nPairwiseStates];
+  }
+
+  /**
+   * Score of an edge between a node labeled s_label and its neighbor sn
+   * labeled sn_label.
+   */
+  inline double getScore(int bin, sidType sid, sidType nsid,
+                         labelType s_label, labelType sn_label) const {
+    int p = (sid < nsid)?(sn_label*nClasses + s_label):(s_label*nClasses + sn_label);
+    return scores[bin*nPairwiseStates + p];
+  }
+
+  int getNbBins() const { return nBins; }
+
+ private:
+  int nClasses;
+  int nPairwiseStates;
+  int nGradientLevels;
+  int nOrientations;
+  int nBins;
+
+  // pairwise weights the table was built from
+  vector<double> weights;
+
+  // nBins x nPairwiseStates
+  vector<double> scores;
+};
+
+#endif // PAIRWISE_TABLE_H
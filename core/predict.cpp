@@ -44,13 +44,20 @@
 #include "inference.h"
 #include "Feature.h"
 #include "F_Combo.h"
+#include "profiler.h"
 
-#include "gi_libDAI.h"
+#include "gi_bp.h"
 
 #include "energyParam.h"
 #include "svm_struct_api_types.h"
 #include "svm_struct_api.h"
 
+#ifndef _WIN32
+#include "predict_pipeline.h"
+#include "predict_server.h"
+#include "tiled_inference.h"
+#endif
+
 #ifdef _WIN32
 #include "direct.h"
 #define mkdir(x,y) _mkdir(x)
@@ -73,16 +80,20 @@ static char args_doc[] = "args";
 /* Program options */
 static struct option long_options[] = {
   {"all", no_argument, 0, 'a'}, //"export marginals and also run inference using unary potentials only (useful for debugging)"},
+  {"batch", required_argument, 0, 'b'}, //"directory or manifest of volumes to process"},
   {"config_file", required_argument, 0, 'c'}, //"config_file"},
   {"image_dir", required_argument, 0, 'i'}, //"input directory"},
   {"algo_type", required_argument, 0, 'g'}, //"algo_type"},
+  {"jobs", required_argument, 0, 'j'}, //"number of volumes processed concurrently in server mode"},
   {"image_pattern", required_argument, 0, 'k'}, //"image_pattern"},
   {"superpixel_labels", required_argument, 0, 'l'}, //"path of the file containing the labels for the superpixels (labels have be ordered by rows)"},
   {"mask_dir", required_argument, 0, 'm'}, //"mask directory"},
   {"nImages", required_argument, 0, 'n'}, //"number of images to process"},
   {"output_dir", required_argument, 0, 'o'}, //"output filename"},
   {"superpixelStepSize", required_argument, 0, 's'}, //"superpixel step size"},
+  {"server", required_argument, 0, 'S'}, //"serve jobs read from a UNIX socket or from stdin (-)"},
   {"dataset_type", required_argument, 0, 't'}, //"type (0=training, 1=test)"},
+  {"tiled", no_argument, 0, 'T'}, //"process the cube tile by tile"},
   {"verbose", no_argument, 0, 'v'}, //"verbose"},
   {"weight_file", required_argument, 0, 'w'}, //"weight_file"},
   {"overlay", required_argument, 0, 'y'}, //"overlay directory"},
@@ -106,6 +117,10 @@ struct arguments
   char* config_file;
   char* overlay_dir;
   int dataset_type;
+  char* server_socket;
+  int nJobs;
+  char* batch;
+  bool tiled;
 };
 
 arguments args;
@@ -117,16 +132,20 @@ void print_usage(){
   "usage: \n \
   predict.exe -c config.txt -w model.txt \n \
   -a all: export marginals and also run inference using unary potentials only (useful for debugging) \n \
+  -b batch : directory (one volume per sub-directory) or manifest (image_dir [mask_dir [output_dir]] per line) of volumes to process \n \
   -c config_file \n \
   -i image_dir input directory \n \
   -g algo_type \n \
+  -j jobs : number of volumes processed concurrently in server mode \n \
   -k image_pattern \n \
   -l superpixel_labels : path of the file containing the labels for the superpixels (labels have be ordered by rows) \n \
   -m mask_dir : mask directory \n \
   -n nImages : number of images to process \n \
   -o output_dir : output filename \n \
   -s superpixelStepSize : superpixel step size \n \
+  -S server : serve jobs (image_dir [mask_dir [output_dir]] per line) read from a UNIX socket or from stdin (-) \n \
   -t dataset_type : type (0=training, 1=test) \n \
+  -T tiled : process the cube tile by tile (for cubes that do not fit in memory) \n \
   -v : verbose \n \
   -w weight_file : model obtained from training \n \
   -y : overlay directory\n");
@@ -141,6 +160,9 @@ static int parse_opt (int key, char *arg, struct arguments *argments)
       //TODO change argument from required_argument to no_argument with flag
       argments->export_all = true;
       break;
+    case 'b':
+      argments->batch = arg;
+      break;
     case 'c':
       argments->config_file = arg;
       break;
@@ -151,6 +173,10 @@ static int parse_opt (int key, char *arg, struct arguments *argments)
     case 'i':
       argments->image_dir = arg;
       break;
+    case 'j':
+      if(arg!=0)
+        argments->nJobs = atoi(arg);
+      break;
     case 'k':
       if(arg!=0)
         argments->image_pattern = arg;
@@ -171,10 +197,16 @@ static int parse_opt (int key, char *arg, struct arguments *argments)
     case 's':
       argments->superpixelStepSize = atoi(arg);
       break;
+    case 'S':
+      argments->server_socket = arg;
+      break;
     case 't':
       if(arg!=0)
         argments->dataset_type = atoi(arg);
       break;
+    case 'T':
+      argments->tiled = true;
+      break;
     case 'v':
       //TODO change argument from no_argument to no_argument with flag
       verbose = true;
@@ -215,6 +247,10 @@ int main(int argc,char* argv[])
   args.overlay_dir = 0;
   args.export_all = false;
   args.dataset_type = 0;
+  args.server_socket = 0;
+  args.nJobs = 2;
+  args.batch = 0;
+  args.tiled = false;
   const bool compress_image = false;
 
   int option_index = 0;
@@ -226,7 +262,7 @@ int main(int argc,char* argv[])
      exit(EXIT_FAILURE);
   }
 
-  while((key = getopt_long(argc, argv, "ac:g:i:k:l:m:n:o:s:t:vw:y:h", long_options, &option_index)) != -1){
+  while((key = getopt_long(argc, argv, "ab:c:g:i:j:k:l:m:n:o:s:S:t:Tvw:y:h", long_options, &option_index)) != -1){
       parsing_output = parse_opt(key, optarg, &args);
       if(parsing_output == -1){
           fprintf(stderr, "Wrong argument. Parsing failed.");
@@ -240,12 +276,22 @@ int main(int argc,char* argv[])
     args.overlay_dir = args.output_dir;
   }
 
+#ifndef _WIN32
+  // when jobs are read from stdin, stdout only carries the replies
+  int replyFd = STDOUT_FILENO;
+  if(args.server_socket != 0 && strcmp(args.server_socket, "-") == 0) {
+    replyFd = PredictServer::redirectLogs();
+  }
+#endif
+
   string config_tmp;
   Config* config = new Config(args.config_file);
   Config::setInstance(config);
 
   set_default_parameters(config);
 
+  Profiler::init();
+
   mkdir(args.output_dir, 0777);
 
   string imageDir;
@@ -278,7 +324,11 @@ int main(int argc,char* argv[])
       args.algo_type = T_GI_MAXFLOW;
     }
     if(args.algo_type == T_GI_MULTIOBJ && param.nClasses > 3) {
+#if USE_MAXFLOW
+      args.algo_type = T_GI_EXPANSION;
+#else
       args.algo_type = T_GI_LIBDAI;
+#endif
     }    
   }
 
@@ -290,18 +340,78 @@ int main(int argc,char* argv[])
     FOREGROUND = 2;
   }
 
+  bool rescale_features = true;
+  if(Config::Instance()->getParameter("rescale_features", config_tmp)) {
+    rescale_features = config_tmp.c_str()[0] == '1';
+  }
+  const char* scale_filename = "scale.txt";
+
+  // absorb the feature scale into the weights so that the features are used
+  // as loaded and feature caches mapped in memory are never written
+  bool fold_feature_scale = false;
+  if(Config::Instance()->getParameter("fold_feature_scale", config_tmp)) {
+    fold_feature_scale = config_tmp.c_str()[0] == '1';
+  }
+  if(rescale_features && fold_feature_scale) {
+    vector<double> mean;
+    vector<double> variance;
+    if(Slice_P::loadFeatureScale(scale_filename, mean, variance)) {
+      param.foldFeatureScale(mean, variance);
+    } else {
+      printf("[Main] No scale file %s. Features will be rescaled\n", scale_filename);
+    }
+  }
+
+  if(args.server_socket != 0 || args.batch != 0 || args.tiled) {
+#ifdef _WIN32
+    printf("[Main] Server, batch and tiled modes are not supported on this platform\n");
+    exit(EXIT_FAILURE);
+#else
+    if( (args.weight_file == 0) || !fileExists(args.weight_file)) {
+      printf("[Main] Server, batch and tiled modes require a parameter file\n");
+      exit(EXIT_FAILURE);
+    }
+
+    if(args.tiled) {
+      stringstream soutLabels;
+      soutLabels << args.output_dir << "/" << getLastDirectoryFromPath(imageDir);
+      printf("[Main] Writing labels to %s\n", soutLabels.str().c_str());
+      TiledPredictor predictor(param, args.algo_type);
+      bool success = predictor.run(imageDir.c_str(), soutLabels.str().c_str());
+      Profiler::dump();
+      return success?EXIT_SUCCESS:EXIT_FAILURE;
+    }
+
+    string colormapFilename;
+    getColormapName(colormapFilename);
+    printf("[Main] Colormap=%s\n", colormapFilename.c_str());
+    map<labelType, ulong> labelToClassIdx;
+    getLabelToClassMap(colormapFilename.c_str(), labelToClassIdx);
+
+    if(args.batch != 0) {
+      PredictPipeline pipeline(param, args.algo_type, labelToClassIdx,
+                               args.overlay_dir);
+      pipeline.addVolumes(args.batch, args.output_dir);
+      int nFailed = pipeline.run();
+      Profiler::dump();
+      return (nFailed == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+    }
+
+    PredictServer server(param, args.algo_type, labelToClassIdx,
+                         args.output_dir, args.overlay_dir, args.nJobs);
+    int ret = server.run(args.server_socket, replyFd);
+    Profiler::dump();
+    return ret;
+#endif
+  }
+
   Slice_P* slice = 0;
   Feature* feature = 0;
   int featureSize = 0;
   loadDataAndFeatures(imageDir, maskDir, config, slice, feature, &featureSize);
 
   // rescale features
-  bool rescale_features = true;
-  if(Config::Instance()->getParameter("rescale_features", config_tmp)) {
-    rescale_features = config_tmp.c_str()[0] == '1';
-  }
-  if(rescale_features) {
-    const char* scale_filename = "scale.txt";
+  if(rescale_features && !param.featureScaleFolded) {
     printf("[Main] Rescaling features\n");
     slice->rescalePrecomputedFeatures(scale_filename);
   }
@@ -340,7 +450,7 @@ int main(int argc,char* argv[])
     segmentImage(p,
                  args.output_dir,
                  args.algo_type,
-                 args.weight_file,
+                 param,
                  &labelToClassIdx,
                  score_filename,
                  groundTruthLabels, lossPerLabel,
@@ -366,7 +476,7 @@ int main(int argc,char* argv[])
         segmentImage(p,
                      args.output_dir,
                      T_GI_MAX,
-                     args.weight_file,
+                     param,
                      &labelToClassIdx,
                      score_filename,
                      groundTruthLabels, lossPerLabel,
@@ -377,20 +487,19 @@ int main(int argc,char* argv[])
 
       // export marginals
       printf("[Main] Exporting marginals\n");
-      GI_libDAI* gi_Inference = new GI_libDAI(slice,
-                                              &param,
-                                              param.weights,
-                                              groundTruthLabels,
-                                              lossPerLabel,
-                                              feature,
-                                              0, 0);
+      GI_BP* gi_Inference = new GI_BP(slice,
+                                      &param,
+                                      param.weights,
+                                      groundTruthLabels,
+                                      lossPerLabel,
+                                      feature,
+                                      0, 0);
 
       int nNodes = slice->getNbSupernodes();
       float* marginals = new float[nNodes];
-      GI_libDAI* libDAI = gi_Inference;
 
       for(int l = 0; l < param.nClasses; ++l) {
-        libDAI->getMarginals(marginals, l);
+        gi_Inference->getMarginals(marginals, l);
         
         stringstream sout;
         sout << args.output_dir;
@@ -406,6 +515,7 @@ int main(int argc,char* argv[])
   }
 
   printf("[Main] Cleaning\n");
+  Profiler::dump();
   printf("[Main] Done\n");
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,470 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "predict_pipeline.h"
+
+#include <errno.h>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+// SliceMe
+#include "Config.h"
+#include "Feature.h"
+#include "Slice_P.h"
+#include "inference.h"
+#include "utils.h"
+
+#define SCALE_FILENAME "scale.txt"
+
+//------------------------------------------------------------------------------
+
+static double getElapsedTime(struct timeval& t)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  double elapsed = (now.tv_sec - t.tv_sec) + (now.tv_usec - t.tv_usec)*1e-6;
+  t = now;
+  return elapsed;
+}
+
+/**
+ * Rough estimate of the memory used by a slice and its features.
+ */
+static ulong estimateMemory(Slice_P* slice)
+{
+  ulong nSupernodes = slice->getNbSupernodes();
+  // raw data and supernode ids
+  ulong memory = slice->getSize()*(slice->getNbChannels() + sizeof(sidType));
+  // supernodes, their lines and their neighbors
+  memory += nSupernodes*(sizeof(supernode) + 64);
+  memory += slice->getNbEdges()*(sizeof(edgeInfo) + sizeof(supernode*));
+  // feature matrix
+  memory += nSupernodes*slice->getFeatureStride()*sizeof(float);
+  return memory;
+}
+
+//------------------------------------------------------------------------------
+
+FeatureScale::FeatureScale(const EnergyParam& param)
+{
+  string config_tmp;
+  enabled = true;
+  if(Config::Instance()->getParameter("rescale_features", config_tmp)) {
+    enabled = config_tmp.c_str()[0] == '1';
+  }
+  if(param.featureScaleFolded) {
+    printf("[FeatureScale] Scale is folded into the weights\n");
+    enabled = false;
+  }
+  if(enabled) {
+    if(!Slice_P::loadFeatureScale(SCALE_FILENAME, mean, variance)) {
+      // a scale computed from the first volume would make the results
+      // depend on the order in which the volumes are processed
+      printf("[FeatureScale] Error: %s is required to rescale the features of several volumes. Set rescale_features to 0 or provide the scale computed at training time\n",
+             SCALE_FILENAME);
+      exit(-1);
+    }
+    printf("[FeatureScale] Loaded scale of dimension %ld from %s\n",
+           mean.size(), SCALE_FILENAME);
+  }
+}
+
+FeatureScale::~FeatureScale()
+{
+}
+
+void FeatureScale::apply(Slice_P* slice)
+{
+  if(!enabled) {
+    return;
+  }
+  slice->rescalePrecomputedFeatures(mean, variance);
+}
+
+void exportPrediction(Slice_P* slice, labelType* nodeLabels,
+                      const string& outputDir, const string& overlayDir,
+                      const EnergyParam& param,
+                      map<labelType, ulong>* labelToClassIdx)
+{
+  mkdir(outputDir.c_str(), 0777);
+  string name = getNameFromPathWithoutExtension(slice->getName());
+  stringstream soutColoredImage;
+  soutColoredImage << outputDir << "/" << name << ".png";
+  slice->exportSupernodeLabels(soutColoredImage.str().c_str(),
+                               param.nClasses,
+                               nodeLabels,
+                               slice->getNbSupernodes(),
+                               labelToClassIdx);
+
+  if(!overlayDir.empty()) {
+    mkdir(overlayDir.c_str(), 0777);
+    stringstream soutOverlayImage;
+    soutOverlayImage << overlayDir << "/" << name << "_overlay";
+    if(slice->getType() != SLICEP_SLICE3D) {
+      soutOverlayImage << ".png";
+    }
+    slice->exportOverlay(soutOverlayImage.str().c_str(), nodeLabels);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+PredictPipeline::PredictPipeline(const EnergyParam& _param, int _algoType,
+                                 const map<labelType, ulong>& _labelToClassIdx,
+                                 const char* _overlayDir)
+  : param(_param), scale(_param)
+{
+  algoType = _algoType;
+  labelToClassIdx = _labelToClassIdx;
+  overlayDir = (_overlayDir != 0)?_overlayDir:"";
+
+  const char* threadParameters[N_PIPELINE_STAGES] = {
+    "pipeline_load_threads",
+    "pipeline_feature_threads",
+    "pipeline_inference_threads",
+    "pipeline_export_threads"
+  };
+  string config_tmp;
+  for(int s = 0; s < N_PIPELINE_STAGES; ++s) {
+    nThreads[s] = 1;
+    if(Config::Instance()->getParameter(threadParameters[s], config_tmp)) {
+      nThreads[s] = max(1, atoi(config_tmp.c_str()));
+    }
+    nRunning[s] = 0;
+    pthread_cond_init(&queueCond[s], 0);
+  }
+
+  // memory budget in MB (0 = no limit)
+  memoryBudget = 0;
+  if(Config::Instance()->getParameter("pipeline_memory_budget", config_tmp)) {
+    memoryBudget = atol(config_tmp.c_str())*1024*1024;
+  }
+  memoryInFlight = 0;
+  nInFlight = 0;
+  nFailed = 0;
+
+  pthread_mutex_init(&mutex, 0);
+  pthread_cond_init(&memoryCond, 0);
+}
+
+PredictPipeline::~PredictPipeline()
+{
+  for(vector<PipelineVolume*>::iterator it = volumes.begin();
+      it != volumes.end(); ++it) {
+    release(*it);
+    delete *it;
+  }
+  for(int s = 0; s < N_PIPELINE_STAGES; ++s) {
+    pthread_cond_destroy(&queueCond[s]);
+  }
+  pthread_mutex_destroy(&mutex);
+  pthread_cond_destroy(&memoryCond);
+}
+
+void PredictPipeline::addVolume(const string& imageDir, const string& maskDir,
+                                const string& outputDir)
+{
+  PipelineVolume* volume = new PipelineVolume;
+  volume->id = volumes.size();
+  volume->imageDir = imageDir;
+  volume->maskDir = maskDir;
+  volume->outputDir = outputDir;
+  volume->slice = 0;
+  volume->feature = 0;
+  volume->nodeLabels = 0;
+  volume->memory = 0;
+  for(int s = 0; s < N_PIPELINE_STAGES; ++s) {
+    volume->stageTimes[s] = 0;
+  }
+  volume->failed = false;
+  volumes.push_back(volume);
+}
+
+int PredictPipeline::addVolumes(const char* path, const string& outputDir)
+{
+  int nVolumes = volumes.size();
+
+  if(isDirectory(path)) {
+    string config_tmp;
+    Config::Instance()->getParameter("slice3d", config_tmp);
+    bool useSlice3d = config_tmp.c_str()[0] == '1';
+
+    string dir(path);
+    if(dir[dir.size()-1] != '/') {
+      dir += '/';
+    }
+    vector<string> files;
+    getFilesInDir(dir.c_str(), files, 0, true);
+    for(vector<string>::iterator it = files.begin(); it != files.end(); ++it) {
+      if(getNameFromPath(*it).c_str()[0] == '.') {
+        continue;
+      }
+      if(useSlice3d) {
+        // one cube per sub-directory
+        if(isDirectory(*it)) {
+          addVolume(*it + "/", "", outputDir);
+        }
+      } else if(getExtension(*it) == "png") {
+        addVolume(*it, "", outputDir);
+      }
+    }
+  } else {
+    ifstream ifs(path);
+    if(ifs.fail()) {
+      printf("[PredictPipeline] Error : could not open %s\n", path);
+      return 0;
+    }
+    string line;
+    while(getline(ifs, line)) {
+      vector<string> tokens;
+      splitString(line, tokens);
+      if(tokens.empty() || tokens[0].c_str()[0] == '#') {
+        continue;
+      }
+      addVolume(tokens[0],
+                (tokens.size() > 1)?tokens[1]:"",
+                (tokens.size() > 2)?tokens[2]:outputDir);
+    }
+    ifs.close();
+  }
+
+  nVolumes = volumes.size() - nVolumes;
+  printf("[PredictPipeline] Added %d volumes from %s\n", nVolumes, path);
+  return nVolumes;
+}
+
+void* PredictPipeline::workerThread(void* arg)
+{
+  StageWorker* worker = (StageWorker*)arg;
+  PredictPipeline* pipeline = worker->pipeline;
+
+#ifdef WITH_OPENMP
+  // share the cores between the threads of the CPU-bound stages
+  if(worker->stage == STAGE_FEATURES || worker->stage == STAGE_INFERENCE) {
+    int nCPUThreads = pipeline->nThreads[STAGE_FEATURES] + pipeline->nThreads[STAGE_INFERENCE];
+    omp_set_num_threads(max(1, omp_get_num_procs()/nCPUThreads));
+  }
+#endif
+
+  pipeline->runStage(worker->stage);
+  return 0;
+}
+
+void PredictPipeline::runStage(ePipelineStage stage)
+{
+  PipelineVolume* volume;
+  while((volume = pop(stage)) != 0) {
+    process(stage, volume);
+    if(stage + 1 < N_PIPELINE_STAGES) {
+      push((ePipelineStage)(stage + 1), volume);
+    }
+  }
+
+  // the next stage does not get any new volume once all the threads of this
+  // stage are done
+  pthread_mutex_lock(&mutex);
+  --nRunning[stage];
+  if(nRunning[stage] == 0 && stage + 1 < N_PIPELINE_STAGES) {
+    pthread_cond_broadcast(&queueCond[stage + 1]);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+PipelineVolume* PredictPipeline::pop(ePipelineStage stage)
+{
+  PipelineVolume* volume = 0;
+  pthread_mutex_lock(&mutex);
+  while(queues[stage].empty() && stage > 0 && nRunning[stage - 1] > 0) {
+    pthread_cond_wait(&queueCond[stage], &mutex);
+  }
+  if(!queues[stage].empty()) {
+    volume = queues[stage].front();
+    queues[stage].pop_front();
+  }
+
+  if(volume && stage == STAGE_LOAD) {
+    // back-pressure : wait until enough volumes were exported
+    while(nInFlight > 0 && memoryBudget > 0 && memoryInFlight >= memoryBudget) {
+      pthread_cond_wait(&memoryCond, &mutex);
+    }
+    ++nInFlight;
+  }
+  pthread_mutex_unlock(&mutex);
+  return volume;
+}
+
+void PredictPipeline::push(ePipelineStage stage, PipelineVolume* volume)
+{
+  pthread_mutex_lock(&mutex);
+  queues[stage].push_back(volume);
+  pthread_cond_signal(&queueCond[stage]);
+  pthread_mutex_unlock(&mutex);
+}
+
+void PredictPipeline::process(ePipelineStage stage, PipelineVolume* volume)
+{
+  if(volume->failed && stage != STAGE_EXPORT) {
+    return;
+  }
+
+  struct timeval t;
+  gettimeofday(&t, NULL);
+
+  switch(stage) {
+  case STAGE_LOAD:
+    if(!isDirectory(volume->imageDir) && !fileExists(volume->imageDir)) {
+      volume->failed = true;
+      break;
+    }
+    loadSliceData(volume->imageDir, volume->maskDir, Config::Instance(),
+                  volume->slice);
+    break;
+  case STAGE_FEATURES:
+    {
+      int featureSize = 0;
+      loadSliceFeatures(volume->imageDir, Config::Instance(), volume->slice,
+                        volume->feature, &featureSize);
+      scale.apply(volume->slice);
+    }
+    break;
+  case STAGE_INFERENCE:
+    volume->nodeLabels = computeLabels(volume->slice, volume->feature, param,
+                                       algoType, 0);
+    break;
+  case STAGE_EXPORT:
+    if(!volume->failed) {
+      exportPrediction(volume->slice, volume->nodeLabels, volume->outputDir,
+                       overlayDir, param, &labelToClassIdx);
+    }
+    break;
+  default:
+    break;
+  }
+
+  volume->stageTimes[stage] = getElapsedTime(t);
+
+  if(stage == STAGE_LOAD || stage == STAGE_FEATURES) {
+    // update the memory used by the volume
+    pthread_mutex_lock(&mutex);
+    memoryInFlight -= volume->memory;
+    volume->memory = volume->slice?estimateMemory(volume->slice):0;
+    memoryInFlight += volume->memory;
+    pthread_mutex_unlock(&mutex);
+  }
+
+  if(stage == STAGE_EXPORT) {
+    if(volume->failed) {
+      printf("[PredictPipeline] error %d %s input not found\n", volume->id,
+             volume->imageDir.c_str());
+    } else {
+      printf("[PredictPipeline] done %d %s load=%g features=%g inference=%g export=%g\n",
+             volume->id, volume->imageDir.c_str(),
+             volume->stageTimes[STAGE_LOAD], volume->stageTimes[STAGE_FEATURES],
+             volume->stageTimes[STAGE_INFERENCE], volume->stageTimes[STAGE_EXPORT]);
+    }
+
+    pthread_mutex_lock(&mutex);
+    if(volume->failed) {
+      ++nFailed;
+    }
+    memoryInFlight -= volume->memory;
+    volume->memory = 0;
+    --nInFlight;
+    pthread_cond_broadcast(&memoryCond);
+    pthread_mutex_unlock(&mutex);
+
+    release(volume);
+  }
+}
+
+void PredictPipeline::release(PipelineVolume* volume)
+{
+  delete[] volume->nodeLabels;
+  volume->nodeLabels = 0;
+  if(volume->feature) {
+    releaseSliceFeatures(volume->slice, volume->feature);
+    volume->feature = 0;
+  }
+  delete volume->slice;
+  volume->slice = 0;
+}
+
+int PredictPipeline::run()
+{
+  printf("[PredictPipeline] Processing %ld volumes with %d/%d/%d/%d threads (load/features/inference/export), memory budget=%ld MB\n",
+         volumes.size(), nThreads[STAGE_LOAD], nThreads[STAGE_FEATURES],
+         nThreads[STAGE_INFERENCE], nThreads[STAGE_EXPORT],
+         memoryBudget/(1024*1024));
+
+  struct timeval t;
+  gettimeofday(&t, NULL);
+
+  nFailed = 0;
+  for(vector<PipelineVolume*>::iterator it = volumes.begin();
+      it != volumes.end(); ++it) {
+    queues[STAGE_LOAD].push_back(*it);
+  }
+
+  int nWorkers = 0;
+  for(int s = 0; s < N_PIPELINE_STAGES; ++s) {
+    nRunning[s] = nThreads[s];
+    nWorkers += nThreads[s];
+  }
+
+  vector<pthread_t> threads(nWorkers);
+  vector<StageWorker> workers(nWorkers);
+  int w = 0;
+  for(int s = 0; s < N_PIPELINE_STAGES; ++s) {
+    for(int i = 0; i < nThreads[s]; ++i, ++w) {
+      workers[w].pipeline = this;
+      workers[w].stage = (ePipelineStage)s;
+      if(pthread_create(&threads[w], 0, workerThread, &workers[w]) != 0) {
+        printf("[PredictPipeline] Error : could not create worker thread\n");
+        exit(-1);
+      }
+    }
+  }
+
+  for(w = 0; w < nWorkers; ++w) {
+    pthread_join(threads[w], 0);
+  }
+
+  double wallTime = getElapsedTime(t);
+
+  // busy time of each stage relative to the time its threads were available
+  const char* stageNames[N_PIPELINE_STAGES] = { "load", "features", "inference", "export" };
+  printf("[PredictPipeline] %ld volumes (%d failed) in %gs\n", volumes.size(),
+         nFailed, wallTime);
+  for(int s = 0; s < N_PIPELINE_STAGES; ++s) {
+    double busyTime = 0;
+    for(vector<PipelineVolume*>::iterator it = volumes.begin();
+        it != volumes.end(); ++it) {
+      busyTime += (*it)->stageTimes[s];
+    }
+    printf("[PredictPipeline] %s : %gs, utilization=%.1f%%\n", stageNames[s],
+           busyTime, (wallTime > 0)?100.0*busyTime/(wallTime*nThreads[s]):0);
+  }
+
+  return nFailed;
+}
@@ -0,0 +1,181 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef PREDICT_PIPELINE_H
+#define PREDICT_PIPELINE_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+#include "globalsE.h"
+#include "energyParam.h"
+#include "Supernode.h"
+
+using namespace std;
+
+class Feature;
+class Slice_P;
+
+//------------------------------------------------------------------------------
+
+/**
+ * Feature scale (mean and variance) shared by several volumes.
+ * The scale is read once from scale.txt, which must exist so that every
+ * volume (or tile) is rescaled the same way whatever the processing order.
+ * Nothing is done if the scale was folded into the weights of param.
+ */
+class FeatureScale
+{
+ public:
+  FeatureScale(const EnergyParam& param);
+
+  ~FeatureScale();
+
+  /**
+   * Rescale the precomputed features of slice (thread-safe)
+   */
+  void apply(Slice_P* slice);
+
+ private:
+  bool enabled;
+  vector<double> mean;
+  vector<double> variance;
+};
+
+/**
+ * Export the labels (and the overlay if overlayDir is not empty) predicted
+ * for a slice the same way segmentImage does.
+ */
+void exportPrediction(Slice_P* slice, labelType* nodeLabels,
+                      const string& outputDir, const string& overlayDir,
+                      const EnergyParam& param,
+                      map<labelType, ulong>* labelToClassIdx);
+
+//------------------------------------------------------------------------------
+
+enum ePipelineStage
+{
+  STAGE_LOAD = 0,   // volume, supervoxels and ground truth (I/O-bound)
+  STAGE_FEATURES,   // features and rescaling (CPU-bound)
+  STAGE_INFERENCE,  // CPU-bound
+  STAGE_EXPORT,     // I/O-bound
+  N_PIPELINE_STAGES
+};
+
+struct PipelineVolume
+{
+  int id;
+  string imageDir;
+  string maskDir;
+  string outputDir;
+
+  Slice_P* slice;
+  Feature* feature;
+  labelType* nodeLabels;
+
+  // estimated memory used by the volume (bytes)
+  ulong memory;
+
+  double stageTimes[N_PIPELINE_STAGES];
+  bool failed;
+};
+
+/**
+ * Batch prediction over a list of volumes.
+ * Each stage has its own pool of threads and its own queue so that the
+ * I/O-bound stages of some volumes overlap with the CPU-bound stages of
+ * others. A volume is only loaded while the estimated memory of the
+ * volumes in flight is below the memory budget (at least one volume is
+ * always in flight).
+ * Number of threads per stage and memory budget (in MB) are read from the
+ * config file : pipeline_load_threads, pipeline_feature_threads,
+ * pipeline_inference_threads, pipeline_export_threads and
+ * pipeline_memory_budget.
+ */
+class PredictPipeline
+{
+ public:
+  PredictPipeline(const EnergyParam& param, int algoType,
+                  const map<labelType, ulong>& labelToClassIdx,
+                  const char* overlayDir);
+
+  ~PredictPipeline();
+
+  void setNumberOfThreads(ePipelineStage stage, int n) { nThreads[stage] = max(1, n); }
+
+  void setMemoryBudget(ulong bytes) { memoryBudget = bytes; }
+
+  /**
+   * Add the volumes listed in path : either a manifest with one volume per
+   * line (image_dir [mask_dir [output_dir]]) or a directory containing one
+   * volume per sub-directory (one image per file for 2d slices).
+   */
+  int addVolumes(const char* path, const string& outputDir);
+
+  /**
+   * Process all the volumes. Returns the number of volumes that failed.
+   */
+  int run();
+
+ private:
+  const EnergyParam& param;
+  int algoType;
+  map<labelType, ulong> labelToClassIdx;
+  string overlayDir;
+  FeatureScale scale;
+
+  vector<PipelineVolume*> volumes;
+
+  int nThreads[N_PIPELINE_STAGES];
+  deque<PipelineVolume*> queues[N_PIPELINE_STAGES];
+  // number of threads still running for each stage
+  int nRunning[N_PIPELINE_STAGES];
+  pthread_mutex_t mutex;
+  pthread_cond_t queueCond[N_PIPELINE_STAGES];
+
+  ulong memoryBudget;
+  ulong memoryInFlight;
+  int nInFlight;
+  pthread_cond_t memoryCond;
+
+  int nFailed;
+
+  struct StageWorker
+  {
+    PredictPipeline* pipeline;
+    ePipelineStage stage;
+  };
+
+  static void* workerThread(void* arg);
+
+  void runStage(ePipelineStage stage);
+
+  PipelineVolume* pop(ePipelineStage stage);
+
+  void push(ePipelineStage stage, PipelineVolume* volume);
+
+  void process(ePipelineStage stage, PipelineVolume* volume);
+
+  void release(PipelineVolume* volume);
+
+  void addVolume(const string& imageDir, const string& maskDir,
+                 const string& outputDir);
+};
+
+#endif // PREDICT_PIPELINE_H
@@ -0,0 +1,370 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "predict_server.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+// SliceMe
+#include "Config.h"
+#include "Feature.h"
+#include "Slice_P.h"
+#include "inference.h"
+#include "utils.h"
+
+//------------------------------------------------------------------------------
+
+/**
+ * Client the results of a set of jobs are written to.
+ */
+struct PredictConnection
+{
+  int fd;
+  int nPendingJobs;
+  pthread_mutex_t mutex;
+  pthread_cond_t jobsDone;
+
+  PredictConnection(int _fd) {
+    fd = _fd;
+    nPendingJobs = 0;
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&jobsDone, 0);
+  }
+
+  ~PredictConnection() {
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&jobsDone);
+  }
+
+  void addJob() {
+    pthread_mutex_lock(&mutex);
+    ++nPendingJobs;
+    pthread_mutex_unlock(&mutex);
+  }
+
+  /**
+   * Write the result of a job and signal its completion.
+   */
+  void reply(const string& msg) {
+    pthread_mutex_lock(&mutex);
+    const char* p = msg.c_str();
+    size_t n = msg.size();
+    while(n > 0) {
+      ssize_t written = write(fd, p, n);
+      if(written <= 0) {
+        if(written < 0 && errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      p += written;
+      n -= written;
+    }
+    --nPendingJobs;
+    pthread_cond_broadcast(&jobsDone);
+    pthread_mutex_unlock(&mutex);
+  }
+
+  void waitForJobs() {
+    pthread_mutex_lock(&mutex);
+    while(nPendingJobs > 0) {
+      pthread_cond_wait(&jobsDone, &mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+  }
+};
+
+static double getElapsedTime(struct timeval& t)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  double elapsed = (now.tv_sec - t.tv_sec) + (now.tv_usec - t.tv_usec)*1e-6;
+  t = now;
+  return elapsed;
+}
+
+//------------------------------------------------------------------------------
+
+PredictServer::PredictServer(const EnergyParam& _param, int _algoType,
+                             const map<labelType, ulong>& _labelToClassIdx,
+                             const char* _outputDir, const char* _overlayDir,
+                             int _nWorkers)
+  : param(_param), scale(_param)
+{
+  algoType = _algoType;
+  labelToClassIdx = _labelToClassIdx;
+  outputDir = _outputDir;
+  overlayDir = (_overlayDir != 0)?_overlayDir:"";
+  nWorkers = max(1, _nWorkers);
+  maxQueuedJobs = 4*nWorkers;
+  stopping = false;
+  nextJobId = 0;
+
+  pthread_mutex_init(&queueMutex, 0);
+  pthread_cond_init(&jobAvailable, 0);
+  pthread_cond_init(&slotAvailable, 0);
+}
+
+PredictServer::~PredictServer()
+{
+  pthread_mutex_destroy(&queueMutex);
+  pthread_cond_destroy(&jobAvailable);
+  pthread_cond_destroy(&slotAvailable);
+}
+
+void* PredictServer::workerThread(void* arg)
+{
+  PredictServer* server = (PredictServer*)arg;
+
+#ifdef WITH_OPENMP
+  // share the cores between the volumes processed concurrently
+  omp_set_num_threads(max(1, omp_get_num_procs()/server->nWorkers));
+#endif
+
+  PredictJob job;
+  while(server->popJob(job)) {
+    server->processJob(job);
+  }
+  return 0;
+}
+
+void PredictServer::startWorkers()
+{
+  workers.resize(nWorkers);
+  for(int i = 0; i < nWorkers; ++i) {
+    if(pthread_create(&workers[i], 0, workerThread, this) != 0) {
+      printf("[PredictServer] Error : could not create worker thread %d\n", i);
+      exit(-1);
+    }
+  }
+  printf("[PredictServer] Started %d workers\n", nWorkers);
+}
+
+void PredictServer::stopWorkers()
+{
+  pthread_mutex_lock(&queueMutex);
+  stopping = true;
+  pthread_cond_broadcast(&jobAvailable);
+  pthread_mutex_unlock(&queueMutex);
+
+  for(int i = 0; i < nWorkers; ++i) {
+    pthread_join(workers[i], 0);
+  }
+  workers.clear();
+}
+
+bool PredictServer::pushJob(const string& line, PredictConnection* connection)
+{
+  vector<string> tokens;
+  splitString(line, tokens);
+  if(tokens.empty()) {
+    return true;
+  }
+  if(tokens[0] == "quit") {
+    return false;
+  }
+
+  PredictJob job;
+  job.imageDir = tokens[0];
+  job.maskDir = (tokens.size() > 1)?tokens[1]:"";
+  job.outputDir = (tokens.size() > 2)?tokens[2]:outputDir;
+  job.connection = connection;
+
+  pthread_mutex_lock(&queueMutex);
+  while(jobs.size() >= maxQueuedJobs) {
+    pthread_cond_wait(&slotAvailable, &queueMutex);
+  }
+  job.id = nextJobId++;
+  connection->addJob();
+  jobs.push_back(job);
+  pthread_cond_signal(&jobAvailable);
+  pthread_mutex_unlock(&queueMutex);
+  return true;
+}
+
+bool PredictServer::popJob(PredictJob& job)
+{
+  pthread_mutex_lock(&queueMutex);
+  while(jobs.empty() && !stopping) {
+    pthread_cond_wait(&jobAvailable, &queueMutex);
+  }
+  if(jobs.empty()) {
+    pthread_mutex_unlock(&queueMutex);
+    return false;
+  }
+  job = jobs.front();
+  jobs.pop_front();
+  pthread_cond_signal(&slotAvailable);
+  pthread_mutex_unlock(&queueMutex);
+  return true;
+}
+
+bool PredictServer::readJobs(int fd, PredictConnection* connection)
+{
+  string pending;
+  char buffer[4096];
+  while(true) {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      break;
+    }
+    pending.append(buffer, n);
+
+    size_t pos;
+    while((pos = pending.find('\n')) != string::npos) {
+      string line = pending.substr(0, pos);
+      pending.erase(0, pos + 1);
+      if(!pushJob(line, connection)) {
+        return false;
+      }
+    }
+  }
+  // last line might not be terminated
+  return pushJob(pending, connection);
+}
+
+void PredictServer::processJob(const PredictJob& job)
+{
+  stringstream sout;
+
+  if(!isDirectory(job.imageDir) && !fileExists(job.imageDir)) {
+    sout << "error " << job.id << " " << job.imageDir << " input not found" << endl;
+    job.connection->reply(sout.str());
+    return;
+  }
+
+  PRINT_MESSAGE("[PredictServer] Processing job %d : %s\n", job.id, job.imageDir.c_str());
+
+  struct timeval t;
+  gettimeofday(&t, NULL);
+
+  Slice_P* slice = 0;
+  loadSliceData(job.imageDir, job.maskDir, Config::Instance(), slice);
+  double loadTime = getElapsedTime(t);
+
+  Feature* feature = 0;
+  int featureSize = 0;
+  loadSliceFeatures(job.imageDir, Config::Instance(), slice, feature,
+                    &featureSize);
+  scale.apply(slice);
+  double featureTime = getElapsedTime(t);
+
+  labelType* nodeLabels = computeLabels(slice, feature, param, algoType, 0);
+  double inferenceTime = getElapsedTime(t);
+
+  exportPrediction(slice, nodeLabels, job.outputDir, overlayDir, param,
+                   &labelToClassIdx);
+  double exportTime = getElapsedTime(t);
+  double totalTime = loadTime + featureTime + inferenceTime + exportTime;
+
+  delete[] nodeLabels;
+  releaseSliceFeatures(slice, feature);
+  delete slice;
+
+  sout << "done " << job.id << " " << job.imageDir;
+  sout << " load=" << loadTime << " features=" << featureTime;
+  sout << " inference=" << inferenceTime << " export=" << exportTime;
+  sout << " total=" << totalTime << endl;
+  job.connection->reply(sout.str());
+}
+
+int PredictServer::redirectLogs()
+{
+  fflush(stdout);
+  int replyFd = dup(STDOUT_FILENO);
+  if(replyFd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+    printf("[PredictServer] Error : could not redirect stdout (%s)\n", strerror(errno));
+    exit(-1);
+  }
+  return replyFd;
+}
+
+int PredictServer::run(const char* socketPath, int replyFd)
+{
+  startWorkers();
+
+  if(socketPath == 0 || strcmp(socketPath, "-") == 0) {
+    printf("[PredictServer] Reading jobs from stdin\n");
+    fflush(stdout);
+    PredictConnection connection(replyFd);
+    readJobs(STDIN_FILENO, &connection);
+    connection.waitForJobs();
+    stopWorkers();
+    return 0;
+  }
+
+  int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(sfd < 0) {
+    printf("[PredictServer] Error : could not create socket\n");
+    stopWorkers();
+    return -1;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+  unlink(socketPath);
+  if(bind(sfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+     listen(sfd, 8) != 0) {
+    printf("[PredictServer] Error : could not listen to %s (%s)\n",
+           socketPath, strerror(errno));
+    close(sfd);
+    stopWorkers();
+    return -1;
+  }
+
+  printf("[PredictServer] Listening to %s\n", socketPath);
+  fflush(stdout);
+
+  bool quit = false;
+  while(!quit) {
+    int cfd = accept(sfd, 0, 0);
+    if(cfd < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      printf("[PredictServer] Error : accept failed (%s)\n", strerror(errno));
+      break;
+    }
+
+    // jobs of a client are processed concurrently, clients are served in turn
+    PredictConnection connection(cfd);
+    quit = !readJobs(cfd, &connection);
+    connection.waitForJobs();
+    close(cfd);
+  }
+
+  close(sfd);
+  unlink(socketPath);
+  stopWorkers();
+  return 0;
+}
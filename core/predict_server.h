@@ -0,0 +1,132 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef PREDICT_SERVER_H
+#define PREDICT_SERVER_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "globalsE.h"
+#include "energyParam.h"
+#include "predict_pipeline.h"
+#include "Supernode.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+struct PredictConnection;
+
+struct PredictJob
+{
+  int id;
+  string imageDir;
+  string maskDir;
+  string outputDir;
+
+  // connection the result has to be reported to
+  PredictConnection* connection;
+};
+
+/**
+ * Long-running prediction loop used by predict --server.
+ * The config, the model, the colormap and the feature scale are loaded once
+ * and each job only loads its volume, computes its features and runs
+ * inference. Jobs are read from stdin or from a local UNIX socket, one job
+ * per line :
+ *   image_dir [mask_dir [output_dir]]
+ * and are processed by a bounded pool of worker threads. A line
+ *   done <id> <image_dir> load=<s> features=<s> inference=<s> export=<s> total=<s>
+ * (or error <id> <image_dir> <message>) is written back for every job.
+ * "quit" stops the server once the pending jobs are done.
+ * When jobs are read from stdin, replies are the only lines written to
+ * stdout and all the logs go to stderr.
+ */
+class PredictServer
+{
+ public:
+  /**
+   * @param nWorkers is the number of volumes processed concurrently
+   */
+  PredictServer(const EnergyParam& param, int algoType,
+                const map<labelType, ulong>& labelToClassIdx,
+                const char* outputDir, const char* overlayDir,
+                int nWorkers);
+
+  ~PredictServer();
+
+  /**
+   * Serve jobs until quit is received.
+   * @param socketPath is the path of the UNIX socket to listen to
+   * ("-" to read jobs from stdin).
+   * @param replyFd is where replies to the jobs read from stdin are written
+   */
+  int run(const char* socketPath, int replyFd = STDOUT_FILENO);
+
+  /**
+   * Send everything printed to stdout (printf, PRINT_MESSAGE) to stderr so
+   * that logs can not be interleaved with the replies. Returns a descriptor
+   * for the original stdout. Has to be called before anything is printed.
+   */
+  static int redirectLogs();
+
+ private:
+  const EnergyParam& param;
+  int algoType;
+  map<labelType, ulong> labelToClassIdx;
+  string outputDir;
+  string overlayDir;
+  int nWorkers;
+
+  // feature scale shared by all the jobs
+  FeatureScale scale;
+
+  // bounded job queue
+  deque<PredictJob> jobs;
+  uint maxQueuedJobs;
+  bool stopping;
+  int nextJobId;
+  pthread_mutex_t queueMutex;
+  pthread_cond_t jobAvailable;
+  pthread_cond_t slotAvailable;
+
+  vector<pthread_t> workers;
+
+  static void* workerThread(void* arg);
+
+  void startWorkers();
+
+  void stopWorkers();
+
+  /**
+   * Read jobs from fd until end of file or quit.
+   * Returns false if quit was received.
+   */
+  bool readJobs(int fd, PredictConnection* connection);
+
+  bool pushJob(const string& line, PredictConnection* connection);
+
+  bool popJob(PredictJob& job);
+
+  void processJob(const PredictJob& job);
+};
+
+#endif // PREDICT_SERVER_H
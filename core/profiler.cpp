@@ -0,0 +1,316 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "profiler.h"
+
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/resource.h>
+#endif
+
+#include "Config.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+struct ProfileThreadData
+{
+  double time[PROFILER_MAX_ENTRIES];
+  double maxTime[PROFILER_MAX_ENTRIES];
+  unsigned long long calls[PROFILER_MAX_ENTRIES];
+};
+
+bool Profiler::enabled = false;
+
+static string profileFilename = "profile.json";
+static timeval profileStart;
+
+// registered entries, protected by profileMutex
+static map<string, int> entryIds;
+static vector<string> entryNames;
+static vector<eProfileEntryType> entryTypes;
+
+// per-thread tables. Tables are never released so that the report still
+// accounts for threads that exited before dump() is called.
+static vector<ProfileThreadData*> threadTables;
+
+//------------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+static CRITICAL_SECTION profileMutex;
+static DWORD threadKey = TLS_OUT_OF_INDEXES;
+
+// created before main() as there is no static initializer for these
+struct ProfileWin32Init
+{
+  ProfileWin32Init() {
+    InitializeCriticalSection(&profileMutex);
+    threadKey = TlsAlloc();
+  }
+};
+static ProfileWin32Init profileWin32Init;
+
+static void lockProfile() { EnterCriticalSection(&profileMutex); }
+static void unlockProfile() { LeaveCriticalSection(&profileMutex); }
+
+static ProfileThreadData* getThreadSpecific()
+{
+  return (ProfileThreadData*)TlsGetValue(threadKey);
+}
+
+static void setThreadSpecific(ProfileThreadData* data)
+{
+  TlsSetValue(threadKey, data);
+}
+
+// peak resident set size in KB (not reported on Windows)
+static long getMaxRSS()
+{
+  return 0;
+}
+
+#else
+
+static pthread_mutex_t profileMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t threadKey;
+static pthread_once_t threadKeyOnce = PTHREAD_ONCE_INIT;
+
+static void lockProfile() { pthread_mutex_lock(&profileMutex); }
+static void unlockProfile() { pthread_mutex_unlock(&profileMutex); }
+
+static void createThreadKey()
+{
+  pthread_key_create(&threadKey, NULL);
+}
+
+static ProfileThreadData* getThreadSpecific()
+{
+  pthread_once(&threadKeyOnce, createThreadKey);
+  return (ProfileThreadData*)pthread_getspecific(threadKey);
+}
+
+static void setThreadSpecific(ProfileThreadData* data)
+{
+  pthread_setspecific(threadKey, data);
+}
+
+// peak resident set size in KB
+static long getMaxRSS()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+#endif // _WIN32
+
+//------------------------------------------------------------------------------
+
+static ProfileThreadData* getThreadData()
+{
+  ProfileThreadData* data = getThreadSpecific();
+  if(data == 0) {
+    data = new ProfileThreadData;
+    memset(data, 0, sizeof(ProfileThreadData));
+    setThreadSpecific(data);
+    lockProfile();
+    threadTables.push_back(data);
+    unlockProfile();
+  }
+  return data;
+}
+
+static double getElapsedTime(struct timeval& t)
+{
+  timeval end;
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - t.tv_sec) + (end.tv_usec - t.tv_usec)/1e6;
+}
+
+//------------------------------------------------------------------------------
+
+void Profiler::init()
+{
+  string config_tmp;
+  bool _enabled = false;
+  if(Config::Instance()->getParameter("profile", config_tmp)) {
+    _enabled = config_tmp.c_str()[0] == '1';
+  }
+  if(Config::Instance()->getParameter("profile_file", config_tmp)) {
+    profileFilename = config_tmp;
+  }
+  setEnabled(_enabled);
+  if(enabled) {
+    printf("[Profiler] Writing profile to %s\n", profileFilename.c_str());
+  }
+}
+
+void Profiler::setEnabled(bool _enabled)
+{
+  if(_enabled && !enabled) {
+    gettimeofday(&profileStart, NULL);
+  }
+  enabled = _enabled;
+}
+
+int Profiler::registerEntry(const char* name, eProfileEntryType type)
+{
+  lockProfile();
+  int id;
+  map<string, int>::iterator it = entryIds.find(name);
+  if(it != entryIds.end()) {
+    id = it->second;
+  } else {
+    id = entryNames.size();
+    if(id >= PROFILER_MAX_ENTRIES) {
+      printf("[Profiler] Error : too many entries (%d)\n", id);
+      exit(-1);
+    }
+    entryIds[name] = id;
+    entryNames.push_back(name);
+    entryTypes.push_back(type);
+  }
+  unlockProfile();
+  return id;
+}
+
+void Profiler::addTime(int id, double seconds)
+{
+  ProfileThreadData* data = getThreadData();
+  data->time[id] += seconds;
+  ++data->calls[id];
+  if(seconds > data->maxTime[id]) {
+    data->maxTime[id] = seconds;
+  }
+}
+
+void Profiler::addCount(int id, unsigned long long n)
+{
+  ProfileThreadData* data = getThreadData();
+  data->calls[id] += n;
+}
+
+//------------------------------------------------------------------------------
+
+void Profiler::dump()
+{
+  dump(profileFilename.c_str());
+}
+
+void Profiler::dump(const char* filename)
+{
+  if(!enabled) {
+    return;
+  }
+
+  lockProfile();
+
+  int nEntries = entryNames.size();
+  int nThreads = threadTables.size();
+  vector<double> time(nEntries, 0);
+  vector<double> maxTime(nEntries, 0);
+  vector<unsigned long long> calls(nEntries, 0);
+  vector<int> activeThreads(nEntries, 0);
+  for(int t = 0; t < nThreads; ++t) {
+    ProfileThreadData* data = threadTables[t];
+    for(int i = 0; i < nEntries; ++i) {
+      if(data->calls[i] == 0) {
+        continue;
+      }
+      time[i] += data->time[i];
+      calls[i] += data->calls[i];
+      if(data->maxTime[i] > maxTime[i]) {
+        maxTime[i] = data->maxTime[i];
+      }
+      ++activeThreads[i];
+    }
+  }
+
+  long maxRSS = getMaxRSS();
+  double wallTime = getElapsedTime(profileStart);
+
+  FILE* fp = fopen(filename, "w");
+  if(fp == 0) {
+    printf("[Profiler] Error : could not open %s\n", filename);
+    unlockProfile();
+    return;
+  }
+
+  int len = strlen(filename);
+  bool csv = (len > 4 && strcmp(filename + len - 4, ".csv") == 0);
+  if(csv) {
+    fprintf(fp, "type,name,calls,total_s,avg_s,max_s,threads\n");
+    for(int i = 0; i < nEntries; ++i) {
+      if(entryTypes[i] == PROFILE_TIMER) {
+        fprintf(fp, "timer,%s,%llu,%g,%g,%g,%d\n", entryNames[i].c_str(),
+                calls[i], time[i], calls[i]?time[i]/calls[i]:0.0,
+                maxTime[i], activeThreads[i]);
+      } else {
+        fprintf(fp, "counter,%s,%llu,,,,%d\n", entryNames[i].c_str(),
+                calls[i], activeThreads[i]);
+      }
+    }
+    fprintf(fp, "process,wall_s,,%g,,,%d\n", wallTime, nThreads);
+    fprintf(fp, "process,max_rss_kb,%ld,,,,\n", maxRSS);
+  } else {
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"wall_s\": %g,\n", wallTime);
+    fprintf(fp, "  \"max_rss_kb\": %ld,\n", maxRSS);
+    fprintf(fp, "  \"threads\": %d,\n", nThreads);
+    fprintf(fp, "  \"timers\": {");
+    bool first = true;
+    for(int i = 0; i < nEntries; ++i) {
+      if(entryTypes[i] != PROFILE_TIMER) {
+        continue;
+      }
+      fprintf(fp, "%s\n    \"%s\": {\"calls\": %llu, \"total_s\": %g, \"avg_s\": %g, \"max_s\": %g, \"threads\": %d}",
+              first?"":",", entryNames[i].c_str(), calls[i], time[i],
+              calls[i]?time[i]/calls[i]:0.0, maxTime[i], activeThreads[i]);
+      first = false;
+    }
+    fprintf(fp, "\n  },\n");
+    fprintf(fp, "  \"counters\": {");
+    first = true;
+    for(int i = 0; i < nEntries; ++i) {
+      if(entryTypes[i] != PROFILE_COUNTER) {
+        continue;
+      }
+      fprintf(fp, "%s\n    \"%s\": %llu", first?"":",",
+              entryNames[i].c_str(), calls[i]);
+      first = false;
+    }
+    fprintf(fp, "\n  }\n");
+    fprintf(fp, "}\n");
+  }
+  fclose(fp);
+
+  unlockProfile();
+
+  printf("[Profiler] Profile written to %s (%d entries, %d threads)\n",
+         filename, nEntries, nThreads);
+}
@@ -0,0 +1,129 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stddef.h>
+#ifdef _WIN32
+#include "gettimeofday.h"
+#else
+#include <sys/time.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+#define PROFILER_MAX_ENTRIES 128
+
+enum eProfileEntryType
+{
+  PROFILE_TIMER = 0,
+  PROFILE_COUNTER
+};
+
+/**
+ * Stage-level timers and counters shared by train and predict.
+ * Entries are registered once by name and accumulated in per-thread tables
+ * that are only merged when the report is written, so instrumented code
+ * never takes a lock. Everything is a no-op unless "profile" is set to 1 in
+ * the config file. The report goes to "profile_file" (default profile.json,
+ * a .csv extension selects the CSV format).
+ */
+class Profiler
+{
+ public:
+  /**
+   * Read the profile and profile_file parameters from the config file.
+   */
+  static void init();
+
+  static bool isEnabled() { return enabled; }
+
+  static void setEnabled(bool _enabled);
+
+  /**
+   * Returns the id of the entry with the given name, creating it if needed.
+   */
+  static int registerEntry(const char* name, eProfileEntryType type);
+
+  static void addTime(int id, double seconds);
+
+  static void addCount(int id, unsigned long long n);
+
+  /**
+   * Write the report to the file given in the config file.
+   */
+  static void dump();
+
+  static void dump(const char* filename);
+
+ private:
+  static bool enabled;
+};
+
+//------------------------------------------------------------------------------
+
+class ProfilerScope
+{
+ public:
+  ProfilerScope(int _id) {
+    id = _id;
+    active = Profiler::isEnabled();
+    if(active) {
+      gettimeofday(&start, NULL);
+    }
+  }
+
+  ~ProfilerScope() {
+    if(active) {
+      timeval end;
+      gettimeofday(&end, NULL);
+      Profiler::addTime(id, (end.tv_sec - start.tv_sec) +
+                        (end.tv_usec - start.tv_usec)/1e6);
+    }
+  }
+
+ private:
+  int id;
+  bool active;
+  timeval start;
+};
+
+//------------------------------------------------------------------------------
+
+#define PROFILE_CONCAT_(a,b) a##b
+#define PROFILE_CONCAT(a,b) PROFILE_CONCAT_(a,b)
+
+/**
+ * Time the enclosing scope under the given name.
+ */
+#define PROFILE_SCOPE(name)                                             \
+  static const int PROFILE_CONCAT(_profile_id_, __LINE__) =             \
+    Profiler::registerEntry(name, PROFILE_TIMER);                       \
+  ProfilerScope PROFILE_CONCAT(_profile_scope_, __LINE__)(PROFILE_CONCAT(_profile_id_, __LINE__))
+
+/**
+ * Add n to the counter with the given name.
+ */
+#define PROFILE_COUNT(name, n)                                          \
+  do {                                                                  \
+    if(Profiler::isEnabled()) {                                         \
+      static const int _profile_id =                                    \
+        Profiler::registerEntry(name, PROFILE_COUNTER);                 \
+      Profiler::addCount(_profile_id, (unsigned long long)(n));         \
+    }                                                                   \
+  } while(0)
+
+#endif // PROFILER_H
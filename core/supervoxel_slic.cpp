@@ -0,0 +1,367 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "supervoxel_slic.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+// offset of the first seed along a dimension of the given size
+static inline int getSeedOffset(int size, int step)
+{
+  return (size < step)?size/2:step/2;
+}
+
+static inline int findRoot(vector<int>& parent, int c)
+{
+  while(parent[c] != c) {
+    parent[c] = parent[parent[c]];
+    c = parent[c];
+  }
+  return c;
+}
+
+//------------------------------------------------------------------------------
+
+SupervoxelSLIC::SupervoxelSLIC(int _width, int _height, int _depth,
+                               int _step, double _cubeness)
+{
+  width = _width;
+  height = _height;
+  depth = _depth;
+  sliceSize = (ulong)width*height;
+  step = _step;
+  cubeness = _cubeness;
+  nIterations = 10;
+  nThreads = -1;
+}
+
+int SupervoxelSLIC::getNumberOfThreads()
+{
+#ifdef WITH_OPENMP
+  return (nThreads > 0)?nThreads:omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+int SupervoxelSLIC::segment(const float* data, sidType**& klabels)
+{
+  ulong nVoxels = sliceSize*depth;
+
+  initSeeds(data);
+  PRINT_MESSAGE("[SupervoxelSLIC] %ld seeds, %d threads\n", seeds.size(), getNumberOfThreads());
+
+  sidType* labels = new sidType[nVoxels];
+  float* distances = new float[nVoxels];
+  for(ulong i = 0; i < nVoxels; i++) {
+    labels[i] = -1;
+  }
+
+  for(int it = 0; it < nIterations; it++) {
+    assignVoxels(data, labels, distances);
+    updateSeeds(data, labels);
+  }
+  delete[] distances;
+
+  int nLabels = enforceConnectivity(labels, klabels);
+  delete[] labels;
+
+  PRINT_MESSAGE("[SupervoxelSLIC] %d supervoxels created\n", nLabels);
+  return nLabels;
+}
+
+void SupervoxelSLIC::initSeeds(const float* data)
+{
+  seeds.clear();
+  for(int z = getSeedOffset(depth, step); z < depth; z += step) {
+    for(int y = getSeedOffset(height, step); y < height; y += step) {
+      for(int x = getSeedOffset(width, step); x < width; x += step) {
+        seed s;
+        s.l = data[z*sliceSize + y*width + x];
+        s.x = x;
+        s.y = y;
+        s.z = z;
+        seeds.push_back(s);
+      }
+    }
+  }
+}
+
+void SupervoxelSLIC::assignVoxels(const float* data, sidType* labels, float* distances)
+{
+  const int nSeeds = seeds.size();
+  const float invwt = (cubeness*cubeness)/(step*step);
+  const ulong nVoxels = sliceSize*depth;
+
+  for(ulong i = 0; i < nVoxels; i++) {
+    distances[i] = FLT_MAX;
+  }
+
+  // sort seeds by z coordinate so that each plane only visits the seeds
+  // whose window contains it
+  vector<int> zOffsets(depth + 1, 0);
+  vector<int> zSeeds(nSeeds);
+  vector<int> seedPlanes(nSeeds);
+  for(int k = 0; k < nSeeds; k++) {
+    int z = (int)(seeds[k].z + 0.5f);
+    z = (z < 0)?0:((z >= depth)?depth-1:z);
+    seedPlanes[k] = z;
+    zOffsets[z + 1]++;
+  }
+  for(int z = 0; z < depth; z++) {
+    zOffsets[z + 1] += zOffsets[z];
+  }
+  vector<int> zCounts(zOffsets.begin(), zOffsets.end() - 1);
+  for(int k = 0; k < nSeeds; k++) {
+    zSeeds[zCounts[seedPlanes[k]]++] = k;
+  }
+
+  int _nThreads = getNumberOfThreads();
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(_nThreads)
+#endif
+  for(int z = 0; z < depth; z++) {
+    const int zMin = max(0, z - step);
+    const int zMax = min(depth - 1, z + step);
+    for(int k = zOffsets[zMin]; k < zOffsets[zMax + 1]; k++) {
+      const int sIdx = zSeeds[k];
+      const seed& s = seeds[sIdx];
+      const float dz = z - s.z;
+      if(fabs(dz) > step) {
+        continue;
+      }
+      const float dz2 = dz*dz;
+      const int yMin = max(0, (int)(s.y - step));
+      const int yMax = min(height - 1, (int)(s.y + step));
+      const int xMin = max(0, (int)(s.x - step));
+      const int xMax = min(width - 1, (int)(s.x + step));
+      for(int y = yMin; y <= yMax; y++) {
+        const float dy = y - s.y;
+        const float dyz2 = dy*dy + dz2;
+        ulong idx = z*sliceSize + (ulong)y*width + xMin;
+        for(int x = xMin; x <= xMax; x++, idx++) {
+          const float dl = data[idx] - s.l;
+          const float dx = x - s.x;
+          const float d = dl*dl + invwt*(dx*dx + dyz2);
+          if(d < distances[idx]) {
+            distances[idx] = d;
+            labels[idx] = sIdx;
+          }
+        }
+      }
+    }
+  }
+}
+
+void SupervoxelSLIC::updateSeeds(const float* data, const sidType* labels)
+{
+  const int nSeeds = seeds.size();
+  const int nFields = 5; // l,x,y,z,count
+  int _nThreads = getNumberOfThreads();
+
+  // per-thread accumulators
+  double* acc = new double[(ulong)_nThreads*nSeeds*nFields];
+  memset(acc, 0, (ulong)_nThreads*nSeeds*nFields*sizeof(double));
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(_nThreads)
+#endif
+  for(int z = 0; z < depth; z++) {
+#ifdef WITH_OPENMP
+    double* threadAcc = acc + (ulong)omp_get_thread_num()*nSeeds*nFields;
+#else
+    double* threadAcc = acc;
+#endif
+    ulong idx = z*sliceSize;
+    for(int y = 0; y < height; y++) {
+      for(int x = 0; x < width; x++, idx++) {
+        if(labels[idx] < 0) {
+          continue;
+        }
+        double* a = threadAcc + labels[idx]*nFields;
+        a[0] += data[idx];
+        a[1] += x;
+        a[2] += y;
+        a[3] += z;
+        a[4] += 1;
+      }
+    }
+  }
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for num_threads(_nThreads)
+#endif
+  for(int k = 0; k < nSeeds; k++) {
+    double sum[nFields] = {0, 0, 0, 0, 0};
+    for(int t = 0; t < _nThreads; t++) {
+      const double* a = acc + ((ulong)t*nSeeds + k)*nFields;
+      for(int f = 0; f < nFields; f++) {
+        sum[f] += a[f];
+      }
+    }
+    if(sum[4] > 0) {
+      seeds[k].l = sum[0]/sum[4];
+      seeds[k].x = sum[1]/sum[4];
+      seeds[k].y = sum[2]/sum[4];
+      seeds[k].z = sum[3]/sum[4];
+    }
+  }
+
+  delete[] acc;
+}
+
+int SupervoxelSLIC::enforceConnectivity(const sidType* labels, sidType**& klabels)
+{
+  const ulong nVoxels = sliceSize*depth;
+  const int nSlabs = min(getNumberOfThreads(), depth);
+  vector<int> slabStart(nSlabs + 1);
+  for(int k = 0; k <= nSlabs; k++) {
+    slabStart[k] = (int)(((long)k*depth)/nSlabs);
+  }
+
+  // label 6-connected components inside each slab
+  int* comp = new int[nVoxels];
+  vector< vector<ulong> > compSizes(nSlabs);
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(nSlabs)
+#endif
+  for(int k = 0; k < nSlabs; k++) {
+    const ulong begin = slabStart[k]*sliceSize;
+    const ulong end = slabStart[k+1]*sliceSize;
+    vector<ulong>& sizes = compSizes[k];
+    vector<ulong> stack;
+    for(ulong i = begin; i < end; i++) {
+      comp[i] = -1;
+    }
+    for(ulong i = begin; i < end; i++) {
+      if(comp[i] != -1) {
+        continue;
+      }
+      const int c = sizes.size();
+      const sidType label = labels[i];
+      ulong size = 0;
+      comp[i] = c;
+      stack.push_back(i);
+      while(!stack.empty()) {
+        const ulong j = stack.back();
+        stack.pop_back();
+        size++;
+        const int z = j/sliceSize;
+        const int y = (j%sliceSize)/width;
+        const int x = j%width;
+        ulong neighbors[6];
+        int nNeighbors = 0;
+        if(x > 0) neighbors[nNeighbors++] = j - 1;
+        if(x < width - 1) neighbors[nNeighbors++] = j + 1;
+        if(y > 0) neighbors[nNeighbors++] = j - width;
+        if(y < height - 1) neighbors[nNeighbors++] = j + width;
+        if(z > slabStart[k]) neighbors[nNeighbors++] = j - sliceSize;
+        if(z < slabStart[k+1] - 1) neighbors[nNeighbors++] = j + sliceSize;
+        for(int n = 0; n < nNeighbors; n++) {
+          const ulong nj = neighbors[n];
+          if(comp[nj] == -1 && labels[nj] == label) {
+            comp[nj] = c;
+            stack.push_back(nj);
+          }
+        }
+      }
+      sizes.push_back(size);
+    }
+  }
+
+  // make component ids global
+  vector<int> compOffsets(nSlabs + 1, 0);
+  for(int k = 0; k < nSlabs; k++) {
+    compOffsets[k+1] = compOffsets[k] + compSizes[k].size();
+  }
+  const int nComponents = compOffsets[nSlabs];
+#ifdef WITH_OPENMP
+#pragma omp parallel for num_threads(nSlabs)
+#endif
+  for(int k = 1; k < nSlabs; k++) {
+    const ulong end = slabStart[k+1]*sliceSize;
+    for(ulong i = slabStart[k]*sliceSize; i < end; i++) {
+      comp[i] += compOffsets[k];
+    }
+  }
+
+  // merge components across slab boundaries
+  vector<int> parent(nComponents);
+  for(int c = 0; c < nComponents; c++) {
+    parent[c] = c;
+  }
+  for(int k = 1; k < nSlabs; k++) {
+    const ulong begin = slabStart[k]*sliceSize;
+    for(ulong i = begin; i < begin + sliceSize; i++) {
+      if(labels[i] == labels[i - sliceSize]) {
+        int r1 = findRoot(parent, comp[i]);
+        int r2 = findRoot(parent, comp[i - sliceSize]);
+        if(r1 != r2) {
+          parent[max(r1,r2)] = min(r1,r2);
+        }
+      }
+    }
+  }
+
+  vector<ulong> rootSizes(nComponents, 0);
+  for(int k = 0; k < nSlabs; k++) {
+    for(int c = 0; c < (int)compSizes[k].size(); c++) {
+      int gc = compOffsets[k] + c;
+      parent[gc] = findRoot(parent, gc);
+      rootSizes[parent[gc]] += compSizes[k][c];
+    }
+  }
+
+  // assign final labels in raster order. Components that are too small are
+  // merged with the component of a voxel visited before them.
+  const ulong minSize = ((ulong)step*step*min(step,depth)) >> 2;
+  vector<sidType> finalLabels(nComponents, -1);
+  int nLabels = 0;
+  klabels = new sidType*[depth];
+  for(int z = 0; z < depth; z++) {
+    klabels[z] = new sidType[sliceSize];
+    const int* pComp = comp + z*sliceSize;
+    for(ulong xy = 0; xy < sliceSize; xy++) {
+      const int r = parent[pComp[xy]];
+      if(finalLabels[r] == -1) {
+        sidType adjLabel = -1;
+        if(xy % width != 0) {
+          adjLabel = klabels[z][xy - 1];
+        } else if(xy >= (ulong)width) {
+          adjLabel = klabels[z][xy - width];
+        } else if(z > 0) {
+          adjLabel = klabels[z-1][xy];
+        }
+        if(rootSizes[r] > minSize || adjLabel == -1) {
+          finalLabels[r] = nLabels++;
+        } else {
+          finalLabels[r] = adjLabel;
+        }
+      }
+      klabels[z][xy] = finalLabels[r];
+    }
+  }
+
+  delete[] comp;
+  return nLabels;
+}
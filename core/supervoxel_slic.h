@@ -0,0 +1,103 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef SUPERVOXEL_SLIC_H
+#define SUPERVOXEL_SLIC_H
+
+#include <vector>
+
+#include "globalsE.h"
+#include "Supernode.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+/**
+ * Multi-threaded SLIC supervoxels for gray volumes.
+ * This is a replacement for LKM::DoSupervoxelSegmentationForGrayVolume that
+ * works on a contiguous float volume ordered by zyx :
+ * - the assignment step is run in parallel over z planes, each plane being
+ * visited by the seeds whose 2S window contains it.
+ * - seeds are updated from per-thread accumulators.
+ * - connectivity is enforced by labeling connected components in parallel
+ * over slabs of slices followed by a merge pass across slab boundaries.
+ */
+class SupervoxelSLIC
+{
+ public:
+  /**
+   * @param step is the initial distance between seeds
+   * @param cubeness weights the spatial distance against the intensity distance
+   */
+  SupervoxelSLIC(int width, int height, int depth, int step, double cubeness);
+
+  void setNumberOfIterations(int _nIterations) { nIterations = _nIterations; }
+
+  /**
+   * Set the number of threads (-1 : use the OpenMP default)
+   */
+  void setNumberOfThreads(int _nThreads) { nThreads = _nThreads; }
+
+  /**
+   * Compute supervoxels for a volume of width*height*depth voxels.
+   * klabels is allocated by this function (one array of width*height labels
+   * per slice) and caller is responsible for freeing memory.
+   * Returns the number of supervoxels.
+   */
+  int segment(const float* data, sidType**& klabels);
+
+ private:
+
+  struct seed
+  {
+    float l;
+    float x;
+    float y;
+    float z;
+  };
+
+  void initSeeds(const float* data);
+
+  /**
+   * Assign each voxel to the closest seed
+   */
+  void assignVoxels(const float* data, sidType* labels, float* distances);
+
+  /**
+   * Move each seed to the center of the voxels assigned to it
+   */
+  void updateSeeds(const float* data, const sidType* labels);
+
+  /**
+   * Relabel connected components and merge the small ones with a neighbor
+   */
+  int enforceConnectivity(const sidType* labels, sidType**& klabels);
+
+  int getNumberOfThreads();
+
+  int width;
+  int height;
+  int depth;
+  ulong sliceSize;
+  int step;
+  double cubeness;
+  int nIterations;
+  int nThreads;
+
+  vector<seed> seeds;
+};
+
+#endif // SUPERVOXEL_SLIC_H
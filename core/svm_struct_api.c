@@ -36,6 +36,8 @@
 #include "svm_struct_api.h"
 #include "svm_struct_globals.h"
 #include "label_cache.h"
+#include "graph_cache.h"
+#include "evaluation_queue.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -62,6 +64,7 @@
 #include "gi_max.h"
 #include "gi_MF.h"
 #include "gi_sampling.h"
+#include "gi_bp.h"
 
 #if USE_LIBDAI
 #include "gi_libDAI.h"
@@ -69,6 +72,7 @@ using namespace dai;
 #endif
 #if USE_MAXFLOW
 #include "gi_maxflow.h"
+#include "gi_expansion.h"
 #endif
 #if USE_MULTIOBJ
 #include "gi_multiobject.h"
@@ -81,6 +85,7 @@ using namespace dai;
 #include "F_LoadFromFile.h"
 #include "F_Precomputed.h"
 #include "Slice.h"
+#include "profiler.h"
 #include "utils.h"
 #include "utils_ITK.h"
 
@@ -103,9 +108,10 @@ double totalLhsXw = 0;
 double totalWPsi = 0;
 double totalWPsiGT = 0;
 
-// Maximum number of threads you will be running.
-// TODO : Make sure this is a correct number !!!
-const int maxBuffers = 100;
+// Number of inference buffers. Each thread searching most violated
+// constraints uses the buffer of its thread id, or nParallelChains buffers
+// when sampling. Resized in read_struct_examples.
+int maxBuffers = 100;
 
 // Memory buffer used to run inference after each iteration.
 // maxBuffers buffers will be allocated
@@ -161,6 +167,17 @@ bool useGCForSubModularEnergy = true;
 bool predictTrainingImages = true;
 int nParallelChains = 12;
 
+// re-use the maxflow graph of each training example across iterations
+bool cacheMaxflowGraphs = true;
+
+// evaluate the snapshots of the weight vector in background threads
+bool asyncEvaluation = false;
+int asyncEvaluationThreads = 1;
+bool asyncEvaluationDropStale = false;
+#ifndef _WIN32
+EvaluationQueue* evaluationQueue = 0;
+#endif
+
 // output directories
 string mostViolatedConstraintDir = "mostViolatedConstraint0";
 string inferenceDir_training = "inference_training0";
@@ -438,6 +455,100 @@ SWORD* computePsi(SPATTERN x, LABEL y, const STRUCTMODEL *sm,
   return computePsi(words, x, y, sm, sparm, _score);
 }
 
+/**
+ * Add coeff*psi_node(x,sid,label) to the unary entries of feats.
+ */
+inline void accumulateNodePsi(double* feats, SPATTERN& x, const STRUCTMODEL *sm,
+                              const STRUCT_LEARN_PARM *sparm, sidType sid,
+                              int label, int fvSize, double coeff)
+{
+  if (sparm->nUnaryWeights == 1 && label == T_FOREGROUND) {
+    // Only accumulates weights for BACKGROUND class.
+    return;
+  }
+
+  if(x.nodeCoeffs) {
+    coeff *= (*x.nodeCoeffs)[sid];
+  }
+
+#ifdef W_OFFSET
+  feats[label] += coeff;
+#endif
+
+  const float* n = x.slice->getFeature(sid);
+  int featIdx = 0;
+  for(int s = 0; s < fvSize; s++) {
+    featIdx = SVM_FEAT_INDEX(sparm, label, s);
+    if(featIdx >= sm->sizePsi) {
+      printf("[SVM_struct] featIdx>=sm->sizePsi %d %d %d %d %d %d %ld\n",featIdx,label,T_FOREGROUND,sparm->nUnaryWeights,s,fvSize,sm->sizePsi);
+      exit(-1);
+    }
+    feats[featIdx] += coeff*n[s];
+  }
+}
+
+/**
+ * Add coeff*psi_edge(x,e,label,nLabel) to the pairwise entries of feats.
+ * e is the edge stored in the adjacency list of the supernode labeled with
+ * label. nLabel is the label of e.sid.
+ */
+inline void accumulateEdgePsi(double* feats, const STRUCT_LEARN_PARM *sparm,
+                              const edgeInfo& e, int label, int nLabel,
+                              edgeCoeffType coeff)
+{
+  if(sparm->nGradientLevels == 0) {
+    // Only learn diagonal element.
+    if(label == nLabel) {
+      //sparm->nUnaryWeights is the offset due to unary terms
+      feats[sparm->nUnaryWeights] += coeff;
+    }
+    return;
+  }
+
+  // full pairwise model
+  int featIdx;
+  int offset = (e.orientationIdx*sparm->nClasses*sparm->nClasses);
+
+#if USE_LONG_RANGE_EDGES
+  offset += e.distanceIdx*sparm->nGradientLevels*sparm->nClasses*sparm->nClasses*sparm->nOrientations;
+#endif
+
+  if(sparm->nUnaryWeights < 3) {
+    // symmetric case : add +0.5 to both indices
+    // sparm->nUnaryWeights is the offset due to unary terms
+    for(int i = 0; i <= e.gradientIdx; i++)  {
+      featIdx = (i*sparm->nClasses*sparm->nClasses*sparm->nOrientations) + offset + label*sparm->nClasses + nLabel;
+      feats[featIdx+sparm->nUnaryWeights] += coeff/2.0;
+
+      featIdx = (i*sparm->nClasses*sparm->nClasses*sparm->nOrientations) + offset + label + nLabel*sparm->nClasses;
+      feats[featIdx+sparm->nUnaryWeights] += coeff/2.0;
+    }
+  } else {
+    for(int i = 0; i <= e.gradientIdx; i++)  {
+      featIdx = (i*sparm->nClasses*sparm->nClasses*sparm->nOrientations) + offset + label*sparm->nClasses + nLabel;
+      //sparm->nUnaryWeights is the offset due to unary terms
+      feats[featIdx+sparm->nUnaryWeights] += coeff;
+    }
+  }
+}
+
+/**
+ * Returns the index in x.edgeCoeffs of the edge e stored in the adjacency list
+ * of sid. Edge indices follow the order in which computePsi visits the edges.
+ * edgeIdOffsets[sid] is the number of edges owned by the supernodes < sid.
+ */
+ulong getEdgeCoeffIdx(Slice_P* slice, const ulong* edgeIdOffsets,
+                      sidType sid, const edgeInfo* e)
+{
+  ulong edgeId = edgeIdOffsets[sid];
+  for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != e; ++itE) {
+    if(sid >= itE->sid) {
+      ++edgeId;
+    }
+  }
+  return edgeId;
+}
+
 SWORD* computePsi(SWORD* words, SPATTERN x, LABEL y, const STRUCTMODEL *sm,
                  const STRUCT_LEARN_PARM *sparm,
                  double* _score)
@@ -451,139 +562,37 @@ SWORD* computePsi(SWORD* words, SPATTERN x, LABEL y, const STRUCTMODEL *sm,
   }
 
   int fvSize = x.feature->getSizeFeatureVector();
+  int nSupernodes = x.slice->getNbSupernodes();
 
   // local nodes
-  int label;
-  int featIdx = 0;
   sidType sid = 0;
   const map<int, supernode* >& _supernodes = x.slice->getSupernodes();
   for(map<int, supernode* >::const_iterator itNode = _supernodes.begin();
       itNode != _supernodes.end(); itNode++) {
-    // +1 for the appropriate label
     sid = itNode->first;
-    label = y.nodeLabels[sid]; // label of the node
-    
-    if (sparm->nUnaryWeights == 1 && label == T_FOREGROUND) {
-      // Only accumulates weights for BACKGROUND class.
-      continue;
-    }
-    
-#ifdef W_OFFSET
-    if(x.nodeCoeffs) {
-      feats[label] += (*x.nodeCoeffs)[sid];
-    } else {
-      feats[label]++;
-    }
-#endif
-    
-    osvm_node *n = x.slice->getFeature(sid);    
-
-#if USE_SPARSE_VECTORS
-    assert(0); // TODO...
-#endif
-
-    for(int s = 0; s < fvSize; s++) {
-      featIdx = SVM_FEAT_INDEX(sparm, label, s);
-      if(featIdx >= sm->sizePsi) {
-        printf("[SVM_struct] featIdx>=sm->sizePsi %d %d %d %d %d %d %ld\n",featIdx,label,T_FOREGROUND,sparm->nUnaryWeights,s,fvSize,sm->sizePsi);
-        exit(-1);
-      }
-      assert(s+1 == n[s].index);
-      if(x.nodeCoeffs) {
-        feats[featIdx] += (*x.nodeCoeffs)[sid]*n[s].value;
-      } else {
-        feats[featIdx] += n[s].value;
-      }
-    }
-
+    accumulateNodePsi(feats, x, sm, sparm, sid, y.nodeLabels[sid], fvSize, 1.0);
   }
   
   // edges
   if(sparm->includeLocalEdges) {
-    if(sparm->nGradientLevels == 0) {
-      edgeCoeffType edgeCoeff = 1.0;
-      ulong edgeId = 0;
-      // Only learn diagonal element.
-      const map<int, supernode* >& _supernodes = x.slice->getSupernodes();
-      for(map<int, supernode* >::const_iterator itNode = _supernodes.begin();
-          itNode != _supernodes.end(); itNode++) {
-        for(vector<supernode*>::iterator itNode2 = itNode->second->neighbors.begin();
-            itNode2 != itNode->second->neighbors.end(); itNode2++) {
-          // set edges once
-          if(itNode->first < (*itNode2)->id) {
-            continue;
-          }
-
-          if(x.edgeCoeffs) {
-            edgeCoeff = (*x.edgeCoeffs)[edgeId];
-          }
-
-          if(y.nodeLabels[itNode->first] == y.nodeLabels[(*itNode2)->id]) {
-            //sparm->nUnaryWeights is the offset due to unary terms
-            feats[sparm->nUnaryWeights] += edgeCoeff;
-          }
-
-          ++edgeId;
+    edgeCoeffType edgeCoeff = 1.0;
+    ulong edgeId = 0;
+    for(sid = 0; sid < nSupernodes; sid++) {
+      const edgeInfo* itE_end = x.slice->getEdgesEnd(sid);
+      for(const edgeInfo* itE = x.slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
+        // set edges once
+        if(sid < itE->sid) {
+          continue;
         }
-      }
-    } else {
-      // full pairwise model
-
-#if USE_LONG_RANGE_EDGES
-      int distanceIdx;
-#endif
-      int gradientIdx;
-      int orientationIdx;
-      int featIdx;
-      ulong edgeId = 0;
-      edgeCoeffType edgeCoeff = 1.0;
-      const map<int, supernode* >& _supernodes = x.slice->getSupernodes();
-      for(map<int, supernode* >::const_iterator itNode = _supernodes.begin();
-          itNode != _supernodes.end(); itNode++) {
-        for(vector<supernode*>::iterator itNode2 = itNode->second->neighbors.begin();
-            itNode2 != itNode->second->neighbors.end(); itNode2++) {
-          // set edges once
-          if(itNode->first < (*itNode2)->id) {
-            continue;
-          }
-
-          if(x.edgeCoeffs) {
-            edgeCoeff = (*x.edgeCoeffs)[edgeId];
-          }
-
-          gradientIdx = x.slice->getGradientIdx(itNode->first,
-                                                (*itNode2)->id);
-          orientationIdx = x.slice->getOrientationIdx(itNode->first,
-                                                      (*itNode2)->id);
-
-          int offset = (orientationIdx*sparm->nClasses*sparm->nClasses);
-
-#if USE_LONG_RANGE_EDGES
-          distanceIdx = x.slice->getDistanceIdx(itNode->first,
-                                                (*itNode2)->id);
-          offset += distanceIdx*sparm->nGradientLevels*sparm->nClasses*sparm->nClasses*sparm->nOrientations;
-#endif
 
-          if(sparm->nUnaryWeights < 3) {
-            // symmetric case : add +0.5 to both indices
-            // sparm->nUnaryWeights is the offset due to unary terms
-            for(int i = 0; i <= gradientIdx; i++)  {
-              featIdx = (i*sparm->nClasses*sparm->nClasses*sparm->nOrientations) + offset + y.nodeLabels[itNode->first]*sparm->nClasses + y.nodeLabels[(*itNode2)->id];
-              feats[featIdx+sparm->nUnaryWeights] += edgeCoeff/2.0;
+        if(x.edgeCoeffs) {
+          edgeCoeff = (*x.edgeCoeffs)[edgeId];
+        }
 
-              featIdx = (i*sparm->nClasses*sparm->nClasses*sparm->nOrientations) + offset + y.nodeLabels[itNode->first] + y.nodeLabels[(*itNode2)->id]*sparm->nClasses;
-              feats[featIdx+sparm->nUnaryWeights] += edgeCoeff/2.0;
-            }
-          } else {
-            for(int i = 0; i <= gradientIdx; i++)  {
-              featIdx = (i*sparm->nClasses*sparm->nClasses*sparm->nOrientations) + offset + y.nodeLabels[itNode->first]*sparm->nClasses + y.nodeLabels[(*itNode2)->id];
-              //sparm->nUnaryWeights is the offset due to unary terms
-              feats[featIdx+sparm->nUnaryWeights] += edgeCoeff;
-            }
-          }
+        accumulateEdgePsi(feats, sparm, *itE, y.nodeLabels[sid],
+                          y.nodeLabels[itE->sid], edgeCoeff);
 
-          ++edgeId;
-        }
+        ++edgeId;
       }
     }
   }
@@ -642,6 +651,98 @@ SWORD* computePsi(SWORD* words, SPATTERN x, LABEL y, const STRUCTMODEL *sm,
   return words;
 }
 
+/**
+ * Compute dpsi = psi(x,ybar) - psi(x,y) as a sparse vector. Only the supernodes
+ * whose labels differ in y and ybar and their edges are visited.
+ * Non-zero entries are stored in increasing wnum order and the vector is
+ * terminated by wnum = 0 so dpsi must hold up to sm->sizePsi+1 entries.
+ * Returns the number of non-zero entries.
+ */
+int computePsiDelta(SWORD* dpsi, SPATTERN x, LABEL y, LABEL ybar,
+                    const STRUCTMODEL *sm, const STRUCT_LEARN_PARM *sparm)
+{
+  double* feats = new double[sm->sizePsi]; // 0-indexed
+  memset((void*)feats, 0, sizeof(double)*sm->sizePsi);
+
+  int fvSize = x.feature->getSizeFeatureVector();
+  int nSupernodes = x.slice->getNbSupernodes();
+  const labelType* labels = y.nodeLabels;
+  const labelType* labelsBar = ybar.nodeLabels;
+
+  // edge coefficients are indexed by the order in which computePsi visits
+  // the edges so count the edges owned by each supernode.
+  ulong* edgeIdOffsets = 0;
+  if(sparm->includeLocalEdges && x.edgeCoeffs) {
+    edgeIdOffsets = new ulong[nSupernodes+1];
+    edgeIdOffsets[0] = 0;
+    for(sidType sid = 0; sid < nSupernodes; sid++) {
+      edgeIdOffsets[sid+1] = edgeIdOffsets[sid];
+      const edgeInfo* itE_end = x.slice->getEdgesEnd(sid);
+      for(const edgeInfo* itE = x.slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
+        if(sid >= itE->sid) {
+          ++edgeIdOffsets[sid+1];
+        }
+      }
+    }
+  }
+
+  for(sidType sid = 0; sid < nSupernodes; sid++) {
+    if(labels[sid] == labelsBar[sid]) {
+      continue;
+    }
+
+    accumulateNodePsi(feats, x, sm, sparm, sid, labelsBar[sid], fvSize, 1.0);
+    accumulateNodePsi(feats, x, sm, sparm, sid, labels[sid], fvSize, -1.0);
+
+    if(!sparm->includeLocalEdges) {
+      continue;
+    }
+
+    const edgeInfo* itE_end = x.slice->getEdgesEnd(sid);
+    for(const edgeInfo* itE = x.slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
+      sidType nsid = itE->sid;
+      // edges between two relabeled supernodes are visited from the larger id
+      if(nsid > sid && labels[nsid] != labelsBar[nsid]) {
+        continue;
+      }
+
+      // psi uses the edge stored in the adjacency list of the larger id
+      sidType owner = sid;
+      const edgeInfo* e = itE;
+      if(nsid > sid) {
+        owner = nsid;
+        e = x.slice->findEdge(nsid, sid);
+        assert(e != 0);
+      }
+
+      edgeCoeffType edgeCoeff = 1.0;
+      if(x.edgeCoeffs) {
+        edgeCoeff = (*x.edgeCoeffs)[getEdgeCoeffIdx(x.slice, edgeIdOffsets, owner, e)];
+      }
+
+      accumulateEdgePsi(feats, sparm, *e, labelsBar[owner], labelsBar[e->sid], edgeCoeff);
+      accumulateEdgePsi(feats, sparm, *e, labels[owner], labels[e->sid], -edgeCoeff);
+    }
+  }
+
+  int nnz = 0;
+  for(int i = 0; i < sm->sizePsi; i++) {
+    if(feats[i] != 0) {
+      dpsi[nnz].wnum = i + 1;
+      dpsi[nnz].weight = feats[i];
+      ++nnz;
+    }
+  }
+  dpsi[nnz].wnum = 0;  // termination symbol
+  dpsi[nnz].weight = 0;
+
+  if(edgeIdOffsets) {
+    delete[] edgeIdOffsets;
+  }
+  delete[] feats;
+  return nnz;
+}
+
 /**
  * Initialize loss function
  * The loss for each label is stored in a global variable 'lossPerLabel'
@@ -933,15 +1034,11 @@ void runInferenceWithCurrentParameters(SPATTERN x, LABEL y, STRUCTMODEL *sm,
     soutColoredImage << x.slice->getName();
   }
 
-  x.slice->exportSupernodeLabels(soutColoredImage.str().c_str(),
-                                 sparm->nClasses,
-                                 tempNodeLabels[threadId],
-                                 y.nNodes,
-                                 &(sparm->labelToClassIdx));
-
-  if(useSlice3d) {
-    zipAndDeleteCube(soutColoredImage.str().c_str());
-  }
+  x.slice->exportCompressedSupernodeLabels(soutColoredImage.str().c_str(),
+                                           sparm->nClasses,
+                                           tempNodeLabels[threadId],
+                                           y.nNodes,
+                                           &(sparm->labelToClassIdx));
 
 #endif
 
@@ -993,6 +1090,9 @@ void        svm_struct_learn_api_exit()
 {
   /* Called in learning part at the very end to allow any clean-up
      that might be necessary. */
+  wait_for_pending_evaluations();
+  GraphCache::Instance()->clear();
+  Profiler::dump();
 }
 
 void        svm_struct_classify_api_init(int argc, char* argv[])
@@ -1067,18 +1167,13 @@ void load_3d_dataset(string imageDir,
   printf("[SVM_struct] Checking %s\n", sout_feature_filename.str().c_str());
   Feature* feature = 0;
   bool featuresLoaded = false;
-  if(fileExists(sout_feature_filename.str())) {
-    printf("[SVM_struct] Loading features from %s\n", sout_feature_filename.str().c_str());
-    *featureSize = -1;
-    if(slice3d->loadFeatures(sout_feature_filename.str().c_str(), featureSize)) {
-      featuresLoaded = true;
-      feature = new F_Precomputed(slice3d->getPrecomputedFeatures(), *featureSize/DEFAULT_FEATURE_DISTANCE);
-      printf("[SVM_struct] Features Loaded succesfully\n");
-    } else {
-      printf("[SVM_struct] Features not loaded succesfully\n");
-    }
+  *featureSize = -1;
+  if(slice3d->loadFeatureCache(sout_feature_filename.str().c_str(), paramFeatureTypes, featureSize)) {
+    featuresLoaded = true;
+    feature = new F_Precomputed(slice3d, *featureSize/DEFAULT_FEATURE_DISTANCE);
+    printf("[SVM_struct] Features Loaded succesfully\n");
   } else {
-    printf("[SVM_struct] File %s does not exist\n", sout_feature_filename.str().c_str());
+    printf("[SVM_struct] No feature cache for %s\n", sout_feature_filename.str().c_str());
   }
 
   if(!featuresLoaded) {
@@ -1087,13 +1182,16 @@ void load_3d_dataset(string imageDir,
     *featureSize = feature->getSizeFeatureVector();
     SSVM_PRINT("[SVM_struct] Feature size = %d\n", *featureSize);
     slice3d->precomputeFeatures(feature);
+    slice3d->saveFeatureCache(sout_feature_filename.str().c_str(), paramFeatureTypes);
 
-#if VERBOSITY > 1
-    // Dump features
-    if(feature) {
+    // text export in libsvm format
+    bool exportTextFeatures = false;
+    if(config->getParameter("export_text_features", config_tmp)) {
+      exportTextFeatures = config_tmp.c_str()[0] == '1';
+    }
+    if(exportTextFeatures) {
       feature->save(*slice3d, sout_feature_filename.str().c_str());
     }
-#endif
 
   }
 
@@ -1111,11 +1209,11 @@ void load_3d_dataset(string imageDir,
 #if VERBOSITY > 1
   // Print one feature vector
   const int sid_to_print = 100;
-  osvm_node* n = slice3d->getFeature(sid_to_print);
+  const float* n = slice3d->getFeature(sid_to_print);
 
   SSVM_PRINT("[SVM_struct] Feature(%d):\n", sid_to_print);
   for(int s = 0; s < *featureSize; s++) {
-    SSVM_PRINT("%d:%g ", n[s].index, n[s].value);
+    SSVM_PRINT("%d:%g ", s+1, n[s]);
   }
   SSVM_PRINT("\n");
 #endif
@@ -1246,11 +1344,11 @@ void load_3d_dataset(string imageDir,
   {
     // Print one feature vector
     const int sid_to_print = 100;
-    osvm_node* n = slice3d->getFeature(sid_to_print);
+    const float* n = slice3d->getFeature(sid_to_print);
       
     SSVM_PRINT("[SVM_struct] Feature(%d):\n", sid_to_print);
     for(int s = 0; s < *featureSize; s++) {
-      SSVM_PRINT("%d:%g ", n[s].index, n[s].value);
+      SSVM_PRINT("%d:%g ", s+1, n[s]);
     }
     SSVM_PRINT("\n");
   }
@@ -1501,6 +1599,8 @@ void load_learn_parm(STRUCT_LEARN_PARM *sparm, Config* config)
 {
   string config_tmp;
 
+  Profiler::init();
+
   sparm->nClasses = 3;
   if(config->getParameter("nClasses", config_tmp)) {
     sparm->nClasses = atoi(config_tmp.c_str());
@@ -1808,6 +1908,11 @@ SAMPLE      read_struct_examples(char *file, STRUCT_LEARN_PARM *sparm)
   }
   SSVM_PRINT("[SVM_struct] nParallelChains=%d\n", nParallelChains);
 
+  if(Config::Instance()->getParameter("maxflow_cache_graphs", config_tmp)) {
+    cacheMaxflowGraphs = atoi(config_tmp.c_str()) == 1;
+  }
+  SSVM_PRINT("[SVM_struct] cacheMaxflowGraphs=%d\n", (int)cacheMaxflowGraphs);
+
 
   if(Config::Instance()->getParameter("predictTrainingImages", config_tmp)) {
     if(atoi(config_tmp.c_str())==1) {
@@ -1818,6 +1923,23 @@ SAMPLE      read_struct_examples(char *file, STRUCT_LEARN_PARM *sparm)
   }
   SSVM_PRINT("[SVM_struct] predictTrainingImages=%d\n", (int)predictTrainingImages);
 
+  if(Config::Instance()->getParameter("async_evaluation", config_tmp)) {
+    asyncEvaluation = atoi(config_tmp.c_str()) == 1;
+  }
+#ifdef _WIN32
+  asyncEvaluation = false;
+#endif
+  // share of the cores used by the evaluation threads
+  asyncEvaluationThreads = max(1, omp_get_num_procs()/4);
+  if(Config::Instance()->getParameter("async_evaluation_threads", config_tmp)) {
+    asyncEvaluationThreads = max(1, atoi(config_tmp.c_str()));
+  }
+  if(Config::Instance()->getParameter("async_evaluation_drop_stale", config_tmp)) {
+    asyncEvaluationDropStale = atoi(config_tmp.c_str()) == 1;
+  }
+  SSVM_PRINT("[SVM_struct] asyncEvaluation=%d, threads=%d, dropStale=%d\n",
+             (int)asyncEvaluation, asyncEvaluationThreads, (int)asyncEvaluationDropStale);
+
   SSVM_PRINT("[SVM_struct] SVM_FEAT_INDEX0=%d\n", SVM_FEAT_INDEX0(sparm));
 
   if(useMSRC) {
@@ -1913,11 +2035,11 @@ SAMPLE      read_struct_examples(char *file, STRUCT_LEARN_PARM *sparm)
 
 #if VERBOSITY > 1
       const int sid_to_print = 100;
-      osvm_node* n = examples[i].x.slice->getFeature(sid_to_print);
+      const float* n = examples[i].x.slice->getFeature(sid_to_print);
 
       SSVM_PRINT("[SVM_struct] Feature(%d):\n", sid_to_print);
       for(int s = 0; s < sparm->featureSize; s++) {
-        SSVM_PRINT("%d:%g ", n[s].index, n[s].value);
+        SSVM_PRINT("%d:%g ", s+1, n[s]);
       }
       SSVM_PRINT("\n");
 #endif
@@ -1929,11 +2051,11 @@ SAMPLE      read_struct_examples(char *file, STRUCT_LEARN_PARM *sparm)
 
 #if VERBOSITY > 1
       const int sid_to_print = 100;
-      osvm_node* n = test_examples[i].x.slice->getFeature(sid_to_print);
+      const float* n = test_examples[i].x.slice->getFeature(sid_to_print);
 
       SSVM_PRINT("[SVM_struct] Feature(%d):\n", sid_to_print);
       for(int s = 0; s < sparm->featureSize; s++) {
-        SSVM_PRINT("%d:%g ", n[s].index, n[s].value);
+        SSVM_PRINT("%d:%g ", s+1, n[s]);
       }
       SSVM_PRINT("\n");
 #endif
@@ -1941,6 +2063,14 @@ SAMPLE      read_struct_examples(char *file, STRUCT_LEARN_PARM *sparm)
 
   }
 
+  // one buffer per thread searching most violated constraints and
+  // nParallelChains buffers per thread for sampling
+  int nBufferThreads = omp_get_max_threads();
+  if(Config::Instance()->getParameter("mvc_nThreads", config_tmp)) {
+    nBufferThreads = max(nBufferThreads, atoi(config_tmp.c_str()));
+  }
+  maxBuffers = max(maxBuffers, nBufferThreads*max(1, nParallelChains));
+
   // Allocate memory for max number of nodes.
   SSVM_PRINT("[SVM_struct] Allocating temporary memory to run inference after each iteration. maxBuffers=%d, maxNbNodes=%d\n", maxBuffers, maxNbNodes);
   tempNodeLabels = new labelType*[maxBuffers];
@@ -2173,6 +2303,7 @@ LABEL       find_most_violated_constraint_marginrescaling(SPATTERN x, LABEL y,
      Psi(x,ybar)>Psi(x,y)-1. If the function cannot find a label, it
      shall return an empty label as recognized by the function
      empty_label(y). */
+  PROFILE_SCOPE("mvc");
   LABEL ybar;
 
   clock_t t = clock() - time_0;
@@ -2292,15 +2423,11 @@ LABEL       find_most_violated_constraint_marginrescaling(SPATTERN x, LABEL y,
       soutColoredImage << ".png";
     }
 
-    x.slice->exportSupernodeLabels(soutColoredImage.str().c_str(),
-                                   sparm->nClasses,
-                                   ybar.nodeLabels,
-                                   ybar.nNodes,
-                                   &(sparm->labelToClassIdx));
-
-    if(useSlice3d) {
-      zipAndDeleteCube(soutColoredImage.str().c_str());
-    }
+    x.slice->exportCompressedSupernodeLabels(soutColoredImage.str().c_str(),
+                                             sparm->nClasses,
+                                             ybar.nodeLabels,
+                                             ybar.nNodes,
+                                             &(sparm->labelToClassIdx));
   }
 
 #endif
@@ -2357,12 +2484,62 @@ bool isSubmodular(const STRUCT_LEARN_PARM *sparm, double* smw)
   return submodularEnergy;
 }
 
+#if USE_MAXFLOW
+/**
+ * Returns a maxflow inference object for example x.
+ * If cacheId is valid and graph caching is enabled, the graph built at a
+ * previous iteration is re-used and only its capacities are updated. The
+ * returned object is then owned by GraphCache.
+ */
+GI_maxflow* getMaxflowInference(SPATTERN& x, LABEL& y,
+                                const STRUCT_LEARN_PARM *sparm,
+                                const EnergyParam* param,
+                                double* smw,
+                                int cacheId)
+{
+  GI_maxflow* gi = 0;
+  if(cacheId != -1 && cacheMaxflowGraphs) {
+    gi = (GI_maxflow*)GraphCache::Instance()->getGraph(cacheId);
+    if(gi && gi->slice != x.slice) {
+      // the id was re-used for another example : rebuild the graph
+      SSVM_PRINT("[SVM_struct] Cached graph %d was built for another slice\n", cacheId);
+      gi = 0;
+    }
+    if(gi) {
+      gi->updateGraph(param, smw,
+                      y.nodeLabels, // groundtruth labels used to compute loss
+                      sparm->lossPerLabel);
+      return gi;
+    }
+  }
+
+  gi = new GI_maxflow(x.slice,
+                      param,
+                      smw,
+                      y.nodeLabels, // groundtruth labels used to compute loss  
+                      sparm->lossPerLabel,
+                      x.feature,
+                      x.nodeCoeffs,
+                      x.edgeCoeffs
+                      );
+
+  if(cacheId != -1 && cacheMaxflowGraphs) {
+    // param is a local variable of the caller
+    gi->setParam(param);
+    GraphCache::Instance()->setGraph(cacheId, gi);
+  }
+  return gi;
+}
+#endif
+
 void runInference(SPATTERN x, LABEL y, 
                   const STRUCTMODEL *sm, 
                   const STRUCT_LEARN_PARM *sparm,
                   LABEL& ybar, const int threadId, bool labelFound, int cacheId)
 {
-  GraphInference* gi_MVC;
+  GraphInference* gi_MVC = 0;
+  // true if gi_MVC is owned by GraphCache
+  bool cachedGI = false;
   bool computeEnergyAtEachIteration = true;
   // sm->w[0] is a dummy variable
   double* smw = sm->w + 1;
@@ -2380,15 +2557,8 @@ void runInference(SPATTERN x, LABEL y,
                    pw[1]+pw[2], pw[0]+pw[3], sparm->iterationId);
 
 #if USE_MAXFLOW
-        gi_MVC = new GI_maxflow(x.slice,
-                                &param,
-                                smw,
-                                y.nodeLabels, // groundtruth labels used to compute loss  
-                                sparm->lossPerLabel,
-                                x.feature,
-                                x.nodeCoeffs,
-                                x.edgeCoeffs
-                                );
+        gi_MVC = getMaxflowInference(x, y, sparm, &param, smw, cacheId);
+        cachedGI = (cacheId != -1 && cacheMaxflowGraphs);
 
         double energy = gi_MVC->run(ybar.nodeLabels, // inferred labels
                                     x.id,
@@ -2423,8 +2593,23 @@ void runInference(SPATTERN x, LABEL y,
         SSVM_PRINT("[MostViolatedConstraint] libDAI energy=%g (This should be equal to -score)\n", energy);
 
 #else
-        printf("[svm_struct] USE_LIBDAI is set to 0\n");
-        exit(-1);
+        gi_MVC = new GI_BP(x.slice,
+                           &param,
+                           smw,
+                           y.nodeLabels, // groundtruth labels used to compute loss
+                           sparm->lossPerLabel,
+                           x.feature,
+                           x.nodeCoeffs,
+                           x.edgeCoeffs
+                           );
+
+        double energy = gi_MVC->run(ybar.nodeLabels, // inferred labels
+                                    x.id,
+                                    MVC_MAX_ITER,
+                                    y.nodeLabels, // ground truth
+                                    computeEnergyAtEachIteration);
+
+        SSVM_PRINT("[MostViolatedConstraint] BP energy=%g (This should be equal to -score)\n", energy);
 #endif
       }
     }
@@ -2440,15 +2625,8 @@ void runInference(SPATTERN x, LABEL y,
                    pw[1]+pw[2], pw[0]+pw[3], sparm->iterationId);
 
 #if USE_MAXFLOW
-        gi_MVC = new GI_maxflow(x.slice,
-                                &param,
-                                smw,
-                                y.nodeLabels, // groundtruth labels used to compute loss  
-                                sparm->lossPerLabel,
-                                x.feature,
-                                x.nodeCoeffs,
-                                x.edgeCoeffs
-                                );
+        gi_MVC = getMaxflowInference(x, y, sparm, &param, smw, cacheId);
+        cachedGI = (cacheId != -1 && cacheMaxflowGraphs);
 
         energy = gi_MVC->run(ybar.nodeLabels, // inferred labels
                              x.id,
@@ -2486,7 +2664,10 @@ void runInference(SPATTERN x, LABEL y,
         SSVM_PRINT("[MostViolatedConstraint] libDAI energy=%g (This should be equal to -score)\n", energy);
       }
 
-      delete gi_MVC;
+      if(!cachedGI) {
+        delete gi_MVC;
+      }
+      cachedGI = false;
 
 #if VERBOSITY > 3
 
@@ -2516,15 +2697,11 @@ void runInference(SPATTERN x, LABEL y,
 
         // SSVM_PRINT("[SVM_struct] Saving labels for most violated constraint to %s\n",
         //           soutColoredImage.str().c_str());
-        x.slice->exportSupernodeLabels(soutColoredImage.str().c_str(),
-                                       sparm->nClasses,
-                                       ybar.nodeLabels,
-                                       ybar.nNodes,
-                                       &(sparm->labelToClassIdx));
-
-        if(useSlice3d) {
-          zipAndDeleteCube(soutColoredImage.str().c_str());
-        }
+        x.slice->exportCompressedSupernodeLabels(soutColoredImage.str().c_str(),
+                                                 sparm->nClasses,
+                                                 ybar.nodeLabels,
+                                                 ybar.nNodes,
+                                                 &(sparm->labelToClassIdx));
       }
 
 #endif
@@ -2568,7 +2745,7 @@ void runInference(SPATTERN x, LABEL y,
       _gi_mrf->setUseQPBO(true);
 
       double energy_QPBO = _gi_mrf->run(//ybar.nodeLabels, // inferred labels
-                                        tempNodeLabels[0],
+                                        tempNodeLabels[threadId],
                                         x.id,
                                         MVC_MAX_ITER,
                                         y.nodeLabels, // ground truth
@@ -2598,7 +2775,7 @@ void runInference(SPATTERN x, LABEL y,
 
       if(energy_QPBO < energy) {
         for(int n = 0; n < ybar.nNodes; ++n) {
-          ybar.nodeLabels[n] = tempNodeLabels[0][n];
+          ybar.nodeLabels[n] = tempNodeLabels[threadId][n];
         }
       }
 
@@ -2642,15 +2819,8 @@ void runInference(SPATTERN x, LABEL y,
                    pw[1]+pw[2], pw[0]+pw[3], sparm->iterationId);
 
 #if USE_MAXFLOW
-        gi_MVC = new GI_maxflow(x.slice,
-                                &param,
-                                smw,
-                                y.nodeLabels, // groundtruth labels used to compute loss  
-                                sparm->lossPerLabel,
-                                x.feature,
-                                x.nodeCoeffs,
-                                x.edgeCoeffs
-                                );
+        gi_MVC = getMaxflowInference(x, y, sparm, &param, smw, cacheId);
+        cachedGI = (cacheId != -1 && cacheMaxflowGraphs);
 
         double energy = gi_MVC->run(ybar.nodeLabels, // inferred labels
                                     x.id,
@@ -2928,6 +3098,52 @@ void runInference(SPATTERN x, LABEL y,
     }
     break;
 
+#if USE_MAXFLOW
+  case T_GI_EXPANSION:
+    {
+      gi_MVC = new GI_expansion(x.slice,
+                                &param,
+                                smw,
+                                y.nodeLabels, // groundtruth labels used to compute loss
+                                sparm->lossPerLabel,
+                                x.feature,
+                                x.nodeCoeffs,
+                                x.edgeCoeffs
+                                );
+
+      double energy = gi_MVC->run(ybar.nodeLabels, // inferred labels
+                                  x.id,
+                                  MVC_MAX_ITER,
+                                  y.nodeLabels, // ground truth
+                                  computeEnergyAtEachIteration);
+
+      SSVM_PRINT("[MostViolatedConstraint] expansion energy=%g (This should be equal to -score)\n", energy);
+      break;
+    }
+#endif
+
+  case T_GI_BP:
+    {
+      gi_MVC = new GI_BP(x.slice,
+                         &param,
+                         smw,
+                         y.nodeLabels, // groundtruth labels used to compute loss
+                         sparm->lossPerLabel,
+                         x.feature,
+                         x.nodeCoeffs,
+                         x.edgeCoeffs
+                         );
+
+      double energy = gi_MVC->run(ybar.nodeLabels, // inferred labels
+                                  x.id,
+                                  MVC_MAX_ITER,
+                                  y.nodeLabels, // ground truth
+                                  computeEnergyAtEachIteration);
+
+      SSVM_PRINT("[MostViolatedConstraint] BP energy=%g (This should be equal to -score)\n", energy);
+      break;
+    }
+
 #if USE_MULTIOBJ
   case T_GI_MULTIOBJ:
     {
@@ -2958,7 +3174,7 @@ void runInference(SPATTERN x, LABEL y,
     break;
   }
 
-  if(gi_MVC) {
+  if(gi_MVC && !cachedGI) {
     delete gi_MVC;
   }
 }
@@ -3093,6 +3309,224 @@ void save_parameters(const char* output_filename, STRUCT_LEARN_PARM *sparm, STRU
   ofs.close();
 }
 
+//--------------------------------------------------------------------EVALUATION
+
+/**
+ * Inference on the training, test and validation examples with a snapshot of
+ * the weight vector. The weights are loaded when the snapshot is taken so
+ * that the learner can keep updating sm->w while the snapshot is evaluated.
+ * Scores of 2d images are accumulated per example and not in the patterns,
+ * which are also used by the loss of the most violated constraint. Scores of
+ * cubes are written to one file per example and appended to the score file
+ * in example order by finish.
+ */
+class SnapshotEvaluation : public EvaluationSnapshot
+{
+ public:
+  SnapshotEvaluation(int _iterationId, const char* _weightFile,
+                     STRUCT_LEARN_PARM* _sparm, int _giType)
+    : EvaluationSnapshot(_iterationId),
+      weightFile(_weightFile),
+      param(_weightFile)
+  {
+    sparm = _sparm;
+    giType = _giType;
+    startTime = omp_get_wtime();
+
+    //TODO : temporary hack
+#if USE_LONG_RANGE_EDGES
+    param.nDistances = sparm->nDistances;
+#endif
+  }
+
+  ~SnapshotEvaluation()
+  {
+    for(uint s = 0; s < sets.size(); ++s) {
+      delete[] sets[s].scores;
+    }
+  }
+
+  void addSet(EXAMPLE* examples, long nExamples,
+              const string& outputDir, const string& scoreFilename,
+              const char* overlayDir)
+  {
+    EvaluationSet set;
+    set.examples = examples;
+    set.nExamples = nExamples;
+    set.outputDir = outputDir;
+    set.scoreFilename = scoreFilename;
+    set.overlayDir = overlayDir;
+    set.scores = 0;
+    if(!useSlice3d) {
+      // TPs, FPs, FNs and count for each example
+      ulong n = nExamples*4*sparm->nClasses;
+      set.scores = new ulong[n];
+      for(ulong i = 0; i < n; ++i) {
+        set.scores[i] = 0;
+      }
+    }
+    sets.push_back(set);
+
+    // the tables built on first use by the slices are not thread-safe and
+    // the slices are shared with the learner : build them now.
+    for(long i = 0; i < nExamples; ++i) {
+      Slice_P* slice = examples[i].x.slice;
+      if(!slice->isEdgeTableBuilt()) {
+        slice->buildEdgeTable();
+      }
+      slice->precomputeSupernodeStats();
+    }
+
+    nTasks += nExamples;
+  }
+
+  void runTask(int taskId)
+  {
+    uint s = 0;
+    while(taskId >= sets[s].nExamples) {
+      taskId -= sets[s].nExamples;
+      ++s;
+    }
+    EvaluationSet& set = sets[s];
+    int sid = taskId;
+    SPATTERN& x = set.examples[sid].x;
+    const bool compress_image = true;
+
+    if(useSlice3d) {
+      // add name of the cube
+      stringstream sout;
+      sout << set.outputDir.c_str();
+      sout << getNameFromPathWithoutExtension(x.slice->getName());
+      sout << "_";
+      sout << iterationId;
+
+      segmentImage(x,
+                   sout.str().c_str(),
+                   giType,
+                   param,
+                   &sparm->labelToClassIdx,
+                   getTaskScoreFilename(set, sid),
+                   0,0,
+                   compress_image,
+                   set.overlayDir,
+                   sparm->metric_type);
+    } else {
+      int nClasses = sparm->nClasses;
+      ulong* scores = set.scores + sid*4*nClasses;
+      Slice* slice = static_cast<Slice*>(x.slice);
+      computeScore(slice,
+                   x.feature,
+                   x.imgAnnotation,
+                   giType,
+                   param,
+                   sparm->labelToClassIdx,
+                   sparm->classIdxToLabel,
+                   true,
+                   param.nClasses,
+                   scores, scores + nClasses,
+                   scores + 2*nClasses, scores + 3*nClasses,
+                   set.outputDir.c_str(),
+                   x.nodeCoeffs,
+                   x.edgeCoeffs);
+    }
+  }
+
+  void finish()
+  {
+    if(useSlice3d) {
+      for(uint s = 0; s < sets.size(); ++s) {
+        for(long sid = 0; sid < sets[s].nExamples; ++sid) {
+          appendScoreFile(sets[s].scoreFilename, getTaskScoreFilename(sets[s], sid));
+        }
+      }
+    } else {
+      int nClasses = sparm->nClasses;
+      ulong* total = new ulong[4*nClasses];
+      for(uint s = 0; s < sets.size(); ++s) {
+        for(int i = 0; i < 4*nClasses; ++i) {
+          total[i] = 0;
+        }
+        for(long sid = 0; sid < sets[s].nExamples; ++sid) {
+          const ulong* scores = sets[s].scores + sid*4*nClasses;
+          for(int i = 0; i < 4*nClasses; ++i) {
+            total[i] += scores[i];
+          }
+        }
+        outputScore(sets[s].scoreFilename.c_str(), sparm->classIdxToLabel,
+                    total, total + nClasses, total + 2*nClasses, total + 3*nClasses,
+                    weightFile.c_str());
+      }
+      delete[] total;
+    }
+
+    SSVM_PRINT("[svm_struct] Evaluation of iteration %d (%d examples) done in %f s\n",
+               iterationId, nTasks, omp_get_wtime() - startTime);
+  }
+
+ private:
+  struct EvaluationSet
+  {
+    EXAMPLE* examples;
+    long nExamples;
+    string outputDir;
+    string scoreFilename;
+    const char* overlayDir;
+    ulong* scores;
+  };
+
+  string getTaskScoreFilename(const EvaluationSet& set, long sid)
+  {
+    stringstream sout;
+    sout << set.scoreFilename << "." << iterationId << "." << sid;
+    return sout.str();
+  }
+
+  /**
+   * Append the lines of taskFilename, written by segmentImage, to
+   * scoreFilename and delete taskFilename. The header is only kept if
+   * scoreFilename does not exist yet.
+   */
+  static void appendScoreFile(const string& scoreFilename, const string& taskFilename)
+  {
+    ifstream ifs(taskFilename.c_str());
+    if(ifs.fail()) {
+      // no ground truth for this example
+      return;
+    }
+    bool scoreFileExists = fileExists(scoreFilename);
+    ofstream ofs(scoreFilename.c_str(), ios::app);
+    string line;
+    bool header = true;
+    while(getline(ifs, line)) {
+      if(!header || !scoreFileExists) {
+        ofs << line << endl;
+      }
+      header = false;
+    }
+    ofs.close();
+    ifs.close();
+    remove(taskFilename.c_str());
+  }
+
+  string weightFile;
+  EnergyParam param;
+  STRUCT_LEARN_PARM* sparm;
+  int giType;
+  double startTime;
+  vector<EvaluationSet> sets;
+};
+
+void wait_for_pending_evaluations()
+{
+#ifndef _WIN32
+  if(evaluationQueue) {
+    SSVM_PRINT("[svm_struct] Waiting for pending evaluations\n");
+    delete evaluationQueue;
+    evaluationQueue = 0;
+  }
+#endif
+}
+
 int         finalize_iteration(double ceps, int cached_constraint,
 			       SAMPLE sample, STRUCTMODEL *sm,
 			       CONSTSET cset, double *alpha, 
@@ -3162,13 +3596,10 @@ int         finalize_iteration(double ceps, int cached_constraint,
   if( (sparm->iterationId>1) &&
       (oldC != sparm->C || (sparm->iterationId%sparm->stepForOutputFiles)==0) ) {
 
-    const bool compress_image = true;
-
     // switch to BP (or graph-cuts) if sampling is specified
-    bool use_sampling = false;
-    if(sparm->giType == T_GI_SAMPLING) {
-      use_sampling = true;
-      sparm->giType = T_GI_LIBDAI;
+    int giType = sparm->giType;
+    if(giType == T_GI_SAMPLING) {
+      giType = T_GI_LIBDAI;
     }
 
     //int iterationId = sparm->iterationId-1;
@@ -3196,12 +3627,9 @@ int         finalize_iteration(double ceps, int cached_constraint,
       soutOutput << sparm->startC << "_" << sparm->C;
     }
 
-    EnergyParam param(soutWeightFile.str().c_str());
-
-    //TODO : temporary hack
-#if USE_LONG_RANGE_EDGES
-    param.nDistances = sparm->nDistances;
-#endif
+    SnapshotEvaluation* evaluation = new SnapshotEvaluation(iterationId,
+                                                            soutWeightFile.str().c_str(),
+                                                            sparm, giType);
 
 #if VERBOSITY > 4
     if(oldC != sparm->C)
@@ -3218,303 +3646,65 @@ int         finalize_iteration(double ceps, int cached_constraint,
           SSVM_PRINT("[SVM_struct] Running inference for training dataset. Output results will be stored in %s\n",
                      soutOutputDir.c_str());
 
-          SSVM_PRINT("[svm_struct] training segmentImage::START %ld\n", clock() - time_0);
-
-          string training_score_filename = scoreDir + "training_score.txt";
-
-#ifdef USE_OPENMP
-#pragma omp parallel for
-#endif
-          for(int sid = 0; sid < sample.n; sid++) {
-
-            int threadId = omp_get_thread_num();
-            SSVM_PRINT("[svm_struct] segmentImage Thread %d/%d\n", threadId, omp_get_num_threads());
-
-            stringstream sout;
-            sout << soutOutputDir.c_str();
-            if(useSlice3d) {
-              // add name of the cube
-              sout << getNameFromPathWithoutExtension(sample.examples[sid].x.slice->getName());
-              sout << "_";
-              sout << iterationId;
-            }
-
-            if(useSlice3d) {
-              segmentImage(sample.examples[sid].x,
-                           sout.str().c_str(),
-                           sparm->giType,
-                           soutWeightFile.str().c_str(),
-                           &sparm->labelToClassIdx,
-                           training_score_filename,
-                           0,0,
-                           compress_image,
-                           (exportOverlay)?"overlay_training/":0,
-                           sparm->metric_type);
-            } else {
-              for(int c = 0; c < sparm->nClasses; c++) {
-                sample.examples[sid].x.TPs[c] = 0;
-                sample.examples[sid].x.FPs[c] = 0;
-                sample.examples[sid].x.FNs[c] = 0;
-                sample.examples[sid].x.count[c] = 0;
-              }
-
-              Slice* slice = static_cast<Slice*>(sample.examples[sid].x.slice);
-              computeScore(slice,
-                           sample.examples[sid].x.feature,
-                           sample.examples[sid].x.imgAnnotation,
-                           sparm->giType,
-                           param,
-                           sparm->labelToClassIdx,
-                           sparm->classIdxToLabel,
-                           true,
-                           param.nClasses,
-                           sample.examples[sid].x.TPs, sample.examples[sid].x.FPs,
-                           sample.examples[sid].x.FNs, sample.examples[sid].x.count,
-                           soutOutputDir.c_str(),
-                           sample.examples[sid].x.nodeCoeffs,
-                           sample.examples[sid].x.edgeCoeffs);
-            }
-          }
-
-          SSVM_PRINT("[svm_struct] training segmentImage::END %ld\n", clock() - time_0);
-
-          if(!useSlice3d) {
-            ulong *TPs = (ulong *)my_malloc(sizeof(ulong)*sparm->nClasses);
-            ulong *FPs = (ulong *)my_malloc(sizeof(ulong)*sparm->nClasses);
-            ulong *FNs = (ulong *)my_malloc(sizeof(ulong)*sparm->nClasses);
-            ulong *count = (ulong *)my_malloc(sizeof(ulong)*sparm->nClasses);
-            for(int c = 0; c < sparm->nClasses; c++) {
-              TPs[c] = 0;
-              FPs[c] = 0;
-              FNs[c] = 0;
-              count[c] = 0;
-            }
-            for(int sid = 0; sid < sample.n; sid++) {
-              for(int c = 0; c < sparm->nClasses; c++) {
-                TPs[c] += sample.examples[sid].x.TPs[c];
-                FPs[c] += sample.examples[sid].x.FPs[c];
-                FNs[c] += sample.examples[sid].x.FNs[c];
-                count[c] += sample.examples[sid].x.count[c];
-              }
-            }
-
-            outputScore(training_score_filename.c_str(), sparm->classIdxToLabel, TPs, FPs, FNs,
-                        count, soutWeightFile.str().c_str());
-            free(TPs);
-            free(FPs);
-            free(FNs);
-            free(count);
-          }
+          evaluation->addSet(sample.examples, sample.n, soutOutputDir,
+                             scoreDir + "training_score.txt",
+                             (exportOverlay)?"overlay_training/":0);
         }
       }
 
     if(testDir != "") {
-        string soutTestOutputDir = inferenceDir_test;
-        if(!useSlice3d) {
-          soutTestOutputDir += soutOutput.str() + "/";
-          mkdir(soutTestOutputDir.c_str(), 0777);
-        }
-
-        SSVM_PRINT("[SVM_struct] Running inference for test dataset containing %ld images\n",
-                      nTestExamples); 
-        SSVM_PRINT("[SVM_struct] Output results will be stored in %s\n",
-                      soutTestOutputDir.c_str());
-
-        clock_t t = clock() - time_0;
-        SSVM_PRINT("[svm_struct] test segmentImage::START %ld %f\n", t,
-                   t/(float)CLOCKS_PER_SEC);
-
-        string testing_score_filename = scoreDir + "test_score.txt";
-
-#ifdef USE_OPENMP
-#pragma omp parallel for
-#endif
-        for(int sid = 0; sid < nTestExamples; sid++)
-          {
-            stringstream sout;
-            sout << soutTestOutputDir.c_str();
-            if(useSlice3d) {
-              // add name of the cubeness
-              sout << getNameFromPathWithoutExtension(test_examples[sid].x.slice->getName());
-              sout << "_";
-              sout << iterationId;
-            }
+      string soutTestOutputDir = inferenceDir_test;
+      if(!useSlice3d) {
+        soutTestOutputDir += soutOutput.str() + "/";
+        mkdir(soutTestOutputDir.c_str(), 0777);
+      }
 
-            if(useSlice3d) {
-              segmentImage(test_examples[sid].x,
-                           sout.str().c_str(),
-                           sparm->giType,
-                           soutWeightFile.str().c_str(),
-                           &sparm->labelToClassIdx,
-                           testing_score_filename,
-                           0,0,
-                           compress_image,
-                           (exportOverlay)?"overlay_test/":0,
-                           sparm->metric_type);
-            } else {
-              for(int c = 0; c < sparm->nClasses; c++) {
-                sample.test_examples[sid].x.TPs[c] = 0;
-                sample.test_examples[sid].x.FPs[c] = 0;
-                sample.test_examples[sid].x.FNs[c] = 0;
-                sample.test_examples[sid].x.count[c] = 0;
-              }
+      SSVM_PRINT("[SVM_struct] Running inference for test dataset containing %ld images\n",
+                 nTestExamples);
+      SSVM_PRINT("[SVM_struct] Output results will be stored in %s\n",
+                 soutTestOutputDir.c_str());
 
-              Slice* slice = static_cast<Slice*>(sample.test_examples[sid].x.slice);
-              computeScore(slice,
-                           sample.test_examples[sid].x.feature,
-                           sample.test_examples[sid].x.imgAnnotation,
-                           sparm->giType,
-                           param,
-                           sparm->labelToClassIdx,
-                           sparm->classIdxToLabel,
-                           true,
-                           param.nClasses,
-                           sample.test_examples[sid].x.TPs, sample.test_examples[sid].x.FPs,
-                           sample.test_examples[sid].x.FNs, sample.test_examples[sid].x.count,
-                           soutTestOutputDir.c_str(),
-                           test_examples[sid].x.nodeCoeffs,
-                           test_examples[sid].x.edgeCoeffs);
-            }
-          }
-        t = clock() - time_0;
-        SSVM_PRINT("[svm_struct] test segmentImage::END %ld %f\n", t, t/(float)CLOCKS_PER_SEC);
-
-        if(!useSlice3d) {
-            ulong *TPs = (ulong *)my_malloc(sizeof(ulong)*sparm->nClasses);
-            ulong *FPs = (ulong *)my_malloc(sizeof(ulong)*sparm->nClasses);
-            ulong *FNs = (ulong *)my_malloc(sizeof(ulong)*sparm->nClasses);
-            ulong *count = (ulong *)my_malloc(sizeof(ulong)*sparm->nClasses);
-          for(int c = 0; c < sparm->nClasses; c++) {
-            TPs[c] = 0;
-            FPs[c] = 0;
-            FNs[c] = 0;
-            count[c] = 0;
-          }
-          for(int sid = 0; sid < nTestExamples; sid++) {
-            for(int c = 0; c < sparm->nClasses; c++) {
-              TPs[c] += sample.test_examples[sid].x.TPs[c];
-              FPs[c] += sample.test_examples[sid].x.FPs[c];
-              FNs[c] += sample.test_examples[sid].x.FNs[c];
-              count[c] += sample.test_examples[sid].x.count[c];
-            }
-          }
+      evaluation->addSet(test_examples, nTestExamples, soutTestOutputDir,
+                         scoreDir + "test_score.txt",
+                         (exportOverlay)?"overlay_test/":0);
+    }
 
-          outputScore(testing_score_filename.c_str(), sparm->classIdxToLabel, TPs, FPs, FNs,
-                      count, soutWeightFile.str().c_str());
-            free(TPs);
-            free(FPs);
-            free(FNs);
-            free(count);
-        }
+    if(validationDir != "" && isDirectory(validationDir.c_str())) {
+      string soutValidationOutputDir = inferenceDir_validation;
+      if(!useSlice3d) {
+        soutValidationOutputDir += soutOutput.str() + "/";
+        mkdir(soutValidationOutputDir.c_str(), 0777);
       }
 
-      if(validationDir != "" && isDirectory(validationDir.c_str()))
-        {
-          string soutValidationOutputDir = inferenceDir_validation;
-          if(!useSlice3d) {
-            soutValidationOutputDir += soutOutput.str() + "/";
-            mkdir(soutValidationOutputDir.c_str(), 0777);
-          }
-
-          SSVM_PRINT("[SVM_struct] Running inference for validation dataset containing %ld images\n",
-                        nValidationExamples); 
-          SSVM_PRINT("[SVM_struct] Output results will be stored in %s\n",
-                        soutValidationOutputDir.c_str());
+      SSVM_PRINT("[SVM_struct] Running inference for validation dataset containing %ld images\n",
+                 nValidationExamples);
+      SSVM_PRINT("[SVM_struct] Output results will be stored in %s\n",
+                 soutValidationOutputDir.c_str());
 
-	  clock_t t = clock() - time_0;
-	  SSVM_PRINT("[svm_struct] validation segmentImage::START %ld %f\n", t,
-                     t/(float)CLOCKS_PER_SEC);
-
-          string validation_score_filename = scoreDir + "validation_score.txt";
+      evaluation->addSet(validation_examples, nValidationExamples,
+                         soutValidationOutputDir,
+                         scoreDir + "validation_score.txt",
+                         (exportOverlay)?"overlay_validation/":0);
+    }
 
-#ifdef USE_OPENMP
-#pragma omp parallel for
+#ifndef _WIN32
+    if(asyncEvaluation) {
+      if(evaluationQueue == 0) {
+        evaluationQueue = new EvaluationQueue(asyncEvaluationThreads,
+                                              asyncEvaluationDropStale);
+      }
+      SSVM_PRINT("[svm_struct] Queuing evaluation of iteration %d (%d examples)\n",
+                 iterationId, evaluation->nTasks);
+      evaluationQueue->push(evaluation);
+    } else
 #endif
-          for(int sid = 0; sid < nValidationExamples; sid++)
-            {
-              stringstream sout;
-              sout << soutValidationOutputDir.c_str();
-              if(useSlice3d) {
-                sout << getNameFromPathWithoutExtension(validation_examples[sid].x.slice->getName());
-                sout << "_";
-                sout << iterationId;
-              }
-
-              if(useSlice3d) {
-                segmentImage(validation_examples[sid].x,
-                             sout.str().c_str(),
-                             sparm->giType,
-                             soutWeightFile.str().c_str(),
-                             &sparm->labelToClassIdx,
-                             validation_score_filename,
-                             0,0,
-                             compress_image,
-                             (exportOverlay)?"overlay_validation/":0,
-                             sparm->metric_type);
-              } else {
-                for(int c = 0; c < sparm->nClasses; c++) {
-                  sample.validation_examples[sid].x.TPs[c] = 0;
-                  sample.validation_examples[sid].x.FPs[c] = 0;
-                  sample.validation_examples[sid].x.FNs[c] = 0;
-                  sample.validation_examples[sid].x.count[c] = 0;
-                }
-
-                Slice* slice = static_cast<Slice*>(sample.validation_examples[sid].x.slice);
-                computeScore(slice,
-                             sample.validation_examples[sid].x.feature,
-                             sample.validation_examples[sid].x.imgAnnotation,
-                             sparm->giType,
-                             param,
-                             sparm->labelToClassIdx,
-                             sparm->classIdxToLabel,
-                             true,
-                             param.nClasses,
-                             sample.validation_examples[sid].x.TPs, sample.validation_examples[sid].x.FPs,
-                             sample.validation_examples[sid].x.FNs, sample.validation_examples[sid].x.count,
-                             soutValidationOutputDir.c_str(),
-                             validation_examples[sid].x.nodeCoeffs,
-                             validation_examples[sid].x.edgeCoeffs);
-              }
-            }
-	  t = clock() - time_0;
-	  SSVM_PRINT("[svm_struct] validation segmentImage::END %ld %f\n", t,
-                     t/(float)CLOCKS_PER_SEC);
-
-          if(!useSlice3d) {
-            ulong *TPs = (ulong *)my_malloc(sizeof(ulong)*sparm->nClasses);
-            ulong *FPs = (ulong *)my_malloc(sizeof(ulong)*sparm->nClasses);
-            ulong *FNs = (ulong *)my_malloc(sizeof(ulong)*sparm->nClasses);
-            ulong *count = (ulong *)my_malloc(sizeof(ulong)*sparm->nClasses);
-            for(int c = 0; c < sparm->nClasses; c++) {
-              TPs[c] = 0;
-              FPs[c] = 0;
-              FNs[c] = 0;
-              count[c] = 0;
-            }
-            for(int sid = 0; sid < nValidationExamples; sid++) {
-              for(int c = 0; c < sparm->nClasses; c++) {
-                TPs[c] += sample.validation_examples[sid].x.TPs[c];
-                FPs[c] += sample.validation_examples[sid].x.FPs[c];
-                FNs[c] += sample.validation_examples[sid].x.FNs[c];
-                count[c] += sample.validation_examples[sid].x.count[c];
-              }
-            }
-
-            outputScore(validation_score_filename.c_str(), sparm->classIdxToLabel, TPs, FPs, FNs,
-                        count, soutWeightFile.str().c_str());
-            free(TPs);
-            free(FPs);
-            free(FNs);
-            free(count);
-          }
-        }
-
-      oldC = sparm->C;
-      if(use_sampling) {
-        sparm->giType = T_GI_SAMPLING;
+      {
+        evaluation->run();
+        delete evaluation;
       }
 
-    }
+    oldC = sparm->C;
+  }
 
   SSVM_PRINT("------------------------------------------------NEW ITERATION\n");
   sparm->iterationId++;
@@ -3781,6 +3971,9 @@ void get_best_parameter_vector(EnergyParam* param)
 
 void finalize()
 {
+  // scores of the last snapshots are needed to pick the best model
+  wait_for_pending_evaluations();
+
   string outputModel = "model.txt";
   if(Config::Instance()->getParameter("outputModel", outputModel)) {
     SSVM_PRINT("[svm_struct] outputModel = %s\n", outputModel.c_str());
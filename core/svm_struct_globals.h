@@ -15,4 +15,10 @@
 #define USE_OPENMP 1
 #define NTHREADS 8
 
+// number of per-thread inference buffers (svm_struct_api.c)
+extern int maxBuffers;
+
 //---------------------------------------------------------------------FUNCTIONS
+
+// Block until the snapshots queued for asynchronous evaluation are evaluated.
+void wait_for_pending_evaluations();
@@ -34,6 +34,7 @@
 #endif
 
 #include "constraint_set.h"
+#include "graph_cache.h"
 #include "label_cache.h"
 #include "svm_struct_learn_custom.h"
 #include "svm_struct_api.h"
@@ -158,18 +159,13 @@ double get_norm_psi_gt(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm, EXAMPLE *examp
 
 /**
  * accumulate gradient in dfy
+ * dpsi = psi(x,y_bar) - psi(x,y) is a sparse vector (see computePsiDelta)
  */
 void compute_gradient_accumulate(STRUCTMODEL *sm, GRADIENT_PARM* gparm,
-                                 SWORD* fy_to, SWORD* fy_away, double *dfy,
+                                 SWORD* dpsi, double *dfy,
                                  const double loss, const double dfy_weight)
 {
-#if CUSTOM_VERBOSITY > 2
-  double score_y = 0;
-  double score_y_away = 0;
-#endif
-
-  SWORD* wy_to = fy_to;
-  SWORD* wy_away = fy_away;
+  SWORD* wdpsi = dpsi;
   switch(gparm->loss_type)
     {
     case LOG_LOSS:
@@ -180,19 +176,9 @@ void compute_gradient_accumulate(STRUCTMODEL *sm, GRADIENT_PARM* gparm,
         // dL(w)/dw = ( m'(x) e(m(x)) ) / ( 1 + e(m(x)))
         // m'(x) = psi(x,y_bar) - psi(x,y)
         double m = 0;
-        double dm;
-        while (wy_to->wnum) {
-          while(wy_away->wnum && (wy_away->wnum < wy_to->wnum)) {
-            ++wy_away;
-          }
-
-          if(wy_to->wnum == wy_away->wnum) {
-            dm = wy_away->weight - wy_to->weight;
-          } else {
-            dm = - wy_to->weight;
-          }
-          m += (sm->w[wy_to->wnum]*dm);
-          ++wy_to;
+        while (wdpsi->wnum) {
+          m += (sm->w[wdpsi->wnum]*wdpsi->weight);
+          ++wdpsi;
         }
         m += loss;
         double e_m = 0;
@@ -200,28 +186,14 @@ void compute_gradient_accumulate(STRUCTMODEL *sm, GRADIENT_PARM* gparm,
           e_m = exp(m);
         }
 
-        wy_to = fy_to;
-        wy_away = fy_away;
-        while (wy_to->wnum) {
-          while(wy_away->wnum && (wy_away->wnum < wy_to->wnum)) {
-            ++wy_away;
-          }
-          if(wy_to->wnum == wy_away->wnum) {
-            dm = wy_away->weight - wy_to->weight;
-          } else {
-            dm = - wy_to->weight;
-          }
-
+        wdpsi = dpsi;
+        while (wdpsi->wnum) {
           if(m >= 100) {
-            dfy[wy_to->wnum] += dfy_weight * dm;
+            dfy[wdpsi->wnum] += dfy_weight * wdpsi->weight;
           } else {
-            dfy[wy_to->wnum] += dfy_weight * (dm*e_m / (e_m + 1));
+            dfy[wdpsi->wnum] += dfy_weight * (wdpsi->weight*e_m / (e_m + 1));
           }
-#if CUSTOM_VERBOSITY > 2
-          score_y += sm->w[wy_to->wnum]*wy_to->weight;
-          score_y_away += sm->w[wy_to->wnum]*wy_away->weight;
-#endif
-          ++wy_to;
+          ++wdpsi;
         }
       }
       break;
@@ -230,24 +202,9 @@ void compute_gradient_accumulate(STRUCTMODEL *sm, GRADIENT_PARM* gparm,
         // L(w) = (loss(y,y_bar) + score(x,y_bar)) - score(x,y)
         // where score(x,y) = w^T*psi(x,y)
         // dL(w)/dw = psi(x,y_bar) - psi(x,y)
-        double dm;
-        while (wy_to->wnum) {
-          while(wy_away->wnum && (wy_away->wnum < wy_to->wnum)) {
-            ++wy_away;
-          }
-
-          if(wy_to->wnum == wy_away->wnum) {
-            dm = wy_away->weight - wy_to->weight;
-          } else {
-            dm = - wy_to->weight;
-          }
-
-          dfy[wy_to->wnum] += dfy_weight * dm;
-#if CUSTOM_VERBOSITY > 2
-          score_y += sm->w[wy_to->wnum]*wy_to->weight;
-          score_y_away += sm->w[wy_to->wnum]*wy_away->weight;
-#endif
-          ++wy_to;
+        while (wdpsi->wnum) {
+          dfy[wdpsi->wnum] += dfy_weight * wdpsi->weight;
+          ++wdpsi;
         }
       }
       break;
@@ -259,40 +216,16 @@ void compute_gradient_accumulate(STRUCTMODEL *sm, GRADIENT_PARM* gparm,
         // dL(w)/dw = ( m'(x) e(m(x)) ) / ( 1 + e(m(x)))
         // m'(x) = psi(x,y_bar) - psi(x,y)
         double m = 0;
-        double dm;
-        while (wy_to->wnum) {
-          while(wy_away->wnum && (wy_away->wnum < wy_to->wnum)) {
-            ++wy_away;
-          }
-
-          if(wy_to->wnum == wy_away->wnum) {
-            dm = wy_away->weight - wy_to->weight;
-          } else {
-            dm = - wy_to->weight;
-          }
-          m += (sm->w[wy_to->wnum]*dm);
-          ++wy_to;
+        while (wdpsi->wnum) {
+          m += (sm->w[wdpsi->wnum]*wdpsi->weight);
+          ++wdpsi;
         }
         m += loss;
 
-        wy_to = fy_to;
-        wy_away = fy_away;
-        while (wy_to->wnum) {
-          while(wy_away->wnum && (wy_away->wnum < wy_to->wnum)) {
-            ++wy_away;
-          }
-          if(wy_to->wnum == wy_away->wnum) {
-            dm = wy_away->weight - wy_to->weight;
-          } else {
-            dm = - wy_to->weight;
-          }
-
-          dfy[wy_to->wnum] += 1e-30 * dfy_weight * dm * m;
-#if CUSTOM_VERBOSITY > 2
-          score_y += sm->w[wy_to->wnum]*wy_to->weight;
-          score_y_away += sm->w[wy_to->wnum]*wy_away->weight;
-#endif
-          ++wy_to;
+        wdpsi = dpsi;
+        while (wdpsi->wnum) {
+          dfy[wdpsi->wnum] += 1e-30 * dfy_weight * wdpsi->weight * m;
+          ++wdpsi;
         }
       }
       break;
@@ -303,44 +236,43 @@ void compute_gradient_accumulate(STRUCTMODEL *sm, GRADIENT_PARM* gparm,
     }
 
 #if CUSTOM_VERBOSITY > 2
-  ofstream ofs_score_y("score_y.txt", ios::app);
-  ofs_score_y << score_y << endl;
-  ofs_score_y.close();
-
-  ofstream ofs_score_y_away("score_y_away.txt", ios::app);
-  ofs_score_y_away << score_y_away << endl;
-  ofs_score_y_away.close();
+  double dscore_psi = 0;
+  wdpsi = dpsi;
+  while (wdpsi->wnum) {
+    dscore_psi += sm->w[wdpsi->wnum]*wdpsi->weight;
+    ++wdpsi;
+  }
+  ofstream ofs_dscore_psi("dscore_psi.txt", ios::app);
+  ofs_dscore_psi << dscore_psi << endl;
+  ofs_dscore_psi.close();
 #endif
 }
 
+/**
+ * Compute the sparse vector dpsi = psi(x,y_away) - psi(x,y_to)
+ */
 void compute_psi(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
                    EXAMPLE* ex, LABEL* y_bar, LABEL* y_direct,
-                   GRADIENT_PARM* gparm, SWORD* fy_to, SWORD* fy_away,
+                   GRADIENT_PARM* gparm, SWORD* dpsi,
                    double* loss)
 {
-  labelType* y_to = 0;
-  labelType* y_away = 0;
+  LABEL* y_to = 0;
+  LABEL* y_away = 0;
   switch(gparm->gradient_type) {
   case GRADIENT_GT:
     // moves toward ground truth, away from larger loss
-    y_to = ex->y.nodeLabels;
-    y_away = y_bar->nodeLabels;
-    computePsi(fy_to, ex->x, ex->y, sm, sparm);
-    computePsi(fy_away, ex->x, *y_bar, sm, sparm);
+    y_to = &ex->y;
+    y_away = y_bar;
     break;
   case GRADIENT_DIRECT_ADD:
     // moves away from larger loss
-    y_to = y_direct->nodeLabels;
-    y_away = y_bar->nodeLabels;
-    computePsi(fy_to, ex->x, *y_direct, sm, sparm);
-    computePsi(fy_away, ex->x, *y_bar, sm, sparm);
+    y_to = y_direct;
+    y_away = y_bar;
     break;
   case GRADIENT_DIRECT_SUBTRACT:
     // moves toward better label
-    y_to = y_direct->nodeLabels;
-    y_away = y_bar->nodeLabels;
-    computePsi(fy_to, ex->x, *y_direct, sm, sparm);
-    computePsi(fy_away, ex->x, *y_bar, sm, sparm);
+    y_to = y_direct;
+    y_away = y_bar;
     break;
   default:
     printf("[svm_struct_custom] Unknown gradient type\n");
@@ -348,10 +280,12 @@ void compute_psi(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
     break;
   }
 
+  computePsiDelta(dpsi, ex->x, *y_to, *y_away, sm, sparm);
+
   if(!gparm->ignore_loss) {
     int nDiff;
     double _loss;
-    computeLoss(y_to, y_away, ex->y.nNodes, sparm, _loss, nDiff);
+    computeLoss(y_to->nodeLabels, y_away->nodeLabels, ex->y.nNodes, sparm, _loss, nDiff);
     if(loss) {
       *loss = _loss;
     }
@@ -385,17 +319,17 @@ void compute_psi_to(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
 
 double compute_gradient_accumulate(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
                                    EXAMPLE* ex, LABEL* y_bar, LABEL* y_direct,
-                                   GRADIENT_PARM* gparm, SWORD* fy_to, SWORD* fy_away,
+                                   GRADIENT_PARM* gparm, SWORD* dpsi,
                                    double *dfy, double* loss, const double dfy_weight)
 {
   int _sizePsi = sm->sizePsi + 1;
-  double _loss;
-  compute_psi(sparm, sm, ex, y_bar, y_direct, gparm, fy_to, fy_away, &_loss);
+  double _loss = 0;
+  compute_psi(sparm, sm, ex, y_bar, y_direct, gparm, dpsi, &_loss);
   if(loss) {
     *loss = _loss;
   }
 
-  compute_gradient_accumulate(sm, gparm, fy_to, fy_away, dfy, _loss, dfy_weight);
+  compute_gradient_accumulate(sm, gparm, dpsi, dfy, _loss, dfy_weight);
 
 #if CUSTOM_VERBOSITY > 3
   write_vector("dfy.txt", dfy, _sizePsi);
@@ -412,7 +346,7 @@ double compute_gradient_accumulate(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
 
 double compute_gradient(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
                         EXAMPLE* ex, LABEL* y_bar, LABEL* y_direct,
-                        GRADIENT_PARM* gparm, SWORD* fy_to, SWORD* fy_away,
+                        GRADIENT_PARM* gparm, SWORD* dpsi,
                         double *dfy, double* loss, const double dfy_weight)
 {
   // initialize dfy to 0
@@ -421,11 +355,11 @@ double compute_gradient(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
     dfy[i] = 0;
   }
 
-  return compute_gradient_accumulate(sparm, sm, ex, y_bar, y_direct, gparm, fy_to, fy_away, dfy, loss, dfy_weight);
+  return compute_gradient_accumulate(sparm, sm, ex, y_bar, y_direct, gparm, dpsi, dfy, loss, dfy_weight);
 }
 
 double compute_gradient(STRUCTMODEL *sm, GRADIENT_PARM* gparm,
-                        SWORD* fy_to, SWORD* fy_away, double *dfy,
+                        SWORD* dpsi, double *dfy,
                         const double loss, const double dfy_weight)
 {
   // initialize dfy to 0
@@ -434,7 +368,7 @@ double compute_gradient(STRUCTMODEL *sm, GRADIENT_PARM* gparm,
     dfy[i] = 0;
   }
 
-  compute_gradient_accumulate(sm, gparm, fy_to, fy_away, dfy, loss, dfy_weight);
+  compute_gradient_accumulate(sm, gparm, dpsi, dfy, loss, dfy_weight);
 
   double dscore = 0;
   // do not add +1 here as dfy also has an additional dummy entry at index 0.
@@ -479,15 +413,11 @@ void exportLabels(STRUCT_LEARN_PARM *sparm, EXAMPLE* ex,
     soutColoredImage << ex->x.slice->getName();
   }
 
-  ex->x.slice->exportSupernodeLabels(soutColoredImage.str().c_str(),
-                                     sparm->nClasses,
-                                     y->nodeLabels,
-                                     y->nNodes,
-                                     &(sparm->labelToClassIdx));
-
-  if(useSlice3d) {
-    zipAndDeleteCube(soutColoredImage.str().c_str());
-  }
+  ex->x.slice->exportCompressedSupernodeLabels(soutColoredImage.str().c_str(),
+                                               sparm->nClasses,
+                                               y->nodeLabels,
+                                               y->nNodes,
+                                               &(sparm->labelToClassIdx));
 }
 
 double do_gradient_step(STRUCT_LEARN_PARM *sparm,
@@ -496,22 +426,20 @@ double do_gradient_step(STRUCT_LEARN_PARM *sparm,
                         double* momentum, double& dscore, LABEL* y_bar)
 {
   int _sizePsi = sm->sizePsi + 1;
-  SWORD* fy_to = new SWORD[_sizePsi];
-  SWORD* fy_away = new SWORD[_sizePsi];
+  SWORD* dpsi = new SWORD[_sizePsi];
   double* dfy = new double[_sizePsi];
   memset((void*)dfy, 0, sizeof(double)*(_sizePsi));
 
   double m = do_gradient_step(sparm, sm, ex, nExamples, gparm,
-                              momentum, fy_to, fy_away, dfy, dscore, y_bar);
-  delete[] fy_to;
-  delete[] fy_away;
+                              momentum, dpsi, dfy, dscore, y_bar);
+  delete[] dpsi;
   delete[] dfy;
   return m;
 }
 
 double compute_gradient_with_history(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
                                      EXAMPLE* ex,
-                                     GRADIENT_PARM* gparm, SWORD* fy_to,
+                                     GRADIENT_PARM* gparm,
                                      double *dfy, double* loss)
 {
   ConstraintSet* cs = ConstraintSet::Instance();
@@ -556,8 +484,8 @@ double compute_gradient_with_history(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
     int c = 0;
     for(vector<constraint>::const_iterator it = constraints->begin();
         it != constraints->end(); ++it) {
-      compute_gradient_accumulate(sm, gparm, fy_to,
-                                  it->first->w, dfy, it->first->loss, dfy_weights[c]);
+      compute_gradient_accumulate(sm, gparm, it->first->w, dfy,
+                                  it->first->loss, dfy_weights[c]);
       if(loss) {
         *loss += it->first->loss;
       }      
@@ -566,19 +494,19 @@ double compute_gradient_with_history(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
   } else {
     // only use violated constraints
 
-    double score_gt = computeScore(sm, fy_to);
     int c = 0;
     for(vector<constraint>::const_iterator it = constraints->begin();
         it != constraints->end(); ++it) {
       // check if constraint is violated
-      double score_cs = computeScore(sm, it->first->w);
-      bool positive_margin = (score_cs - score_gt + it->first->loss) > 0;
-      //printf("Margin constraint %d: score_cs = %g, score_gt = %g, loss = %g, margin = %g\n",
-      //       c, score_cs, score_gt, it->first->loss, score_cs - score_gt + it->first->loss);
+      // constraints store psi(x,y_bar) - psi(x,y) so w*psi is the score difference
+      double dscore_cs = cs->computeScore(it->first->w, sm->w);
+      bool positive_margin = (dscore_cs + it->first->loss) > 0;
+      //printf("Margin constraint %d: dscore_cs = %g, loss = %g, margin = %g\n",
+      //       c, dscore_cs, it->first->loss, dscore_cs + it->first->loss);
 
       if(positive_margin) {
-        compute_gradient_accumulate(sm, gparm, fy_to,
-                                    it->first->w, dfy, it->first->loss, dfy_weights[c]);
+        compute_gradient_accumulate(sm, gparm, it->first->w, dfy,
+                                    it->first->loss, dfy_weights[c]);
         if(loss) {
           *loss += it->first->loss;
         }
@@ -601,7 +529,7 @@ double compute_gradient_with_history(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
 
 double compute_gradient_with_history(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
                                      EXAMPLE* ex, LABEL* y_bar, LABEL* y_direct,
-                                     GRADIENT_PARM* gparm, SWORD* fy_to, SWORD* fy_away,
+                                     GRADIENT_PARM* gparm, SWORD* dpsi,
                                      double *dfy, double* loss)
 {
   double dfy_weight = 1.0;
@@ -612,8 +540,8 @@ double compute_gradient_with_history(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
   }
 
   double _loss;
-  double _dscore = compute_gradient(sparm, sm, ex, y_bar, y_direct, gparm, fy_to,
-                                    fy_away, dfy, &_loss, dfy_weight);
+  double _dscore = compute_gradient(sparm, sm, ex, y_bar, y_direct, gparm, dpsi,
+                                    dfy, &_loss, dfy_weight);
   if(loss) {
     *loss += _loss;
   }
@@ -625,8 +553,8 @@ double compute_gradient_with_history(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
     dfy_weight = 1.0/(double)(constraints->size()+1.0);
     for(vector<constraint>::const_iterator it = constraints->begin();
         it != constraints->end(); ++it) {
-      compute_gradient_accumulate(sm, gparm, fy_to,
-                                  it->first->w, dfy, it->first->loss, dfy_weight);
+      compute_gradient_accumulate(sm, gparm, it->first->w, dfy,
+                                  it->first->loss, dfy_weight);
       if(loss) {
         *loss += it->first->loss;
       }
@@ -665,11 +593,46 @@ void update_w(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm, GRADIENT_PARM* gparm,
   }
 }
 
+// labels y_direct the constraints of each example are relative to
+static map<int, labelType*> y_direct_reference;
+
+/**
+ * Constraints are stored as sparse deltas psi(x,ybar) - psi(x,y_direct)
+ * but y_direct is recomputed at every step. Shift the constraints of ex by
+ * psi(x,y_prev) - psi(x,y_direct) so that they are relative to the current
+ * y_direct, as when the dense psi(x,ybar) was stored and compared to the
+ * current psi(x,y_direct). shift is a buffer of sizePsi+1 entries.
+ */
+static void rebase_direct_constraints(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
+                                      EXAMPLE* ex, LABEL* y_direct, SWORD* shift)
+{
+  int nNodes = y_direct->nNodes;
+  labelType*& reference = y_direct_reference[ex->x.id];
+  if(reference == 0) {
+    reference = new labelType[nNodes];
+  } else if(ConstraintSet::Instance()->count(ex->x.id) > 0) {
+    LABEL y_prev = *y_direct;
+    y_prev.nodeLabels = reference;
+    computePsiDelta(shift, ex->x, *y_direct, y_prev, sm, sparm);
+    ConstraintSet::Instance()->rebase(ex->x.id, shift);
+  }
+  memcpy(reference, y_direct->nodeLabels, nNodes*sizeof(labelType));
+}
+
+static void release_direct_references()
+{
+  for(map<int, labelType*>::iterator it = y_direct_reference.begin();
+      it != y_direct_reference.end(); ++it) {
+    delete[] it->second;
+  }
+  y_direct_reference.clear();
+}
+
 double do_gradient_step(STRUCT_LEARN_PARM *sparm,
                         STRUCTMODEL *sm, EXAMPLE *ex, long nExamples,
                         GRADIENT_PARM* gparm,
                         double* momentum,
-                        SWORD* fy_to, SWORD* fy_away, double *dfy,
+                        SWORD* dpsi, double *dfy,
                         double& dscore,
                         LABEL* y_bar)
 {
@@ -681,27 +644,21 @@ double do_gradient_step(STRUCT_LEARN_PARM *sparm,
     sparm->lossPerLabel = 0;
   }
 
-  // setting this to 1 will make the example loop below single thread so that
-  // several threads can be run for different temperature while running the
-  // samplign code.
-#define USE_SAMPLING 0
-
-#if USE_SAMPLING
+  // Examples are independent so the most violated constraints are searched
+  // in parallel. Inference time varies a lot between volumes, hence the
+  // dynamic schedule. The example loop is kept single threaded for sampling
+  // so that several threads can be used by the chains. Each thread uses its
+  // own inference buffers, hence at most maxBuffers threads.
 #ifdef USE_OPENMP
-#pragma omp parallel for
-#endif
+  int nMVCThreads = (gparm->mvc_n_threads > 0)?gparm->mvc_n_threads:omp_get_max_threads();
+  if(sparm->giType == T_GI_SAMPLING) {
+    nMVCThreads = 1;
+  }
+  nMVCThreads = min(nMVCThreads, maxBuffers);
+#pragma omp parallel for schedule(dynamic) num_threads(nMVCThreads) if(nMVCThreads > 1 && nExamples > 1)
 #endif
-
   /*** precomputation step ***/
   for(int i = 0; i < nExamples; i++) {
-
-#if USE_SAMPLING
-#ifdef USE_OPENMP
-    int threadId = omp_get_thread_num();
-    printf("[svm_struct_custom] Thread %d/%d\n", threadId,omp_get_num_threads());
-#endif
-#endif
-
     if(sparm->loss_type == SLACK_RESCALING) {
       y_bar[i] = find_most_violated_constraint_slackrescaling(ex[i].x, ex[i].y,
                                                              sm, sparm);
@@ -734,23 +691,28 @@ double do_gradient_step(STRUCT_LEARN_PARM *sparm,
       int threadId = 0;
 #endif
 
-      // check if labels are stored in the cache
-      int cacheId = nExamples + ex[il].x.id;
-      bool labelFound = LabelCache::Instance()->getLabel(cacheId, *y_direct);
+      // check if labels are stored in the cache. Ids of the direct labels
+      // start after the ids of all the training examples (not only the ones
+      // in this batch) so that they never collide with the ids used by the
+      // most violated constraint search.
+      int cacheId = gparm->n_total_examples + ex[il].x.id;
+      bool labelFound = LabelCache::Instance()->getLabel(cacheId, y_direct[il]);
       if(!labelFound) {
         // allocate memory
-        y_direct->nNodes = ex[il].y.nNodes;
-        y_direct->nodeLabels = new labelType[y_direct->nNodes];
+        y_direct[il].nNodes = ex[il].y.nNodes;
+        y_direct[il].nodeLabels = new labelType[y_direct[il].nNodes];
         for(int n = 0; n < ex[il].y.nNodes; n++) {
-          y_direct->nodeLabels[n] = ex[il].y.nodeLabels[n];
+          y_direct[il].nodeLabels[n] = ex[il].y.nodeLabels[n];
         }
-        y_direct->cachedNodeLabels = false;
+        y_direct[il].cachedNodeLabels = false;
         labelFound = true;
       }
 
       runInference(ex[il].x, ex[il].y, sm, sparm, y_direct[il], threadId, labelFound, cacheId);
       //exportLabels(sparm, &ex[il], y_bar, "direct/");
 
+      rebase_direct_constraints(sparm, sm, &ex[il], &y_direct[il], dpsi);
+
     }
     sparm->lossPerLabel = _lossPerLabel;
   }
@@ -773,20 +735,20 @@ double do_gradient_step(STRUCT_LEARN_PARM *sparm,
 
       double _loss = 0;
       compute_gradient(sparm, sm, &ex[il], &y_bar[il], &y_direct[il], gparm,
-                       fy_to, fy_away, dfy, &_loss, dfy_weight);
+                       dpsi, dfy, &_loss, dfy_weight);
 
       // add the current constraint first
       if(gparm->constraint_set_type == CS_MARGIN || gparm->constraint_set_type == CS_MARGIN_DISTANCE) {
         double margin = total_dscore + total_dloss;
         double sorting_value = (fabs(margin) < 1e-38)?0 : 1.0/margin;
-        cs->add(ex[il].x.id, fy_away, _loss, _sizePsi, sorting_value);
+        cs->add(ex[il].x.id, dpsi, _loss, _sizePsi, sorting_value);
       } else {
-        cs->add(ex[il].x.id, fy_away, _loss, _sizePsi);
+        cs->add(ex[il].x.id, dpsi, _loss, _sizePsi);
       }
 
       const constraint* c = cs->getMostViolatedConstraint(ex[il].x.id, sm->w);
-      double dscore_cs = compute_gradient(sm, gparm, fy_to,
-                                          c->first->w, dfy, c->first->loss, dfy_weight);
+      double dscore_cs = compute_gradient(sm, gparm, c->first->w, dfy,
+                                          c->first->loss, dfy_weight);
       bool positive_margin = (dscore_cs + c->first->loss) > 0;
 
       if( (gparm->loss_type != HINGE_LOSS && gparm->loss_type != SQUARE_HINGE_LOSS) || positive_margin) {
@@ -806,7 +768,7 @@ double do_gradient_step(STRUCT_LEARN_PARM *sparm,
       // compute gradient for last generated constraint
       double _loss;
       double _dscore = compute_gradient(sparm, sm, &ex[il], &y_bar[il], &y_direct[il], gparm,
-                                        fy_to, fy_away, dfy, &_loss, dfy_weight);
+                                        dpsi, dfy, &_loss, dfy_weight);
 
       if(gparm->use_history) {
 
@@ -815,9 +777,9 @@ double do_gradient_step(STRUCT_LEARN_PARM *sparm,
         if(gparm->constraint_set_type == CS_MARGIN || gparm->constraint_set_type == CS_MARGIN_DISTANCE) {
           double margin = _dscore + _loss;
           double sorting_value = (fabs(margin) < 1e-38)?0 : 1.0/margin;
-          cs->add(ex[il].x.id, fy_away, _loss, _sizePsi, sorting_value);
+          cs->add(ex[il].x.id, dpsi, _loss, _sizePsi, sorting_value);
         } else {
-          cs->add(ex[il].x.id, fy_away, _loss, _sizePsi);
+          cs->add(ex[il].x.id, dpsi, _loss, _sizePsi);
         }
 
         const vector< constraint >* constraints = cs->getConstraints(ex[il].x.id);
@@ -825,8 +787,8 @@ double do_gradient_step(STRUCT_LEARN_PARM *sparm,
         if(constraints) {
           for(vector<constraint>::const_iterator it = constraints->begin();
               it != constraints->end(); ++it) {
-            double dscore_cs = compute_gradient(sm, gparm, fy_to,
-                                                it->first->w, dfy, it->first->loss, dfy_weight);
+            double dscore_cs = compute_gradient(sm, gparm, it->first->w, dfy,
+                                                it->first->loss, dfy_weight);
             total_dloss += it->first->loss;
             bool positive_margin = (dscore_cs + it->first->loss) > 0;
 
@@ -854,9 +816,9 @@ double do_gradient_step(STRUCT_LEARN_PARM *sparm,
           // compute margin
           double margin = total_dscore + total_dloss;
           double sorting_value = (fabs(margin) < 1e-38)?0 : 1.0/margin;
-          cs->add(ex[il].x.id, fy_away, _loss, _sizePsi, sorting_value);
+          cs->add(ex[il].x.id, dpsi, _loss, _sizePsi, sorting_value);
         } else {
-          cs->add(ex[il].x.id, fy_away, _loss, _sizePsi);
+          cs->add(ex[il].x.id, dpsi, _loss, _sizePsi);
         }
       } else {
         bool positive_margin = (_dscore + _loss) > 0;
@@ -901,7 +863,7 @@ double do_gradient_step(STRUCT_LEARN_PARM *sparm,
 
   dscore = total_dscore;
 
-  double m = compute_m(sparm, sm, ex, nExamples, gparm, y_bar, y_direct, fy_to, fy_away, dfy);
+  double m = compute_m(sparm, sm, ex, nExamples, gparm, y_bar, y_direct, dpsi, dfy);
 
   if(y_direct) {
     delete[] y_direct;
@@ -913,7 +875,7 @@ double do_gradient_step(STRUCT_LEARN_PARM *sparm,
 double compute_m(STRUCT_LEARN_PARM *sparm,
                  STRUCTMODEL *sm, EXAMPLE *ex, long nExamples,
                  GRADIENT_PARM* gparm, LABEL* y_bar, LABEL* y_direct,
-                 SWORD* fy_to, SWORD* fy_away, double *dfy)
+                 SWORD* dpsi, double *dfy)
 {
   const double dfy_weight = 1.0;
   double total_loss = 0; // cumulative loss for all examples
@@ -929,8 +891,8 @@ double compute_m(STRUCT_LEARN_PARM *sparm,
       if(constraints) {
         for(vector<constraint>::const_iterator it = constraints->begin();
             it != constraints->end(); ++it) {
-          double dscore_cs = compute_gradient(sm, gparm, fy_to,
-                                              it->first->w, dfy, it->first->loss, dfy_weight);
+          double dscore_cs = compute_gradient(sm, gparm, it->first->w, dfy,
+                                              it->first->loss, dfy_weight);
 
           // do not add if negative to avoid adding and subtracting values.
           // this score is just logged, not used in any computation.
@@ -945,7 +907,7 @@ double compute_m(STRUCT_LEARN_PARM *sparm,
     for(int il = 0; il < nExamples; il++) { /*** example loop ***/
       double _loss  = 0;
       total_dscore += compute_gradient(sparm, sm, &ex[il], &y_bar[il],
-                                       &y_direct[il], gparm, fy_to, fy_away,
+                                       &y_direct[il], gparm, dpsi,
                                        dfy, &_loss, dfy_weight);
       total_loss += _loss;
     }
@@ -1000,14 +962,11 @@ double compute_score_estimate(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm, GRADIEN
       sid = i;
     }
 
-    supernode* s = slice->getSupernode(sid);
-    vector < supernode* >* lNeighbors = &(s->neighbors);
-
     double potential = gi.computeUnaryPotential(slice, sid, c);
-    for(vector < supernode* >::iterator itN = lNeighbors->begin();
-        itN != lNeighbors->end(); itN++) {
+    const edgeInfo* itE_end = slice->getEdgesEnd(sid);
+    for(const edgeInfo* itE = slice->getEdgesBegin(sid); itE != itE_end; ++itE) {
       const int c2 = rand()*sparm->nClasses / (double)RAND_MAX;
-      double pairwisePotential = gi.computePairwisePotential(slice, s, (*itN),
+      double pairwisePotential = gi.computePairwisePotential(sid, *itE,
                                                              c, c2);
       potential += pairwisePotential;
     }
@@ -1225,8 +1184,7 @@ void svm_learn_struct_joint_custom(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 
   double last_obj = 0;
   int _sizePsi = sm->sizePsi + 1;
-  SWORD* fy_to = new SWORD[_sizePsi];
-  SWORD* fy_away = new SWORD[_sizePsi];
+  SWORD* dpsi = new SWORD[_sizePsi];
   double* dfy = new double[_sizePsi];
   memset((void*)dfy, 0, sizeof(double)*(_sizePsi));
   LABEL* y_bar = new LABEL[nTotalExamples];
@@ -1270,7 +1228,7 @@ void svm_learn_struct_joint_custom(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
     }
 
     double m = do_gradient_step(sparm, sm, _ex, _nBatchExamples,
-                                &gparm, momentum, fy_to, fy_away, dfy,
+                                &gparm, momentum, dpsi, dfy,
                                 dscores[idx], y_bar);
 
     // projection
@@ -1395,6 +1353,13 @@ void svm_learn_struct_joint_custom(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
 
   ConstraintSet::Instance()->save("constraint_set.txt");
 
+  // examples must not be released while snapshots are being evaluated
+  wait_for_pending_evaluations();
+
+  // cached graphs point to the slices of the examples
+  GraphCache::Instance()->clear();
+  release_direct_references();
+
   if(numIt >= nMaxIterations) {
     printf("[svm_struct_custom] Reached max number of iterations %d\n",
            nMaxIterations);
@@ -1409,8 +1374,7 @@ void svm_learn_struct_joint_custom(SAMPLE sample, STRUCT_LEARN_PARM *sparm,
     momentum = 0;
   }
 
-  delete[] fy_to;
-  delete[] fy_away;
+  delete[] dpsi;
   delete[] dfy;
   delete[] objs;
   delete[] ms;
@@ -1713,6 +1677,15 @@ void init_gradient_param(GRADIENT_PARM& gparm, Config* config,
   }
   printf("[SVM_struct_custom] enforce_submodularity = %d\n", (int)enforce_submodularity);
 
+  // number of threads used to find the most violated constraints of the
+  // examples in a batch. Set to 1 to process examples sequentially (needed if
+  // the inference code is itself multi-threaded, e.g. parallel sampling chains)
+  int mvc_n_threads = -1;
+  if(Config::Instance()->getParameter("mvc_nThreads", config_tmp)) {
+    mvc_n_threads = atoi(config_tmp.c_str());
+  }
+  printf("[SVM_struct_custom] mvc_n_threads = %d\n", mvc_n_threads);
+
   gparm.learning_rate = learning_rate;
   gparm.learning_rate_0 = learning_rate; // initial learning rate
   gparm.learning_rate_exponent = learning_rate_exponent;
@@ -1727,4 +1700,5 @@ void init_gradient_param(GRADIENT_PARM& gparm, Config* config,
   gparm.constraint_set_type = constraint_set_type;
   gparm.ignore_loss = sgd_ignore_loss;
   gparm.n_batch_examples = sgd_n_batch_examples;
+  gparm.mvc_n_threads = mvc_n_threads;
 }
\ No newline at end of file
@@ -74,22 +74,30 @@ typedef struct struct_gradient_parm {
   double* momentum;
   double max_norm_w;
   bool use_random_weights;
+  int mvc_n_threads; // threads used to search most violated constraints (<= 0 : all)
 } GRADIENT_PARM;
 
 
 //---------------------------------------------------------------------FUNCTIONS
 
+/**
+ * Compute the sparse vector dpsi = psi(x,ybar) - psi(x,y) by only visiting
+ * the supernodes whose labels differ. Defined in svm_struct_api.c.
+ */
+int computePsiDelta(SWORD* dpsi, SPATTERN x, LABEL y, LABEL ybar,
+                    const STRUCTMODEL *sm, const STRUCT_LEARN_PARM *sparm);
+
 /**
  * Compute gradient using history.
  */
 double compute_gradient_with_history(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
                                      EXAMPLE* ex,
-                                     GRADIENT_PARM* gparm, SWORD* fy_to,
+                                     GRADIENT_PARM* gparm,
                                      double *dfy, double* loss);
 
 double compute_gradient_with_history(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
                                      EXAMPLE* ex, LABEL* y_bar, LABEL* y_direct,
-                                     GRADIENT_PARM* gparm, SWORD* fy_to, SWORD* fy_away,
+                                     GRADIENT_PARM* gparm, SWORD* dpsi,
                                      double *dfy, double* loss);
 
 /**
@@ -98,7 +106,7 @@ double compute_gradient_with_history(STRUCT_LEARN_PARM *sparm, STRUCTMODEL *sm,
 double compute_m(STRUCT_LEARN_PARM *sparm,
                  STRUCTMODEL *sm, EXAMPLE *ex, long nExamples,
                  GRADIENT_PARM* gparm, LABEL* ybar, LABEL* y_direct,
-                 SWORD* fy, SWORD* fybar, double *dfy);
+                 SWORD* dpsi, double *dfy);
 
 double do_gradient_step(STRUCT_LEARN_PARM *sparm,
                         STRUCTMODEL *sm, EXAMPLE *ex, long nExamples,
@@ -110,7 +118,7 @@ double do_gradient_step(STRUCT_LEARN_PARM *sparm,
                         STRUCTMODEL *sm, EXAMPLE *ex, long nExamples,
                         GRADIENT_PARM* gparm,
                         double* momentum,
-                        SWORD* fy, SWORD* fybar, double *dfy, double& dscore,
+                        SWORD* dpsi, double *dfy, double& dscore,
                         LABEL* y_bar);
 
 void exportLabels(STRUCT_LEARN_PARM *sparm, EXAMPLE* ex,
@@ -0,0 +1,288 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "tiled_inference.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// SliceMe
+#include "Config.h"
+#include "Feature.h"
+#include "Slice3d.h"
+#include "inference.h"
+#include "utils.h"
+#include "volume_loader.h"
+
+// memory needed per voxel of a tile : raw data, float copy, supervoxel
+// labels and distances for SLIC, reverse indexing and lines.
+#define TILE_BYTES_PER_VOXEL 24
+
+//------------------------------------------------------------------------------
+
+static double getElapsedTime(struct timeval& t)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  double elapsed = (now.tv_sec - t.tv_sec) + (now.tv_usec - t.tv_usec)*1e-6;
+  t = now;
+  return elapsed;
+}
+
+//------------------------------------------------------------------------------
+
+TiledPredictor::TiledPredictor(const EnergyParam& _param, int _algoType)
+  : param(_param), scale(_param)
+{
+  algoType = _algoType;
+  voxelStep = DEFAULT_VOXEL_STEP;
+  cubeness = SUPERVOXEL_DEFAULT_CUBENESS;
+
+  string config_tmp;
+  memoryCap = 2048;
+  if(Config::Instance()->getParameter("tiled_memory_cap", config_tmp)) {
+    memoryCap = atol(config_tmp.c_str());
+  }
+  memoryCap *= 1024*1024;
+
+  tileSize = -1;
+  if(Config::Instance()->getParameter("tiled_tile_size", config_tmp)) {
+    tileSize = atoi(config_tmp.c_str());
+  }
+
+  halo = 2*voxelStep;
+  if(Config::Instance()->getParameter("tiled_halo", config_tmp)) {
+    halo = atoi(config_tmp.c_str());
+  }
+
+  rescale = false;
+  if(Config::Instance()->getParameter("rescale_raw_data", config_tmp)) {
+    rescale = config_tmp[0] == '1';
+  }
+  rescaleMin = 0;
+  rescaleMax = 255;
+}
+
+int TiledPredictor::computeTileSize()
+{
+  int _tileSize = tileSize;
+  if(_tileSize <= 0) {
+    // largest extended tile that fits in the memory cap
+    int extendedSize = (int)cbrt((double)memoryCap/TILE_BYTES_PER_VOXEL);
+    _tileSize = extendedSize - 2*halo;
+    if(_tileSize < max(halo, voxelStep)) {
+      printf("[TiledPredictor] Error : tiled_memory_cap=%ldMB is too small for a halo of %d voxels\n",
+             memoryCap/(1024*1024), halo);
+      exit(-1);
+    }
+  }
+  return _tileSize;
+}
+
+void TiledPredictor::computeRescaleRange(VolumeLoader& loader)
+{
+  int width = loader.getWidth();
+  int height = loader.getHeight();
+  int depth = loader.getDepth();
+  ulong sliceSize = (ulong)width*height;
+  int slabDepth = max(1, min(depth, (int)(memoryCap/sliceSize)));
+  uchar* slab = new uchar[sliceSize*slabDepth];
+
+  ulong buckets[RESCALE_N_BUCKETS];
+  for(int i = 0; i < RESCALE_N_BUCKETS; ++i) {
+    buckets[i] = 0;
+  }
+  for(int z = 0; z < depth; z += slabDepth) {
+    int nSlices = min(slabDepth, depth - z);
+    loader.loadSlab(z, nSlices, slab);
+    ulong n = sliceSize*nSlices;
+    for(ulong i = 0; i < n; ++i) {
+      ++buckets[slab[i]];
+    }
+  }
+  delete[] slab;
+
+  Slice3d::computeRescaleRange(buckets, sliceSize*depth, rescaleMin, rescaleMax);
+  printf("[TiledPredictor] Rescaling data. min=%g, max=%g\n", rescaleMin, rescaleMax);
+}
+
+bool TiledPredictor::run(const char* inputDir, const char* outputFilename)
+{
+  VolumeLoader loader(inputDir);
+  if(!loader.isValid()) {
+    printf("[TiledPredictor] Error : no slice found in %s\n", inputDir);
+    return false;
+  }
+
+  int width = loader.getWidth();
+  int height = loader.getHeight();
+  int depth = loader.getDepth();
+  int _tileSize = computeTileSize();
+
+  int nTilesX = (width + _tileSize - 1)/_tileSize;
+  int nTilesY = (height + _tileSize - 1)/_tileSize;
+  int nTilesZ = (depth + _tileSize - 1)/_tileSize;
+  int nTiles = nTilesX*nTilesY*nTilesZ;
+
+  printf("[TiledPredictor] Cube (%d,%d,%d) : %d tiles of size %d with a halo of %d\n",
+         width, height, depth, nTiles, _tileSize, halo);
+
+  if(rescale) {
+    computeRescaleRange(loader);
+  }
+
+  int fd = open(outputFilename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    printf("[TiledPredictor] Error : could not open %s (%s)\n",
+           outputFilename, strerror(errno));
+    return false;
+  }
+
+  bool success = true;
+  int tileIdx = 0;
+  for(int tz = 0; tz < nTilesZ && success; ++tz) {
+    for(int ty = 0; ty < nTilesY && success; ++ty) {
+      for(int tx = 0; tx < nTilesX && success; ++tx) {
+        tile t;
+        t.x0 = tx*_tileSize;
+        t.y0 = ty*_tileSize;
+        t.z0 = tz*_tileSize;
+        t.x1 = min(width, t.x0 + _tileSize);
+        t.y1 = min(height, t.y0 + _tileSize);
+        t.z1 = min(depth, t.z0 + _tileSize);
+        t.ex0 = max(0, t.x0 - halo);
+        t.ey0 = max(0, t.y0 - halo);
+        t.ez0 = max(0, t.z0 - halo);
+        t.ex1 = min(width, t.x1 + halo);
+        t.ey1 = min(height, t.y1 + halo);
+        t.ez1 = min(depth, t.z1 + halo);
+
+        printf("[TiledPredictor] Tile %d/%d : (%d,%d,%d)-(%d,%d,%d)\n",
+               ++tileIdx, nTiles, t.x0, t.y0, t.z0, t.x1, t.y1, t.z1);
+        success = processTile(loader, t, width, height, fd);
+      }
+    }
+  }
+
+  close(fd);
+
+  if(success) {
+    exportVIVAInfo(outputFilename, depth, height, width, "uchar");
+  }
+  return success;
+}
+
+bool TiledPredictor::processTile(VolumeLoader& loader, const tile& t,
+                                 int width, int height, int fd)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+
+  // load extended tile
+  int ew = t.ex1 - t.ex0;
+  int eh = t.ey1 - t.ey0;
+  int ed = t.ez1 - t.ez0;
+  ulong eSliceSize = (ulong)ew*eh;
+  uchar* raw_data = new uchar[eSliceSize*ed];
+  loader.setWindow(t.ex0, t.ey0, ew, eh);
+  loader.loadSlab(t.ez0, ed, raw_data);
+  if(rescale) {
+    Slice3d::rescaleRawData(raw_data, eSliceSize*ed, rescaleMin, rescaleMax);
+  }
+  double loadTime = getElapsedTime(tv);
+
+  // supervoxels are not cached for tiles
+  Slice3d* slice = new Slice3d(raw_data, ew, eh, ed, voxelStep);
+  slice->generateSupervoxels(cubeness);
+  double supervoxelTime = getElapsedTime(tv);
+
+  Feature* feature = 0;
+  int featureSize = 0;
+  loadSliceFeatures("", Config::Instance(), slice, feature, &featureSize, false);
+  scale.apply(slice);
+  double featureTime = getElapsedTime(tv);
+
+  labelType* nodeLabels = computeLabels(slice, feature, param, algoType, 0);
+  double inferenceTime = getElapsedTime(tv);
+
+  // labels of the voxels inside the tile
+  int w = t.x1 - t.x0;
+  int h = t.y1 - t.y0;
+  int d = t.z1 - t.z0;
+  ulong sliceSize = (ulong)w*h;
+  uchar* labelTile = new uchar[sliceSize*d];
+  memset(labelTile, 0, sliceSize*d);
+
+  int nClasses = max(1, param.nClasses - 1);
+  int nSupernodes = slice->getNbSupernodes();
+  int ox = t.x0 - t.ex0;
+  int oy = t.y0 - t.ey0;
+  int oz = t.z0 - t.ez0;
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+  for(int sid = 0; sid < nSupernodes; ++sid) {
+    supernode* s = slice->getSupernode(sid);
+    if(s == 0) {
+      continue;
+    }
+    uchar value = (nodeLabels[sid]/(float)nClasses)*255;
+    const lineContainer* lines = s->getLines();
+    for(uint l = 0; l < s->getNumberOfLines(); ++l) {
+      int z = lines[l].coord.z - oz;
+      int y = lines[l].coord.y - oy;
+      if(z < 0 || z >= d || y < 0 || y >= h) {
+        continue;
+      }
+      // clip the line to the tile
+      int xs = max(0, (int)lines[l].coord.x - ox);
+      int xe = min(w, (int)(lines[l].coord.x + lines[l].length) - ox);
+      if(xs < xe) {
+        memset(labelTile + z*sliceSize + (ulong)y*w + xs, value, xe - xs);
+      }
+    }
+  }
+
+  delete[] nodeLabels;
+  releaseSliceFeatures(slice, feature);
+  delete slice;
+  delete[] raw_data;
+
+  // write the rows of the tile at their offset in the output cube
+  bool success = true;
+  for(int z = 0; z < d && success; ++z) {
+    for(int y = 0; y < h; ++y) {
+      off_t offset = ((off_t)(t.z0 + z)*height + t.y0 + y)*width + t.x0;
+      if(pwrite(fd, labelTile + z*sliceSize + (ulong)y*w, w, offset) != w) {
+        printf("[TiledPredictor] Error while writing labels (%s)\n", strerror(errno));
+        success = false;
+        break;
+      }
+    }
+  }
+  delete[] labelTile;
+  double writeTime = getElapsedTime(tv);
+
+  printf("[TiledPredictor] load=%g supervoxels=%g features=%g inference=%g write=%g\n",
+         loadTime, supervoxelTime, featureTime, inferenceTime, writeTime);
+  return success;
+}
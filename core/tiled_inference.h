@@ -0,0 +1,95 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef TILED_INFERENCE_H
+#define TILED_INFERENCE_H
+
+#include "globalsE.h"
+#include "energyParam.h"
+#include "predict_pipeline.h"
+
+class VolumeLoader;
+
+//------------------------------------------------------------------------------
+
+/**
+ * Out-of-core prediction for cubes that do not fit in memory.
+ * The cube is partitioned into tiles. Each tile is loaded with a halo of
+ * voxels around it and supervoxels, features and inference are computed on
+ * the extended tile only. The labels of the voxels inside the tile (halo
+ * excluded) are then written to the output cube, so that every voxel is
+ * labeled by exactly one tile and the result does not depend on the order
+ * in which tiles are processed.
+ * Parameters read from the config file :
+ * - tiled_memory_cap : memory used to process a tile in MB (default 2048)
+ * - tiled_tile_size : size of the tiles (overrides tiled_memory_cap)
+ * - tiled_halo : size of the halo in voxels (default 2 supervoxel steps)
+ * If rescale_raw_data is set, the intensity range is computed once over the
+ * whole cube and every tile is rescaled with it, as loadSliceData does for
+ * cubes that fit in memory.
+ */
+class TiledPredictor
+{
+ public:
+  TiledPredictor(const EnergyParam& param, int algoType);
+
+  /**
+   * Predict the labels of the cube stored as a stack of images in inputDir
+   * and write them to outputFilename as a raw uchar cube (+ .nfo file).
+   */
+  bool run(const char* inputDir, const char* outputFilename);
+
+ private:
+  const EnergyParam& param;
+  int algoType;
+
+  int voxelStep;
+  int cubeness;
+  ulong memoryCap;
+  int tileSize;
+  int halo;
+
+  FeatureScale scale;
+
+  // intensity rescaling (rescale_raw_data)
+  bool rescale;
+  double rescaleMin;
+  double rescaleMax;
+
+  struct tile
+  {
+    // tile [x0,x1) x [y0,y1) x [z0,z1)
+    int x0, y0, z0;
+    int x1, y1, z1;
+    // extended tile including the halo
+    int ex0, ey0, ez0;
+    int ex1, ey1, ez1;
+  };
+
+  /**
+   * Size of the tiles (without halo) for the given cube
+   */
+  int computeTileSize();
+
+  /**
+   * Compute the intensity range of the whole cube, reading it slab by slab.
+   */
+  void computeRescaleRange(VolumeLoader& loader);
+
+  bool processTile(VolumeLoader& loader, const tile& t,
+                   int width, int height, int fd);
+};
+
+#endif // TILED_INFERENCE_H
@@ -36,6 +36,8 @@
 #include "Slice.h"
 #include "Slice3d.h"
 #include "Slice_P.h"
+#include "profiler.h"
+#include "volume_loader.h"
 
 //---------------------------------------------------------------------FUNCTIONS
 
@@ -915,16 +917,12 @@ void exportNRRDCube(uchar* rawData,
 
 #endif // USE_ITK
 
-void exportVIVACube(float* rawData,
-                    const char* filename,
+void exportVIVAInfo(const char* filename,
                     int cubeDepth,
                     int cubeHeight,
-                    int cubeWidth)
+                    int cubeWidth,
+                    const char* type)
 {
-  ofstream ofs(filename);
-  ofs.write((char*)rawData,cubeDepth*cubeHeight*cubeWidth*sizeof(float));
-  ofs.close();
-
   // NFO file used by VIVA
   char* nfoFilename = new char[strlen(filename)+5];
   sprintf(nfoFilename,"%s.nfo", filename);
@@ -940,11 +938,24 @@ void exportVIVACube(float* rawData,
   nfo << "z_offset 0" << endl;
   //nfo << "cubeFile " << getNameFromPath() << endl;
   nfo << "cubeFile " << filename << endl;
-  nfo << "type float" << endl;
+  nfo << "type " << type << endl;
   nfo.close();
   delete[] nfoFilename;
 }
 
+void exportVIVACube(float* rawData,
+                    const char* filename,
+                    int cubeDepth,
+                    int cubeHeight,
+                    int cubeWidth)
+{
+  ofstream ofs(filename);
+  ofs.write((char*)rawData,cubeDepth*cubeHeight*cubeWidth*sizeof(float));
+  ofs.close();
+
+  exportVIVAInfo(filename, cubeDepth, cubeHeight, cubeWidth, "float");
+}
+
 void exportVIVACube(uchar* rawData,
                     const char* filename,
                     int cubeDepth,
@@ -955,25 +966,7 @@ void exportVIVACube(uchar* rawData,
   ofs.write((char*)rawData,cubeDepth*cubeHeight*cubeWidth*sizeof(char));
   ofs.close();
 
-  // NFO file used by VIVA    
-  char* nfoFilename = new char[strlen(filename)+5];
-  sprintf(nfoFilename,"%s.nfo", filename);
-
-  ofstream nfo(nfoFilename);
-  nfo << "voxelDepth 0.1" << endl;
-  nfo << "voxelHeight 0.1" << endl;
-  nfo << "voxelWidth 0.1" << endl;
-  nfo << "cubeDepth " << cubeDepth << endl;
-  nfo << "cubeHeight " << cubeHeight << endl;
-  nfo << "cubeWidth " << cubeWidth << endl;
-  nfo << "x_offset 0" << endl;
-  nfo << "y_offset 0" << endl;
-  nfo << "z_offset 0" << endl;
-  //nfo << "cubeFile " << getNameFromPath() << endl;
-  nfo << "cubeFile " << filename << endl;
-  nfo << "type uchar" << endl;
-  nfo.close();
-  delete[] nfoFilename;
+  exportVIVAInfo(filename, cubeDepth, cubeHeight, cubeWidth, "uchar");
 }
 
 #ifdef USE_ITK
@@ -2153,39 +2146,15 @@ void loadData(string imageDir, string maskDir, Config* config,
   }
 }
 
-void loadDataAndFeatures(string imageDir, string maskDir, Config* config,
-                         Slice_P*& slice, Feature*& feature, int* featureSize, int fileIdx)
+void loadSliceData(string imageDir, string maskDir, Config* config,
+                   Slice_P*& slice, int fileIdx)
 {
+  PROFILE_SCOPE("load");
   slice = 0;
-  feature = 0;
   string config_tmp;
   Config::Instance()->getParameter("slice3d", config_tmp);
   bool useSlice3d = config_tmp.c_str()[0] == '1';
 
-  int nGradientLevels = 5;
-  if(config->getParameter("nGradientLevels", config_tmp)) {
-    nGradientLevels = atoi(config_tmp.c_str());
-  }
-
-  int nOrientations = 1;
-  if(config->getParameter("nOrientations", config_tmp)) {
-    nOrientations = atoi(config_tmp.c_str());
-  }
-
-#if USE_LONG_RANGE_EDGES
-  int nDistances = 1;
-  if(config->getParameter("nDistances", config_tmp)) {
-    nDistances = atoi(config_tmp.c_str());
-  }
-#endif
-
-  vector<eFeatureType> feature_types;
-  int paramFeatureTypes = DEFAULT_FEATURE_TYPE;
-  if(config->getParameter("featureTypes", config_tmp)) {
-    paramFeatureTypes = atoi(config_tmp.c_str());
-    getFeatureTypes(paramFeatureTypes, feature_types);
-  }
-
   if(useSlice3d) {
     printf("[utils] Loading 3d cube using images in %s\n", imageDir.c_str());
     Slice3d* slice3d = new Slice3d(imageDir.c_str());
@@ -2219,40 +2188,6 @@ void loadDataAndFeatures(string imageDir, string maskDir, Config* config,
     slice3d->generateSupernodeLabelFromMaskDirectory(maskDir.c_str(),
                                                      includeBoundaryLabels,
                                                      includeUnknownType);
-
-    stringstream sout_feature_filename;
-    sout_feature_filename << getDirectoryFromPath(imageDir) << "/features_";
-    sout_feature_filename << slice->getSupernodeStep() << "_" << slice->getCubeness();
-    sout_feature_filename << "_" << paramFeatureTypes;
-    sout_feature_filename << "_" << DEFAULT_FEATURE_DISTANCE;
-    printf("[utils] Checking %s\n", sout_feature_filename.str().c_str());
-    bool featuresLoaded = false;
-    if(fileExists(sout_feature_filename.str())) {
-      printf("[utils] Loading features from %s\n", sout_feature_filename.str().c_str());
-      *featureSize = -1;
-      if(slice->loadFeatures(sout_feature_filename.str().c_str(), featureSize)) {
-        featuresLoaded = true;
-        feature = new F_Precomputed(slice->getPrecomputedFeatures(), *featureSize/DEFAULT_FEATURE_DISTANCE);
-        printf("[utils] Features Loaded succesfully\n");
-      } else {
-        printf("[utils] Features not loaded succesfully\n");
-      }
-    }
-
-    if(!featuresLoaded) {
-      feature = Feature::getFeature(slice3d, feature_types);
-      slice3d->precomputeFeatures(feature);
-      feature->save(*slice3d, sout_feature_filename.str().c_str());
-    }
-
-    // precompute gradient indices to avoid race conditions
-    slice3d->precomputeGradientIndices(nGradientLevels);
-    slice3d->precomputeOrientationIndices(nOrientations);
-#if USE_LONG_RANGE_EDGES
-    slice3d->precomputeDistanceIndices(nDistances);
-#endif
-
-    slice = slice3d;
   } else {
 
     string imageName = imageDir;
@@ -2276,6 +2211,81 @@ void loadDataAndFeatures(string imageDir, string maskDir, Config* config,
     bool includeBoundaryLabels = false;
     slice2d->generateSupernodeLabelFromMaskImage(maskName.c_str(),
                                                  includeBoundaryLabels);
+  }
+}
+
+void loadSliceFeatures(string imageDir, Config* config, Slice_P* slice,
+                       Feature*& feature, int* featureSize, bool useCache)
+{
+  PROFILE_SCOPE("features");
+  feature = 0;
+  string config_tmp;
+
+  int nGradientLevels = 5;
+  if(config->getParameter("nGradientLevels", config_tmp)) {
+    nGradientLevels = atoi(config_tmp.c_str());
+  }
+
+  int nOrientations = 1;
+  if(config->getParameter("nOrientations", config_tmp)) {
+    nOrientations = atoi(config_tmp.c_str());
+  }
+
+#if USE_LONG_RANGE_EDGES
+  int nDistances = 1;
+  if(config->getParameter("nDistances", config_tmp)) {
+    nDistances = atoi(config_tmp.c_str());
+  }
+#endif
+
+  vector<eFeatureType> feature_types;
+  int paramFeatureTypes = DEFAULT_FEATURE_TYPE;
+  if(config->getParameter("featureTypes", config_tmp)) {
+    paramFeatureTypes = atoi(config_tmp.c_str());
+    getFeatureTypes(paramFeatureTypes, feature_types);
+  }
+
+  if(slice->getType() == SLICEP_SLICE3D) {
+    Slice3d* slice3d = static_cast<Slice3d*>(slice);
+
+    stringstream sout_feature_filename;
+    sout_feature_filename << getDirectoryFromPath(imageDir) << "/features_";
+    sout_feature_filename << slice->getSupernodeStep() << "_" << slice->getCubeness();
+    sout_feature_filename << "_" << paramFeatureTypes;
+    sout_feature_filename << "_" << DEFAULT_FEATURE_DISTANCE;
+    printf("[utils] Checking %s\n", sout_feature_filename.str().c_str());
+    bool featuresLoaded = false;
+    *featureSize = -1;
+    if(useCache && slice3d->loadFeatureCache(sout_feature_filename.str().c_str(), paramFeatureTypes, featureSize)) {
+      featuresLoaded = true;
+      feature = new F_Precomputed(slice3d, *featureSize/DEFAULT_FEATURE_DISTANCE);
+      printf("[utils] Features Loaded succesfully\n");
+    }
+
+    if(!featuresLoaded) {
+      feature = Feature::getFeature(slice3d, feature_types);
+      slice3d->precomputeFeatures(feature);
+      if(useCache) {
+        slice3d->saveFeatureCache(sout_feature_filename.str().c_str(), paramFeatureTypes);
+      }
+
+      // text export in libsvm format
+      bool exportTextFeatures = false;
+      if(config->getParameter("export_text_features", config_tmp)) {
+        exportTextFeatures = config_tmp.c_str()[0] == '1';
+      }
+      if(exportTextFeatures) {
+        feature->save(*slice3d, sout_feature_filename.str().c_str());
+      }
+    }
+
+    // precompute gradient indices to avoid race conditions
+    slice3d->precomputeGradientIndices(nGradientLevels);
+    slice3d->precomputeOrientationIndices(nOrientations);
+#if USE_LONG_RANGE_EDGES
+    slice3d->precomputeDistanceIndices(nDistances);
+#endif
+  } else {
 
     feature = Feature::getFeature(slice, feature_types);
 
@@ -2294,6 +2304,19 @@ void loadDataAndFeatures(string imageDir, string maskDir, Config* config,
   }
 }
 
+void releaseSliceFeatures(Slice_P* slice, Feature* feature)
+{
+  Feature::releaseCachedFeatures(slice->getId());
+  delete feature;
+}
+
+void loadDataAndFeatures(string imageDir, string maskDir, Config* config,
+                         Slice_P*& slice, Feature*& feature, int* featureSize, int fileIdx)
+{
+  loadSliceData(imageDir, maskDir, config, slice, fileIdx);
+  loadSliceFeatures(imageDir, config, slice, feature, featureSize);
+}
+
 
 int drawLabels(Slice* slice, const char* prediction_filename,
                const char* outputFilename, bool use_prob,
@@ -2361,123 +2384,13 @@ int drawLabels(Slice* slice, const char* prediction_filename,
 void loadFromDir(const char* dir, uchar*& raw_data,
                  int& width, int& height, int* nImgs)
 {
-  const int bytes_per_pixel = 1;
-  IplImage* img;
-  IplImage* gray_img;
-
-  // load files
-  vector<string> files;
-  getFilesInDir(dir, files,"png", true);
-  if(files.size() == 0) {
-    getFilesInDir(dir, files,"tif", true);
-  }
-
-  width = -1;
-  int nValidImgs = 0;
-  for(vector<string>::iterator itFile = files.begin();
-      itFile != files.end(); itFile++)
-    {
-      if((itFile->c_str()[0] != '.') && ( (getExtension(*itFile) == "png") || (getExtension(*itFile) == "tif")) )
-        {
-          if(width == -1)
-            {
-              IplImage* img_slice = cvLoadImage(itFile->c_str(),0);
-              if(!img_slice)
-                continue;
-
-              width = img_slice->width;
-              height = img_slice->height;
-
-              cvReleaseImage(&img_slice);
-            }
-
-          nValidImgs++;
-        }
-    }
-
-  if(*nImgs != -1)
-    {
-      if(*nImgs > nValidImgs)
-        {
-          printf("[PixelData] Warning : nImgs=%d > nValidImgs=%d\n", *nImgs, nValidImgs);
-          *nImgs = nValidImgs;
-        }
-    }
-  else
-    *nImgs = nValidImgs;
-
-  // ask for enough memory for the texels and make sure we got it before proceeding
-  uint n = width*height*sizeof(char);
-  raw_data = new uchar[n*(*nImgs)];
+  VolumeLoader loader(dir, 0, *nImgs);
+  width = loader.isValid()?loader.getWidth():-1;
+  height = loader.getHeight();
+  *nImgs = loader.getDepth();
 
   printf("[PixelData] Loading %d images from directory %s, width=%d, height=%d\n", *nImgs, dir, width, height);
-  int d = 0;
-  for(int iImage = 0; d < *nImgs; iImage++)
-    {
-      string image = files[iImage];
-
-      //printf("[PixelData] Loading image %s\n",fullpath.c_str());
-
-      // Load image in black and white
-      // Do no handle 3d cubes in color for now !
-      IplImage* img_slice = cvLoadImage(image.c_str(),0);
-
-      if(!img_slice)
-        continue;
-
-      if(img_slice->width != width || img_slice->height != height)
-        {
-          if(img_slice->nChannels != bytes_per_pixel)
-            {
-              gray_img = cvCreateImage(cvSize(img_slice->width,img_slice->height),IPL_DEPTH_8U,bytes_per_pixel);
-              //printf("%d\n",img_slice->nChannels);
-              //printf("%d\n",gray_img->nChannels);
-              cvCvtColor(img_slice,gray_img,CV_RGB2GRAY);
-              img = cvCreateImage(cvSize(width,height),IPL_DEPTH_8U,bytes_per_pixel);
-              cvResize(gray_img,img);
-              cvReleaseImage(&gray_img);
-            }
-          else
-            {
-              img = cvCreateImage(cvSize(width,height),IPL_DEPTH_8U,bytes_per_pixel);
-              cvResize(img_slice,img);
-            }
-
-          memcpy(raw_data+(d*n),img->imageData,n);
-          cvReleaseImage(&img);
-          cvReleaseImage(&img_slice);
-        }
-      else
-        {
-          img = img_slice;
-
-          if(img_slice->nChannels != bytes_per_pixel)
-            {
-              // FIXME
-              printf("[Slice3d] img_slice->nChannels %d\n", img_slice->nChannels);
-              exit(-1);
-            }
-
-          //printf("[Slice3d] img->widthStep %d\n", img->widthStep);
-
-          if(img->widthStep != img->width)
-            {
-              int i = 0;
-              for(int y = 0; y < img->height ; y++)
-                for(int x = 0; x < img->width ; x++)
-                  {
-                    raw_data[d*n+i] = ((uchar*)(img->imageData + img->widthStep*y))[x*img->nChannels];
-                    i++;
-                  }
-            }
-          else
-            memcpy(raw_data+(d*n),img->imageData,n);
-
-          cvReleaseImage(&img);
-        }
-
-      d++;
-    }
+  raw_data = loader.loadVolume();
 }
 
 void print_osvm_node(osvm_node *x, const char* title)
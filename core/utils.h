@@ -230,6 +230,15 @@ void exportColorTIFCube(uchar* rawData,
 
 #endif
 
+/**
+ * Write the .nfo file describing a raw cube of the given type (uchar, float)
+ */
+void exportVIVAInfo(const char* filename,
+                    int cubeDepth,
+                    int cubeHeight,
+                    int cubeWidth,
+                    const char* type);
+
 void exportVIVACube(float* rawData,
                     const char* filename,
                     int cubeDepth,
@@ -371,6 +380,23 @@ void getColormapName(string& paramColormap);
 
 void loadData(string imageDir, string maskDir, Config* config, Slice_P*& slice);
 
+/**
+ * Load a slice or a cube, its supernodes and its ground truth labels.
+ */
+void loadSliceData(string imageDir, string maskDir, Config* config, Slice_P*& slice, int fileIdx = 0);
+
+/**
+ * Load the features of a slice loaded by loadSliceData from the feature
+ * cache or compute them (the cache is not used if useCache is false).
+ */
+void loadSliceFeatures(string imageDir, Config* config, Slice_P* slice, Feature*& feature, int* featureSize, bool useCache = true);
+
+/**
+ * Delete the features returned by loadSliceFeatures and remove them from the
+ * feature cache.
+ */
+void releaseSliceFeatures(Slice_P* slice, Feature* feature);
+
 void loadDataAndFeatures(string imageDir, string maskDir, Config* config, Slice_P*& slice, Feature*& feature, int* featureSize, int fileIdx = 0);
 
 void loadFromDir(const char* dir, uchar*& raw_data,
@@ -0,0 +1,146 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#include "volume_loader.h"
+#include "profiler.h"
+#include "utils.h"
+
+#include <assert.h>
+#include <cv.h>
+#include <highgui.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+VolumeLoader::VolumeLoader(const char* dir, int firstSlice, int nSlices)
+{
+  sliceWidth = 0;
+  sliceHeight = 0;
+  start_x = 0;
+  start_y = 0;
+  width = 0;
+  height = 0;
+  depth = 0;
+
+  vector<string> _files;
+  getFilesInDir(dir, _files, firstSlice, "png", true);
+  if(_files.size() == 0) {
+    getFilesInDir(dir, _files, firstSlice, "tif", true);
+  }
+
+  // size of the volume is given by the first valid slice
+  for(vector<string>::iterator itFile = _files.begin();
+      itFile != _files.end(); itFile++) {
+    if(sliceWidth == 0) {
+      IplImage* img_slice = cvLoadImage(itFile->c_str(),0);
+      if(!img_slice) {
+        continue;
+      }
+      sliceWidth = img_slice->width;
+      sliceHeight = img_slice->height;
+      cvReleaseImage(&img_slice);
+    }
+    files.push_back(*itFile);
+  }
+
+  if(nSlices != -1 && nSlices < (int)files.size()) {
+    files.resize(nSlices);
+  }
+  if(nSlices > (int)files.size()) {
+    printf("[VolumeLoader] Warning : nSlices=%d > nValidSlices=%ld\n", nSlices, files.size());
+  }
+
+  width = sliceWidth;
+  height = sliceHeight;
+  depth = files.size();
+}
+
+void VolumeLoader::setWindow(int x, int y, int w, int h)
+{
+  assert(x >= 0 && y >= 0 && x + w <= sliceWidth && y + h <= sliceHeight);
+  start_x = x;
+  start_y = y;
+  width = w;
+  height = h;
+}
+
+bool VolumeLoader::loadSlice(int z, uchar* dst)
+{
+  const int bytes_per_pixel = 1;
+
+  // Load image in black and white
+  // Do no handle 3d cubes in color for now !
+  IplImage* img = cvLoadImage(files[z].c_str(),0);
+  if(!img) {
+    printf("[VolumeLoader] Warning : image %s not loaded properly\n", files[z].c_str());
+    memset(dst, 0, width*height);
+    return false;
+  }
+  PROFILE_COUNT("load_bytes", img->imageSize);
+
+  if(img->nChannels != bytes_per_pixel) {
+    IplImage* gray_img = cvCreateImage(cvSize(img->width,img->height),IPL_DEPTH_8U,bytes_per_pixel);
+    cvCvtColor(img,gray_img,CV_RGB2GRAY);
+    cvReleaseImage(&img);
+    img = gray_img;
+  }
+
+  if(img->width != sliceWidth || img->height != sliceHeight) {
+    printf("[VolumeLoader] Warning : resizing %s to %dx%d\n", files[z].c_str(), sliceWidth, sliceHeight);
+    IplImage* resized_img = cvCreateImage(cvSize(sliceWidth,sliceHeight),IPL_DEPTH_8U,bytes_per_pixel);
+    cvResize(img,resized_img);
+    cvReleaseImage(&img);
+    img = resized_img;
+  }
+
+  // copy window
+  for(int y = 0; y < height; y++) {
+    memcpy(dst + y*width,
+           img->imageData + img->widthStep*(y + start_y) + start_x,
+           width);
+  }
+
+  cvReleaseImage(&img);
+  return true;
+}
+
+int VolumeLoader::loadSlab(int z, int nSlices, uchar* dst)
+{
+  assert(z >= 0 && z + nSlices <= depth);
+  ulong n = (ulong)width*height;
+  int nLoaded = 0;
+
+#ifdef WITH_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:nLoaded)
+#endif
+  for(int iSlice = 0; iSlice < nSlices; iSlice++) {
+    if(loadSlice(z + iSlice, dst + iSlice*n)) {
+      ++nLoaded;
+    }
+  }
+  return nLoaded;
+}
+
+uchar* VolumeLoader::loadVolume()
+{
+  uchar* raw_data = new uchar[(ulong)width*height*depth];
+  PRINT_MESSAGE("[VolumeLoader] Loading %d %dx%d images (window at %d,%d)\n",
+                depth, width, height, start_x, start_y);
+  int nLoaded = loadSlab(0, depth, raw_data);
+  if(nLoaded != depth) {
+    printf("[VolumeLoader] Warning : only %d/%d images were loaded\n", nLoaded, depth);
+  }
+  return raw_data;
+}
@@ -0,0 +1,89 @@
+
+/////////////////////////////////////////////////////////////////////////
+// This program is free software; you can redistribute it and/or       //
+// modify it under the terms of the GNU General Public License         //
+// version 2 as published by the Free Software Foundation.             //
+//                                                                     //
+// This program is distributed in the hope that it will be useful, but //
+// WITHOUT ANY WARRANTY; without even the implied warranty of          //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU   //
+// General Public License for more details.                            //
+//                                                                     //
+// Written and (C) by Aurelien Lucchi                                  //
+// Contact <aurelien.lucchi@gmail.com> for comments & bug reports      //
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef VOLUME_LOADER_H
+#define VOLUME_LOADER_H
+
+#include <string>
+#include <vector>
+
+#include "globalsE.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+
+/**
+ * Decodes a stack of png (or tif) slices into a cube of uchar voxels ordered
+ * by zyx. The directory is listed once and slices are decoded in parallel.
+ * A sub-volume window can be loaded without decoding the slices outside of
+ * it and the volume can be read slab by slab by consumers that do not need
+ * the whole cube at once.
+ */
+class VolumeLoader
+{
+ public:
+
+  /**
+   * Lists the slices of dir, starting at slice firstSlice. At most nSlices
+   * slices are used (-1 : all the remaining slices).
+   */
+  VolumeLoader(const char* dir, int firstSlice = 0, int nSlices = -1);
+
+  int getDepth() { return depth; }
+  int getHeight() { return height; }
+  int getWidth() { return width; }
+
+  /**
+   * Returns false if no slice could be found in the directory.
+   */
+  bool isValid() { return depth > 0; }
+
+  /**
+   * Only load the window [x, x+w) x [y, y+h) of each slice.
+   */
+  void setWindow(int x, int y, int w, int h);
+
+  /**
+   * Decode slices [z, z+nSlices) into dst which must hold
+   * nSlices*getHeight()*getWidth() voxels. Slices that can not be decoded are
+   * set to 0. Returns the number of slices decoded successfully.
+   */
+  int loadSlab(int z, int nSlices, uchar* dst);
+
+  /**
+   * Decode all the slices in a new cube.
+   * Caller is responsible for freeing memory.
+   */
+  uchar* loadVolume();
+
+ private:
+  vector<string> files;
+
+  // size of the slices stored on disk
+  int sliceWidth;
+  int sliceHeight;
+
+  // window to be loaded
+  int start_x;
+  int start_y;
+  int width;
+  int height;
+  int depth;
+
+  bool loadSlice(int z, uchar* dst);
+};
+
+#endif // VOLUME_LOADER_H
@@ -155,18 +155,13 @@ void exportFeatures(string imageDir,
   printf("[SVM_struct] Checking if %s exists\n", outputFilename.c_str());
   Feature* feature = 0;
   bool featuresLoaded = false;
-  if(fileExists(outputFilename)) {
-    printf("[SVM_struct] Loading features from %s\n", outputFilename.c_str());
-    int featureSize = -1;
-    if(slice3d->loadFeatures(outputFilename.c_str(), &featureSize)) {
-      featuresLoaded = true;
-      feature = new F_Precomputed(slice3d->getPrecomputedFeatures(), featureSize/DEFAULT_FEATURE_DISTANCE);
-      printf("[SVM_struct] Features Loaded succesfully\n");
-    } else {
-      printf("[SVM_struct] Features not loaded succesfully\n");
-    }
+  int featureSize = -1;
+  if(slice3d->loadFeatureCache(outputFilename.c_str(), paramFeatureTypes, &featureSize)) {
+    featuresLoaded = true;
+    feature = new F_Precomputed(slice3d, featureSize/DEFAULT_FEATURE_DISTANCE);
+    printf("[SVM_struct] Features Loaded succesfully\n");
   } else {
-    printf("[SVM_struct] File %s does not exist\n", outputFilename.c_str());
+    printf("[SVM_struct] No feature cache for %s\n", outputFilename.c_str());
   }
 
   if(!featuresLoaded) {
@@ -175,6 +170,7 @@ void exportFeatures(string imageDir,
     int featureSize = feature->getSizeFeatureVector();
     printf("[SVM_struct] Feature size = %d\n", featureSize);
     slice3d->precomputeFeatures(feature);
+    slice3d->saveFeatureCache(outputFilename.c_str(), paramFeatureTypes);
 
     // Dump features
     if(feature) {